@@ -23,7 +23,8 @@
 PS3USB::PS3USB(USB *p, uint8_t btadr5, uint8_t btadr4, uint8_t btadr3, uint8_t btadr2, uint8_t btadr1, uint8_t btadr0) :
 pUsb(p), // pointer to USB class instance - mandatory
 bAddress(0), // device address - mandatory
-bPollEnable(false) // don't start polling before dongle is connected
+bPollEnable(false), // don't start polling before dongle is connected
+reportTime(0)
 {
         for(uint8_t i = 0; i < PS3_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
@@ -275,7 +276,8 @@ uint8_t PS3USB::Poll() {
 
         if(PS3Connected || PS3NavigationConnected) {
                 uint16_t BUFFER_SIZE = EP_MAXPKTSIZE;
-                pUsb->inTransfer(bAddress, epInfo[ PS3_INPUT_PIPE ].epAddr, &BUFFER_SIZE, readBuf); // input on endpoint 1
+                if(!pUsb->inTransfer(bAddress, epInfo[ PS3_INPUT_PIPE ].epAddr, &BUFFER_SIZE, readBuf)) // input on endpoint 1
+                        reportTime = pUsb->GetLastInTime();
                 if((int32_t)((uint32_t)millis() - timer) > 100) { // Loop 100ms before processing data
                         readReport();
 #ifdef PRINTREPORT
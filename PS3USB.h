@@ -93,6 +93,14 @@ public:
                 return bPollEnable;
         };
 
+        /**
+         * Used to get the time the last input report was received.
+         * @return micros() when the IN transfer of the report completed.
+         */
+        uint32_t getReportTime() {
+                return reportTime;
+        };
+
         /**
          * Used by the USB core to check what this driver support.
          * @param  vid The device's VID.
@@ -281,6 +289,7 @@ private:
         void (*pFuncOnInit)(void); // Pointer to function called in onInit()
 
         bool bPollEnable;
+        uint32_t reportTime; // micros() when the last input report was received
 
         uint32_t timer; // used to continuously set PS3 Move controller Bulb and rumble values
 
@@ -20,9 +20,10 @@ e-mail   :  support@circuitsathome.com
 
 static uint8_t usb_error = 0;
 static uint8_t usb_task_state;
+static uint32_t usb_task_delay = 0;
 
 /* constructor */
-USB::USB() : bmHubPre(0) {
+USB::USB() : bmHubPre(0), qInTime(0), qSofTime(0) {
         usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE; //set up state machine
         init();
 }
@@ -218,7 +219,26 @@ uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t*
         return InTransfer(pep, nak_limit, nbytesptr, data, bInterval);
 }
 
-uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval /*= 0*/) {
+/* Streaming IN transfer. Every packet is read from the RCVFIFO into a buffer of one packet on the stack and handed
+   to the parser right away, with offset + the number of bytes received before it, so a transfer of any size needs
+   only USB_FIFO_SIZE bytes of RAM. The transfer ends like inTransfer(), with a short packet or after *nbytesptr bytes */
+uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, USBReadParser *p, uint16_t offset /*= 0*/) {
+        EpInfo *pep = NULL;
+        uint16_t nak_limit = 0;
+        uint8_t pktbuf[USB_FIFO_SIZE];
+
+        uint8_t rcode = SetAddress(addr, ep, &pep, &nak_limit);
+
+        if(rcode) {
+                USBTRACE3("(USB::InTransfer) SetAddress Failed ", rcode, 0x81);
+                USBTRACE3("(USB::InTransfer) addr requested ", addr, 0x81);
+                USBTRACE3("(USB::InTransfer) ep requested ", ep, 0x81);
+                return rcode;
+        }
+        return InTransfer(pep, nak_limit, nbytesptr, pktbuf, 0, p, offset);
+}
+
+uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval /*= 0*/, USBReadParser *p /*= NULL*/, uint16_t offset /*= 0*/) {
         uint8_t rcode = 0;
         uint8_t pktsize;
 
@@ -260,14 +280,20 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
                         pktsize = nbytes;
                 }
 
-                int16_t mem_left = (int16_t)nbytes - *((int16_t*)nbytesptr);
-
-                if(mem_left < 0)
-                        mem_left = 0;
+                // *nbytesptr is below nbytes until the loop ends, unsigned so transfers above 32 KiB work
+                uint16_t mem_left = nbytes - *nbytesptr;
 
-                data = bytesRd(rRCVFIFO, ((pktsize > mem_left) ? mem_left : pktsize), data);
-
-                regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer
+                if(p) {
+                        // Streaming, data is the packet buffer and is used again for every packet
+                        if(pktsize > mem_left)
+                                pktsize = mem_left;
+                        bytesRd(rRCVFIFO, pktsize, data);
+                        regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer
+                        p->Parse(pktsize, data, offset + *nbytesptr);
+                } else {
+                        data = bytesRd(rRCVFIFO, ((pktsize > mem_left) ? mem_left : pktsize), data);
+                        regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer
+                }
                 *nbytesptr += pktsize; // add this packet's byte count to total transfer length
 
                 /* The transfer is complete under two conditions:           */
@@ -278,6 +304,7 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
                         // Save toggle value
                         pep->bmRcvToggle = ((regRd(rHRSL) & bmRCVTOGRD)) ? 1 : 0;
                         //printf("\r\n");
+                        qInTime = (uint32_t)micros();
                         rcode = 0;
                         break;
                 } else if(bInterval > 0)
@@ -424,10 +451,15 @@ uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
 /* USB main task. Performs enumeration/cleanup */
 void USB::Task(void) //USB state machine
 {
-        uint8_t rcode;
+        bool lowspeed = UpdateBusState();
+
+        PollDeviceClasses(0);
+        EnumerationTask(lowspeed);
+}
+
+/* Runs the MAX3421E task and updates the state machine if Vbus changed. Returns true if a low speed device is attached */
+bool USB::UpdateBusState(void) {
         uint8_t tmpdata;
-        static uint32_t delay = 0;
-        //USB_DEVICE_DESCRIPTOR buf;
         bool lowspeed = false;
 
         MAX3421E::Task();
@@ -451,15 +483,25 @@ void USB::Task(void) //USB state machine
                         //intentional fallthrough
                 case FSHOST: //attached
                         if((usb_task_state & USB_STATE_MASK) == USB_STATE_DETACHED) {
-                                delay = (uint32_t)millis() + USB_SETTLE_DELAY;
+                                usb_task_delay = (uint32_t)millis() + USB_SETTLE_DELAY;
                                 usb_task_state = USB_ATTACHED_SUBSTATE_SETTLE;
                         }
                         break;
         }// switch( tmpdata
 
-        for(uint8_t i = 0; i < USB_NUMDEVICES; i++)
-                if(devConfig[i])
-                        rcode = devConfig[i]->Poll();
+        return lowspeed;
+}
+
+/* Polls the registered device classes starting at index first. Registration is sequential, so the first empty slot ends the list */
+void USB::PollDeviceClasses(uint8_t first) {
+        for(uint8_t i = first; i < USB_NUMDEVICES && devConfig[i]; i++)
+                devConfig[i]->Poll();
+}
+
+/* Enumeration and cleanup part of the state machine */
+void USB::EnumerationTask(bool lowspeed) {
+        uint8_t rcode;
+        uint8_t tmpdata;
 
         switch(usb_task_state) {
                 case USB_DETACHED_SUBSTATE_INITIALIZE:
@@ -476,7 +518,7 @@ void USB::Task(void) //USB state machine
                 case USB_DETACHED_SUBSTATE_ILLEGAL: //just sit here
                         break;
                 case USB_ATTACHED_SUBSTATE_SETTLE: //settle time for just attached device
-                        if((int32_t)((uint32_t)millis() - delay) >= 0L)
+                        if((int32_t)((uint32_t)millis() - usb_task_delay) >= 0L)
                                 usb_task_state = USB_ATTACHED_SUBSTATE_RESET_DEVICE;
                         else break; // don't fall through
                 case USB_ATTACHED_SUBSTATE_RESET_DEVICE:
@@ -487,6 +529,7 @@ void USB::Task(void) //USB state machine
                         if((regRd(rHCTL) & bmBUSRST) == 0) {
                                 tmpdata = regRd(rMODE) | bmSOFKAENAB; //start SOF generation
                                 regWr(rMODE, tmpdata);
+                                qSofTime = (uint32_t)micros();
                                 usb_task_state = USB_ATTACHED_SUBSTATE_WAIT_SOF;
                                 //delay = (uint32_t)millis() + 20; //20ms wait after reset per USB spec
                         }
@@ -499,11 +542,11 @@ void USB::Task(void) //USB state machine
                                         usb_task_state = USB_STATE_CONFIGURING;
                                  */
                                 usb_task_state = USB_ATTACHED_SUBSTATE_WAIT_RESET;
-                                delay = (uint32_t)millis() + 20;
+                                usb_task_delay = (uint32_t)millis() + 20;
                         }
                         break;
                 case USB_ATTACHED_SUBSTATE_WAIT_RESET:
-                        if((int32_t)((uint32_t)millis() - delay) >= 0L) usb_task_state = USB_STATE_CONFIGURING;
+                        if((int32_t)((uint32_t)millis() - usb_task_delay) >= 0L) usb_task_state = USB_STATE_CONFIGURING;
                         else break; // don't fall through
                 case USB_STATE_CONFIGURING:
 
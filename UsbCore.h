@@ -45,6 +45,8 @@ typedef MAX3421e<P15, P5> MAX3421E; // ESP8266 boards
 typedef MAX3421e<P10, P9> MAX3421E; // Official Arduinos (UNO, Duemilanove, Mega, 2560, Leonardo, Due etc.), Intel Edison, Intel Galileo 2 or Teensy 2.0 and 3.x
 #endif
 
+#define USB_FIFO_SIZE       64      // Size of the MAX3421E send and receive FIFOs, the largest packet it handles
+
 /* Common setup data constant combinations  */
 #define bmREQ_GET_DESCR     USB_SETUP_DEVICE_TO_HOST|USB_SETUP_TYPE_STANDARD|USB_SETUP_RECIPIENT_DEVICE     //get descriptor request type
 #define bmREQ_SET           USB_SETUP_HOST_TO_DEVICE|USB_SETUP_TYPE_STANDARD|USB_SETUP_RECIPIENT_DEVICE     //set request type for all but 'set feature' and 'set interface'
@@ -98,7 +100,9 @@ typedef MAX3421e<P10, P9> MAX3421E; // Official Arduinos (UNO, Duemilanove, Mega
 #define USB_RETRY_LIMIT         3       // 3 retry limit for a transfer
 #define USB_SETTLE_DELAY        200     // settle delay in milliseconds
 
+#ifndef USB_NUMDEVICES
 #define USB_NUMDEVICES          16      //number of USB devices
+#endif
 //#define HUB_MAX_HUBS          7       // maximum number of hubs that can be attached to the host controller
 #define HUB_PORT_RESET_DELAY    20      // hub port reset delay 10 ms recomended, can be up to 20 ms
 
@@ -193,6 +197,8 @@ typedef struct {
 
 class USBReadParser {
 public:
+        // offset is the position of pbuf in the data of one request. It is 16 bits, so a request that hands
+        // more than 64 KiB to a parser has to be split, as BulkOnly::Read() does
         virtual void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset) = 0;
 };
 
@@ -200,6 +206,8 @@ class USB : public MAX3421E {
         AddressPoolImpl<USB_NUMDEVICES> addrPool;
         USBDeviceConfig* devConfig[USB_NUMDEVICES];
         uint8_t bmHubPre;
+        uint32_t qInTime; // micros() when the last IN transfer completed
+        uint32_t qSofTime; // micros() when SOF generation started
 
 public:
         USB(void);
@@ -226,6 +234,17 @@ public:
                 return USB_ERROR_UNABLE_TO_REGISTER_DEVICE_CLASS;
         };
 
+        // micros() when the last IN transfer completed, drivers use it to time stamp input reports
+        uint32_t GetLastInTime() const {
+                return qInTime;
+        };
+
+        /* Frame number (0-2047) of a micros() time. The MAX3421E does not expose its frame counter, so this
+           counts 1 ms frames from the start of SOF generation after the last bus reset */
+        uint16_t GetFrameNumber(uint32_t t) const {
+                return (uint16_t)((t - qSofTime) / 1000) & 0x7FF;
+        };
+
         void ForEachUsbDevice(UsbDeviceHandleFunc pfunc) {
                 addrPool.ForEachUsbDevice(pfunc);
         };
@@ -248,6 +267,7 @@ public:
         uint8_t ctrlData(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* dataptr, bool direction);
         uint8_t ctrlStatus(uint8_t ep, bool direction, uint16_t nak_limit);
         uint8_t inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval = 0);
+        uint8_t inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, USBReadParser *p, uint16_t offset = 0);
         uint8_t outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data);
         uint8_t dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit);
 
@@ -260,11 +280,24 @@ public:
         uint8_t ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bRequest, uint8_t wValLo, uint8_t wValHi,
                 uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p);
 
+protected:
+        // The three parts of Task(), split so USBHostT can poll its own drivers in between
+        bool UpdateBusState(void);
+        void PollDeviceClasses(uint8_t first);
+        void EnumerationTask(bool lowspeed);
+
+        uint8_t GetNumDeviceClasses(void) {
+                uint8_t i = 0;
+                while(i < USB_NUMDEVICES && devConfig[i])
+                        i++;
+                return i;
+        };
+
 private:
         void init();
         uint8_t SetAddress(uint8_t addr, uint8_t ep, EpInfo **ppep, uint16_t *nak_limit);
         uint8_t OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data);
-        uint8_t InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t *data, uint8_t bInterval = 0);
+        uint8_t InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t *data, uint8_t bInterval = 0, USBReadParser *p = NULL, uint16_t offset = 0);
         uint8_t AttemptConfig(uint8_t driver, uint8_t parent, uint8_t port, bool lowspeed);
 };
 
@@ -0,0 +1,117 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__USBHOSTT_H__)
+#define __USBHOSTT_H__
+
+#include "Usb.h"
+
+#if __cplusplus >= 201103L
+
+/*
+ * USB host with a driver set fixed at compile time:
+ *
+ *      USBHostT<USBHub, HIDBoot<USB_HID_PROTOCOL_KEYBOARD>, BulkOnly> Usb;
+ *      HIDBoot<USB_HID_PROTOCOL_KEYBOARD> &Keyboard = Usb.Get<1>();
+ *
+ * The drivers are stored by value inside the host object and Task() calls each Poll() directly,
+ * so the poll loop does not go through the vtable and does not scan empty registry slots.
+ * Every driver type must be constructible from a single USB pointer.
+ *
+ * The drivers still register themselves in the constructor, so enumeration and release keep
+ * using the same code as USB. Drivers constructed separately with a pointer to this host
+ * (e.g. a BTD) are registered after the static ones and are polled through the registry as usual.
+ * The size of the address pool and the registry is still set by USB_NUMDEVICES.
+ */
+
+template <class... Drivers>
+class USBDriverList;
+
+template <>
+class USBDriverList<> {
+public:
+        USBDriverList(USB *p __attribute__((unused))) {
+        };
+
+        void Poll() {
+        };
+};
+
+template <class D, class... Rest>
+class USBDriverList<D, Rest...> {
+public:
+        D drv;
+        USBDriverList<Rest...> rest;
+
+        USBDriverList(USB *p) : drv(p), rest(p) {
+        };
+
+        void Poll() {
+                drv.D::Poll(); // Qualified call, resolved at compile time
+                rest.Poll();
+        };
+};
+
+// Type and reference of driver number I in a USBDriverList
+template <uint8_t I, class List>
+struct USBDriverAt;
+
+template <class D, class... Rest>
+struct USBDriverAt<0, USBDriverList<D, Rest...> > {
+        typedef D type;
+
+        static D& Get(USBDriverList<D, Rest...> &list) {
+                return list.drv;
+        };
+};
+
+template <uint8_t I, class D, class... Rest>
+struct USBDriverAt<I, USBDriverList<D, Rest...> > {
+        typedef typename USBDriverAt<I - 1, USBDriverList<Rest...> >::type type;
+
+        static type& Get(USBDriverList<D, Rest...> &list) {
+                return USBDriverAt<I - 1, USBDriverList<Rest...> >::Get(list.rest);
+        };
+};
+
+template <class... Drivers>
+class USBHostT : public USB {
+        static_assert(sizeof...(Drivers) <= USB_NUMDEVICES, "More drivers than USB_NUMDEVICES");
+
+        USBDriverList<Drivers...> drivers;
+        uint8_t bNumStatic; // Number of registry slots taken by the drivers above
+
+public:
+        USBHostT() : USB(), drivers(this), bNumStatic(GetNumDeviceClasses()) {
+        };
+
+        template <uint8_t I>
+        typename USBDriverAt<I, USBDriverList<Drivers...> >::type& Get() {
+                return USBDriverAt<I, USBDriverList<Drivers...> >::Get(drivers);
+        };
+
+        void Task(void) {
+                bool lowspeed = UpdateBusState();
+
+                drivers.Poll();
+                PollDeviceClasses(bNumStatic);
+                EnumerationTask(lowspeed);
+        };
+};
+
+#endif // __cplusplus >= 201103L
+
+#endif // __USBHOSTT_H__
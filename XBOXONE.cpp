@@ -27,7 +27,8 @@
 XBOXONE::XBOXONE(USB *p) :
 pUsb(p), // pointer to USB class instance - mandatory
 bAddress(0), // device address - mandatory
-bPollEnable(false) { // don't start polling before dongle is connected
+bPollEnable(false), // don't start polling before dongle is connected
+reportTime(0) {
         for(uint8_t i = 0; i < XBOX_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
                 epInfo[i].maxPktSize = (i) ? 0 : 8;
@@ -243,6 +244,7 @@ uint8_t XBOXONE::Poll() {
         uint16_t BUFFER_SIZE = EP_MAXPKTSIZE;
         uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[ XBOX_INPUT_PIPE ].epAddr, &BUFFER_SIZE, readBuf);
         if (!rcode) {
+                reportTime = pUsb->GetLastInTime();
                 readReport();
 #ifdef PRINTREPORT
                 printReport(); // Uncomment "#define PRINTREPORT" to print the report send by the Xbox ONE Controller
@@ -23,7 +23,8 @@
 XBOXUSB::XBOXUSB(USB *p) :
 pUsb(p), // pointer to USB class instance - mandatory
 bAddress(0), // device address - mandatory
-bPollEnable(false) { // don't start polling before dongle is connected
+bPollEnable(false), // don't start polling before dongle is connected
+reportTime(0) {
         for(uint8_t i = 0; i < XBOX_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
                 epInfo[i].maxPktSize = (i) ? 0 : 8;
@@ -233,7 +234,8 @@ uint8_t XBOXUSB::Poll() {
         if(!bPollEnable)
                 return 0;
         uint16_t BUFFER_SIZE = EP_MAXPKTSIZE;
-        pUsb->inTransfer(bAddress, epInfo[ XBOX_INPUT_PIPE ].epAddr, &BUFFER_SIZE, readBuf); // input on endpoint 1
+        if(!pUsb->inTransfer(bAddress, epInfo[ XBOX_INPUT_PIPE ].epAddr, &BUFFER_SIZE, readBuf)) // input on endpoint 1
+                reportTime = pUsb->GetLastInTime();
         readReport();
 #ifdef PRINTREPORT
         printReport(); // Uncomment "#define PRINTREPORT" to print the report send by the Xbox 360 Controller
@@ -94,6 +94,14 @@ public:
                 return bPollEnable;
         };
 
+        /**
+         * Used to get the time the last input report was received.
+         * @return micros() when the IN transfer of the report completed.
+         */
+        uint32_t getReportTime() {
+                return reportTime;
+        };
+
         /**
          * Used by the USB core to check what this driver support.
          * @param  vid The device's VID.
@@ -202,6 +210,7 @@ private:
         void (*pFuncOnInit)(void); // Pointer to function called in onInit()
 
         bool bPollEnable;
+        uint32_t reportTime; // micros() when the last input report was received
 
         /* Variables to store the buttons */
         uint32_t ButtonState;
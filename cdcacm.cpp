@@ -132,22 +132,20 @@ uint8_t ACM::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         USBTRACE2("NC:", num_of_conf);
 
         for(uint8_t i = 0; i < num_of_conf; i++) {
-                ConfigDescParser< USB_CLASS_COM_AND_CDC_CTRL,
+                // Control and data interface are both extracted in a single pass over the configuration
+                ConfigDescMultiParser CdcParser;
+
+                CdcParser.AddXtracter(this, USB_CLASS_COM_AND_CDC_CTRL,
                         CDC_SUBCLASS_ACM,
                         CDC_PROTOCOL_ITU_T_V_250,
                         CP_MASK_COMPARE_CLASS |
                         CP_MASK_COMPARE_SUBCLASS |
-                        CP_MASK_COMPARE_PROTOCOL > CdcControlParser(this);
-
-                ConfigDescParser<USB_CLASS_CDC_DATA, 0, 0,
-                        CP_MASK_COMPARE_CLASS> CdcDataParser(this);
-
-                rcode = pUsb->getConfDescr(bAddress, 0, i, &CdcControlParser);
+                        CP_MASK_COMPARE_PROTOCOL);
 
-                if(rcode)
-                        goto FailGetConfDescr;
+                CdcParser.AddXtracter(this, USB_CLASS_CDC_DATA, 0, 0,
+                        CP_MASK_COMPARE_CLASS);
 
-                rcode = pUsb->getConfDescr(bAddress, 0, i, &CdcDataParser);
+                rcode = pUsb->getConfDescr(bAddress, 0, i, &CdcParser);
 
                 if(rcode)
                         goto FailGetConfDescr;
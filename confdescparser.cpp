@@ -0,0 +1,205 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "Usb.h"
+
+ConfigDescMultiParser::ConfigDescMultiParser() :
+numXtracters(0),
+stateParseDescr(0),
+dscrLen(0),
+dscrType(0),
+confValue(0),
+protoValue(0),
+ifaceNumber(0),
+ifaceAltSet(0) {
+        iad.bInterfaceCount = 0;
+        theBuffer.valueSize = 0;
+        theBuffer.pValue = varBuffer;
+        valParser.Initialize(&theBuffer);
+        theSkipper.Initialize(&theBuffer);
+}
+
+/* Adds an extractor together with the interface class, subclass and protocol it wants. The same extractor can be
+  added more than once, e.g. for the control and the data interface of a CDC device. Returns false if the table is full */
+bool ConfigDescMultiParser::AddXtracter(UsbConfigXtracter *xtractor, uint8_t class_id, uint8_t subclass_id, uint8_t protocol_id, uint8_t mask) {
+        if(numXtracters >= CP_MAX_XTRACTERS)
+                return false;
+
+        XtracterEntry *pe = &theXtracters[numXtracters++];
+
+        pe->xtractor = xtractor;
+        pe->classId = class_id;
+        pe->subclassId = subclass_id;
+        pe->protocolId = protocol_id;
+        pe->mask = mask;
+        pe->function = CP_NO_FUNCTION;
+        pe->isGoodInterface = false;
+        return true;
+}
+
+void ConfigDescMultiParser::Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset __attribute__((unused))) {
+        uint16_t cntdn = (uint16_t)len;
+        uint8_t *p = (uint8_t*)pbuf;
+
+        while(cntdn) {
+                // Fast path, see ConfigDescParser::Parse
+                if(stateParseDescr == 0 && cntdn >= 2 && p[0] >= 2 && p[0] <= cntdn) {
+                        uint8_t dlen = p[0];
+
+                        DescriptorXtract(p);
+                        p += dlen;
+                        cntdn -= dlen;
+                        continue;
+                }
+                if(!ParseDescriptor(&p, &cntdn))
+                        return;
+        }
+}
+
+// A descriptor with a bLength shorter than its type is skipped, its fields would be read past its end
+void ConfigDescMultiParser::DescriptorXtract(const uint8_t *pdscr) {
+        switch(pdscr[1]) {
+                case USB_DESCRIPTOR_CONFIGURATION:
+                        if(pdscr[0] < sizeof(USB_CONFIGURATION_DESCRIPTOR))
+                                break;
+                        confValue = ((const USB_CONFIGURATION_DESCRIPTOR*)pdscr)->bConfigurationValue;
+                        break;
+                case USB_DESCRIPTOR_INTERFACE_ASSOCIATION:
+                        if(pdscr[0] < sizeof(iad))
+                                break;
+                        memcpy(&iad, pdscr, sizeof(iad));
+                        break;
+                case USB_DESCRIPTOR_INTERFACE:
+                        if(pdscr[0] < sizeof(USB_INTERFACE_DESCRIPTOR)) {
+                                // The endpoints that follow belong to no interface
+                                for(uint8_t i = 0; i < numXtracters; i++)
+                                        theXtracters[i].isGoodInterface = false;
+                                break;
+                        }
+                        InterfaceXtract((const USB_INTERFACE_DESCRIPTOR*)pdscr);
+                        break;
+                case USB_DESCRIPTOR_ENDPOINT:
+                        if(pdscr[0] < sizeof(USB_ENDPOINT_DESCRIPTOR))
+                                break;
+                        EndpointXtract((const USB_ENDPOINT_DESCRIPTOR*)pdscr);
+                        break;
+        }
+}
+
+bool ConfigDescMultiParser::IsMatch(const XtracterEntry *pe, uint8_t class_id, uint8_t subclass_id, uint8_t protocol_id) {
+        if((pe->mask & CP_MASK_COMPARE_CLASS) && class_id != pe->classId)
+                return false;
+        if((pe->mask & CP_MASK_COMPARE_SUBCLASS) && subclass_id != pe->subclassId)
+                return false;
+        if((pe->mask & CP_MASK_COMPARE_PROTOCOL) && protocol_id != pe->protocolId)
+                return false;
+        return true;
+}
+
+void ConfigDescMultiParser::InterfaceXtract(const USB_INTERFACE_DESCRIPTOR *uid) {
+        ifaceNumber = uid->bInterfaceNumber;
+        ifaceAltSet = uid->bAlternateSetting;
+        protoValue = uid->bInterfaceProtocol;
+
+        // The interfaces of a function follow its association descriptor, so the association ends with the first interface outside it
+        if(iad.bInterfaceCount && (ifaceNumber < iad.bFirstInterface || ifaceNumber - iad.bFirstInterface >= iad.bInterfaceCount))
+                iad.bInterfaceCount = 0;
+
+        for(uint8_t i = 0; i < numXtracters; i++) {
+                XtracterEntry *pe = &theXtracters[i];
+
+                pe->isGoodInterface = false;
+
+                bool ifaceMatch = IsMatch(pe, uid->bInterfaceClass, uid->bInterfaceSubClass, uid->bInterfaceProtocol);
+                bool funcMatch = iad.bInterfaceCount && IsMatch(pe, iad.bFunctionClass, iad.bFunctionSubClass, iad.bFunctionProtocol);
+
+                if(!ifaceMatch && !funcMatch)
+                        continue;
+
+                if(iad.bInterfaceCount) {
+                        if(pe->function == CP_NO_FUNCTION) {
+                                // Only the function or the whole interface triple binds, an entry that matches e.g. the
+                                // class of a data interface would pick the first function that has one
+                                if(!funcMatch && pe->mask != CP_MASK_COMPARE_ALL)
+                                        continue;
+                                // Bind every entry of this extractor to the function
+                                for(uint8_t j = 0; j < numXtracters; j++)
+                                        if(theXtracters[j].xtractor == pe->xtractor)
+                                                theXtracters[j].function = iad.bFirstInterface;
+                        } else if(pe->function != iad.bFirstInterface)
+                                continue;
+                }
+                pe->isGoodInterface = true;
+        }
+}
+
+void ConfigDescMultiParser::EndpointXtract(const USB_ENDPOINT_DESCRIPTOR *pep) {
+        for(uint8_t i = 0; i < numXtracters; i++) {
+                if(!theXtracters[i].isGoodInterface || !theXtracters[i].xtractor)
+                        continue;
+
+                // Pass each endpoint only once to an extractor that is in the table more than once
+                uint8_t j = 0;
+                while(j < i && !(theXtracters[j].isGoodInterface && theXtracters[j].xtractor == theXtracters[i].xtractor))
+                        j++;
+
+                if(j == i)
+                        theXtracters[i].xtractor->EndpointXtract(confValue, ifaceNumber, ifaceAltSet, protoValue, pep);
+        }
+}
+
+/* Same streaming state machine as ConfigDescParser, used for descriptors split across two calls */
+bool ConfigDescMultiParser::ParseDescriptor(uint8_t **pp, uint16_t *pcntdn) {
+        switch(stateParseDescr) {
+                case 0:
+                        theBuffer.valueSize = 2;
+                        valParser.Initialize(&theBuffer);
+                        stateParseDescr = 1;
+                case 1:
+                        if(!valParser.Parse(pp, pcntdn))
+                                return false;
+                        dscrLen = *((uint8_t*)theBuffer.pValue);
+                        dscrType = *((uint8_t*)theBuffer.pValue + 1);
+                        stateParseDescr = 2;
+                case 2:
+                        // See ConfigDescParser, the rest of the descriptor is read right after the size and the type fields
+                        theBuffer.pValue = varBuffer + 2;
+                        stateParseDescr = 3;
+                case 3:
+                        if(dscrLen > sizeof(varBuffer))
+                                dscrType = 0; // Too long for the buffer, skip it
+                        theBuffer.valueSize = dscrLen - 2;
+                        valParser.Initialize(&theBuffer);
+                        stateParseDescr = 4;
+                case 4:
+                        switch(dscrType) {
+                                case USB_DESCRIPTOR_CONFIGURATION:
+                                case USB_DESCRIPTOR_INTERFACE_ASSOCIATION:
+                                case USB_DESCRIPTOR_INTERFACE:
+                                case USB_DESCRIPTOR_ENDPOINT:
+                                        if(!valParser.Parse(pp, pcntdn))
+                                                return false;
+                                        DescriptorXtract(varBuffer);
+                                        break;
+                                default:
+                                        if(!theSkipper.Skip(pp, pcntdn, dscrLen - 2))
+                                                return false;
+                        }
+                        theBuffer.pValue = varBuffer;
+                        stateParseDescr = 0;
+        }
+        return true;
+}
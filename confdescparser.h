@@ -56,9 +56,13 @@ class ConfigDescParser : public USBReadParser {
         uint8_t ifaceAltSet; // Interface alternate settings
 
         bool UseOr;
-        bool ParseDescriptor(uint8_t **pp, uint16_t *pcntdn);
+        void DescriptorXtract(const uint8_t *pdscr);
         void PrintHidDescriptor(const USB_HID_DESCRIPTOR *pDesc);
 
+protected:
+        // The streaming state machine alone, without the in place fast path of Parse()
+        bool ParseDescriptor(uint8_t **pp, uint16_t *pcntdn);
+
 public:
 
         void SetOR(void) {
@@ -75,6 +79,7 @@ stateParseDescr(0),
 dscrLen(0),
 dscrType(0),
 UseOr(false) {
+        theBuffer.valueSize = 0;
         theBuffer.pValue = varBuffer;
         valParser.Initialize(&theBuffer);
         theSkipper.Initialize(&theBuffer);
@@ -85,17 +90,69 @@ void ConfigDescParser<CLASS_ID, SUBCLASS_ID, PROTOCOL_ID, MASK>::Parse(const uin
         uint16_t cntdn = (uint16_t)len;
         uint8_t *p = (uint8_t*)pbuf;
 
-        while(cntdn)
+        while(cntdn) {
+                // Fast path: the whole descriptor is in the buffer, so it is used in place.
+                // Descriptors split across two calls go through the state machine below
+                if(stateParseDescr == 0 && cntdn >= 2 && p[0] >= 2 && p[0] <= cntdn) {
+                        uint8_t dlen = p[0];
+
+                        DescriptorXtract(p);
+                        p += dlen;
+                        cntdn -= dlen;
+                        continue;
+                }
                 if(!ParseDescriptor(&p, &cntdn))
                         return;
+        }
+}
+
+/* Handles a complete descriptor, either in place in the caller's buffer or collected in varBuffer. Takes values for class, subclass,
+  protocol fields in interface descriptor and compare masks for them. When the match is found, calls EndpointXtract passing the endpoint descriptor.
+  A descriptor with a bLength shorter than its type is skipped, its fields would be read past its end */
+template <const uint8_t CLASS_ID, const uint8_t SUBCLASS_ID, const uint8_t PROTOCOL_ID, const uint8_t MASK>
+void ConfigDescParser<CLASS_ID, SUBCLASS_ID, PROTOCOL_ID, MASK>::DescriptorXtract(const uint8_t *pdscr) {
+        const USB_INTERFACE_DESCRIPTOR* uid = reinterpret_cast<const USB_INTERFACE_DESCRIPTOR*>(pdscr);
+
+        switch(pdscr[1]) {
+                case USB_DESCRIPTOR_CONFIGURATION:
+                        if(pdscr[0] < sizeof(USB_CONFIGURATION_DESCRIPTOR))
+                                break;
+                        confValue = reinterpret_cast<const USB_CONFIGURATION_DESCRIPTOR*>(pdscr)->bConfigurationValue;
+                        break;
+                case USB_DESCRIPTOR_INTERFACE:
+                        isGoodInterface = false;
+                        if(pdscr[0] < sizeof(USB_INTERFACE_DESCRIPTOR))
+                                break;
+                        if((MASK & CP_MASK_COMPARE_CLASS) && uid->bInterfaceClass != CLASS_ID)
+                                break;
+                        if((MASK & CP_MASK_COMPARE_SUBCLASS) && uid->bInterfaceSubClass != SUBCLASS_ID)
+                                break;
+                        if(UseOr) {
+                                if((!((MASK & CP_MASK_COMPARE_PROTOCOL) && uid->bInterfaceProtocol)))
+                                        break;
+                        } else {
+                                if((MASK & CP_MASK_COMPARE_PROTOCOL) && uid->bInterfaceProtocol != PROTOCOL_ID)
+                                        break;
+                        }
+                        isGoodInterface = true;
+                        ifaceNumber = uid->bInterfaceNumber;
+                        ifaceAltSet = uid->bAlternateSetting;
+                        protoValue = uid->bInterfaceProtocol;
+                        break;
+                case USB_DESCRIPTOR_ENDPOINT:
+                        if(pdscr[0] < sizeof(USB_ENDPOINT_DESCRIPTOR))
+                                break;
+                        if(isGoodInterface)
+                                if(theXtractor)
+                                        theXtractor->EndpointXtract(confValue, ifaceNumber, ifaceAltSet, protoValue, reinterpret_cast<const USB_ENDPOINT_DESCRIPTOR*>(pdscr));
+                        break;
+        }
 }
 
-/* Parser for the configuration descriptor. Takes values for class, subclass, protocol fields in interface descriptor and
-  compare masks for them. When the match is found, calls EndpointXtract passing buffer containing endpoint descriptor */
+/* Streaming parser for the configuration descriptor. Collects a descriptor which arrives in pieces in varBuffer and
+  passes it to DescriptorXtract once complete */
 template <const uint8_t CLASS_ID, const uint8_t SUBCLASS_ID, const uint8_t PROTOCOL_ID, const uint8_t MASK>
 bool ConfigDescParser<CLASS_ID, SUBCLASS_ID, PROTOCOL_ID, MASK>::ParseDescriptor(uint8_t **pp, uint16_t *pcntdn) {
-        USB_CONFIGURATION_DESCRIPTOR* ucd = reinterpret_cast<USB_CONFIGURATION_DESCRIPTOR*>(varBuffer);
-        USB_INTERFACE_DESCRIPTOR* uid = reinterpret_cast<USB_INTERFACE_DESCRIPTOR*>(varBuffer);
         switch(stateParseDescr) {
                 case 0:
                         theBuffer.valueSize = 2;
@@ -116,50 +173,19 @@ bool ConfigDescParser<CLASS_ID, SUBCLASS_ID, PROTOCOL_ID, MASK>::ParseDescriptor
                         theBuffer.pValue = varBuffer + 2;
                         stateParseDescr = 3;
                 case 3:
-                        switch(dscrType) {
-                                case USB_DESCRIPTOR_INTERFACE:
-                                        isGoodInterface = false;
-                                        break;
-                                case USB_DESCRIPTOR_CONFIGURATION:
-                                case USB_DESCRIPTOR_ENDPOINT:
-                                case HID_DESCRIPTOR_HID:
-                                        break;
-                        }
+                        if(dscrLen > sizeof(varBuffer))
+                                dscrType = 0; // Too long for the buffer, skip it
                         theBuffer.valueSize = dscrLen - 2;
                         valParser.Initialize(&theBuffer);
                         stateParseDescr = 4;
                 case 4:
                         switch(dscrType) {
                                 case USB_DESCRIPTOR_CONFIGURATION:
-                                        if(!valParser.Parse(pp, pcntdn))
-                                                return false;
-                                        confValue = ucd->bConfigurationValue;
-                                        break;
                                 case USB_DESCRIPTOR_INTERFACE:
-                                        if(!valParser.Parse(pp, pcntdn))
-                                                return false;
-                                        if((MASK & CP_MASK_COMPARE_CLASS) && uid->bInterfaceClass != CLASS_ID)
-                                                break;
-                                        if((MASK & CP_MASK_COMPARE_SUBCLASS) && uid->bInterfaceSubClass != SUBCLASS_ID)
-                                                break;
-                                        if(UseOr) {
-                                                if((!((MASK & CP_MASK_COMPARE_PROTOCOL) && uid->bInterfaceProtocol)))
-                                                        break;
-                                        } else {
-                                                if((MASK & CP_MASK_COMPARE_PROTOCOL) && uid->bInterfaceProtocol != PROTOCOL_ID)
-                                                        break;
-                                        }
-                                        isGoodInterface = true;
-                                        ifaceNumber = uid->bInterfaceNumber;
-                                        ifaceAltSet = uid->bAlternateSetting;
-                                        protoValue = uid->bInterfaceProtocol;
-                                        break;
                                 case USB_DESCRIPTOR_ENDPOINT:
                                         if(!valParser.Parse(pp, pcntdn))
                                                 return false;
-                                        if(isGoodInterface)
-                                                if(theXtractor)
-                                                        theXtractor->EndpointXtract(confValue, ifaceNumber, ifaceAltSet, protoValue, (USB_ENDPOINT_DESCRIPTOR*)varBuffer);
+                                        DescriptorXtract(varBuffer);
                                         break;
                                         //case HID_DESCRIPTOR_HID:
                                         //      if (!valParser.Parse(pp, pcntdn))
@@ -207,4 +233,64 @@ void ConfigDescParser<CLASS_ID, SUBCLASS_ID, PROTOCOL_ID, MASK>::PrintHidDescrip
 }
 
 
+#ifndef CP_MAX_XTRACTERS
+#define CP_MAX_XTRACTERS                        4       // Number of class matches a ConfigDescMultiParser can hold
+#endif
+
+#define CP_NO_FUNCTION                          0xFF    // Entry is not bound to an interface association yet
+
+// Configuration descriptor parser for several drivers or class matches at once. The configuration is parsed
+// a single time and the endpoints of every interface are passed to each matching extractor. Interfaces grouped
+// by an Interface Association Descriptor also match on the function class, subclass and protocol, and an
+// extractor is kept to the first function it matched, so one driver does not pick up endpoints of two functions.
+// An extractor is bound by an entry that matches the function, or every field of an interface of it. An entry
+// that compares less, e.g. only the class of a CDC data interface, uses the function its extractor is bound to.
+
+class ConfigDescMultiParser : public USBReadParser {
+        struct XtracterEntry {
+                UsbConfigXtracter *xtractor;
+                uint8_t classId;
+                uint8_t subclassId;
+                uint8_t protocolId;
+                uint8_t mask;
+                uint8_t function; // First interface of the associated function or CP_NO_FUNCTION
+                bool isGoodInterface; // Current interface matches this entry
+        };
+
+        XtracterEntry theXtracters[CP_MAX_XTRACTERS];
+        uint8_t numXtracters;
+
+        MultiValueBuffer theBuffer;
+        MultiByteValueParser valParser;
+        ByteSkipper theSkipper;
+        uint8_t varBuffer[16 /*sizeof(USB_CONFIGURATION_DESCRIPTOR)*/];
+
+        uint8_t stateParseDescr; // ParseDescriptor state
+
+        uint8_t dscrLen; // Descriptor length
+        uint8_t dscrType; // Descriptor type
+
+        uint8_t confValue; // Configuration value
+        uint8_t protoValue; // Protocol value
+        uint8_t ifaceNumber; // Interface number
+        uint8_t ifaceAltSet; // Interface alternate settings
+
+        USB_INTERFACE_ASSOCIATION_DESCRIPTOR iad; // Last interface association, bInterfaceCount is 0 if none applies
+
+        void DescriptorXtract(const uint8_t *pdscr);
+        void InterfaceXtract(const USB_INTERFACE_DESCRIPTOR *uid);
+        void EndpointXtract(const USB_ENDPOINT_DESCRIPTOR *pep);
+        bool IsMatch(const XtracterEntry *pe, uint8_t class_id, uint8_t subclass_id, uint8_t protocol_id);
+
+protected:
+        // The streaming state machine alone, without the in place fast path of Parse()
+        bool ParseDescriptor(uint8_t **pp, uint16_t *pcntdn);
+
+public:
+        ConfigDescMultiParser();
+
+        bool AddXtracter(UsbConfigXtracter *xtractor, uint8_t class_id, uint8_t subclass_id, uint8_t protocol_id, uint8_t mask);
+        void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset);
+};
+
 #endif // __CONFDESCPARSER_H__
@@ -0,0 +1,75 @@
+#include <hidboot.h>
+#include <usblatency.h>
+#include <usbhub.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+USBLatencyProbe Probe;
+
+class MouseRptParser : public MouseReportParser
+{
+public:
+    void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+};
+
+void MouseRptParser::Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf)
+{
+  MouseReportParser::Parse(hid, is_rpt_id, len, buf);
+  Probe.Record(hid->GetReportTime()); // Time from the end of the IN transfer to here
+}
+
+USB     Usb;
+USBHub     Hub(&Usb);
+HIDBoot<USB_HID_PROTOCOL_MOUSE>    HidMouse(&Usb);
+
+MouseRptParser Prs;
+
+void setup()
+{
+  Serial.begin( 115200 );
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+  Serial.println("Start");
+
+  if (Usb.Init() == -1)
+    Serial.println("OSC did not start.");
+
+  delay( 200 );
+
+  HidMouse.SetReportParser(0, &Prs);
+}
+
+void loop()
+{
+  static uint32_t next;
+
+  Usb.Task();
+
+  // Print the histogram every 10 seconds, move the mouse to collect samples
+  if ((int32_t)((uint32_t)millis() - next) >= 0L) {
+    next = (uint32_t)millis() + 10000;
+
+    if (!Probe.GetSamples())
+      return;
+
+    for (uint8_t i = 0; i < USB_LATENCY_BUCKETS; i++) {
+      if (!Probe.GetCount(i))
+        continue;
+      Serial.print("< ");
+      Serial.print(Probe.GetBucketLimit(i));
+      Serial.print(" us: ");
+      Serial.println(Probe.GetCount(i));
+    }
+    Serial.print("99th percentile < ");
+    Serial.print(Probe.GetPercentile(99));
+    Serial.print(" us, max ");
+    Serial.print(Probe.GetMax());
+    Serial.println(" us");
+    Probe.Reset();
+  }
+}
@@ -0,0 +1,69 @@
+#include <hiduniversal.h>
+#include <hidboot.h>
+#include <usbhub.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+class MouseRptParser : public HIDMouseReportParser
+{
+protected:
+    void OnButtonsChanged(uint8_t before, uint8_t after);
+};
+
+void MouseRptParser::OnButtonsChanged(uint8_t before, uint8_t after)
+{
+  Serial.print("Buttons: ");
+  Serial.print(before, HEX);
+  Serial.print(" -> ");
+  Serial.println(after, HEX);
+};
+
+USB     Usb;
+USBHub     Hub(&Usb);
+HIDUniversal    Mouse(&Usb); // Leaves the mouse in the report protocol
+
+MouseRptParser Prs;
+
+void setup()
+{
+  Serial.begin( 115200 );
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+  Serial.println("Start");
+
+  if (Usb.Init() == -1)
+    Serial.println("OSC did not start.");
+
+  delay( 200 );
+
+  Mouse.SetReportParser(0, &Prs);
+}
+
+void loop()
+{
+  static uint32_t next;
+
+  Usb.Task();
+
+  // Print the motion summed over all reports of the last 20 ms
+  if ((int32_t)((uint32_t)millis() - next) >= 0L) {
+    HID_MOUSE_MOTION m;
+
+    next = (uint32_t)millis() + 20;
+    if (Prs.ReadMotion(&m) && (m.dX || m.dY || m.wheel || m.pan)) {
+      Serial.print("dx=");
+      Serial.print(m.dX);
+      Serial.print(" dy=");
+      Serial.print(m.dY);
+      Serial.print(" wheel=");
+      Serial.print(m.wheel);
+      Serial.print(" pan=");
+      Serial.println(m.pan);
+    }
+  }
+}
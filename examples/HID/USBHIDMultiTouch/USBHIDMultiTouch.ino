@@ -0,0 +1,85 @@
+#include <hidmultitouch.h>
+#include <usbhub.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+class TouchPanel : public HIDMultiTouch
+{
+public:
+    TouchPanel(USB *p) : HIDMultiTouch(p) {};
+
+protected:
+    void OnTouchDown(const MT_CONTACT *contact);
+    void OnTouchMove(const MT_CONTACT *contact);
+    void OnTouchUp(const MT_CONTACT *contact);
+
+private:
+    void PrintContact(const char *event, const MT_CONTACT *contact);
+};
+
+void TouchPanel::PrintContact(const char *event, const MT_CONTACT *contact)
+{
+  Serial.print(event);
+  Serial.print(" id=");
+  Serial.print(contact->id);
+  Serial.print(" x=");
+  Serial.print(contact->x);
+  Serial.print(" y=");
+  Serial.println(contact->y);
+}
+
+void TouchPanel::OnTouchDown(const MT_CONTACT *contact)
+{
+  PrintContact("Down", contact);
+}
+
+void TouchPanel::OnTouchMove(const MT_CONTACT *contact)
+{
+  PrintContact("Move", contact);
+}
+
+void TouchPanel::OnTouchUp(const MT_CONTACT *contact)
+{
+  PrintContact("Up  ", contact);
+}
+
+USB     Usb;
+USBHub     Hub(&Usb);
+TouchPanel    Touch(&Usb);
+
+void setup()
+{
+  Serial.begin( 115200 );
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+  Serial.println("Start");
+
+  if (Usb.Init() == -1)
+    Serial.println("OSC did not start.");
+
+  delay( 200 );
+
+  // Touch.SetInputMode(MT_INPUT_MODE_TOUCHPAD); // For precision touchpads
+}
+
+void loop()
+{
+  static bool touch;
+
+  Usb.Task();
+
+  if (Touch.isTouchDevice() != touch) {
+    touch = !touch;
+    if (touch) {
+      Serial.print("Touch device, range ");
+      Serial.print(Touch.GetMaxX());
+      Serial.print(" x ");
+      Serial.println(Touch.GetMaxY());
+    }
+  }
+}
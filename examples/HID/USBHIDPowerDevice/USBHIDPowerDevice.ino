@@ -0,0 +1,70 @@
+#include <hidpowerdevice.h>
+#include <usbhub.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+class UPS : public HIDPowerDevice
+{
+public:
+    UPS(USB *p) : HIDPowerDevice(p) {};
+
+protected:
+    void OnValueChanged(uint16_t page, uint16_t usage, int32_t value);
+    void OnThreshold(uint16_t page, uint16_t usage, int32_t value, uint8_t zone);
+};
+
+void UPS::OnValueChanged(uint16_t page, uint16_t usage, int32_t value)
+{
+  Serial.print("Page 0x");
+  Serial.print(page, HEX);
+  Serial.print(" usage 0x");
+  Serial.print(usage, HEX);
+  Serial.print(": ");
+  Serial.println(value);
+}
+
+void UPS::OnThreshold(uint16_t page, uint16_t usage, int32_t value, uint8_t zone)
+{
+  if (page == HID_USAGE_PAGE_BATTERY_SYSTEM && usage == PD_USAGE_REMAINING_CAPACITY) {
+    if (zone == PD_ZONE_LOW) {
+      Serial.print("Battery low: ");
+      Serial.print(value);
+      Serial.println("%");
+    } else
+      Serial.println("Battery ok");
+  }
+}
+
+USB     Usb;
+USBHub     Hub(&Usb);
+UPS    Ups(&Usb);
+
+void setup()
+{
+  Serial.begin( 115200 );
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+  Serial.println("Start");
+
+  if (Usb.Init() == -1)
+    Serial.println("OSC did not start.");
+
+  delay( 200 );
+
+  Ups.Watch(HID_USAGE_PAGE_BATTERY_SYSTEM, PD_USAGE_REMAINING_CAPACITY, 20, PD_NO_HIGH_LIMIT); // Event below 20 %
+  Ups.Watch(HID_USAGE_PAGE_BATTERY_SYSTEM, PD_USAGE_RUN_TIME_TO_EMPTY);
+  Ups.Watch(HID_USAGE_PAGE_BATTERY_SYSTEM, PD_USAGE_AC_PRESENT);
+  Ups.Watch(HID_USAGE_PAGE_BATTERY_SYSTEM, PD_USAGE_CHARGING);
+  Ups.Watch(HID_USAGE_PAGE_POWER_DEVICE, PD_USAGE_PERCENT_LOAD);
+  Ups.SetPollPeriod(10000); // Read the feature reports every 10 s
+}
+
+void loop()
+{
+  Usb.Task();
+}
@@ -0,0 +1,48 @@
+#include <hidboot.h>
+#include <hidscanner.h>
+#include <usbhub.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+USB     Usb;
+//USBHub     Hub(&Usb);
+HIDBoot<USB_HID_PROTOCOL_KEYBOARD>    Scanner(&Usb);
+
+HIDScannerParser Prs;
+
+void setup()
+{
+  Serial.begin( 115200 );
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+  Serial.println("Start");
+
+  if (Usb.Init() == -1)
+    Serial.println("OSC did not start.");
+
+  delay( 200 );
+
+  // Prs.SetKeymap(HIDKeymapDE); // Layout the scanner is set up for
+  // Prs.SetTerminator(0); // For scanners that do not send Enter, end a scan after 50 ms without a key
+  Scanner.SetReportParser(0, &Prs);
+}
+
+void loop()
+{
+  Usb.Task();
+
+  char code[64];
+
+  if (Prs.ReadLine(code, sizeof(code))) {
+    Serial.print("Scan: ");
+    Serial.print(code);
+    Serial.print(" (");
+    Serial.print(Prs.GetStats()->lastDuration);
+    Serial.println(" us)");
+  }
+}
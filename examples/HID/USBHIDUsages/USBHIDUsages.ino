@@ -0,0 +1,64 @@
+#include <usbhid.h>
+#include <hiduniversal.h>
+#include <hidreportlayout.h>
+#include <usbhub.h>
+
+// Satisfy IDE, which only needs to see the include statment in the ino.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+// Prints the axes, the hat switch and the first 16 buttons of a joystick or gamepad
+class JoystickUsages : public HIDUsageReportParser {
+protected:
+        void OnValueChanged(uint16_t page, uint16_t usage, int32_t oldValue, int32_t newValue);
+        void OnButtonChanged(uint16_t button, bool pressed);
+};
+
+void JoystickUsages::OnValueChanged(uint16_t page __attribute__((unused)), uint16_t usage, int32_t oldValue __attribute__((unused)), int32_t newValue) {
+        switch(usage) {
+                case 0x30: Serial.print(F("X: ")); break;
+                case 0x31: Serial.print(F("Y: ")); break;
+                case 0x32: Serial.print(F("Z: ")); break;
+                case 0x35: Serial.print(F("Rz: ")); break;
+                case 0x39: Serial.print(F("Hat: ")); break;
+        }
+        Serial.println(newValue);
+}
+
+void JoystickUsages::OnButtonChanged(uint16_t button, bool pressed) {
+        Serial.print(F("Button "));
+        Serial.print(button);
+        Serial.println(pressed ? F(" pressed") : F(" released"));
+}
+
+USB Usb;
+USBHub Hub(&Usb);
+HIDUniversal Hid(&Usb);
+JoystickUsages Joy;
+
+void setup() {
+        Serial.begin(115200);
+#if !defined(__MIPSEL__)
+        while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+        Serial.println("Start");
+
+        if (Usb.Init() == -1)
+                Serial.println("OSC did not start.");
+
+        delay(200);
+
+        Joy.Subscribe(HID_USAGE_PAGE_GENERIC_DESKTOP, 0x30, 0x32); // X, Y and Z
+        Joy.Subscribe(HID_USAGE_PAGE_GENERIC_DESKTOP, 0x35); // Rz
+        Joy.Subscribe(HID_USAGE_PAGE_GENERIC_DESKTOP, 0x39); // Hat switch
+        Joy.Subscribe(HID_USAGE_PAGE_BUTTON, 1, 16);
+
+        if (!Hid.SetReportParser(0, &Joy))
+                ErrorMessage<uint8_t > (PSTR("SetReportParser"), 1);
+}
+
+void loop() {
+        Usb.Task();
+}
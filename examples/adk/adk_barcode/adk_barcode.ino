@@ -53,7 +53,7 @@ uint8_t keylcl;
 
   keylcl = key;
 
-  if( keylcl == 0x13 ) {
+  if( keylcl == '\r' ) {
     rcode = adk.SndData( strlen( new_line ), (uint8_t *)new_line );
     if (rcode && rcode != hrNAK) {
       Serial.print(F("\r\nData send: "));
@@ -0,0 +1,38 @@
+/* Time functions and the serial port of the Arduino stub */
+#include <time.h>
+#include <Arduino.h>
+
+HardwareSerial Serial;
+
+static uint64_t now_us(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t start_us = now_us();
+
+unsigned long micros(void) {
+        return (unsigned long)(now_us() - start_us);
+}
+
+unsigned long millis(void) {
+        return (unsigned long)((now_us() - start_us) / 1000);
+}
+
+void delay(unsigned long ms) {
+        uint64_t end = now_us() + (uint64_t)ms * 1000;
+
+        while(now_us() < end)
+                yield();
+}
+
+void delayMicroseconds(unsigned int us) {
+        uint64_t end = now_us() + us;
+
+        while(now_us() < end);
+}
+
+void yield(void) {
+}
@@ -0,0 +1,151 @@
+/* Minimal Arduino API for building parts of the library on a desktop computer.
+ * Only what the benchmarks in this directory need is provided.
+ */
+#ifndef _ARDUINO_STUB_H_
+#define _ARDUINO_STUB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARDUINO 10800
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) ((const __FlashStringHelper*)(s))
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+#define pgm_read_pointer(p) pgm_read_ptr(p) // As avrpins.h defines it for ESP8266
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#define noInterrupts()
+#define interrupts()
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef unsigned int word;
+
+class __FlashStringHelper;
+
+inline void pinMode(uint8_t pin __attribute__((unused)), uint8_t mode __attribute__((unused))) {
+}
+
+inline void digitalWrite(uint8_t pin __attribute__((unused)), uint8_t val __attribute__((unused))) {
+}
+
+inline int digitalRead(uint8_t pin __attribute__((unused))) {
+        return LOW;
+}
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+// Print writes to stdout, so debug output of the library can be seen
+class Print {
+public:
+        virtual size_t write(uint8_t c) {
+                return fputc(c, stdout) == EOF ? 0 : 1;
+        };
+
+        size_t print(const char *s) {
+                return printf("%s", s);
+        };
+
+        size_t print(const __FlashStringHelper *s) {
+                return print((const char*)s);
+        };
+
+        size_t print(char c) {
+                return write(c);
+        };
+
+        size_t print(unsigned long n, int base = DEC) {
+                return printf(base == HEX ? "%lX" : "%lu", n);
+        };
+
+        size_t print(long n, int base = DEC) {
+                return base == HEX ? print((unsigned long)n, base) : printf("%ld", n);
+        };
+
+        size_t print(unsigned int n, int base = DEC) {
+                return print((unsigned long)n, base);
+        };
+
+        size_t print(int n, int base = DEC) {
+                return print((long)n, base);
+        };
+
+        size_t print(unsigned char n, int base = DEC) {
+                return print((unsigned long)n, base);
+        };
+
+        size_t print(double n, int digits = 2) {
+                return printf("%.*f", digits, n);
+        };
+
+        size_t println(void) {
+                return print("\r\n");
+        };
+
+        template <class T>
+        size_t println(T val) {
+                return print(val) + println();
+        };
+
+        template <class T>
+        size_t println(T val, int base) {
+                return print(val, base) + println();
+        };
+};
+
+class Stream : public Print {
+public:
+        virtual int available(void) {
+                return 0;
+        };
+
+        virtual int read(void) {
+                return -1;
+        };
+
+        virtual int peek(void) {
+                return -1;
+        };
+
+        virtual void flush(void) {
+                fflush(stdout);
+        };
+};
+
+class HardwareSerial : public Stream {
+public:
+        void begin(unsigned long baud __attribute__((unused))) {
+        };
+
+        operator bool() {
+                return true;
+        };
+};
+
+extern HardwareSerial Serial;
+
+#endif // _ARDUINO_STUB_H_
@@ -0,0 +1,43 @@
+/* SPI interface used by usbhost.h. The transfer functions are implemented by the benchmark
+ * that needs them, the others do nothing.
+ */
+#ifndef _SPI_STUB_H_
+#define _SPI_STUB_H_
+
+#include <Arduino.h>
+
+#define SPI_HAS_TRANSACTION
+#define SPI_MODE0 0x00
+#define MSBFIRST 1
+
+class SPISettings {
+public:
+        SPISettings() {
+        };
+
+        SPISettings(uint32_t clock __attribute__((unused)), uint8_t bitOrder __attribute__((unused)), uint8_t dataMode __attribute__((unused))) {
+        };
+};
+
+class SPIClass {
+public:
+        void begin(void) {
+        };
+
+        void beginTransaction(SPISettings settings __attribute__((unused))) {
+        };
+
+        void endTransaction(void);
+
+        uint8_t transfer(uint8_t data);
+        void transfer(void *buf, size_t count);
+        void writeBytes(uint8_t *data, uint32_t size);
+        void transferBytes(uint8_t *out, uint8_t *in, uint32_t size);
+
+        void setClockDivider(uint8_t div __attribute__((unused))) {
+        };
+};
+
+extern SPIClass SPI;
+
+#endif // _SPI_STUB_H_
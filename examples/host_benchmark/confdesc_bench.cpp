@@ -0,0 +1,153 @@
+/* Host side benchmark of the configuration descriptor parsers.
+ *
+ * Every descriptor in descriptors.h is fed to ConfigDescParser and ConfigDescMultiParser in chunks of 64 bytes,
+ * the size USB::getConfDescr() reads them with. Each parser is timed as it is, with the in place fast path, and
+ * with a derived parser that sends every descriptor through the streaming state machine, so both paths get the
+ * same calls. The endpoints extracted are compared between the two and with a feed of one byte at a time, which
+ * splits every descriptor, so the benchmark also checks that all paths give the same result.
+ *
+ * Build and run with: make run
+ */
+#include <Usb.h>
+
+#include "descriptors.h"
+
+#define BENCH_TIME_US 200000UL
+
+class EndpointCounter : public UsbConfigXtracter {
+public:
+        uint16_t count;
+        uint16_t checksum;
+
+        EndpointCounter() : count(0), checksum(0) {
+        };
+
+        void EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR *pep) {
+                count++;
+                checksum = (checksum << 3) + (checksum >> 13) + conf + iface + alt + proto + pep->bEndpointAddress + pep->bmAttributes + pep->wMaxPacketSize + pep->bInterval;
+        };
+};
+
+static void feed(USBReadParser *p, const ConfDescr *d, uint16_t chunk) {
+        for(uint16_t offset = 0; offset < d->len; offset += chunk) {
+                uint16_t n = d->len - offset < chunk ? d->len - offset : chunk;
+
+                p->Parse(n, d->data + offset, offset);
+        }
+}
+
+// The parsers without the in place fast path
+class StreamingParser : public ConfigDescParser<0, 0, 0, 0> {
+public:
+        StreamingParser(UsbConfigXtracter *xtractor) : ConfigDescParser<0, 0, 0, 0>(xtractor) {
+        };
+
+        void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset __attribute__((unused))) {
+                uint16_t cntdn = len;
+                uint8_t *p = (uint8_t*)pbuf;
+
+                while(cntdn && ParseDescriptor(&p, &cntdn));
+        };
+};
+
+class StreamingMultiParser : public ConfigDescMultiParser {
+public:
+        void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset __attribute__((unused))) {
+                uint16_t cntdn = len;
+                uint8_t *p = (uint8_t*)pbuf;
+
+                while(cntdn && ParseDescriptor(&p, &cntdn));
+        };
+};
+
+// Every interface matches, so all endpoints of the descriptor are extracted
+static void parseSingle(const ConfDescr *d, uint16_t chunk, bool streaming, EndpointCounter *counter) {
+        if(streaming) {
+                StreamingParser parser(counter);
+
+                feed(&parser, d, chunk);
+        } else {
+                ConfigDescParser<0, 0, 0, 0> parser(counter);
+
+                feed(&parser, d, chunk);
+        }
+}
+
+// What a composite device driver would register
+static void addXtracters(ConfigDescMultiParser *parser, EndpointCounter *counter) {
+        parser->AddXtracter(counter, USB_CLASS_HID, 0, 0, CP_MASK_COMPARE_CLASS);
+        parser->AddXtracter(counter, USB_CLASS_COM_AND_CDC_CTRL, 0, 0, CP_MASK_COMPARE_CLASS);
+        parser->AddXtracter(counter, USB_CLASS_CDC_DATA, 0, 0, CP_MASK_COMPARE_CLASS);
+        parser->AddXtracter(counter, USB_CLASS_MASS_STORAGE, 0, 0, CP_MASK_COMPARE_CLASS);
+}
+
+static void parseMulti(const ConfDescr *d, uint16_t chunk, bool streaming, EndpointCounter *counter) {
+        if(streaming) {
+                StreamingMultiParser parser;
+
+                addXtracters(&parser, counter);
+                feed(&parser, d, chunk);
+        } else {
+                ConfigDescMultiParser parser;
+
+                addXtracters(&parser, counter);
+                feed(&parser, d, chunk);
+        }
+}
+
+typedef void (*ParseFunc)(const ConfDescr*, uint16_t, bool, EndpointCounter*);
+
+// Returns the time of one parse in nanoseconds
+static double bench(ParseFunc parse, const ConfDescr *d, uint16_t chunk, bool streaming, EndpointCounter *result) {
+        uint32_t iterations = 0;
+        uint32_t start = micros(), elapsed;
+
+        do {
+                for(uint16_t i = 0; i < 1000; i++) {
+                        EndpointCounter counter;
+
+                        parse(d, chunk, streaming, &counter);
+                        *result = counter;
+                }
+                iterations += 1000;
+                elapsed = micros() - start;
+        } while(elapsed < BENCH_TIME_US);
+
+        return elapsed * 1000.0 / iterations;
+}
+
+int main(void) {
+        const uint8_t numDescriptors = sizeof(descriptors) / sizeof(descriptors[0]);
+        bool ok = true;
+        const struct {
+                const char *name;
+                ParseFunc parse;
+        } parsers[] = {
+                { "ConfigDescParser", parseSingle },
+                { "ConfigDescMultiParser", parseMulti }
+        };
+
+        for(uint8_t p = 0; p < sizeof(parsers) / sizeof(parsers[0]); p++) {
+                double totalFast = 0, totalStream = 0;
+
+                printf("\n%s, 64 byte chunks\n", parsers[p].name);
+                printf("%-20s %6s %4s %14s %14s %8s\n", "descriptor", "bytes", "eps", "in place (ns)", "streamed (ns)", "speedup");
+
+                for(uint8_t i = 0; i < numDescriptors; i++) {
+                        EndpointCounter rFast, rStream, rSplit;
+                        double tFast = bench(parsers[p].parse, &descriptors[i], 64, false, &rFast);
+                        double tStream = bench(parsers[p].parse, &descriptors[i], 64, true, &rStream);
+
+                        parsers[p].parse(&descriptors[i], 1, false, &rSplit);
+                        printf("%-20s %6u %4u %14.1f %14.1f %7.2fx\n", descriptors[i].name, descriptors[i].len, rFast.count, tFast, tStream, tStream / tFast);
+                        if(rFast.count != rStream.count || rFast.checksum != rStream.checksum || rFast.count != rSplit.count || rFast.checksum != rSplit.checksum) {
+                                printf("  MISMATCH: %u endpoints (%04X) in place, %u endpoints (%04X) streamed, %u endpoints (%04X) split\n", rFast.count, rFast.checksum, rStream.count, rStream.checksum, rSplit.count, rSplit.checksum);
+                                ok = false;
+                        }
+                        totalFast += tFast;
+                        totalStream += tStream;
+                }
+                printf("%-20s %6s %4s %14.1f %14.1f %7.2fx\n", "total", "", "", totalFast, totalStream, totalStream / totalFast);
+        }
+        return ok ? 0 : 1;
+}
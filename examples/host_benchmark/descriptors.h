@@ -0,0 +1,107 @@
+/* Configuration descriptors used by confdesc_bench.cpp, in the form the USB_desc example prints them.
+ * They are modeled on common devices and cover the cases the parser has to deal with: class specific
+ * descriptors between the standard ones, interface association descriptors, alternate settings and
+ * descriptors which are longer than the parser's internal buffer.
+ */
+#ifndef _DESCRIPTORS_H_
+#define _DESCRIPTORS_H_
+
+// arduino_uno_r3, 62 bytes
+static const uint8_t arduino_uno_r3[] = {
+        0x09, 0x02, 0x3E, 0x00, 0x02, 0x01, 0x00, 0xC0, 0x32, 0x09, 0x04, 0x00, 0x00, 0x01, 0x02, 0x02,
+        0x01, 0x00, 0x05, 0x24, 0x00, 0x10, 0x01, 0x04, 0x24, 0x02, 0x06, 0x05, 0x24, 0x06, 0x00, 0x01,
+        0x07, 0x05, 0x82, 0x03, 0x08, 0x00, 0xFF, 0x09, 0x04, 0x01, 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00,
+        0x07, 0x05, 0x04, 0x02, 0x40, 0x00, 0x01, 0x07, 0x05, 0x83, 0x02, 0x40, 0x00, 0x01
+};
+
+// logitech_unifying, 84 bytes
+static const uint8_t logitech_unifying[] = {
+        0x09, 0x02, 0x54, 0x00, 0x03, 0x01, 0x00, 0xA0, 0x31, 0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01,
+        0x01, 0x00, 0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0x3B, 0x00, 0x07, 0x05, 0x81, 0x03, 0x08,
+        0x00, 0x08, 0x09, 0x04, 0x01, 0x00, 0x01, 0x03, 0x01, 0x02, 0x00, 0x09, 0x21, 0x11, 0x01, 0x00,
+        0x01, 0x22, 0x94, 0x00, 0x07, 0x05, 0x82, 0x03, 0x08, 0x00, 0x02, 0x09, 0x04, 0x02, 0x00, 0x01,
+        0x03, 0x00, 0x00, 0x00, 0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0x5D, 0x00, 0x07, 0x05, 0x83,
+        0x03, 0x20, 0x00, 0x02
+};
+
+// flash_drive, 32 bytes
+static const uint8_t flash_drive[] = {
+        0x09, 0x02, 0x20, 0x00, 0x01, 0x01, 0x00, 0x80, 0x64, 0x09, 0x04, 0x00, 0x00, 0x02, 0x08, 0x06,
+        0x50, 0x00, 0x07, 0x05, 0x81, 0x02, 0x40, 0x00, 0x00, 0x07, 0x05, 0x02, 0x02, 0x40, 0x00, 0x00
+};
+
+// ftdi_ft232r, 32 bytes
+static const uint8_t ftdi_ft232r[] = {
+        0x09, 0x02, 0x20, 0x00, 0x01, 0x01, 0x00, 0xA0, 0x2D, 0x09, 0x04, 0x00, 0x00, 0x02, 0xFF, 0xFF,
+        0xFF, 0x02, 0x07, 0x05, 0x81, 0x02, 0x40, 0x00, 0x00, 0x07, 0x05, 0x02, 0x02, 0x40, 0x00, 0x00
+};
+
+// usb2_hub, 25 bytes
+static const uint8_t usb2_hub[] = {
+        0x09, 0x02, 0x19, 0x00, 0x01, 0x01, 0x00, 0xE0, 0x32, 0x09, 0x04, 0x00, 0x00, 0x01, 0x09, 0x00,
+        0x00, 0x00, 0x07, 0x05, 0x81, 0x03, 0x01, 0x00, 0xFF
+};
+
+// xbox360_wired, 153 bytes
+static const uint8_t xbox360_wired[] = {
+        0x09, 0x02, 0x99, 0x00, 0x04, 0x01, 0x00, 0xA0, 0xFA, 0x09, 0x04, 0x00, 0x00, 0x02, 0xFF, 0x5D,
+        0x01, 0x00, 0x11, 0x21, 0x00, 0x01, 0x01, 0x25, 0x81, 0x14, 0x00, 0x00, 0x00, 0x00, 0x13, 0x01,
+        0x08, 0x00, 0x00, 0x07, 0x05, 0x81, 0x03, 0x20, 0x00, 0x04, 0x07, 0x05, 0x01, 0x03, 0x20, 0x00,
+        0x08, 0x09, 0x04, 0x01, 0x00, 0x04, 0xFF, 0x5D, 0x03, 0x00, 0x1B, 0x21, 0x00, 0x01, 0x01, 0x01,
+        0x83, 0x40, 0x01, 0x04, 0x20, 0x16, 0x85, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x16, 0x05, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x05, 0x82, 0x03, 0x20, 0x00, 0x02, 0x07, 0x05, 0x02, 0x03,
+        0x20, 0x00, 0x04, 0x07, 0x05, 0x83, 0x03, 0x20, 0x00, 0x40, 0x07, 0x05, 0x03, 0x03, 0x20, 0x00,
+        0x10, 0x09, 0x04, 0x02, 0x00, 0x01, 0xFF, 0x5D, 0x02, 0x00, 0x09, 0x21, 0x00, 0x01, 0x01, 0x22,
+        0x84, 0x07, 0x00, 0x07, 0x05, 0x84, 0x03, 0x20, 0x00, 0x10, 0x09, 0x04, 0x03, 0x00, 0x00, 0xFF,
+        0xFD, 0x13, 0x04, 0x06, 0x41, 0x00, 0x01, 0x01, 0x03
+};
+
+// cdc_msc_composite, 98 bytes
+static const uint8_t cdc_msc_composite[] = {
+        0x09, 0x02, 0x62, 0x00, 0x03, 0x01, 0x00, 0x80, 0xFA, 0x08, 0x0B, 0x00, 0x02, 0x02, 0x02, 0x01,
+        0x00, 0x09, 0x04, 0x00, 0x00, 0x01, 0x02, 0x02, 0x01, 0x00, 0x05, 0x24, 0x00, 0x20, 0x01, 0x05,
+        0x24, 0x01, 0x00, 0x01, 0x04, 0x24, 0x02, 0x02, 0x05, 0x24, 0x06, 0x00, 0x01, 0x07, 0x05, 0x81,
+        0x03, 0x08, 0x00, 0x10, 0x09, 0x04, 0x01, 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00, 0x07, 0x05, 0x02,
+        0x02, 0x40, 0x00, 0x00, 0x07, 0x05, 0x82, 0x02, 0x40, 0x00, 0x00, 0x09, 0x04, 0x02, 0x00, 0x02,
+        0x08, 0x06, 0x50, 0x00, 0x07, 0x05, 0x03, 0x02, 0x40, 0x00, 0x00, 0x07, 0x05, 0x83, 0x02, 0x40,
+        0x00, 0x00
+};
+
+// usb_audio_headset, 218 bytes
+static const uint8_t usb_audio_headset[] = {
+        0x09, 0x02, 0xDA, 0x00, 0x04, 0x01, 0x00, 0x80, 0x32, 0x09, 0x04, 0x00, 0x00, 0x00, 0x01, 0x01,
+        0x00, 0x00, 0x0A, 0x24, 0x01, 0x00, 0x01, 0x64, 0x00, 0x02, 0x01, 0x02, 0x0C, 0x24, 0x02, 0x01,
+        0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x09, 0x24, 0x03, 0x03, 0x01, 0x03, 0x00, 0x02,
+        0x00, 0x0A, 0x24, 0x06, 0x02, 0x01, 0x01, 0x03, 0x00, 0x00, 0x00, 0x0C, 0x24, 0x02, 0x04, 0x01,
+        0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x09, 0x24, 0x03, 0x06, 0x01, 0x01, 0x00, 0x05, 0x00,
+        0x09, 0x24, 0x06, 0x05, 0x04, 0x01, 0x03, 0x00, 0x00, 0x09, 0x04, 0x01, 0x00, 0x00, 0x01, 0x02,
+        0x00, 0x00, 0x09, 0x04, 0x01, 0x01, 0x01, 0x01, 0x02, 0x00, 0x00, 0x07, 0x24, 0x01, 0x01, 0x01,
+        0x01, 0x00, 0x0B, 0x24, 0x02, 0x01, 0x02, 0x02, 0x10, 0x01, 0x80, 0xBB, 0x00, 0x09, 0x05, 0x01,
+        0x09, 0xC0, 0x00, 0x01, 0x00, 0x00, 0x07, 0x25, 0x01, 0x01, 0x01, 0x01, 0x00, 0x09, 0x04, 0x02,
+        0x00, 0x00, 0x01, 0x02, 0x00, 0x00, 0x09, 0x04, 0x02, 0x01, 0x01, 0x01, 0x02, 0x00, 0x00, 0x07,
+        0x24, 0x01, 0x06, 0x01, 0x01, 0x00, 0x0B, 0x24, 0x02, 0x01, 0x01, 0x02, 0x10, 0x01, 0x80, 0xBB,
+        0x00, 0x09, 0x05, 0x82, 0x05, 0x60, 0x00, 0x01, 0x00, 0x00, 0x07, 0x25, 0x01, 0x01, 0x00, 0x00,
+        0x00, 0x09, 0x04, 0x03, 0x00, 0x01, 0x03, 0x00, 0x00, 0x00, 0x09, 0x21, 0x11, 0x01, 0x00, 0x01,
+        0x22, 0x32, 0x00, 0x07, 0x05, 0x87, 0x03, 0x04, 0x00, 0x20
+};
+
+struct ConfDescr {
+        const char *name;
+        const uint8_t *data;
+        uint16_t len;
+};
+
+#define CONF_DESCR(name) { #name, name, sizeof(name) }
+
+static const ConfDescr descriptors[] = {
+        CONF_DESCR(arduino_uno_r3),
+        CONF_DESCR(logitech_unifying),
+        CONF_DESCR(flash_drive),
+        CONF_DESCR(ftdi_ft232r),
+        CONF_DESCR(usb2_hub),
+        CONF_DESCR(xbox360_wired),
+        CONF_DESCR(cdc_msc_composite),
+        CONF_DESCR(usb_audio_headset)
+};
+
+#endif // _DESCRIPTORS_H_
@@ -0,0 +1,681 @@
+/* Host side benchmark of BulkOnly and BulkOnlyCache against the simulated disk in max3421e_sim.h.
+ *
+ * Measures, for every driver setting:
+ *
+ *      seq_read, seq_write     sequential MB/s with 1 to 128 blocks per call
+ *      rand_read, rand_write   IOPS of 4 KiB (8 block) calls at random aligned addresses
+ *
+ * and how many commands each call needs and how many SPI register accesses each command costs. The command and
+ * SPI counts come from a fixed pass of every test, so they are the same on every machine and are compared
+ * exactly with the baseline. The speed is measured in separate timed rounds and depends on the machine, so
+ * without -t a speed more than 25% below the baseline is printed but is not a regression. Finally every fault of the simulator is injected
+ * into a read, which has to return the expected code, and the right data if that is success. The next read has
+ * to return the right data.
+ * Then a unit attention and a media removal hit a write-back cache with dirty blocks: the first must keep
+ * them, the second must count them as lost, and so must a release after the device is unplugged. The other
+ * transports and features of the simulator are checked last: reads and writes of a floppy on CBI, UNMAP of a
+ * long range and of many short ones, which have to go in as few commands as the block limits allow, and the
+ * MBR with logical partitions, the GPT and its backup.
+ *
+ *      mass_bench                      compare with mass_bench.baseline, if it exists
+ *      mass_bench -b file              compare with file
+ *      mass_bench -w file              write the results to file, to make a new baseline
+ *      mass_bench -t 20                also fail if a speed is more than 20% below the baseline
+ *
+ * The exit status is 1 if a count got worse, a check failed or a speed is below the tolerance.
+ *
+ * Build and run with: make run
+ */
+#include <getopt.h>
+#include <masscache.h>
+#include <masspart.h>
+
+#include "max3421e_sim.h"
+
+#define BENCH_TIME_US           50000UL // Time of one timed round
+#define BENCH_ROUNDS            3       // The fastest round is used
+#define BENCH_COUNT_KIB         2048    // Data moved by the counting pass of a sequential test
+#define BENCH_COUNT_OPS         512     // Calls of the counting pass of a random test
+
+#define DISK_BLOCKS             (1UL << 20) // 512 MiB
+#define DISK_MEM_BLOCKS         8192    // Backed by 4 MiB of RAM, repeated above
+#define SEQ_BLOCKS              16384   // Sequential tests wrap around in the first 8 MiB
+#define MAX_BLOCKS              128
+
+#define FLOPPY_BLOCKS           2880    // 1.44 MB
+#define THIN_MEM_BLOCKS         2048    // Of the disk for UNMAP, as big as the other
+#define PART_BLOCKS             8192    // 4 MiB disk for the partition tables
+
+// UNMAP limits of the block limits page of the simulator
+#define SIM_UNMAP_BLOCKS        0x10000UL
+#define SIM_UNMAP_RANGES        4
+
+#define BASELINE_FILE           "mass_bench.baseline"
+#define MAX_RESULTS             192
+
+// How a result is compared with the baseline
+enum {
+        KIND_SPEED, // Higher is better, depends on the machine
+        KIND_COUNT, // Lower is better, the same on every machine
+        KIND_EXACT // Has to match
+};
+
+struct Result {
+        char name[48];
+        double value;
+        uint8_t kind;
+};
+
+USB Usb;
+SimDriver<BulkOnly> Plain(&Usb);
+SimDriver<BulkOnlyCacheT<8> > Cache8(&Usb);
+SimDriver<BulkOnlyCacheT<32> > Cache32(&Usb);
+SimDriver<BulkOnlyPartitionedT<> > Parted(&Usb);
+
+static SimBOTDisk disk(DISK_BLOCKS, 512, DISK_MEM_BLOCKS);
+static SimBOTDisk floppy(FLOPPY_BLOCKS, 512);
+static SimBOTDisk thin(DISK_BLOCKS, 512, THIN_MEM_BLOCKS);
+static SimBOTDisk partDisk(PART_BLOCKS, 512);
+static uint8_t buf[MAX_BLOCKS * 512];
+static Result results[MAX_RESULTS];
+static uint8_t numResults;
+
+static void attachPlain() {
+        Plain.Attach(&disk);
+}
+
+static void attachCache8() {
+        Cache8.Attach(&disk);
+}
+
+static void attachCache32() {
+        Cache32.Attach(&disk);
+}
+
+// A driver setting under test
+struct Setting {
+        const char *name;
+        BulkOnly *drv;
+        void (*attach)();
+        BulkOnlyCache *cache; // NULL without a cache
+        bool writeBack;
+};
+
+static const Setting settings[] = {
+        { "none", &Plain, attachPlain, NULL, false },
+        { "cache8", &Cache8, attachCache8, &Cache8, false },
+        { "cache8_wb", &Cache8, attachCache8, &Cache8, true },
+        { "cache32_wb", &Cache32, attachCache32, &Cache32, true }
+};
+
+static const uint8_t seqBlocks[] = { 1, 8, 64, MAX_BLOCKS };
+
+static void addResult(const char *name, double value, uint8_t kind) {
+        if(numResults == MAX_RESULTS)
+                return;
+        snprintf(results[numResults].name, sizeof(results[numResults].name), "%s", name);
+        results[numResults].value = value;
+        results[numResults].kind = kind;
+        numResults++;
+}
+
+// Attach the driver and start from an empty cache
+static void prepare(const Setting *s) {
+        s->attach();
+        if(s->cache) {
+                s->cache->SetWriteBack(s->writeBack);
+                s->cache->Invalidate();
+        }
+}
+
+// Write back what the cache holds, part of the cost of a write
+static uint8_t finish(const Setting *s) {
+        return s->cache ? s->cache->Flush() : 0;
+}
+
+// State of a test, so the counting pass and the timed rounds do the same calls
+struct Test {
+        const Setting *s;
+        bool write;
+        bool random;
+        uint8_t blocks;
+        uint32_t lba;
+        uint32_t seed;
+
+        void Start() {
+                lba = 0;
+                seed = 12345;
+        };
+
+        uint8_t Next() {
+                uint8_t rc;
+
+                if(random) {
+                        seed = seed * 1103515245UL + 12345;
+                        lba = ((seed >> 8) % (DISK_BLOCKS / blocks)) * blocks;
+                }
+                if(write)
+                        rc = s->drv->Write(0, lba, 512, blocks, buf);
+                else
+                        rc = s->drv->Read(0, lba, 512, blocks, buf);
+                if(!random)
+                        lba = (lba + blocks) % SEQ_BLOCKS;
+                return rc;
+        };
+};
+
+// Calls per second of the fastest round, or -1 if a call failed
+static double timed(Test *t) {
+        double best = 0;
+
+        for(uint8_t r = 0; r < BENCH_ROUNDS; r++) {
+                uint32_t n = 0;
+                uint32_t start = micros(), elapsed;
+
+                prepare(t->s);
+                t->Start();
+                do {
+                        for(uint8_t i = 0; i < 16; i++) {
+                                if(t->Next())
+                                        return -1;
+                        }
+                        n += 16;
+                        elapsed = micros() - start;
+                } while(elapsed < BENCH_TIME_US);
+                if(finish(t->s))
+                        return -1;
+                elapsed = micros() - start;
+
+                double rate = n * 1000000.0 / elapsed;
+
+                if(rate > best)
+                        best = rate;
+        }
+        return best;
+}
+
+// Runs the counting pass and the timed rounds of one test, false if a call failed
+static bool run(const char *test, const Setting *s, bool write, bool random, uint8_t blocks) {
+        Test t = { s, write, random, blocks, 0, 0 };
+        uint32_t ops = random ? BENCH_COUNT_OPS : BENCH_COUNT_KIB * 2 / blocks;
+        char name[48];
+
+        prepare(s);
+        t.Start();
+        disk.commands = 0;
+        Sim.ResetCounters();
+        for(uint32_t i = 0; i < ops; i++) {
+                if(t.Next())
+                        return false;
+        }
+        if(finish(s))
+                return false;
+
+        uint32_t commands = disk.commands;
+        uint32_t spiTotal = Sim.spiTransactions;
+        double spi = (double)spiTotal / commands;
+        double cmdPerOp = (double)commands / ops;
+        double rate = timed(&t);
+
+        if(rate < 0)
+                return false;
+
+        double mbps = rate * blocks * 512 / 1000000.0;
+
+        printf("%-10s %-12s %6u %9.2f %9.0f %8.3f %8.1f %8.2f\n", test, s->name, blocks, mbps, rate, cmdPerOp, spi, (double)spiTotal * 2 / (ops * blocks));
+
+        snprintf(name, sizeof(name), "%s/%s/%u/%s", test, s->name, blocks, random ? "iops" : "mbps");
+        addResult(name, random ? rate : mbps, KIND_SPEED);
+        snprintf(name, sizeof(name), "%s/%s/%u/cmd_per_op", test, s->name, blocks);
+        addResult(name, cmdPerOp, KIND_COUNT);
+        snprintf(name, sizeof(name), "%s/%s/%u/spi_per_cmd", test, s->name, blocks);
+        addResult(name, spi, KIND_COUNT);
+        return true;
+}
+
+// Injects a fault into a read of 8 blocks, which has to return expect and the right data if it succeeds. The
+// next read has to be right too. False if either is wrong
+static bool fault(const char *faultName, uint8_t f, uint8_t expect) {
+        uint8_t *mem = disk.GetDisk();
+        char name[48];
+        uint8_t rc;
+        uint32_t commands, spi;
+        bool ok;
+
+        prepare(&settings[0]);
+        disk.commands = 0;
+        Sim.ResetCounters();
+        disk.InjectFault(f);
+        memset(buf, 0, 8 * 512);
+        rc = Plain.Read(0, 64, 512, 8, buf);
+        commands = disk.commands;
+        spi = Sim.spiTransactions;
+        disk.InjectFault(SIM_FAULT_NONE);
+        ok = rc == expect && (rc || !memcmp(buf, mem + 64 * 512, 8 * 512));
+
+        memset(buf, 0, 8 * 512);
+        ok = ok && !Plain.Read(0, 72, 512, 8, buf) && !memcmp(buf, mem + 72 * 512, 8 * 512);
+
+        printf("%-10s %4u %4u %9u %8u %10s\n", faultName, rc, expect, commands, spi, ok ? "yes" : "NO");
+
+        snprintf(name, sizeof(name), "fault/%s/rc", faultName);
+        addResult(name, rc, KIND_EXACT);
+        snprintf(name, sizeof(name), "fault/%s/commands", faultName);
+        addResult(name, commands, KIND_COUNT);
+        snprintf(name, sizeof(name), "fault/%s/spi", faultName);
+        addResult(name, spi, KIND_COUNT);
+        return ok;
+}
+
+// A unit attention has to keep the 3 dirty blocks of a write-back cache, removing the media has to count them as
+// lost, and so does a release that can not write 2 more back. False if the driver does something else
+static bool media() {
+        const MASS_CACHE_STATS *st = Cache8.GetStats();
+        uint8_t dirty;
+        uint32_t removedLost, unplugLost;
+        bool kept, lost, back, unplug;
+
+        prepare(&settings[2]);
+        Cache8.ResetStats();
+        for(uint16_t i = 0; i < 3 * 512; i++)
+                buf[i] = i * 3 + 1;
+
+        Cache8.Write(0, 200, 512, 3, buf);
+        disk.InjectFault(SIM_FAULT_ATTENTION);
+        Cache8.PollMedia();
+        dirty = Cache8.GetDirtyCount();
+        kept = dirty == 3 && Cache8.LUNIsGood(0) && !Cache8.Flush() && !memcmp(disk.GetDisk() + 200 * 512, buf, 3 * 512);
+
+        Cache8.Write(0, 300, 512, 3, buf);
+        disk.SetMedia(false);
+        Cache8.PollMedia();
+        removedLost = st->lost;
+        lost = !Cache8.LUNIsGood(0) && !Cache8.GetDirtyCount() && removedLost == 3;
+
+        disk.SetMedia(true);
+        for(uint8_t i = 0; i < 4 && !Cache8.LUNIsGood(0); i++)
+                Cache8.PollMedia();
+        back = Cache8.LUNIsGood(0);
+
+        // Unplugged with the media in: the writes of Release() fail
+        Cache8.Write(0, 400, 512, 2, buf);
+        disk.SetMedia(false);
+        Cache8.Release();
+        disk.SetMedia(true);
+        unplugLost = st->lost - removedLost;
+        unplug = unplugLost == 2 && !Cache8.GetDirtyCount();
+
+        printf("%-10s %5u %5u %8s %8s %9s %6s\n", "cache8_wb", dirty, removedLost, kept ? "yes" : "NO", lost ? "yes" : "NO", back ? "yes" : "NO", unplug ? "yes" : "NO");
+
+        addResult("media/attention/dirty", dirty, KIND_EXACT);
+        addResult("media/removed/lost", removedLost, KIND_EXACT);
+        addResult("media/unplug/lost", unplugLost, KIND_EXACT);
+        return kept && lost && back && unplug;
+}
+
+// Reads and writes a floppy on CBI. A unit attention has to fail a read with MASS_ERR_UNIT_NOT_READY after
+// REQUEST SENSE, and the next read has to be right. False if one of them is wrong
+static bool cbi(const char *protoName, uint8_t proto) {
+        uint8_t *mem = floppy.GetDisk();
+        char name[48];
+        uint8_t rc;
+        uint32_t spi;
+        bool read, written, ok;
+
+        floppy.SetTransport(proto);
+        Plain.Attach(&floppy);
+        floppy.commands = 0;
+        Sim.ResetCounters();
+        memset(buf, 0, 8 * 512);
+        read = !Plain.Read(0, 10, 512, 8, buf) && !memcmp(buf, mem + 10 * 512, 8 * 512) && floppy.commands == 1;
+        spi = Sim.spiTransactions;
+
+        for(uint16_t i = 0; i < 8 * 512; i++)
+                buf[i] = i * 5 + proto;
+        written = !Plain.Write(0, 100, 512, 8, buf) && !memcmp(buf, mem + 100 * 512, 8 * 512);
+
+        floppy.InjectFault(SIM_FAULT_ATTENTION);
+        floppy.commands = 0;
+        rc = Plain.Read(0, 10, 512, 8, buf);
+        ok = rc == MASS_ERR_UNIT_NOT_READY && floppy.commands == 2;
+        memset(buf, 0, 8 * 512);
+        ok = ok && !Plain.Read(0, 20, 512, 8, buf) && !memcmp(buf, mem + 20 * 512, 8 * 512);
+
+        printf("%-10s %5s %5s %8u %4u %10s\n", protoName, read ? "yes" : "NO", written ? "yes" : "NO", spi, rc, ok ? "yes" : "NO");
+
+        snprintf(name, sizeof(name), "cbi/%s/read_spi", protoName);
+        addResult(name, spi, KIND_COUNT);
+        snprintf(name, sizeof(name), "cbi/%s/attention_rc", protoName);
+        addResult(name, rc, KIND_EXACT);
+        return read && written && ok;
+}
+
+// UNMAP has to be found through READ CAPACITY(16) and the VPD pages, a long range has to be split and short ranges
+// batched into as few commands as the block limits allow, and only their blocks may be released. False if not
+static bool unmap() {
+        const uint32_t count = 300000;
+        uint8_t *mem = thin.GetDisk();
+        MASS_UNMAP_RANGE ranges[10];
+        uint32_t longCmds, rangeCmds;
+        bool supported, longOk, rangesOk;
+
+        Plain.Attach(&thin);
+        Plain.InsertMedia(true);
+        supported = Plain.UnmapSupported(0);
+
+        thin.commands = thin.unmapped = 0;
+        longOk = !Plain.Unmap(0, 100, count) && thin.unmapped == count;
+        longCmds = thin.commands;
+
+        memset(mem, 0x77, THIN_MEM_BLOCKS * 512UL);
+        for(uint8_t i = 0; i < 10; i++) {
+                ranges[i].lba = 1000 + i * 16;
+                ranges[i].blocks = 8;
+        }
+        thin.commands = thin.unmapped = 0;
+        rangesOk = !Plain.UnmapRanges(0, ranges, 10) && thin.unmapped == 80;
+        rangeCmds = thin.commands;
+        // The first and the last block of the ranges are released, the gaps between them are not
+        rangesOk = rangesOk && !mem[1000 * 512] && !mem[1152 * 512 - 1] && mem[1008 * 512] == 0x77 && mem[1160 * 512] == 0x77;
+
+        longOk = longOk && longCmds == (count + SIM_UNMAP_BLOCKS - 1) / SIM_UNMAP_BLOCKS;
+        rangesOk = rangesOk && rangeCmds == (10 + SIM_UNMAP_RANGES - 1) / SIM_UNMAP_RANGES;
+
+        printf("%-10s %9s %9u %9u %7s %7s\n", "thin", supported ? "yes" : "NO", longCmds, rangeCmds, longOk ? "yes" : "NO", rangesOk ? "yes" : "NO");
+
+        addResult("unmap/long/commands", longCmds, KIND_COUNT);
+        addResult("unmap/ranges/commands", rangeCmds, KIND_COUNT);
+        return supported && longOk && rangesOk;
+}
+
+static void putLE32(uint8_t *p, uint32_t v) {
+        for(uint8_t i = 0; i < 4; i++)
+                p[i] = v >> (8 * i);
+}
+
+static void putLE64(uint8_t *p, uint64_t v) {
+        for(uint8_t i = 0; i < 8; i++)
+                p[i] = v >> (8 * i);
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *p, uint32_t len) {
+        crc = ~crc;
+        while(len--) {
+                crc ^= *p++;
+                for(uint8_t i = 0; i < 8; i++)
+                        crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+        return ~crc;
+}
+
+// Entry i of the MBR or EBR in block lba
+static void mbrEntry(uint32_t lba, uint8_t i, uint8_t status, uint8_t type, uint32_t start, uint32_t blocks) {
+        uint8_t *p = partDisk.GetDisk() + lba * 512;
+
+        p[446 + i * 16] = status;
+        p[446 + i * 16 + 4] = type;
+        putLE32(p + 446 + i * 16 + 8, start);
+        putLE32(p + 446 + i * 16 + 12, blocks);
+        p[510] = 0x55;
+        p[511] = 0xAA;
+}
+
+// GPT header in block hdr with n entries of 128 bytes from block entries on
+static void gptWrite(uint32_t hdr, uint32_t entries, const uint32_t *types, const uint32_t *first, const uint32_t *last, uint8_t n) {
+        uint8_t *e = partDisk.GetDisk() + entries * 512;
+        uint8_t *h = partDisk.GetDisk() + hdr * 512;
+
+        memset(e, 0, 128 * 128);
+        for(uint8_t i = 0; i < n; i++) {
+                putLE32(e + i * 128, types[i]);
+                putLE64(e + i * 128 + 32, first[i]);
+                putLE64(e + i * 128 + 40, last[i]);
+        }
+        memset(h, 0, 512);
+        memcpy(h, "EFI PART", 8);
+        putLE32(h + 8, 0x10000); // Revision 1.0
+        putLE32(h + 12, 92);
+        putLE64(h + 24, hdr);
+        putLE64(h + 72, entries);
+        putLE32(h + 80, 128);
+        putLE32(h + 84, 128);
+        putLE32(h + 88, crc32(0, e, 128 * 128));
+        putLE32(h + 16, crc32(0, h, 92));
+}
+
+// A partition the scan has to find
+struct PartWant {
+        uint32_t start;
+        uint32_t blocks;
+        uint8_t type;
+        bool aligned;
+};
+
+// Inserts partDisk and checks the partitions found, and that the first block of each one can be read. False if a
+// partition is missing or wrong
+static bool partScan(const char *tableName, const PartWant *want, uint8_t n) {
+        uint8_t *mem = partDisk.GetDisk();
+        char name[48];
+        uint8_t count;
+        uint32_t commands;
+        bool ok;
+
+        partDisk.commands = 0;
+        Parted.InsertMedia(true);
+        commands = partDisk.commands;
+        count = Parted.Partitions.GetCount();
+        ok = count == n && !Parted.Partitions.IsTruncated();
+        for(uint8_t i = 0; ok && i < n; i++) {
+                MassPartition *part = Parted.Partitions.Get(i);
+
+                ok = part->GetStart() == want[i].start && part->GetBlocks() == want[i].blocks && part->GetType() == want[i].type && part->IsAligned() == want[i].aligned;
+                ok = ok && !part->Read(0, 1, buf) && !memcmp(buf, mem + want[i].start * 512, 512);
+        }
+
+        printf("%-10s %5u %5u %9u %10s\n", tableName, count, n, commands, ok ? "yes" : "NO");
+
+        snprintf(name, sizeof(name), "part/%s/count", tableName);
+        addResult(name, count, KIND_EXACT);
+        snprintf(name, sizeof(name), "part/%s/commands", tableName);
+        addResult(name, commands, KIND_COUNT);
+        return ok;
+}
+
+// An MBR with an extended partition of two logical ones, on a 512e disk with 4096 byte physical blocks. Then a
+// GPT, and the same GPT with the entries of the primary broken, which has to be read from the backup
+static bool partitions() {
+        static const PartWant mbr[] = {
+                { 63, 1000, MASS_PART_TYPE_FAT32_LBA, false },
+                { 6144, 1000, MASS_PART_TYPE_LINUX, true },
+                { 2048 + 63, 500, MASS_PART_TYPE_NTFS, false },
+                { 2048 + 1024 + 2048, 900, MASS_PART_TYPE_LINUX, true }
+        };
+        static const uint32_t types[] = { 0xC12A7328, 0xE3C9E316, 0xEBD0A0A2 }; // EFI system, reserved, basic data
+        static const uint32_t first[] = { 2048, 4096, 4128 };
+        static const uint32_t last[] = { 4095, 4127, PART_BLOCKS - 34 };
+        static const PartWant gpt[] = {
+                { 2048, 2048, MASS_PART_TYPE_EFI, true },
+                { 4128, PART_BLOCKS - 34 - 4128 + 1, MASS_PART_TYPE_NTFS, true }
+        };
+        uint8_t *mem = partDisk.GetDisk();
+        bool ok = true;
+
+        for(uint32_t i = 0; i < PART_BLOCKS * 512UL; i++)
+                mem[i] = i * 3 + (i >> 9);
+
+        memset(mem, 0, 512);
+        mbrEntry(0, 0, 0x80, MASS_PART_TYPE_FAT32_LBA, 63, 1000);
+        mbrEntry(0, 1, 0x00, 0x0F, 2048, 4096);
+        mbrEntry(0, 2, 0x00, MASS_PART_TYPE_LINUX, 6144, 1000);
+        // EBRs: a logical partition, then the link to the next EBR, relative to the extended partition
+        memset(mem + 2048 * 512, 0, 512);
+        mbrEntry(2048, 0, 0x00, MASS_PART_TYPE_NTFS, 63, 500);
+        mbrEntry(2048, 1, 0x00, 0x05, 1024, 3072);
+        memset(mem + (2048 + 1024) * 512, 0, 512);
+        mbrEntry(2048 + 1024, 0, 0x00, MASS_PART_TYPE_LINUX, 2048, 900);
+        Parted.Attach(&partDisk);
+        partDisk.SetPhysicalBlockExp(3);
+        ok &= partScan("mbr", mbr, 4);
+
+        memset(mem, 0, 512);
+        mbrEntry(0, 0, 0x00, 0xEE, 1, PART_BLOCKS - 1); // Protective MBR
+        gptWrite(1, 2, types, first, last, 3);
+        gptWrite(PART_BLOCKS - 1, PART_BLOCKS - 33, types, first, last, 3);
+        partDisk.SetPhysicalBlockExp(0);
+        ok &= partScan("gpt", gpt, 2);
+
+        mem[2 * 512 + 200] ^= 1;
+        ok &= partScan("gpt_backup", gpt, 2);
+        return ok;
+}
+
+static bool writeBaseline(const char *file) {
+        FILE *fp = fopen(file, "w");
+
+        if(!fp) {
+                printf("Can not write %s\n", file);
+                return false;
+        }
+        fprintf(fp, "# mass_bench results, the speeds depend on the machine that wrote them\n");
+        for(uint8_t i = 0; i < numResults; i++)
+                fprintf(fp, "%s %.3f\n", results[i].name, results[i].value);
+        fclose(fp);
+        printf("\nWrote %u results to %s\n", numResults, file);
+        return true;
+}
+
+// Returns the number of regressions, tolerance is in percent, < 0 to only report slower speeds
+static uint8_t compare(const char *file, double tolerance, bool quiet) {
+        FILE *fp = fopen(file, "r");
+        char line[96], name[48];
+        double value;
+        uint8_t regressions = 0, slower = 0, missing = numResults;
+        bool found[MAX_RESULTS] = { false };
+
+        if(!fp) {
+                if(!quiet)
+                        printf("\nCan not read %s\n", file);
+                return quiet ? 0 : 1;
+        }
+        printf("\nCompared with %s:\n", file);
+        while(fgets(line, sizeof(line), fp)) {
+                if(line[0] == '#' || sscanf(line, "%47s %lf", name, &value) != 2)
+                        continue;
+
+                uint8_t i;
+
+                for(i = 0; i < numResults && strcmp(results[i].name, name); i++);
+                if(i == numResults) {
+                        printf("  %-40s no longer measured\n", name);
+                        continue;
+                }
+                found[i] = true;
+                missing--;
+
+                double now = results[i].value;
+                bool worse = false, better = false;
+
+                switch(results[i].kind) {
+                        case KIND_SPEED:
+                                if(value > 0 && now < value * (1 - (tolerance < 0 ? 0.25 : tolerance / 100))) {
+                                        printf("  %-40s %10.3f %10.3f %+6.1f%% %s\n", name, value, now, (now - value) * 100 / value, tolerance < 0 ? "slower" : "SLOWER");
+                                        worse = tolerance >= 0;
+                                        slower++;
+                                }
+                                break;
+                        case KIND_COUNT:
+                                // The baseline has 3 decimals
+                                worse = now > value + 0.0005;
+                                better = now < value - 0.0005;
+                                break;
+                        case KIND_EXACT:
+                                worse = now != value;
+                                break;
+                }
+                if(results[i].kind != KIND_SPEED && (worse || better))
+                        printf("  %-40s %10.3f %10.3f %s\n", name, value, now, worse ? "WORSE" : "better");
+                if(worse)
+                        regressions++;
+        }
+        fclose(fp);
+        for(uint8_t i = 0; i < numResults && missing; i++) {
+                if(!found[i]) {
+                        printf("  %-40s not in the baseline\n", results[i].name);
+                        missing--;
+                }
+        }
+        if(tolerance < 0 && slower)
+                printf("%u speeds slower, not counted without -t\n", slower);
+        printf("%u regressions\n", regressions);
+        return regressions;
+}
+
+int main(int argc, char **argv) {
+        const char *baseline = BASELINE_FILE;
+        const char *output = NULL;
+        double tolerance = -1;
+        bool given = false;
+        bool ok = true;
+        int opt;
+
+        while((opt = getopt(argc, argv, "b:w:t:")) != -1) {
+                switch(opt) {
+                        case 'b':
+                                baseline = optarg;
+                                given = true;
+                                break;
+                        case 'w':
+                                output = optarg;
+                                break;
+                        case 't':
+                                tolerance = atof(optarg);
+                                break;
+                        default:
+                                printf("Usage: %s [-b baseline] [-w output] [-t tolerance %%]\n", argv[0]);
+                                return 2;
+                }
+        }
+
+        UsbDEBUGlvl = 0;
+        for(uint32_t i = 0; i < DISK_MEM_BLOCKS * 512UL; i++)
+                disk.GetDisk()[i] = i * 7 + (i >> 9);
+
+        printf("%-10s %-12s %6s %9s %9s %8s %8s %8s\n", "test", "driver", "blocks", "MB/s", "calls/s", "cmd/call", "SPI/cmd", "SPI/KiB");
+        for(uint8_t s = 0; s < sizeof(settings) / sizeof(settings[0]); s++) {
+                for(uint8_t b = 0; b < sizeof(seqBlocks); b++)
+                        ok &= run("seq_read", &settings[s], false, false, seqBlocks[b]);
+                for(uint8_t b = 0; b < sizeof(seqBlocks); b++)
+                        ok &= run("seq_write", &settings[s], true, false, seqBlocks[b]);
+                ok &= run("rand_read", &settings[s], false, true, 8);
+                ok &= run("rand_write", &settings[s], true, true, 8);
+        }
+        if(!ok)
+                printf("A command failed\n");
+
+        printf("\n%-10s %4s %4s %9s %8s %10s\n", "fault", "rc", "want", "commands", "SPI", "correct");
+        ok &= fault("stall", SIM_FAULT_STALL, MASS_ERR_SUCCESS); // Sense, TEST UNIT READY and the read again
+        ok &= fault("phase", SIM_FAULT_PHASE, MASS_ERR_GENERAL_SCSI_ERROR); // After the reset recovery
+        ok &= fault("residue", SIM_FAULT_RESIDUE, MASS_ERR_SUCCESS); // The residue is not checked, all data moved
+        ok &= fault("signature", SIM_FAULT_SIGNATURE, MASS_ERR_INVALID_CSW);
+
+        printf("\n%-10s %5s %5s %8s %8s %9s %6s\n", "media", "dirty", "lost", "kept", "counted", "reinsert", "unplug");
+        ok &= media();
+
+        for(uint32_t i = 0; i < FLOPPY_BLOCKS * 512UL; i++)
+                floppy.GetDisk()[i] = i * 5 + (i >> 9);
+        printf("\n%-10s %5s %5s %8s %4s %10s\n", "cbi", "read", "write", "SPI", "rc", "recovered");
+        ok &= cbi("cbi", MASS_PROTO_CBI);
+        ok &= cbi("cbi_no_int", MASS_PROTO_CBI_NO_INT);
+
+        printf("\n%-10s %9s %9s %9s %7s %7s\n", "unmap", "supported", "long cmds", "ranges", "long", "ranges");
+        ok &= unmap();
+
+        printf("\n%-10s %5s %5s %9s %10s\n", "table", "found", "want", "commands", "correct");
+        ok &= partitions();
+
+        if(output)
+                ok &= writeBaseline(output);
+        else if(compare(baseline, tolerance, !given))
+                ok = false;
+        return ok ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+/* Host side benchmark of the mass storage trace points.
+ *
+ * Reads single blocks from the simulated disk in max3421e_sim.h and reports the CPU time and SPI register
+ * accesses of one READ command. The Makefile builds it once per trace setting, all with DEBUG_USB_HOST:
+ *
+ *      masstrace_bench_off     MASS_TRACE_LEVEL 0, the trace points are compiled out
+ *      masstrace_bench_print   MASS_TRACE_LEVEL 2 printed, but UsbDEBUGlvl filters every message at run time,
+ *                              which is what each command paid before the trace level existed
+ *      masstrace_bench_ring    MASS_TRACE_LEVEL 2 recorded in the ring buffer
+ *
+ * Build and run with: make run
+ */
+#include <masstorage.h>
+
+#include "max3421e_sim.h"
+
+#define BENCH_TIME_US 100000UL
+#define BENCH_ROUNDS 7
+
+USB Usb;
+SimDriver<BulkOnly> ms(&Usb);
+
+// Returns the time of one READ command in nanoseconds
+static double bench(uint32_t *commands) {
+        static uint8_t buf[512];
+        uint32_t n = 0;
+        uint32_t lba = 0;
+        uint32_t start = micros(), elapsed;
+
+        do {
+                for(uint16_t i = 0; i < 1000; i++) {
+                        if(ms.Read(0, lba, 512, 1, buf))
+                                return -1;
+                        lba = (lba + 1) & 2047;
+                }
+                n += 1000;
+#if MASS_TRACE_RING
+                MassTraceClear();
+#endif
+                elapsed = micros() - start;
+        } while(elapsed < BENCH_TIME_US);
+
+        *commands += n;
+        return elapsed * 1000.0 / n;
+}
+
+int main(void) {
+        SimBOTDisk disk(2048, 512);
+        uint32_t commands = 0;
+        double best = 0;
+
+        UsbDEBUGlvl = 0;
+        ms.Attach(&disk);
+        Sim.ResetCounters();
+
+        // The fastest round, the others were disturbed by something else running
+        for(uint8_t r = 0; r < BENCH_ROUNDS; r++) {
+                double t = bench(&commands);
+
+                if(t < 0) {
+                        printf("Read failed\n");
+                        return 1;
+                }
+                if(!r || t < best)
+                        best = t;
+        }
+
+#if MASS_TRACE_LEVEL == 0
+        const char *mode = "compiled out";
+#elif MASS_TRACE_RING
+        const char *mode = "ring buffer";
+#else
+        const char *mode = "filtered at run time";
+#endif
+        printf("trace level %u, %-20s %8.1f ns/command %6.1f SPI transactions/command %7.1f SPI bytes/command\n",
+                MASS_TRACE_LEVEL, mode, best, (double)Sim.spiTransactions / commands, (double)Sim.spiBytes / commands);
+        return 0;
+}
@@ -0,0 +1,566 @@
+/* Register level model of the MAX3421E and a Bulk-Only RAM disk, see max3421e_sim.h */
+#include "max3421e_sim.h"
+
+MAX3421ESim Sim;
+SPIClass SPI;
+
+uint8_t SPIClass::transfer(uint8_t data) {
+        return Sim.Transfer(data);
+}
+
+void SPIClass::endTransaction(void) {
+        Sim.EndTransaction();
+}
+
+static inline uint32_t get32be(const uint8_t *p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put32be(uint8_t *p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+}
+
+static inline void put32le(uint8_t *p, uint32_t v) {
+        p[0] = v;
+        p[1] = v >> 8;
+        p[2] = v >> 16;
+        p[3] = v >> 24;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Host controller
+
+////////////////////////////////////////////////////////////////////////////////
+
+void MAX3421ESim::Reset() {
+        memset(regs, 0, sizeof(regs));
+        regs[rUSBIRQ >> 3] = bmOSCOKIRQ;
+        rcvLen = rcvPos = sndPos = sudPos = 0;
+        cmd = 0xFF;
+        ResetCounters();
+}
+
+void MAX3421ESim::Dispatch(uint8_t hxfr) {
+        uint8_t token = hxfr & 0xF0;
+        uint8_t ep = hxfr & 0x0F;
+        uint8_t rcode = hrSUCCESS;
+        uint8_t n = 0;
+
+        packets++;
+        if(!dev)
+                rcode = hrTIMEOUT;
+        else if(token & 0x80) // Handshake of the status stage
+                rcode = hrSUCCESS;
+        else if(token == tokSETUP) {
+                rcode = dev->Setup(sudFifo);
+                sudPos = 0;
+        } else if(token == tokIN) {
+                rcode = dev->In(ep, rcvFifo, sizeof(rcvFifo), &n);
+                if(rcode == hrSUCCESS) {
+                        rcvLen = n;
+                        rcvPos = 0;
+                        regs[rHIRQ >> 3] |= bmRCVDAVIRQ;
+                        regs[rHCTL >> 3] ^= bmRCVTOGRD; // Kept in the HCTL slot, read back through HRSL
+                }
+        } else if(token == tokOUT) {
+                rcode = dev->Out(ep, sndFifo, regs[rSNDBC >> 3]);
+                if(rcode == hrSUCCESS)
+                        regs[rHCTL >> 3] ^= bmSNDTOGRD;
+                sndPos = 0;
+        }
+        regs[rHRSL >> 3] = rcode;
+        regs[rHIRQ >> 3] |= bmHXFRDNIRQ;
+}
+
+uint8_t MAX3421ESim::Transfer(uint8_t data) {
+        spiBytes++;
+        if(cmd == 0xFF) {
+                cmd = data;
+                return regs[rHIRQ >> 3];
+        }
+
+        uint8_t reg = cmd >> 3;
+
+        if(!(cmd & 0x02)) {
+                switch(cmd & 0xF8) {
+                        case rRCVFIFO:
+                                return (rcvPos < rcvLen) ? rcvFifo[rcvPos++] : 0;
+                        case rRCVBC:
+                                return rcvLen;
+                        case rHRSL:
+                                return regs[reg] | (regs[rHCTL >> 3] & (bmRCVTOGRD | bmSNDTOGRD));
+                        case rREVISION:
+                                return 0x13;
+                        default:
+                                return regs[reg];
+                }
+        }
+
+        switch(cmd & 0xF8) {
+                case rSNDFIFO:
+                        sndFifo[sndPos++ & 0x3F] = data;
+                        break;
+                case rSUDFIFO:
+                        sudFifo[sudPos++ & 0x07] = data;
+                        break;
+                case rSNDBC:
+                        if(!data)
+                                sndPos = 0;
+                        regs[reg] = data;
+                        break;
+                case rHIRQ:
+                        regs[reg] &= ~data;
+                        if(data & bmRCVDAVIRQ)
+                                rcvLen = 0;
+                        break;
+                case rHCTL:
+                        if(data & bmRCVTOG0)
+                                regs[reg] &= ~bmRCVTOGRD;
+                        if(data & bmRCVTOG1)
+                                regs[reg] |= bmRCVTOGRD;
+                        if(data & bmSNDTOG0)
+                                regs[reg] &= ~bmSNDTOGRD;
+                        if(data & bmSNDTOG1)
+                                regs[reg] |= bmSNDTOGRD;
+                        break;
+                case rHXFR:
+                        Dispatch(data);
+                        break;
+                default:
+                        regs[reg] = data;
+        }
+        return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Bulk-Only RAM disk
+
+////////////////////////////////////////////////////////////////////////////////
+
+SimBOTDisk::SimBOTDisk(uint64_t nblocks, uint16_t block_size, uint32_t mem_blocks) :
+state(BOT_CBW), blocks(nblocks), memBlocks(mem_blocks ? mem_blocks : (uint32_t)nblocks), blockSize(block_size),
+haltIn(false), haltOut(false), fault(SIM_FAULT_NONE), media(true), physExp(0), transport(MASS_PROTO_BBB), adscLen(0), adscPos(0), ctlLen(0), commands(0), unmapped(0), syncs(0), writes(0) {
+        disk = (uint8_t*)calloc(memBlocks, blockSize);
+        memset(sense, 0, sizeof(sense));
+}
+
+SimBOTDisk::~SimBOTDisk() {
+        free(disk);
+}
+
+void SimBOTDisk::SetSense(uint8_t key, uint8_t asc) {
+        sense[0] = key;
+        sense[1] = asc;
+        sense[2] = 0;
+        status = 1;
+}
+
+bool SimBOTDisk::Range(uint64_t lba, uint32_t count) {
+        if(lba + count > blocks) {
+                SetSense(SCSI_S_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+                return false;
+        }
+        diskPos = lba * blockSize;
+        dataLen = count * blockSize;
+        toDisk = true;
+        return true;
+}
+
+void SimBOTDisk::Command() {
+        const uint8_t *cb = cbw + 15;
+        bool in = (cbw[12] & 0x80) != 0;
+        uint64_t lba;
+
+        commands++;
+        expected = cbw[8] | ((uint32_t)cbw[9] << 8) | ((uint32_t)cbw[10] << 16) | ((uint32_t)cbw[11] << 24);
+        moved = 0;
+        status = 0;
+        toDisk = false;
+        dataLen = 0;
+        memset(resp, 0, sizeof(resp));
+
+        if(fault == SIM_FAULT_ATTENTION && cb[0] != SCSI_CMD_REQUEST_SENSE) {
+                SetSense(SCSI_S_UNIT_ATTENTION, 0x29); // Power on or reset occurred
+                fault = SIM_FAULT_NONE;
+        } else if(!media && cb[0] != SCSI_CMD_INQUIRY && cb[0] != SCSI_CMD_REQUEST_SENSE) {
+                SetSense(SCSI_S_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+        } else switch(cb[0]) {
+                case SCSI_CMD_TEST_UNIT_READY:
+                case SCSI_CMD_START_STOP_UNIT:
+                case SCSI_CMD_PREVENT_REMOVAL:
+                        break;
+                case SCSI_CMD_REQUEST_SENSE:
+                        resp[0] = 0x70;
+                        resp[2] = sense[0];
+                        resp[7] = 10;
+                        resp[12] = sense[1];
+                        resp[13] = sense[2];
+                        memset(sense, 0, sizeof(sense));
+                        dataLen = 18;
+                        break;
+                case SCSI_CMD_INQUIRY:
+                        if(cb[1] & 0x01) {
+                                // Vital product data
+                                resp[1] = cb[2];
+                                switch(cb[2]) {
+                                        case 0x00:
+                                                resp[3] = 3;
+                                                resp[5] = 0xB0;
+                                                resp[6] = 0xB2;
+                                                dataLen = 7;
+                                                break;
+                                        case 0xB0: // Block limits
+                                                resp[3] = 0x3C;
+                                                put32be(resp + 8, 0xFFFF); // Maximum transfer length
+                                                put32be(resp + 20, 0x10000); // Maximum unmap LBA count
+                                                put32be(resp + 24, 4); // Maximum unmap block descriptor count
+                                                dataLen = 64;
+                                                break;
+                                        case 0xB2: // Logical block provisioning
+                                                resp[3] = 4;
+                                                resp[5] = 0x80; // LBPU
+                                                dataLen = 8;
+                                                break;
+                                        default:
+                                                SetSense(SCSI_S_ILLEGAL_REQUEST, 0x24);
+                                }
+                                break;
+                        }
+                        resp[1] = 0x80;
+                        resp[2] = 6;
+                        resp[3] = 2;
+                        resp[4] = 31;
+                        memcpy(resp + 8, "SIM     RAM disk        1.0 ", 28);
+                        dataLen = 36;
+                        break;
+                case SCSI_CMD_MODE_SENSE_6:
+                        if(transport != MASS_PROTO_BBB) {
+                                SetSense(SCSI_S_ILLEGAL_REQUEST, 0x20); // Not in UFI
+                                break;
+                        }
+                        resp[0] = 3;
+                        dataLen = 4;
+                        break;
+                case SCSI_CMD_MODE_SENSE_10:
+                        resp[1] = 6;
+                        dataLen = 8;
+                        break;
+                case SCSI_CMD_READ_CAPACITY_10:
+                        put32be(resp, (blocks - 1 > 0xFFFFFFFFull) ? 0xFFFFFFFF : (uint32_t)(blocks - 1));
+                        put32be(resp + 4, blockSize);
+                        dataLen = 8;
+                        break;
+                case 0x9E: // Service action in (16)
+                        if((cb[1] & 0x1F) != 0x10) {
+                                SetSense(SCSI_S_ILLEGAL_REQUEST, 0x24);
+                                break;
+                        }
+                        put32be(resp, (uint32_t)((blocks - 1) >> 32));
+                        put32be(resp + 4, (uint32_t)(blocks - 1));
+                        put32be(resp + 8, blockSize);
+                        resp[13] = physExp;
+                        resp[14] = 0x80; // LBPME
+                        dataLen = 32;
+                        break;
+                case SCSI_CMD_READ_10:
+                case SCSI_CMD_WRITE_10:
+                        if(cb[0] == SCSI_CMD_WRITE_10)
+                                writes++;
+                        Range(get32be(cb + 2), ((uint32_t)cb[7] << 8) | cb[8]);
+                        break;
+                case 0x88: // READ(16)
+                case 0x8A: // WRITE(16)
+                        if(cb[0] == 0x8A)
+                                writes++;
+                        lba = ((uint64_t)get32be(cb + 2) << 32) | get32be(cb + 6);
+                        Range(lba, get32be(cb + 10));
+                        break;
+                case 0x35: // SYNCHRONIZE CACHE(10)
+                case 0x91: // SYNCHRONIZE CACHE(16)
+                        syncs++;
+                        break;
+                case 0x42: // UNMAP, the parameter list is handled in Finish()
+                        dataLen = sizeof(resp);
+                        break;
+                default:
+                        SetSense(SCSI_S_ILLEGAL_REQUEST, 0x20);
+        }
+
+        if(status)
+                dataLen = 0;
+
+        switch(fault) {
+                case SIM_FAULT_STALL:
+                        if(expected) {
+                                if(in)
+                                        haltIn = true;
+                                else
+                                        haltOut = true;
+                                status = 1;
+                                fault = SIM_FAULT_NONE;
+                                state = BOT_CSW;
+                                Finish();
+                                return;
+                        }
+                        break;
+        }
+
+        if(!expected)
+                Finish();
+        else
+                state = in ? BOT_DATA_IN : BOT_DATA_OUT;
+}
+
+// Moves n bytes of the data stage between buf and the disk or the response buffer
+void SimBOTDisk::Copy(uint8_t *buf, uint8_t n, bool in) {
+        for(uint8_t i = 0; i < n;) {
+                uint32_t pos = moved + i;
+                uint8_t chunk = n - i;
+
+                if(pos >= dataLen) {
+                        if(in)
+                                memset(buf + i, 0, chunk); // Padding after a short response
+                        break;
+                }
+                if(chunk > dataLen - pos)
+                        chunk = dataLen - pos;
+                if(toDisk) {
+                        uint64_t memSize = (uint64_t)memBlocks * blockSize;
+                        uint32_t off = (uint32_t)((diskPos + pos) % memSize);
+
+                        if(chunk > memSize - off)
+                                chunk = memSize - off;
+                        if(in)
+                                memcpy(buf + i, disk + off, chunk);
+                        else
+                                memcpy(disk + off, buf + i, chunk);
+                } else if(pos < sizeof(resp)) {
+                        if(chunk > sizeof(resp) - pos)
+                                chunk = sizeof(resp) - pos;
+                        if(in)
+                                memcpy(buf + i, resp + pos, chunk);
+                        else
+                                memcpy(resp + pos, buf + i, chunk);
+                }
+                i += chunk;
+        }
+}
+
+void SimBOTDisk::Finish() {
+        uint32_t residue = expected - moved;
+
+        if(transport != MASS_PROTO_BBB) {
+                intr[0] = status ? sense[1] : 0;
+                intr[1] = status ? sense[2] : 0;
+                if(status && !intr[0])
+                        intr[0] = 0xFF;
+                state = (transport == MASS_PROTO_CBI) ? BOT_CSW : BOT_CBW;
+                return;
+        }
+
+        if(cbw[15] == 0x42 && !status) {
+                // UNMAP parameter list: 8 byte header, then descriptors of LBA (8), count (4) and 4 reserved bytes
+                uint16_t len = ((uint16_t)resp[2] << 8) | resp[3];
+
+                for(uint16_t d = 8; d + 16 <= len + 8 && (size_t)(d + 16) <= sizeof(resp); d += 16) {
+                        uint64_t lba = ((uint64_t)get32be(resp + d) << 32) | get32be(resp + d + 4);
+                        uint32_t count = get32be(resp + d + 8);
+
+                        if(lba + count > blocks) {
+                                SetSense(SCSI_S_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+                                break;
+                        }
+                        for(uint32_t b = 0; b < count; b++)
+                                memset(disk + ((lba + b) % memBlocks) * blockSize, 0, blockSize);
+                        unmapped += count;
+                }
+        }
+
+        // The data stage went through, the CSW reports a phase error and the host recovers with a reset
+        if(fault == SIM_FAULT_PHASE) {
+                status = 2;
+                fault = SIM_FAULT_NONE;
+        }
+
+        put32le(csw, MASS_CSW_SIGNATURE);
+        memcpy(csw + 4, cbw + 4, 4); // Tag
+        put32le(csw + 8, (fault == SIM_FAULT_RESIDUE) ? residue + blockSize : residue);
+        csw[12] = status;
+        if(fault == SIM_FAULT_SIGNATURE)
+                csw[0] ^= 0xFF;
+        if(fault == SIM_FAULT_RESIDUE || fault == SIM_FAULT_SIGNATURE)
+                fault = SIM_FAULT_NONE;
+        state = BOT_CSW;
+}
+
+static uint16_t get16be(const uint8_t *p) {
+        return ((uint16_t)p[0] << 8) | p[1];
+}
+
+// A CBI command has no CBW, the length and direction of the data stage follow from the command
+void SimBOTDisk::CBICommand(const uint8_t *cb, uint8_t len) {
+        uint32_t xflen = 0;
+        bool out = false;
+
+        if(cb[0] == SCSI_CMD_SEND_DIAGNOSTIC && cb[1] == 0x04) {
+                // Command block reset
+                status = 0;
+                expected = 0;
+                state = BOT_CBW;
+                return;
+        }
+        switch(cb[0]) {
+                case SCSI_CMD_INQUIRY:
+                case SCSI_CMD_REQUEST_SENSE:
+                case SCSI_CMD_MODE_SENSE_6:
+                        xflen = cb[4];
+                        break;
+                case SCSI_CMD_MODE_SENSE_10:
+                        xflen = get16be(cb + 7);
+                        break;
+                case SCSI_CMD_READ_CAPACITY_10:
+                        xflen = 8;
+                        break;
+                case SCSI_CMD_WRITE_10:
+                        out = true;
+                        // fall through
+                case SCSI_CMD_READ_10:
+                        xflen = (uint32_t)get16be(cb + 7) * blockSize;
+                        break;
+        }
+        memset(cbw, 0, sizeof(cbw));
+        put32le(cbw + 8, xflen);
+        cbw[12] = out ? MASS_CMD_DIR_OUT : MASS_CMD_DIR_IN;
+        cbw[14] = len;
+        memcpy(cbw + 15, cb, (len > 16) ? 16 : len);
+        Command();
+        if(status && expected && state != BOT_CSW && state != BOT_CBW) {
+                // A failed command STALLs its data stage
+                if(out)
+                        haltOut = true;
+                else
+                        haltIn = true;
+                Finish();
+        }
+}
+
+uint8_t SimBOTDisk::Setup(const uint8_t *setup) {
+        uint16_t wIndex = setup[4] | (setup[5] << 8);
+
+        ctlLen = 0;
+        if(setup[0] == (USB_SETUP_HOST_TO_DEVICE | USB_SETUP_TYPE_CLASS | USB_SETUP_RECIPIENT_INTERFACE) && setup[1] == MASS_REQ_ADSC) {
+                if(transport == MASS_PROTO_BBB)
+                        return hrSTALL;
+                adscLen = (setup[6] > sizeof(adsc)) ? sizeof(adsc) : setup[6];
+                adscPos = 0;
+                return hrSUCCESS;
+        }
+        switch(setup[1]) {
+                case MASS_REQ_GET_MAX_LUN:
+                        ctlReply[0] = 0;
+                        ctlLen = 1;
+                        break;
+                case MASS_REQ_BOMSR:
+                        state = BOT_CBW;
+                        break;
+                case USB_REQUEST_CLEAR_FEATURE:
+                        if(wIndex == 0x81)
+                                haltIn = false;
+                        else if(wIndex == 0x02)
+                                haltOut = false;
+                        break;
+        }
+        return hrSUCCESS;
+}
+
+uint8_t SimBOTDisk::In(uint8_t ep, uint8_t *buf, uint8_t max, uint8_t *len) {
+        *len = 0;
+        if(ep == 0) {
+                memcpy(buf, ctlReply, ctlLen);
+                *len = ctlLen;
+                return hrSUCCESS;
+        }
+        if(ep == 3 && transport == MASS_PROTO_CBI) {
+                if(state != BOT_CSW)
+                        return hrNAK;
+                memcpy(buf, intr, sizeof(intr));
+                *len = sizeof(intr);
+                state = BOT_CBW;
+                return hrSUCCESS;
+        }
+        if(ep != 1)
+                return hrSTALL;
+        if(haltIn)
+                return hrSTALL;
+
+        if(state == BOT_DATA_IN) {
+                uint32_t n = expected - moved;
+
+                if(n > max)
+                        n = max;
+                Copy(buf, n, true);
+                moved += n;
+                *len = n;
+                if(moved == expected)
+                        Finish();
+                return hrSUCCESS;
+        }
+        if(state == BOT_CSW && transport == MASS_PROTO_BBB) {
+                memcpy(buf, csw, sizeof(csw));
+                *len = sizeof(csw);
+                state = BOT_CBW;
+                return hrSUCCESS;
+        }
+        return hrNAK;
+}
+
+uint8_t SimBOTDisk::Out(uint8_t ep, const uint8_t *buf, uint8_t len) {
+        if(ep == 0) {
+                if(adscLen) {
+                        if(len > adscLen - adscPos)
+                                len = adscLen - adscPos;
+                        memcpy(adsc + adscPos, buf, len);
+                        adscPos += len;
+                        if(adscPos < adscLen)
+                                return hrSUCCESS;
+                        len = adscLen;
+                        adscLen = 0;
+                        CBICommand(adsc, len);
+                        // Without an interrupt endpoint a failed command without data STALLs the request
+                        if(transport == MASS_PROTO_CBI_NO_INT && status && !expected)
+                                return hrSTALL;
+                }
+                return hrSUCCESS;
+        }
+        if(ep != 2)
+                return hrSTALL;
+        if(haltOut)
+                return hrSTALL;
+
+        if(state == BOT_CBW && transport == MASS_PROTO_BBB) {
+                if(len != sizeof(cbw)) {
+                        haltIn = haltOut = true;
+                        return hrSTALL;
+                }
+                memcpy(cbw, buf, sizeof(cbw));
+                Command();
+                return hrSUCCESS;
+        }
+        if(state == BOT_DATA_OUT) {
+                uint32_t n = expected - moved;
+
+                if(n > len)
+                        n = len;
+                Copy((uint8_t*)buf, n, false);
+                moved += n;
+                if(moved == expected)
+                        Finish();
+                return hrSUCCESS;
+        }
+        return hrNAK;
+}
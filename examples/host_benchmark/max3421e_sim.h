@@ -0,0 +1,228 @@
+/* Register level model of the MAX3421E host controller and a Bulk-Only mass storage device behind it.
+ *
+ * The SPI functions of arduino_stub are implemented here, so the unmodified USB and BulkOnly code runs against
+ * the model: every register access goes through SPIClass::transfer() and is counted. A transfer completes in the
+ * same register write that starts it, HXFRDNIRQ is set right away and the host never sees a NAK, so the
+ * benchmarks measure the CPU cost of the driver and the number of SPI operations it needs.
+ */
+#ifndef _MAX3421E_SIM_H_
+#define _MAX3421E_SIM_H_
+
+#include <masstorage.h>
+
+// A USB device function attached to the simulated host controller
+class SimDevice {
+public:
+        // The 8 byte setup packet of a control transfer, the data stage follows on endpoint 0
+        virtual uint8_t Setup(const uint8_t *setup) = 0;
+        // Fill buf with up to max bytes, set *len, return a hr* handshake (hrSUCCESS, hrNAK, hrSTALL)
+        virtual uint8_t In(uint8_t ep, uint8_t *buf, uint8_t max, uint8_t *len) = 0;
+        virtual uint8_t Out(uint8_t ep, const uint8_t *buf, uint8_t len) = 0;
+};
+
+class MAX3421ESim {
+        SimDevice *dev;
+        uint8_t regs[32];
+        uint8_t rcvFifo[64];
+        uint8_t rcvLen;
+        uint8_t rcvPos;
+        uint8_t sndFifo[64];
+        uint8_t sndPos;
+        uint8_t sudFifo[8];
+        uint8_t sudPos;
+        uint8_t cmd; // Command byte of the SPI transaction, 0xFF until it is sent
+
+        void Dispatch(uint8_t hxfr);
+
+public:
+        uint32_t spiTransactions; // Register accesses, one per chip select
+        uint32_t spiBytes; // Bytes moved over SPI, command bytes included
+        uint32_t packets; // USB packets dispatched
+
+        MAX3421ESim() : dev(NULL) {
+                Reset();
+        };
+
+        void Attach(SimDevice *d) {
+                dev = d;
+        };
+
+        void Reset();
+
+        void ResetCounters() {
+                spiTransactions = spiBytes = packets = 0;
+        };
+
+        // SPI side
+        uint8_t Transfer(uint8_t data);
+
+        void EndTransaction() {
+                if(cmd != 0xFF)
+                        spiTransactions++;
+                cmd = 0xFF;
+        };
+};
+
+extern MAX3421ESim Sim;
+
+/* SCSI block device with a RAM disk on the Bulk-Only Transport, one LUN.
+ * Faults can be injected into the next command: a STALL of the data stage, a phase error status, a wrong
+ * residue or a unit attention. With SetTransport() it is a UFI floppy on CBI instead: commands come in ADSC requests, a failed
+ * command STALLs its data stage and the status is read from interrupt endpoint 3. */
+#define SIM_FAULT_NONE          0
+#define SIM_FAULT_STALL         1       // STALL the data stage, the CSW reports failed
+#define SIM_FAULT_PHASE         2       // The data moves, then CSW status 2, the host does a reset recovery
+#define SIM_FAULT_RESIDUE       3       // CSW has a residue that does not match the data moved
+#define SIM_FAULT_SIGNATURE     4       // CSW has a bad signature
+#define SIM_FAULT_ATTENTION     5       // The command fails with UNIT ATTENTION, power on or reset
+
+class SimBOTDisk : public SimDevice {
+        enum {
+                BOT_CBW, BOT_DATA_IN, BOT_DATA_OUT, BOT_CSW
+        } state;
+
+        uint8_t *disk;
+        uint64_t blocks;
+        uint32_t memBlocks; // Blocks backed by RAM, the disk repeats them above
+        uint16_t blockSize;
+
+        uint8_t cbw[31];
+        uint8_t csw[13];
+        uint8_t status;
+        uint32_t expected; // dCBWDataTransferLength
+        uint32_t moved; // Bytes of the data stage done
+
+        // Data stage source or sink: the disk or the small response buffer
+        bool toDisk;
+        uint64_t diskPos; // Byte address on the disk
+        uint32_t dataLen;
+        uint8_t resp[96];
+        uint8_t sense[3]; // Key, ASC, ASCQ of the last error
+
+        bool haltIn;
+        bool haltOut;
+        uint8_t fault;
+        bool media;
+        uint8_t physExp; // 2^n blocks in a physical block
+        uint8_t transport; // MASS_PROTO_*
+        uint8_t adsc[16]; // Command block of an ADSC request, it comes in packets of the control endpoint
+        uint8_t adscLen; // wLength of the request, 0 if none is pending
+        uint8_t adscPos;
+        uint8_t intr[2]; // CBI status, ASC and ASCQ
+
+        // Control transfer
+        uint8_t ctlReply[8];
+        uint8_t ctlLen;
+
+        void Command();
+        void Copy(uint8_t *buf, uint8_t n, bool in);
+        void Finish();
+        void SetSense(uint8_t key, uint8_t asc);
+        bool Range(uint64_t lba, uint32_t count);
+        void CBICommand(const uint8_t *cb, uint8_t len);
+
+public:
+        uint32_t commands;
+        uint32_t unmapped; // Blocks released by UNMAP
+        uint32_t syncs; // SYNCHRONIZE CACHE commands
+        uint32_t writes; // WRITE commands
+
+        SimBOTDisk(uint64_t nblocks, uint16_t block_size, uint32_t mem_blocks = 0);
+        ~SimBOTDisk();
+
+        // Without media every command but INQUIRY and REQUEST SENSE fails with MEDIUM NOT PRESENT
+        void SetMedia(bool present) {
+                media = present;
+        };
+
+        // Reported by READ CAPACITY(16), e.g. 3 for a 512e drive with 4096 byte physical blocks
+        void SetPhysicalBlockExp(uint8_t exp) {
+                physExp = exp;
+        };
+
+        // MASS_PROTO_BBB, MASS_PROTO_CBI or MASS_PROTO_CBI_NO_INT
+        void SetTransport(uint8_t proto) {
+                transport = proto;
+                state = BOT_CBW;
+        };
+
+        uint8_t GetTransport() {
+                return transport;
+        };
+
+        void InjectFault(uint8_t f) {
+                fault = f;
+        };
+
+        uint8_t* GetDisk() {
+                return disk;
+        };
+
+        uint64_t GetBlocks() {
+                return blocks;
+        };
+
+        uint16_t GetBlockSize() {
+                return blockSize;
+        };
+
+        uint8_t Setup(const uint8_t *setup);
+        uint8_t In(uint8_t ep, uint8_t *buf, uint8_t max, uint8_t *len);
+        uint8_t Out(uint8_t ep, const uint8_t *buf, uint8_t len);
+};
+
+/* A BulkOnly driver, or a class derived from it, that is attached to a SimBOTDisk without enumeration:
+ *
+ *      SimDriver<BulkOnly> ms(&Usb);
+ *      ms.Attach(&disk);
+ */
+template <class BOT>
+class SimDriver : public BOT {
+public:
+        SimDriver(USB *p) : BOT(p) {
+        };
+
+        void Attach(SimBOTDisk *disk) {
+                uint8_t addr = this->bAddress;
+
+                Sim.Attach(disk);
+                // Release() clears bAddress before it frees it, so the address is freed here or the pool runs out
+                this->Release();
+                this->pUsb->GetAddressPool().FreeAddress(addr);
+                this->bAddress = this->pUsb->GetAddressPool().AllocAddress(0, false, 1);
+                this->epInfo[1].epAddr = 1; // Bulk IN
+                this->epInfo[1].maxPktSize = 64;
+                this->epInfo[2].epAddr = 2; // Bulk OUT
+                this->epInfo[2].maxPktSize = 64;
+                this->bNumEP = 3;
+                this->bProtocol = disk->GetTransport();
+                if(this->bProtocol == MASS_PROTO_CBI) {
+                        this->epInfo[3].epAddr = 3; // Interrupt IN
+                        this->epInfo[3].maxPktSize = 2;
+                        this->bNumEP = 4;
+                }
+                this->pUsb->setEpInfoEntry(this->bAddress, this->bNumEP, this->epInfo);
+                this->LUNOk[0] = true;
+                this->WriteOk[0] = true;
+                this->CurrentCapacity[0] = disk->GetBlocks();
+                this->CurrentSectorSize[0] = disk->GetBlockSize();
+                this->bPollEnable = true;
+        };
+
+        // Checks the media of the next LUN now, as Poll() does every MASS_POLL_INTERVAL
+        void PollMedia() {
+                this->qNextPollTime = (uint32_t)millis();
+                this->Poll();
+        };
+
+        // As if the media was just inserted: the next poll reads the capacity, with READ CAPACITY(16) if rc16, and
+        // calls OnMediaInserted()
+        void InsertMedia(bool rc16) {
+                this->RC16Ok[0] = rc16;
+                this->LUNOk[0] = false;
+                this->bPollSkip[0] = 0;
+                PollMedia();
+        };
+};
+
+#endif // _MAX3421E_SIM_H_
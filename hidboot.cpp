@@ -129,73 +129,301 @@ void KeyboardReportParser::Parse(USBHID *hid, bool is_rpt_id __attribute__((unus
         if (buf[2] == 1)
                 return;
 
-        //KBDINFO       *pki = (KBDINFO*)buf;
+        uint8_t keys[sizeof (keyState)];
+        uint8_t mod = buf[0];
+
+        memset(keys, 0, sizeof (keys));
+
+        for (uint8_t i = 2; i < 8; i++)
+                SetKey(keys, &mod, buf[i]);
+
+        UpdateKeys(hid, mod, keys);
+
+        for (uint8_t i = 0; i < 8; i++)
+                prevState.bInfo[i] = buf[i];
+};
+
+// Adds a Keyboard page usage to a key set, modifier keys go to the modifier byte
+void KeyboardReportParser::SetKey(uint8_t *keys, uint8_t *mod, uint16_t usage) {
+        if (usage >= 0xE0 && usage <= 0xE7)
+                *mod |= (1 << (usage - 0xE0));
+        else if (usage > 3 && usage <= 0xFF) // 1 to 3 are error codes
+                keys[usage >> 3] |= (1 << (usage & 7));
+}
+
+/* Raises the events for the difference between the keys that are down and a new key set.
+   Only the bytes of the set that changed are looked at, so the cost does not depend on the number of keys down */
+void KeyboardReportParser::UpdateKeys(USBHID *hid, uint8_t mod, const uint8_t *keys) {
+        uint8_t old_mod = prevState.bInfo[0x00];
 
         // provide event for changed control key state
-        if (prevState.bInfo[0x00] != buf[0x00]) {
-                OnControlKeysChanged(prevState.bInfo[0x00], buf[0x00]);
-        }
+        if (old_mod != mod)
+                OnControlKeysChanged(old_mod, mod);
 
-        for (uint8_t i = 2; i < 8; i++) {
-                bool down = false;
-                bool up = false;
+        for (uint8_t i = 0; i < sizeof (keyState); i++) {
+                uint8_t changed = keyState[i] ^ keys[i];
 
-                for (uint8_t j = 2; j < 8; j++) {
-                        if (buf[i] == prevState.bInfo[j] && buf[i] != 1)
-                                down = true;
-                        if (buf[j] == prevState.bInfo[i] && prevState.bInfo[i] != 1)
-                                up = true;
+                if (!changed)
+                        continue;
+
+                for (uint8_t bit = 0; bit < 8; bit++) {
+                        if (!(changed & (1 << bit)))
+                                continue;
+
+                        uint8_t key = (i << 3) | bit;
+
+                        if (keys[i] & (1 << bit)) {
+                                HandleLockingKeys(hid, key);
+                                OnKeyDown(mod, key);
+                        } else
+                                OnKeyUp(old_mod, key);
                 }
-                if (!down) {
-                        HandleLockingKeys(hid, buf[i]);
-                        OnKeyDown(*buf, buf[i]);
+                keyState[i] = keys[i];
+        }
+        prevState.bInfo[0x00] = mod;
+}
+
+void NKROKeyboardReportParser::Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf) {
+        if (hid && hid->GetAddress() != bAddress)
+                Reset();
+        // A failed read of the descriptor is tried again on the next reports, the boot report is used meanwhile
+        if (hid && !bCompiled && bCompileTries < HID_LAYOUT_COMPILE_TRIES) {
+                bAddress = hid->GetAddress();
+                if (layout.Compile(hid, bIface))
+                        bCompileTries++;
+                else
+                        bCompiled = true;
+        }
+
+        if (!layout.GetNumFields()) {
+                if (len >= 8)
+                        KeyboardReportParser::Parse(hid, is_rpt_id, len, buf);
+                return;
+        }
+
+        uint8_t id = 0;
+
+        if (layout.HasReportIds()) {
+                if (!len)
+                        return;
+                id = *buf++;
+                len--;
+        }
+
+        uint8_t keys[sizeof (keyState)];
+        uint8_t mod = 0;
+        bool found = false;
+
+        memset(keys, 0, sizeof (keys));
+
+        for (uint8_t i = 0; i < layout.GetNumFields(); i++) {
+                const HID_REPORT_FIELD *pf = layout.GetField(i);
+
+                if (pf->reportId != id || pf->reportType != HID_REPORT_TYPE_INPUT || pf->usagePage != HID_USAGE_PAGE_KEYBOARD)
+                        continue;
+
+                found = true;
+
+                if (!(pf->flags & HID_FIELD_VARIABLE)) {
+                        // Array of key codes, like the boot report
+                        for (uint8_t j = 0; j < pf->count; j++) {
+                                uint16_t usage = HIDReportLayout::GetArrayUsage(pf, HIDReportLayout::GetElement(pf, buf, len, j));
+
+                                if (usage == 1) // Too many keys down
+                                        return;
+                                SetKey(keys, &mod, usage);
+                        }
+                } else if (pf->size == 1) {
+                        // Bitmap, read eight keys at a time
+                        for (uint8_t j = 0; j < pf->count; j += 8) {
+                                uint8_t n = (pf->count - j < 8) ? pf->count - j : 8;
+                                uint8_t bits = (uint8_t)HIDReportLayout::GetBits(buf, len, pf->offset + j, n);
+
+                                for (uint8_t k = 0; bits; k++, bits >>= 1)
+                                        if (bits & 1)
+                                                SetKey(keys, &mod, HIDReportLayout::GetElementUsage(pf, j + k));
+                        }
+                } else {
+                        for (uint8_t j = 0; j < pf->count; j++)
+                                if (HIDReportLayout::GetElement(pf, buf, len, j))
+                                        SetKey(keys, &mod, HIDReportLayout::GetElementUsage(pf, j));
                 }
-                if (!up)
-                        OnKeyUp(prevState.bInfo[0], prevState.bInfo[i]);
         }
-        for (uint8_t i = 0; i < 8; i++)
-                prevState.bInfo[i] = buf[i];
-};
+
+        if (found)
+                UpdateKeys(hid, mod, keys);
+}
+
+HIDMouseReportParser::HIDMouseReportParser() :
+bReportId(0),
+bIface(0),
+bAddress(0),
+bCompiled(false),
+bCompileTries(0),
+bChanged(false) {
+        memset(&motion, 0, sizeof (motion));
+}
+
+void HIDMouseReportParser::Resolve(MouseUsage *pu, uint16_t page, uint16_t usage) {
+        const HID_REPORT_FIELD *pf = layout.FindField(HID_REPORT_TYPE_INPUT, page, usage, &pu->index);
+
+        // Only variable fields of the report that carries X
+        if(pf && (pf->flags & HID_FIELD_VARIABLE) && pf->reportId == bReportId)
+                pu->field = (uint8_t)(pf - layout.GetField(0));
+        else
+                pu->field = HID_NO_FIELD;
+}
+
+int32_t HIDMouseReportParser::GetUsageValue(const MouseUsage *pu, const uint8_t *buf, uint8_t len) {
+        return (pu->field == HID_NO_FIELD) ? 0 : HIDReportLayout::GetElement(layout.GetField(pu->field), buf, len, pu->index);
+}
+
+void HIDMouseReportParser::Parse(USBHID *hid, bool is_rpt_id __attribute__((unused)), uint8_t len, uint8_t *buf) {
+        if(hid && hid->GetAddress() != bAddress)
+                Reset();
+        // A failed read of the descriptor is tried again on the next reports, boot reports are read meanwhile
+        if(hid && !bCompiled && bCompileTries < HID_LAYOUT_COMPILE_TRIES) {
+                bAddress = hid->GetAddress();
+                if(layout.Compile(hid, bIface))
+                        bCompileTries++;
+                else
+                        bCompiled = true;
+
+                const HID_REPORT_FIELD *pf = layout.FindField(HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_GENERIC_DESKTOP, 0x30, NULL);
+
+                bReportId = (pf) ? pf->reportId : 0;
+                Resolve(&axes[AXIS_X], HID_USAGE_PAGE_GENERIC_DESKTOP, 0x30);
+                Resolve(&axes[AXIS_Y], HID_USAGE_PAGE_GENERIC_DESKTOP, 0x31);
+                Resolve(&axes[AXIS_WHEEL], HID_USAGE_PAGE_GENERIC_DESKTOP, 0x38);
+                Resolve(&axes[AXIS_PAN], HID_USAGE_PAGE_CONSUMER, 0x238);
+
+                for(uint8_t i = 0; i < HID_MOUSE_MAX_BUTTONS; i++)
+                        Resolve(&buttons[i], HID_USAGE_PAGE_BUTTON, i + 1);
+        }
+
+        // A mouse switched to the boot protocol, e.g. by HIDBoot, sends boot reports shorter than its descriptor says
+        if(axes[AXIS_X].field == HID_NO_FIELD || (!layout.HasReportIds() && len < layout.GetReportLength(0, HID_REPORT_TYPE_INPUT))) {
+                if(len >= 3)
+                        Update(buf[0], (int8_t)buf[1], (int8_t)buf[2], (len > 3) ? (int8_t)buf[3] : 0, 0);
+                return;
+        }
+
+        if(layout.HasReportIds()) {
+                if(!len || *buf != bReportId)
+                        return;
+                buf++;
+                len--;
+        }
+
+        uint8_t btns = 0;
+
+        for(uint8_t i = 0; i < HID_MOUSE_MAX_BUTTONS; i++)
+                if(GetUsageValue(&buttons[i], buf, len))
+                        btns |= (1 << i);
+
+        Update(btns, GetUsageValue(&axes[AXIS_X], buf, len), GetUsageValue(&axes[AXIS_Y], buf, len),
+                (int16_t)GetUsageValue(&axes[AXIS_WHEEL], buf, len), (int16_t)GetUsageValue(&axes[AXIS_PAN], buf, len));
+}
+
+void HIDMouseReportParser::Update(uint8_t btns, int32_t dx, int32_t dy, int16_t wheel, int16_t pan) {
+        if(btns != motion.buttons) {
+                uint8_t before = motion.buttons;
+
+                motion.buttons = btns;
+                bChanged = true;
+                OnButtonsChanged(before, btns);
+        }
+
+        if(dx || dy) {
+                motion.dX += dx;
+                motion.dY += dy;
+                bChanged = true;
+                OnMouseMove(dx, dy);
+        }
+
+        if(wheel || pan) {
+                motion.wheel += wheel;
+                motion.pan += pan;
+                bChanged = true;
+                OnWheel(wheel, pan);
+        }
+}
+
+/* Copies the motion since the last call and clears it. Returns false if the mouse did not move and no button changed */
+bool HIDMouseReportParser::ReadMotion(HID_MOUSE_MOTION *pm) {
+        bool changed = bChanged;
+
+        *pm = motion;
+        motion.dX = motion.dY = 0;
+        motion.wheel = motion.pan = 0;
+        bChanged = false;
+        return changed;
+}
+
+/* Looks the key up in the keymap. Returns the character, with HID_KEY_DEAD set for a dead key, or 0 if the key
+   has no character. Right Alt or Ctrl with left Alt select the AltGr row */
+uint16_t KeyboardReportParser::OemToUnicode(uint8_t mod, uint8_t key) {
+        uint8_t index;
+
+        if (VALUE_WITHIN(key, 0x04, 0x38))
+                index = key - 0x04;
+        else if (VALUE_WITHIN(key, 0x54, 0x64)) {
+                // Keypad numbers and the decimal key only type with Num Lock on
+                if (VALUE_WITHIN(key, 0x59, 0x63) && kbdLockingKeys.kbdLeds.bmNumLock == 0)
+                        return 0;
+                index = key - 0x54 + (0x38 - 0x04 + 1);
+        } else
+                return 0;
+
+        uint8_t row = (mod & 0x22) ? 1 : 0;
+
+        if ((mod & 0x40) || (mod & 0x05) == 0x05)
+                row |= 2;
+
+        uint16_t c = pgm_read_word(&pKeymap[row * HID_KEYMAP_KEYS + index]);
+
+        if ((c & HID_KEY_CAPS) && kbdLockingKeys.kbdLeds.bmCapsLock == 1)
+                c = pgm_read_word(&pKeymap[(row ^ 1) * HID_KEYMAP_KEYS + index]);
+
+        return c & ~HID_KEY_CAPS;
+}
 
 const uint8_t KeyboardReportParser::numKeys[10] PROGMEM = {'!', '@', '#', '$', '%', '^', '&', '*', '(', ')'};
 const uint8_t KeyboardReportParser::symKeysUp[12] PROGMEM = {'_', '+', '{', '}', '|', '~', ':', '"', '~', '<', '>', '?'};
 const uint8_t KeyboardReportParser::symKeysLo[12] PROGMEM = {'-', '=', '[', ']', '\\', ' ', ';', '\'', '`', ',', '.', '/'};
 const uint8_t KeyboardReportParser::padKeys[5] PROGMEM = {'/', '*', '-', '+', 0x13};
 
+// ASCII character of the key, 0 for keys without one and for dead keys
 uint8_t KeyboardReportParser::OemToAscii(uint8_t mod, uint8_t key) {
-        uint8_t shift = (mod & 0x22);
+        uint16_t c = OemToUnicode(mod, key);
 
-        // [a-z]
-        if (VALUE_WITHIN(key, 0x04, 0x1d)) {
-                // Upper case letters
-                if ((kbdLockingKeys.kbdLeds.bmCapsLock == 0 && shift) ||
-                        (kbdLockingKeys.kbdLeds.bmCapsLock == 1 && shift == 0))
-                        return (key - 4 + 'A');
+        return (c < 0x80) ? (uint8_t)c : 0;
+}
 
-                        // Lower case letters
-                else
-                        return (key - 4 + 'a');
-        }// Numbers
-        else if (VALUE_WITHIN(key, 0x1e, 0x27)) {
-                if (shift)
-                        return ((uint8_t)pgm_read_byte(&getNumKeys()[key - 0x1e]));
+/* Writes the UTF-8 text typed by the key to str and returns its length, str needs room for 7 bytes.
+   A dead key types nothing, it is combined with the next key. If the two do not combine both are typed */
+uint8_t KeyboardReportParser::OemToUtf8(uint8_t mod, uint8_t key, char *str) {
+        uint16_t c = OemToUnicode(mod, key);
+        uint8_t n = 0;
+
+        if (c && deadKey) {
+                uint16_t composed = (c & HID_KEY_DEAD) ? 0 : HIDComposeDeadKey(deadKey, c);
+
+                if (composed)
+                        c = composed;
+                else if (c == ' ')
+                        c = deadKey; // Dead key and space type the accent itself
                 else
-                        return ((key == UHS_HID_BOOT_KEY_ZERO) ? '0' : key - 0x1e + '1');
-        }// Keypad Numbers
-        else if(VALUE_WITHIN(key, 0x59, 0x61)) {
-                if(kbdLockingKeys.kbdLeds.bmNumLock == 1)
-                        return (key - 0x59 + '1');
-        } else if(VALUE_WITHIN(key, 0x2d, 0x38))
-                return ((shift) ? (uint8_t)pgm_read_byte(&getSymKeysUp()[key - 0x2d]) : (uint8_t)pgm_read_byte(&getSymKeysLo()[key - 0x2d]));
-        else if(VALUE_WITHIN(key, 0x54, 0x58))
-                return (uint8_t)pgm_read_byte(&getPadKeys()[key - 0x54]);
-        else {
-                switch(key) {
-                        case UHS_HID_BOOT_KEY_SPACE: return (0x20);
-                        case UHS_HID_BOOT_KEY_ENTER: return (0x13);
-                        case UHS_HID_BOOT_KEY_ZERO2: return ((kbdLockingKeys.kbdLeds.bmNumLock == 1) ? '0': 0);
-                        case UHS_HID_BOOT_KEY_PERIOD: return ((kbdLockingKeys.kbdLeds.bmNumLock == 1) ? '.': 0);
-                }
+                        n = HIDEncodeUtf8(deadKey, str);
+
+                deadKey = 0;
         }
-        return ( 0);
+
+        if (c & HID_KEY_DEAD)
+                deadKey = c & HID_KEY_CHAR;
+        else if (c)
+                n += HIDEncodeUtf8(c, str + n);
+
+        str[n] = 0;
+        return n;
 }
@@ -18,6 +18,8 @@ e-mail   :  support@circuitsathome.com
 #define __HIDBOOT_H__
 
 #include "usbhid.h"
+#include "hidreportlayout.h"
+#include "hidkeymaps.h"
 
 #define UHS_HID_BOOT_KEY_ZERO           0x27
 #define UHS_HID_BOOT_KEY_ENTER          0x28
@@ -119,6 +121,9 @@ struct KBDLEDS {
 };
 
 class KeyboardReportParser : public HIDReportParser {
+        const uint16_t *pKeymap; // HID_KEYMAP_SIZE words in PROGMEM, see hidkeymaps.h
+        uint16_t deadKey; // Dead key waiting for the next key, 0 if none
+
         static const uint8_t numKeys[10];
         static const uint8_t symKeysUp[12];
         static const uint8_t symKeysLo[12];
@@ -136,16 +141,34 @@ protected:
                 uint8_t bLeds;
         } kbdLockingKeys;
 
+        uint8_t keyState[32]; // Keys that are down, bit n is usage n of the Keyboard page. Modifiers are in prevState
+
+        uint16_t OemToUnicode(uint8_t mod, uint8_t key);
         uint8_t OemToAscii(uint8_t mod, uint8_t key);
+        uint8_t OemToUtf8(uint8_t mod, uint8_t key, char *str);
+        void UpdateKeys(USBHID *hid, uint8_t mod, const uint8_t *keys);
+
+        static void SetKey(uint8_t *keys, uint8_t *mod, uint16_t usage);
 
 public:
 
-        KeyboardReportParser() {
+        KeyboardReportParser() : pKeymap(HID_DEFAULT_KEYMAP), deadKey(0) {
                 kbdLockingKeys.bLeds = 0;
+
+                for(uint8_t i = 0; i < sizeof (prevState); i++)
+                        prevState.bInfo[i] = 0;
+                for(uint8_t i = 0; i < sizeof (keyState); i++)
+                        keyState[i] = 0;
         };
 
         void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
 
+        // Layout used to translate keys, e.g. HIDKeymapDE
+        void SetKeymap(const uint16_t *keymap) {
+                pKeymap = keymap;
+                deadKey = 0;
+        };
+
 protected:
 
         virtual uint8_t HandleLockingKeys(USBHID* hid, uint8_t key) {
@@ -180,6 +203,8 @@ protected:
         virtual void OnKeyUp(uint8_t mod __attribute__((unused)), uint8_t key __attribute__((unused))) {
         };
 
+        // Deprecated: the US tables used by OemToAscii() before keymaps were added. They are kept for
+        // derived classes, but overriding them no longer changes the translation, use SetKeymap() instead
         virtual const uint8_t *getNumKeys() {
                 return numKeys;
         };
@@ -197,6 +222,121 @@ protected:
         };
 };
 
+/*
+ * Keyboard parser for report protocol keyboards, including N-key rollover keyboards that send a bitmap of
+ * all keys instead of the six key array of the boot report. The report descriptor is compiled on the first
+ * report. Reports without Keyboard page fields, e.g. the media keys of the same interface, are ignored.
+ * If the descriptor can not be read the reports are parsed as boot reports.
+ */
+class NKROKeyboardReportParser : public KeyboardReportParser {
+        HIDReportLayoutT<> layout;
+        uint8_t bIface; // Interface to read the report descriptor from
+        uint8_t bAddress; // Address of the device the layout was compiled for
+        bool bCompiled;
+        uint8_t bCompileTries; // Failed reads of the report descriptor
+
+public:
+        NKROKeyboardReportParser() : bIface(0), bAddress(0), bCompiled(false), bCompileTries(0) {
+        };
+
+        void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+
+        void SetInterface(uint8_t iface) {
+                bIface = iface;
+                Reset();
+        };
+
+        // Compile the report descriptor again on the next report
+        void Reset() {
+                bCompiled = false;
+                bCompileTries = 0;
+        };
+};
+
+#define HID_MOUSE_MAX_BUTTONS           8
+
+// Motion of a HIDMouseReportParser, summed over the reports since it was last read
+typedef struct {
+        int32_t dX;
+        int32_t dY;
+        int16_t wheel; // Vertical wheel, positive is away from the user
+        int16_t pan; // Horizontal wheel (AC Pan), positive is to the right
+        uint8_t buttons; // Bit 0 is the primary button. Current state, not summed
+} HID_MOUSE_MOTION;
+
+/*
+ * Mouse parser for report protocol mice: 16-bit X and Y, vertical and horizontal wheel and up to 8 buttons.
+ * Use it with HIDUniversal, which leaves the mouse in the report protocol. The report descriptor is compiled
+ * on the first report. Without a descriptor the reports are read as boot reports, with the wheel in the fourth byte.
+ *
+ * Motion is summed between calls to ReadMotion(), so an application running slower than the mouse reports
+ * takes one delta per frame and nothing saturates at +-127. The parser asks HIDUniversal to pass on repeated
+ * reports, so no motion is lost as long as Poll() keeps up with the mouse. The On... callbacks are called for every report.
+ */
+class HIDMouseReportParser : public HIDReportParser {
+        enum {
+                AXIS_X, AXIS_Y, AXIS_WHEEL, AXIS_PAN, NUM_AXES
+        };
+
+        struct MouseUsage {
+                uint8_t field; // HID_NO_FIELD if the mouse does not have it
+                uint8_t index;
+        };
+
+        HIDReportLayoutT<> layout;
+        MouseUsage axes[NUM_AXES];
+        MouseUsage buttons[HID_MOUSE_MAX_BUTTONS];
+        uint8_t bReportId; // Report ID of the X axis
+        uint8_t bIface;
+        uint8_t bAddress;
+        bool bCompiled;
+        uint8_t bCompileTries; // Failed reads of the report descriptor
+
+        HID_MOUSE_MOTION motion;
+        bool bChanged; // Motion or buttons changed since the last ReadMotion()
+
+        void Resolve(MouseUsage *pu, uint16_t page, uint16_t usage);
+        int32_t GetUsageValue(const MouseUsage *pu, const uint8_t *buf, uint8_t len);
+        void Update(uint8_t btns, int32_t dx, int32_t dy, int16_t wheel, int16_t pan);
+
+protected:
+        virtual void OnMouseMove(int32_t dX __attribute__((unused)), int32_t dY __attribute__((unused))) {
+        };
+
+        virtual void OnWheel(int16_t wheel __attribute__((unused)), int16_t pan __attribute__((unused))) {
+        };
+
+        virtual void OnButtonsChanged(uint8_t before __attribute__((unused)), uint8_t after __attribute__((unused))) {
+        };
+
+public:
+        HIDMouseReportParser();
+
+        void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+
+        bool ReadMotion(HID_MOUSE_MOTION *pm);
+
+        // Two reports with the same motion are two moves, the driver must not drop the second one
+        bool WantsRepeatedReports() {
+                return true;
+        };
+
+        uint8_t GetButtons() {
+                return motion.buttons;
+        };
+
+        void SetInterface(uint8_t iface) {
+                bIface = iface;
+                Reset();
+        };
+
+        // Compile the report descriptor again on the next report
+        void Reset() {
+                bCompiled = false;
+                bCompileTries = 0;
+        };
+};
+
 template <const uint8_t BOOT_PROTOCOL>
 class HIDBoot : public USBHID //public USBDeviceConfig, public UsbConfigXtracter
 {
@@ -207,9 +347,9 @@ class HIDBoot : public USBHID //public USBDeviceConfig, public UsbConfigXtracter
         uint8_t bIfaceNum; // Interface Number
         uint8_t bNumIface; // number of interfaces in the configuration
         uint8_t bNumEP; // total number of EP in the configuration
-        uint32_t qNextPollTime; // next poll time
+        uint32_t qNextPollTimes[epMUL(BOOT_PROTOCOL)]; // next poll time of each interrupt IN endpoint
+        uint8_t bIntervals[epMUL(BOOT_PROTOCOL)]; // bInterval of each interrupt IN endpoint
         bool bPollEnable; // poll enable flag
-        uint8_t bInterval; // largest interval
         bool bRptProtoEnable; // Report Protocol enable flag
 
         void Initialize();
@@ -255,13 +395,14 @@ public:
 template <const uint8_t BOOT_PROTOCOL>
 HIDBoot<BOOT_PROTOCOL>::HIDBoot(USB *p, bool bRptProtoEnable/* = false*/) :
 USBHID(p),
-qNextPollTime(0),
 bPollEnable(false),
 bRptProtoEnable(bRptProtoEnable) {
         Initialize();
 
         for(int i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
                 pRptParser[i] = NULL;
+                qNextPollTimes[i] = 0;
+                bIntervals[i] = 0;
         }
         if(pUsb)
                 pUsb->RegisterDeviceClass(this);
@@ -305,7 +446,9 @@ uint8_t HIDBoot<BOOT_PROTOCOL>::Init(uint8_t parent, uint8_t port, bool lowspeed
         if(bAddress)
                 return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
 
-        bInterval = 0;
+        for(uint8_t i = 0; i < epMUL(BOOT_PROTOCOL); i++)
+                bIntervals[i] = 0;
+
         // Get pointer to pseudo device with address 0 assigned
         p = addrPool.GetUsbDevicePtr(0);
 
@@ -547,7 +690,7 @@ void HIDBoot<BOOT_PROTOCOL>::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t
         bIfaceNum = iface;
 
         if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_INTERRUPT && (pep->bEndpointAddress & 0x80) == 0x80) {
-                if(pep->bInterval > bInterval) bInterval = pep->bInterval;
+                bIntervals[bNumEP - 1] = pep->bInterval;
 
                 // Fill in the endpoint info structure
                 epInfo[bNumEP].epAddr = (pep->bEndpointAddress & 0x0F);
@@ -563,14 +706,20 @@ void HIDBoot<BOOT_PROTOCOL>::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t
 template <const uint8_t BOOT_PROTOCOL>
 uint8_t HIDBoot<BOOT_PROTOCOL>::Release() {
         pUsb->GetAddressPool().FreeAddress(bAddress);
+        ClearOutputQueue();
 
         bConfNum = 0;
         bIfaceNum = 0;
         bNumEP = 1;
         bAddress = 0;
-        qNextPollTime = 0;
         bPollEnable = false;
 
+        for(uint8_t i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
+                qNextPollTimes[i] = 0;
+                if(pRptParser[i])
+                        pRptParser[i]->Reset();
+        }
+
         return 0;
 }
 
@@ -578,10 +727,15 @@ template <const uint8_t BOOT_PROTOCOL>
 uint8_t HIDBoot<BOOT_PROTOCOL>::Poll() {
         uint8_t rcode = 0;
 
-        if(bPollEnable && ((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L)) {
+        if(bPollEnable) {
 
-                // To-do: optimize manually, using the for loop only if needed.
+                // Each interrupt IN endpoint is polled at its own interval
                 for(int i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
+                        if((int32_t)((uint32_t)millis() - qNextPollTimes[i]) < 0L)
+                                continue;
+
+                        qNextPollTimes[i] = (uint32_t)millis() + GetPollInterval(bIntervals[i]);
+
                         const uint16_t const_buff_len = 16;
                         uint8_t buf[const_buff_len];
 
@@ -594,6 +748,7 @@ uint8_t HIDBoot<BOOT_PROTOCOL>::Poll() {
                         // SOME buggy dongles report extra keys (like sleep) using a 2 byte packet on the wrong endpoint.
                         // Since keyboard and mice must report at least 3 bytes, we ignore the extra data.
                         if(!rcode && read > 2) {
+                                StampReport();
                                 if(pRptParser[i])
                                         pRptParser[i]->Parse((USBHID*)this, 0, (uint8_t)read, buf);
 #ifdef DEBUG_USB_HOST
@@ -619,7 +774,11 @@ uint8_t HIDBoot<BOOT_PROTOCOL>::Poll() {
                         }
 
                 }
-                qNextPollTime = (uint32_t)millis() + bInterval;
+
+                uint8_t ret = SendQueuedReports();
+
+                if(ret && (!rcode || rcode == hrNAK))
+                        rcode = ret;
         }
         return rcode;
 }
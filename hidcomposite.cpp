@@ -19,8 +19,6 @@ e-mail   :  support@circuitsathome.com
 
 HIDComposite::HIDComposite(USB *p) :
 USBHID(p),
-qNextPollTime(0),
-pollInterval(0),
 bPollEnable(false),
 bHasReportId(false) {
         Initialize();
@@ -52,8 +50,10 @@ void HIDComposite::Initialize() {
         for(uint8_t i = 0; i < maxHidInterfaces; i++) {
                 hidInterfaces[i].bmInterface = 0;
                 hidInterfaces[i].bmProtocol = 0;
+                hidInterfaces[i].pollInterval = 0;
+                hidInterfaces[i].qNextPollTime = 0;
 
-                for(uint8_t j = 0; j < maxEpPerInterface; j++)
+                for(uint8_t j = 0; j <= maxEpPerInterface; j++)
                         hidInterfaces[i].epIndex[j] = 0;
         }
         for(uint8_t i = 0; i < totalEndpoints; i++) {
@@ -66,7 +66,6 @@ void HIDComposite::Initialize() {
         bNumEP = 1;
         bNumIface = 0;
         bConfNum = 0;
-        pollInterval = 0;
 }
 
 bool HIDComposite::SetReportParser(uint8_t id, HIDReportParser *prs) {
@@ -306,10 +305,17 @@ void HIDComposite::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
 
         // Fill in interface structure in case of new interface
         if(!piface) {
+                if(bNumIface >= maxHidInterfaces)
+                        return;
+
                 piface = hidInterfaces + bNumIface;
                 piface->bmInterface = iface;
                 piface->bmAltSet = alt;
                 piface->bmProtocol = proto;
+                piface->pollInterval = 0;
+                piface->qNextPollTime = 0;
+                piface->epIndex[epInterruptInIndex] = 0;
+                piface->epIndex[epInterruptOutIndex] = 0;
                 bNumIface++;
         }
 
@@ -330,8 +336,8 @@ void HIDComposite::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
                 // Fill in the endpoint index list
                 piface->epIndex[index] = bNumEP; //(pep->bEndpointAddress & 0x0F);
 
-                if(pollInterval < pep->bInterval) // Set the polling interval as the largest polling interval obtained from endpoints
-                        pollInterval = pep->bInterval;
+                if(index == epInterruptInIndex) // Each IN endpoint is polled at its own interval
+                        piface->pollInterval = pep->bInterval;
 
                 bNumEP++;
         }
@@ -339,10 +345,15 @@ void HIDComposite::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
 
 uint8_t HIDComposite::Release() {
         pUsb->GetAddressPool().FreeAddress(bAddress);
+        ClearOutputQueue();
+
+        for(uint8_t i = 0; i < MAX_REPORT_PARSERS; i++)
+                if(rptParsers[i].rptParser)
+                        rptParsers[i].rptParser->Reset();
 
         bNumEP = 1;
+        bNumIface = 0;
         bAddress = 0;
-        qNextPollTime = 0;
         bPollEnable = false;
         return 0;
 }
@@ -358,58 +369,81 @@ uint8_t HIDComposite::Poll() {
         if(!bPollEnable)
                 return 0;
 
-        if((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L) {
-                qNextPollTime = (uint32_t)millis() + pollInterval;
+        uint8_t buf[constBuffLen];
 
-                uint8_t buf[constBuffLen];
+        // Every interface has its own deadline from the bInterval of its IN endpoint
+        for(uint8_t i = 0; i < bNumIface; i++) {
+                HIDInterface *piface = hidInterfaces + i;
+                uint8_t index = piface->epIndex[epInterruptInIndex];
 
-                for(uint8_t i = 0; i < bNumIface; i++) {
-                        uint8_t index = hidInterfaces[i].epIndex[epInterruptInIndex];
+                if(index == 0 || (int32_t)((uint32_t)millis() - piface->qNextPollTime) < 0L)
+                        continue;
 
-                        if (index == 0)
-                            continue;
+                piface->qNextPollTime = (uint32_t)millis() + GetPollInterval(piface->pollInterval);
 
-                        uint16_t read = (uint16_t)epInfo[index].maxPktSize;
+                uint16_t read = (uint16_t)epInfo[index].maxPktSize;
 
-                        ZeroMemory(constBuffLen, buf);
+                ZeroMemory(constBuffLen, buf);
 
-                        uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[index].epAddr, &read, buf);
+                uint8_t ret = pUsb->inTransfer(bAddress, epInfo[index].epAddr, &read, buf);
 
-                        if(rcode) {
-                                if(rcode != hrNAK)
-                                        USBTRACE3("(hidcomposite.h) Poll:", rcode, 0x81);
-                                continue;
+                if(ret) {
+                        if(ret != hrNAK) {
+                                USBTRACE3("(hidcomposite.h) Poll:", ret, 0x81);
+                                if(!rcode)
+                                        rcode = ret;
                         }
+                        continue;
+                }
 
-                        if(read == 0)
-                            continue;
+                if(read == 0)
+                        continue;
 
-                        if(read > constBuffLen)
-                                read = constBuffLen;
+                if(read > constBuffLen)
+                        read = constBuffLen;
+
+                StampReport();
 
 #if 0
-                        Notify(PSTR("\r\nBuf: "), 0x80);
+                Notify(PSTR("\r\nBuf: "), 0x80);
 
-                        for(uint8_t i = 0; i < read; i++) {
-                                D_PrintHex<uint8_t > (buf[i], 0x80);
-                                Notify(PSTR(" "), 0x80);
-                        }
+                for(uint8_t i = 0; i < read; i++) {
+                        D_PrintHex<uint8_t > (buf[i], 0x80);
+                        Notify(PSTR(" "), 0x80);
+                }
 
-                        Notify(PSTR("\r\n"), 0x80);
+                Notify(PSTR("\r\n"), 0x80);
 #endif
-                        ParseHIDData(this, epInfo[index].epAddr, bHasReportId, (uint8_t)read, buf);
-
-                        HIDReportParser *prs = GetReportParser(((bHasReportId) ? *buf : 0));
+                ParseHIDData(this, epInfo[index].epAddr, bHasReportId, (uint8_t)read, buf);
 
-                        if(prs)
-                                prs->Parse(this, bHasReportId, (uint8_t)read, buf);
-                    }
+                HIDReportParser *prs = GetReportParser(((bHasReportId) ? *buf : 0));
 
+                if(prs)
+                        prs->Parse(this, bHasReportId, (uint8_t)read, buf);
         }
+        uint8_t ret = SendQueuedReports();
+
+        if(!rcode)
+                rcode = ret;
+
         return rcode;
 }
 
-// Send a report to interrupt out endpoint. This is NOT SetReport() request!
+// Send a report to the interrupt OUT endpoint of the first interface, or with SET_REPORT if it has none.
+// With report IDs the first byte of the report is the ID
 uint8_t HIDComposite::SndRpt(uint16_t nbytes, uint8_t *dataptr) {
-        return pUsb->outTransfer(bAddress, epInfo[epInterruptOutIndex].epAddr, nbytes, dataptr);
+        if(!bNumIface)
+                return USB_ERROR_EP_NOT_FOUND_IN_TBL;
+        return SendOutputReport(hidInterfaces[0].bmInterface, (bHasReportId && nbytes) ? dataptr[0] : 0, nbytes, dataptr);
+}
+
+// Uses the interrupt OUT endpoint of the interface if it has one, SET_REPORT otherwise
+uint8_t HIDComposite::SendOutputReport(uint8_t iface, uint8_t report_id, uint16_t nbytes, uint8_t *data) {
+        for(uint8_t i = 0; i < bNumIface; i++) {
+                uint8_t index = hidInterfaces[i].epIndex[epInterruptOutIndex];
+
+                if(hidInterfaces[i].bmInterface == iface && index)
+                        return pUsb->outTransfer(bAddress, epInfo[index].epAddr, nbytes, data);
+        }
+        return USBHID::SendOutputReport(iface, report_id, nbytes, data);
 }
@@ -40,14 +40,14 @@ class HIDComposite : public USBHID {
                         uint8_t bmAltSet : 3;
                         uint8_t bmProtocol : 2;
                 };
-                uint8_t epIndex[maxEpPerInterface];
+                uint8_t epIndex[maxEpPerInterface + 1]; // Indexed by epInterruptInIndex and epInterruptOutIndex
+                uint8_t pollInterval; // bInterval of the interrupt IN endpoint
+                uint32_t qNextPollTime; // next poll time
         };
 
         uint8_t bConfNum; // configuration number
         uint8_t bNumIface; // number of interfaces in the configuration
         uint8_t bNumEP; // total number of EP in the configuration
-        uint32_t qNextPollTime; // next poll time
-        uint8_t pollInterval;
         bool bPollEnable; // poll enable flag
 
         static const uint16_t constBuffLen = 64; // event buffer length
@@ -98,9 +98,11 @@ public:
         // UsbConfigXtracter implementation
         void EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
 
-        // Send report - do not mix with SetReport()!
+        // Send an output report on the first interface, over the interrupt OUT endpoint if it has one
         uint8_t SndRpt(uint16_t nbytes, uint8_t *dataptr);
 
+        uint8_t SendOutputReport(uint8_t iface, uint8_t report_id, uint16_t nbytes, uint8_t *data);
+
         // Returns true if we should listen on an interface, false if not
         virtual bool SelectInterface(uint8_t iface, uint8_t proto) = 0;
 };
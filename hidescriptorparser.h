@@ -18,6 +18,7 @@ e-mail   :  support@circuitsathome.com
 #define __HIDDESCRIPTORPARSER_H__
 
 #include "usbhid.h"
+#include "hidreportlayout.h"
 
 class ReportDescParserBase : public USBReadParser {
 public:
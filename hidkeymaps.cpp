@@ -0,0 +1,253 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "hidkeymaps.h"
+
+// Maintained by hand, see hidkeymaps.h for the format
+
+// US English
+const uint16_t HIDKeymapUS[HID_KEYMAP_SIZE] PROGMEM = {
+        // No modifier
+        /* 0x04 */ 0x4061, 0x4062, 0x4063, 0x4064, 0x4065, 0x4066, 0x4067, 0x4068,
+        /* 0x0C */ 0x4069, 0x406A, 0x406B, 0x406C, 0x406D, 0x406E, 0x406F, 0x4070,
+        /* 0x14 */ 0x4071, 0x4072, 0x4073, 0x4074, 0x4075, 0x4076, 0x4077, 0x4078,
+        /* 0x1C */ 0x4079, 0x407A, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036,
+        /* 0x24 */ 0x0037, 0x0038, 0x0039, 0x0030, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x002D, 0x003D, 0x005B, 0x005D, 0x005C, 0x0023, 0x003B,
+        /* 0x34 */ 0x0027, 0x0060, 0x002C, 0x002E, 0x002F,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x005C,
+        // Shift
+        /* 0x04 */ 0x4041, 0x4042, 0x4043, 0x4044, 0x4045, 0x4046, 0x4047, 0x4048,
+        /* 0x0C */ 0x4049, 0x404A, 0x404B, 0x404C, 0x404D, 0x404E, 0x404F, 0x4050,
+        /* 0x14 */ 0x4051, 0x4052, 0x4053, 0x4054, 0x4055, 0x4056, 0x4057, 0x4058,
+        /* 0x1C */ 0x4059, 0x405A, 0x0021, 0x0040, 0x0023, 0x0024, 0x0025, 0x005E,
+        /* 0x24 */ 0x0026, 0x002A, 0x0028, 0x0029, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x005F, 0x002B, 0x007B, 0x007D, 0x007C, 0x007E, 0x003A,
+        /* 0x34 */ 0x0022, 0x007E, 0x003C, 0x003E, 0x003F,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x007C,
+        // AltGr
+        /* 0x04 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x14 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x24 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x0000,
+        // Shift and AltGr
+        /* 0x04 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x14 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x24 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x0000
+};
+
+// UK English
+const uint16_t HIDKeymapUK[HID_KEYMAP_SIZE] PROGMEM = {
+        // No modifier
+        /* 0x04 */ 0x4061, 0x4062, 0x4063, 0x4064, 0x4065, 0x4066, 0x4067, 0x4068,
+        /* 0x0C */ 0x4069, 0x406A, 0x406B, 0x406C, 0x406D, 0x406E, 0x406F, 0x4070,
+        /* 0x14 */ 0x4071, 0x4072, 0x4073, 0x4074, 0x4075, 0x4076, 0x4077, 0x4078,
+        /* 0x1C */ 0x4079, 0x407A, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036,
+        /* 0x24 */ 0x0037, 0x0038, 0x0039, 0x0030, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x002D, 0x003D, 0x005B, 0x005D, 0x0023, 0x0023, 0x003B,
+        /* 0x34 */ 0x0027, 0x0060, 0x002C, 0x002E, 0x002F,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x005C,
+        // Shift
+        /* 0x04 */ 0x4041, 0x4042, 0x4043, 0x4044, 0x4045, 0x4046, 0x4047, 0x4048,
+        /* 0x0C */ 0x4049, 0x404A, 0x404B, 0x404C, 0x404D, 0x404E, 0x404F, 0x4050,
+        /* 0x14 */ 0x4051, 0x4052, 0x4053, 0x4054, 0x4055, 0x4056, 0x4057, 0x4058,
+        /* 0x1C */ 0x4059, 0x405A, 0x0021, 0x0022, 0x00A3, 0x0024, 0x0025, 0x005E,
+        /* 0x24 */ 0x0026, 0x002A, 0x0028, 0x0029, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x005F, 0x002B, 0x007B, 0x007D, 0x007E, 0x007E, 0x003A,
+        /* 0x34 */ 0x0040, 0x00AC, 0x003C, 0x003E, 0x003F,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x007C,
+        // AltGr
+        /* 0x04 */ 0x40E1, 0x0000, 0x0000, 0x0000, 0x40E9, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x40ED, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x40F3, 0x0000,
+        /* 0x14 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x40FA, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x20AC, 0x0000, 0x0000,
+        /* 0x24 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x00A6, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x0000,
+        // Shift and AltGr
+        /* 0x04 */ 0x40C1, 0x0000, 0x0000, 0x0000, 0x40C9, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x40CD, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x40D3, 0x0000,
+        /* 0x14 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x40DA, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x24 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x0000
+};
+
+// German (QWERTZ)
+const uint16_t HIDKeymapDE[HID_KEYMAP_SIZE] PROGMEM = {
+        // No modifier
+        /* 0x04 */ 0x4061, 0x4062, 0x4063, 0x4064, 0x4065, 0x4066, 0x4067, 0x4068,
+        /* 0x0C */ 0x4069, 0x406A, 0x406B, 0x406C, 0x406D, 0x406E, 0x406F, 0x4070,
+        /* 0x14 */ 0x4071, 0x4072, 0x4073, 0x4074, 0x4075, 0x4076, 0x4077, 0x4078,
+        /* 0x1C */ 0x407A, 0x4079, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036,
+        /* 0x24 */ 0x0037, 0x0038, 0x0039, 0x0030, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x00DF, 0x80B4, 0x40FC, 0x002B, 0x0023, 0x0023, 0x40F6,
+        /* 0x34 */ 0x40E4, 0x805E, 0x002C, 0x002E, 0x002D,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002C,
+        /* 0x64 */ 0x003C,
+        // Shift
+        /* 0x04 */ 0x4041, 0x4042, 0x4043, 0x4044, 0x4045, 0x4046, 0x4047, 0x4048,
+        /* 0x0C */ 0x4049, 0x404A, 0x404B, 0x404C, 0x404D, 0x404E, 0x404F, 0x4050,
+        /* 0x14 */ 0x4051, 0x4052, 0x4053, 0x4054, 0x4055, 0x4056, 0x4057, 0x4058,
+        /* 0x1C */ 0x405A, 0x4059, 0x0021, 0x0022, 0x00A7, 0x0024, 0x0025, 0x0026,
+        /* 0x24 */ 0x002F, 0x0028, 0x0029, 0x003D, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x003F, 0x8060, 0x40DC, 0x002A, 0x0027, 0x0027, 0x40D6,
+        /* 0x34 */ 0x40C4, 0x00B0, 0x003B, 0x003A, 0x005F,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002C,
+        /* 0x64 */ 0x003E,
+        // AltGr
+        /* 0x04 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x20AC, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x00B5, 0x0000, 0x0000, 0x0000,
+        /* 0x14 */ 0x0040, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x00B2, 0x00B3, 0x0000, 0x0000, 0x0000,
+        /* 0x24 */ 0x007B, 0x005B, 0x005D, 0x007D, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x005C, 0x0000, 0x0000, 0x007E, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002C,
+        /* 0x64 */ 0x007C,
+        // Shift and AltGr
+        /* 0x04 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x14 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x24 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002C,
+        /* 0x64 */ 0x0000
+};
+
+// French (AZERTY)
+const uint16_t HIDKeymapFR[HID_KEYMAP_SIZE] PROGMEM = {
+        // No modifier
+        /* 0x04 */ 0x4071, 0x4062, 0x4063, 0x4064, 0x4065, 0x4066, 0x4067, 0x4068,
+        /* 0x0C */ 0x4069, 0x406A, 0x406B, 0x406C, 0x002C, 0x406E, 0x406F, 0x4070,
+        /* 0x14 */ 0x4061, 0x4072, 0x4073, 0x4074, 0x4075, 0x4076, 0x407A, 0x4078,
+        /* 0x1C */ 0x4079, 0x4077, 0x0026, 0x00E9, 0x0022, 0x0027, 0x0028, 0x002D,
+        /* 0x24 */ 0x00E8, 0x005F, 0x00E7, 0x00E0, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x0029, 0x003D, 0x805E, 0x0024, 0x002A, 0x002A, 0x406D,
+        /* 0x34 */ 0x00F9, 0x00B2, 0x003B, 0x003A, 0x0021,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x003C,
+        // Shift
+        /* 0x04 */ 0x4051, 0x4042, 0x4043, 0x4044, 0x4045, 0x4046, 0x4047, 0x4048,
+        /* 0x0C */ 0x4049, 0x404A, 0x404B, 0x404C, 0x003F, 0x404E, 0x404F, 0x4050,
+        /* 0x14 */ 0x4041, 0x4052, 0x4053, 0x4054, 0x4055, 0x4056, 0x405A, 0x4058,
+        /* 0x1C */ 0x4059, 0x4057, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036,
+        /* 0x24 */ 0x0037, 0x0038, 0x0039, 0x0030, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x00B0, 0x002B, 0x80A8, 0x00A3, 0x00B5, 0x00B5, 0x404D,
+        /* 0x34 */ 0x0025, 0x0000, 0x002E, 0x002F, 0x00A7,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x003E,
+        // AltGr
+        /* 0x04 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x20AC, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x14 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x807E, 0x0023, 0x007B, 0x005B, 0x007C,
+        /* 0x24 */ 0x8060, 0x005C, 0x005E, 0x0040, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x005D, 0x007D, 0x0000, 0x00A4, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x0000,
+        // Shift and AltGr
+        /* 0x04 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x0C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x14 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x1C */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x24 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x000D, 0x001B, 0x0008, 0x0009,
+        /* 0x2C */ 0x0020, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x34 */ 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+        /* 0x54 */ 0x002F, 0x002A, 0x002D, 0x002B, 0x000D, 0x0031, 0x0032, 0x0033,
+        /* 0x5C */ 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x0030, 0x002E,
+        /* 0x64 */ 0x0000
+};
+
+// Dead key, base character and the combined character
+static const uint8_t HIDDeadKeys[][3] PROGMEM = {
+        {0x5E, 'a', 0xE2}, {0x5E, 'A', 0xC2}, {0x5E, 'e', 0xEA}, {0x5E, 'E', 0xCA},
+        {0x5E, 'i', 0xEE}, {0x5E, 'I', 0xCE}, {0x5E, 'o', 0xF4}, {0x5E, 'O', 0xD4},
+        {0x5E, 'u', 0xFB}, {0x5E, 'U', 0xDB}, {0x60, 'a', 0xE0}, {0x60, 'A', 0xC0},
+        {0x60, 'e', 0xE8}, {0x60, 'E', 0xC8}, {0x60, 'i', 0xEC}, {0x60, 'I', 0xCC},
+        {0x60, 'o', 0xF2}, {0x60, 'O', 0xD2}, {0x60, 'u', 0xF9}, {0x60, 'U', 0xD9},
+        {0xB4, 'a', 0xE1}, {0xB4, 'A', 0xC1}, {0xB4, 'e', 0xE9}, {0xB4, 'E', 0xC9},
+        {0xB4, 'i', 0xED}, {0xB4, 'I', 0xCD}, {0xB4, 'o', 0xF3}, {0xB4, 'O', 0xD3},
+        {0xB4, 'u', 0xFA}, {0xB4, 'U', 0xDA}, {0xB4, 'y', 0xFD}, {0xB4, 'Y', 0xDD},
+        {0xA8, 'a', 0xE4}, {0xA8, 'A', 0xC4}, {0xA8, 'e', 0xEB}, {0xA8, 'E', 0xCB},
+        {0xA8, 'i', 0xEF}, {0xA8, 'I', 0xCF}, {0xA8, 'o', 0xF6}, {0xA8, 'O', 0xD6},
+        {0xA8, 'u', 0xFC}, {0xA8, 'U', 0xDC}, {0xA8, 'y', 0xFF}, {0x7E, 'a', 0xE3},
+        {0x7E, 'A', 0xC3}, {0x7E, 'o', 0xF5}, {0x7E, 'O', 0xD5}, {0x7E, 'n', 0xF1},
+        {0x7E, 'N', 0xD1}
+};
+
+// Returns the character of a dead key followed by c, 0 if they do not combine
+uint16_t HIDComposeDeadKey(uint16_t accent, uint16_t c) {
+        for(uint8_t i = 0; i < sizeof (HIDDeadKeys) / sizeof (HIDDeadKeys[0]); i++)
+                if(pgm_read_byte(&HIDDeadKeys[i][0]) == accent && pgm_read_byte(&HIDDeadKeys[i][1]) == c)
+                        return pgm_read_byte(&HIDDeadKeys[i][2]);
+        return 0;
+}
+
+// Writes c as UTF-8 and returns the number of bytes, str needs room for 3 bytes
+uint8_t HIDEncodeUtf8(uint16_t c, char *str) {
+        if(c < 0x80) {
+                str[0] = (char)c;
+                return 1;
+        }
+        if(c < 0x800) {
+                str[0] = (char)(0xC0 | (c >> 6));
+                str[1] = (char)(0x80 | (c & 0x3F));
+                return 2;
+        }
+        str[0] = (char)(0xE0 | (c >> 12));
+        str[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+        str[2] = (char)(0x80 | (c & 0x3F));
+        return 3;
+}
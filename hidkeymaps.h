@@ -0,0 +1,50 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__HIDKEYMAPS_H__)
+#define __HIDKEYMAPS_H__
+
+#include "Usb.h"
+
+/*
+ * Keyboard layouts used by KeyboardReportParser::OemToUtf8() and OemToAscii().
+ *
+ * A keymap is a flat table of HID_KEYMAP_SIZE words, one row of HID_KEYMAP_KEYS keys for each modifier class:
+ * no modifier, Shift, AltGr and Shift with AltGr. The keys are the Keyboard page usages 0x04 to 0x38
+ * followed by the keypad usages 0x54 to 0x64. Each word is the Unicode character of the key, 0 if the key
+ * has no character, with these flags:
+ */
+#define HID_KEY_DEAD                    0x8000  // Dead key, combined with the next key
+#define HID_KEY_CAPS                    0x4000  // Caps Lock swaps Shift for this key
+#define HID_KEY_CHAR                    0x3FFF  // Character mask
+
+#define HID_KEYMAP_KEYS                 70
+#define HID_KEYMAP_SIZE                 (4 * HID_KEYMAP_KEYS)
+
+extern const uint16_t HIDKeymapUS[HID_KEYMAP_SIZE] PROGMEM;
+extern const uint16_t HIDKeymapUK[HID_KEYMAP_SIZE] PROGMEM;
+extern const uint16_t HIDKeymapDE[HID_KEYMAP_SIZE] PROGMEM;
+extern const uint16_t HIDKeymapFR[HID_KEYMAP_SIZE] PROGMEM;
+
+// Keymap of a new KeyboardReportParser, can be changed at run time with SetKeymap()
+#ifndef HID_DEFAULT_KEYMAP
+#define HID_DEFAULT_KEYMAP              HIDKeymapUS
+#endif
+
+uint16_t HIDComposeDeadKey(uint16_t accent, uint16_t c);
+uint8_t HIDEncodeUtf8(uint16_t c, char *str);
+
+#endif // __HIDKEYMAPS_H__
@@ -0,0 +1,357 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "hidmultitouch.h"
+
+// Layout that only keeps the fields the driver reads, so pressure, width, confidence and the like of every
+// slot do not fill the table. It is compiled twice: the first pass finds the touch report and counts its
+// slots, the second keeps Tip Switch, Contact ID, X and Y of its first MT_MAX_SLOTS slots, so slots the driver
+// has no room for and the pen and mouse reports do not fill it either
+class HIDMultiTouchLayout : public HIDReportLayoutT<MT_LAYOUT_MAX_FIELDS> {
+        uint8_t kept[4]; // Elements kept of each slot usage: Contact ID, Tip Switch, X, Y
+
+        static bool HasUsage(const HID_REPORT_FIELD *field, uint16_t page, uint16_t usage) {
+                return field->usagePage == page && usage >= field->usageMin && usage <= field->usageMax;
+        };
+
+        // Elements of the field with the usage
+        static uint8_t CountUsage(const HID_REPORT_FIELD *field, uint16_t page, uint16_t usage) {
+                uint8_t n = 0;
+
+                if(HasUsage(field, page, usage))
+                        for(uint8_t i = 0; i < field->count; i++)
+                                if(GetElementUsage(field, i) == usage)
+                                        n++;
+                return n;
+        };
+
+protected:
+        bool IsFieldWanted(const HID_REPORT_FIELD *field) {
+                if(!(field->flags & HID_FIELD_VARIABLE))
+                        return false;
+
+                if(field->reportType == HID_REPORT_TYPE_FEATURE)
+                        return bFound && (HasUsage(field, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_DEVICE_MODE)
+                                || HasUsage(field, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_SURFACE_SWITCH)
+                                || HasUsage(field, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_BUTTON_SWITCH));
+
+                if(field->reportType != HID_REPORT_TYPE_INPUT)
+                        return false;
+
+                if(!bFound) {
+                        // The first input report with Contact ID is the touch report
+                        uint8_t n = CountUsage(field, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_CONTACT_ID);
+
+                        if(n && !bDevSlots)
+                                bRptId = field->reportId;
+                        if(n && field->reportId == bRptId)
+                                bDevSlots += n;
+                        return false;
+                }
+
+                if(field->reportId != bRptId)
+                        return false;
+
+                if(HasUsage(field, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_CONTACT_COUNT))
+                        return true;
+
+                uint8_t n[4] = {
+                        CountUsage(field, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_CONTACT_ID),
+                        CountUsage(field, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_TIP_SWITCH),
+                        CountUsage(field, HID_USAGE_PAGE_GENERIC_DESKTOP, 0x30),
+                        CountUsage(field, HID_USAGE_PAGE_GENERIC_DESKTOP, 0x31)
+                };
+                bool wanted = false;
+
+                for(uint8_t i = 0; i < 4; i++) {
+                        if(n[i] && kept[i] < MT_MAX_SLOTS) {
+                                kept[i] += n[i];
+                                wanted = true;
+                        }
+                }
+                return wanted;
+        };
+
+public:
+        bool bFound; // The first pass found the touch report
+        uint8_t bRptId;
+        uint8_t bDevSlots; // Slots of the touch report, the driver reads up to MT_MAX_SLOTS of them
+
+        HIDMultiTouchLayout() : bFound(false), bRptId(0), bDevSlots(0) {
+                memset(kept, 0, sizeof (kept));
+        };
+};
+
+HIDMultiTouch::HIDMultiTouch(USB *p) :
+HIDUniversal(p),
+bNumSlots(0),
+bDevSlots(0),
+bRptId(0),
+bRptLen(0),
+bInputMode(MT_INPUT_MODE_MULTI_INPUT),
+maxX(0),
+maxY(0),
+bExpected(0),
+bReceived(0) {
+        contactCount.size = 0;
+        memset(contacts, 0, sizeof (contacts));
+}
+
+/* Finds element n (0 is the first) with the usage in the reports of type and rptId */
+bool HIDMultiTouch::FindValue(HIDReportLayout *layout, uint8_t type, uint8_t rptId, uint16_t page, uint16_t usage, uint8_t n, MTValue *pv, const HID_REPORT_FIELD **pfield) {
+        pv->size = 0;
+
+        for(uint8_t i = 0; i < layout->GetNumFields(); i++) {
+                const HID_REPORT_FIELD *pf = layout->GetField(i);
+
+                if(pf->reportType != type || pf->reportId != rptId || pf->usagePage != page || !(pf->flags & HID_FIELD_VARIABLE))
+                        continue;
+
+                for(uint8_t j = 0; j < pf->count; j++) {
+                        if(HIDReportLayout::GetElementUsage(pf, j) != usage || n--)
+                                continue;
+
+                        pv->offset = pf->offset + (uint16_t)j * pf->size + ((rptId) ? 8 : 0);
+                        pv->size = pf->size;
+
+                        if(pfield)
+                                *pfield = pf;
+                        return true;
+                }
+        }
+        return false;
+}
+
+/* Compiles the report descriptor of the interface and finds the slots of the touch report. The layout is only
+   needed here, so it lives on the stack, see MT_LAYOUT_MAX_FIELDS for its size */
+bool HIDMultiTouch::CompileTouchReport(uint8_t iface) {
+        HIDMultiTouchLayout layout;
+
+        if(layout.Compile(this, iface) || !layout.bDevSlots)
+                return false;
+
+        layout.bFound = true;
+        if(layout.Compile(this, iface))
+                return false;
+
+        const HID_REPORT_FIELD *pf = layout.FindField(HID_REPORT_TYPE_INPUT, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_CONTACT_ID, NULL);
+
+        if(!pf)
+                return false;
+
+        bRptId = pf->reportId;
+        bRptLen = (uint8_t)layout.GetReportLength(bRptId, HID_REPORT_TYPE_INPUT);
+
+        uint8_t n;
+
+        for(n = 0; n < MT_MAX_SLOTS; n++) {
+                MTSlot *ps = slots + n;
+                const HID_REPORT_FIELD *px, *py;
+
+                if(!FindValue(&layout, HID_REPORT_TYPE_INPUT, bRptId, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_CONTACT_ID, n, &ps->id)
+                        || !FindValue(&layout, HID_REPORT_TYPE_INPUT, bRptId, HID_USAGE_PAGE_GENERIC_DESKTOP, 0x30, n, &ps->x, &px)
+                        || !FindValue(&layout, HID_REPORT_TYPE_INPUT, bRptId, HID_USAGE_PAGE_GENERIC_DESKTOP, 0x31, n, &ps->y, &py))
+                        break;
+
+                FindValue(&layout, HID_REPORT_TYPE_INPUT, bRptId, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_TIP_SWITCH, n, &ps->tip);
+
+                if(!n) {
+                        maxX = (uint16_t)px->logicalMax;
+                        maxY = (uint16_t)py->logicalMax;
+                }
+        }
+
+        if(!n)
+                return false;
+
+        bNumSlots = n;
+        bDevSlots = (layout.bDevSlots > n) ? layout.bDevSlots : n;
+        FindValue(&layout, HID_REPORT_TYPE_INPUT, bRptId, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_CONTACT_COUNT, 0, &contactCount);
+
+        uint8_t rcode = SetInputModeFeature(&layout, iface);
+
+        if(rcode)
+                USBTRACE3("(hidmultitouch.h) Input Mode:", rcode, 0x80);
+        return true;
+}
+
+/* Sets the Input Mode feature if the device has one. Surface and Button Switch in the same report are turned on,
+   a touchpad does not report anything otherwise */
+uint8_t HIDMultiTouch::SetInputModeFeature(HIDReportLayout *layout, uint8_t iface) {
+        uint8_t index;
+        const HID_REPORT_FIELD *pf = layout->FindField(HID_REPORT_TYPE_FEATURE, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_DEVICE_MODE, &index);
+
+        if(!pf)
+                return 0;
+
+        uint8_t id = pf->reportId;
+        uint16_t len = layout->GetReportLength(id, HID_REPORT_TYPE_FEATURE);
+        uint8_t buf[16];
+        MTValue v;
+
+        if(!len || len > sizeof (buf))
+                return USB_ERROR_INVALID_ARGUMENT;
+
+        // Keep the other fields of the report as they are
+        if(GetReport(0, iface, HID_REPORT_TYPE_FEATURE, id, len, buf))
+                memset(buf, 0, sizeof (buf));
+
+        if(id)
+                buf[0] = id;
+
+        FindValue(layout, HID_REPORT_TYPE_FEATURE, id, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_DEVICE_MODE, 0, &v);
+        HIDReportLayout::SetBits(buf, (uint8_t)len, v.offset, v.size, bInputMode);
+
+        if(FindValue(layout, HID_REPORT_TYPE_FEATURE, id, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_SURFACE_SWITCH, 0, &v))
+                HIDReportLayout::SetBits(buf, (uint8_t)len, v.offset, v.size, 1);
+
+        if(FindValue(layout, HID_REPORT_TYPE_FEATURE, id, HID_USAGE_PAGE_DIGITIZER, MT_USAGE_BUTTON_SWITCH, 0, &v))
+                HIDReportLayout::SetBits(buf, (uint8_t)len, v.offset, v.size, 1);
+
+        return SetReport(0, iface, HID_REPORT_TYPE_FEATURE, id, len, buf);
+}
+
+uint8_t HIDMultiTouch::OnInitSuccessful() {
+        ResetContacts();
+        bNumSlots = 0;
+
+        // The touch collection is not always on the first interface
+        for(uint8_t i = 0; i < bNumIface; i++)
+                if(CompileTouchReport(hidInterfaces[i].bmInterface))
+                        break;
+
+        return 0;
+}
+
+uint8_t HIDMultiTouch::Release() {
+        ResetContacts();
+        bNumSlots = 0;
+        return HIDUniversal::Release();
+}
+
+/* Lifts every contact that is down */
+void HIDMultiTouch::ResetContacts() {
+        for(uint8_t i = 0; i < MT_MAX_CONTACTS; i++) {
+                if(contacts[i].state != MT_CONTACT_FREE)
+                        OnTouchUp(&contacts[i]);
+                contacts[i].state = MT_CONTACT_FREE;
+        }
+        bExpected = bReceived = 0;
+}
+
+uint8_t HIDMultiTouch::GetNumContacts() {
+        uint8_t n = 0;
+
+        for(uint8_t i = 0; i < MT_MAX_CONTACTS; i++)
+                if(contacts[i].state != MT_CONTACT_FREE)
+                        n++;
+        return n;
+}
+
+MT_CONTACT* HIDMultiTouch::FindContact(uint16_t id) {
+        for(uint8_t i = 0; i < MT_MAX_CONTACTS; i++)
+                if(contacts[i].state != MT_CONTACT_FREE && contacts[i].id == id)
+                        return &contacts[i];
+        return NULL;
+}
+
+void HIDMultiTouch::UpdateContact(uint16_t id, bool tip, uint16_t x, uint16_t y) {
+        MT_CONTACT *pc = FindContact(id);
+
+        if(!tip) {
+                // Empty slots of a parallel mode report can repeat the ID of a contact reported in an earlier slot
+                if(pc && !(pc->state & MT_CONTACT_SEEN)) {
+                        pc->x = x;
+                        pc->y = y;
+                        OnTouchUp(pc);
+                        pc->state = MT_CONTACT_FREE;
+                }
+                return;
+        }
+
+        if(!pc) {
+                for(uint8_t i = 0; i < MT_MAX_CONTACTS && !pc; i++)
+                        if(contacts[i].state == MT_CONTACT_FREE)
+                                pc = &contacts[i];
+
+                if(!pc)
+                        return; // Table full, the contact is ignored until a slot is free
+
+                pc->id = id;
+                pc->x = x;
+                pc->y = y;
+                pc->state = MT_CONTACT_DOWN | MT_CONTACT_SEEN;
+                OnTouchDown(pc);
+                return;
+        }
+
+        pc->state |= MT_CONTACT_SEEN;
+
+        if(pc->x != x || pc->y != y) {
+                pc->x = x;
+                pc->y = y;
+                OnTouchMove(pc);
+        }
+}
+
+/* Lifts the contacts the frame did not report */
+void HIDMultiTouch::EndFrame() {
+        for(uint8_t i = 0; i < MT_MAX_CONTACTS; i++) {
+                MT_CONTACT *pc = &contacts[i];
+
+                if(pc->state == MT_CONTACT_DOWN) {
+                        OnTouchUp(pc);
+                        pc->state = MT_CONTACT_FREE;
+                } else
+                        pc->state &= ~MT_CONTACT_SEEN;
+        }
+        bExpected = bReceived = 0;
+        OnFrame(GetNumContacts());
+}
+
+void HIDMultiTouch::ParseHIDData(USBHID *hid __attribute__((unused)), bool is_rpt_id __attribute__((unused)), uint8_t len, uint8_t *buf) {
+        if(!bNumSlots || len < bRptLen || (bRptId && *buf != bRptId))
+                return;
+
+        if(contactCount.size) {
+                uint8_t count = (uint8_t)GetValue(&contactCount, buf, len);
+
+                // Hybrid mode: the contact count is only sent in the first report of a frame
+                if(count) {
+                        if(bReceived < bExpected)
+                                EndFrame(); // A report of the last frame was lost
+                        bExpected = count;
+                } else if(bReceived >= bExpected) {
+                        EndFrame(); // Empty frame, nothing touches
+                        return;
+                }
+        } else
+                bExpected = bDevSlots;
+
+        for(uint8_t i = 0; i < bNumSlots && bReceived < bExpected; i++, bReceived++) {
+                const MTSlot *ps = slots + i;
+                bool tip = !ps->tip.size || GetValue(&ps->tip, buf, len);
+
+                UpdateContact((uint16_t)GetValue(&ps->id, buf, len), tip, (uint16_t)GetValue(&ps->x, buf, len), (uint16_t)GetValue(&ps->y, buf, len));
+        }
+
+        // The contacts in the slots past MT_MAX_SLOTS are not read, but belong to the frame
+        for(uint8_t i = bNumSlots; i < bDevSlots && bReceived < bExpected; i++)
+                bReceived++;
+
+        if(bReceived >= bExpected)
+                EndFrame();
+}
@@ -0,0 +1,172 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__HIDMULTITOUCH_H__)
+#define __HIDMULTITOUCH_H__
+
+#include "hiduniversal.h"
+#include "hidreportlayout.h"
+
+#ifndef MT_MAX_CONTACTS
+#define MT_MAX_CONTACTS                 5       // Contacts tracked at the same time, 7 bytes of RAM each
+#endif
+
+// Contacts read from one touch report, 12 bytes of RAM each. The contacts in further slots are ignored
+#ifndef MT_MAX_SLOTS
+#if defined(__AVR__)
+#define MT_MAX_SLOTS                    2
+#else
+#define MT_MAX_SLOTS                    10
+#endif
+#endif
+
+// Fields kept while the device is configured: Tip Switch, Contact ID, X and Y of each slot read, the Contact Count and
+// the Input Mode report. The layout is on the stack in OnInitSuccessful(), 21 bytes per field, 252 bytes on AVR
+#ifndef MT_LAYOUT_MAX_FIELDS
+#define MT_LAYOUT_MAX_FIELDS            (MT_MAX_SLOTS * 4 + 4)
+#endif
+
+/* Digitizer page usages */
+#define MT_USAGE_TOUCH_SCREEN           0x04
+#define MT_USAGE_TOUCH_PAD              0x05
+#define MT_USAGE_TIP_SWITCH             0x42
+#define MT_USAGE_DEVICE_MODE            0x52    // Input Mode feature
+#define MT_USAGE_CONTACT_ID             0x51
+#define MT_USAGE_CONTACT_COUNT          0x54
+#define MT_USAGE_SURFACE_SWITCH         0x57
+#define MT_USAGE_BUTTON_SWITCH          0x58
+
+/* Input Mode values */
+#define MT_INPUT_MODE_MOUSE             0x00
+#define MT_INPUT_MODE_MULTI_INPUT       0x02    // Touch screens
+#define MT_INPUT_MODE_TOUCHPAD          0x03    // Precision touchpads
+
+/* Contact states */
+#define MT_CONTACT_FREE                 0x00
+#define MT_CONTACT_DOWN                 0x01
+#define MT_CONTACT_SEEN                 0x02    // Reported in the current frame
+
+typedef struct {
+        uint16_t id; // Contact Identifier sent by the device
+        uint8_t state; // MT_CONTACT_*
+        uint16_t x;
+        uint16_t y;
+} __attribute__((packed)) MT_CONTACT;
+
+/*
+ * Driver for multitouch touch screens and touchpads that use the Digitizer page. It replaces HIDUniversal:
+ *
+ *      HIDMultiTouch Touch(&Usb);
+ *
+ * When the device is configured the report descriptor is compiled once. The touch report is the input report
+ * with the Contact Identifier usage, and every Contact Identifier starts a slot with its own Tip Switch, X and Y.
+ * The driver then sets the Input Mode feature, so the device sends touch reports instead of mouse reports.
+ *
+ * Devices that report more contacts than they have slots (hybrid mode) send the Contact Count of the frame in
+ * the first report and 0 in the others. Devices in parallel mode send every contact in one report. In both
+ * cases the contacts are kept in a table, and OnTouchDown(), OnTouchMove() and OnTouchUp() are called per
+ * contact. A contact missing from a frame is treated as lifted. OnFrame() is called at the end of every frame.
+ */
+class HIDMultiTouch : public HIDUniversal {
+
+        // Bit field of the touch report, offset counts the report ID byte
+        struct MTValue {
+                uint16_t offset;
+                uint8_t size; // 0 if the device does not send it
+        };
+
+        struct MTSlot {
+                MTValue tip;
+                MTValue id;
+                MTValue x;
+                MTValue y;
+        };
+
+        MTSlot slots[MT_MAX_SLOTS];
+        MTValue contactCount;
+        uint8_t bNumSlots; // 0 if the device is not a multitouch digitizer
+        uint8_t bDevSlots; // Slots in the touch report, bNumSlots of them are read
+        uint8_t bRptId; // Report ID of the touch report
+        uint8_t bRptLen; // Length of the touch report, report ID included
+        uint8_t bInputMode;
+        uint16_t maxX; // Logical maximum of X and Y
+        uint16_t maxY;
+
+        MT_CONTACT contacts[MT_MAX_CONTACTS];
+        uint8_t bExpected; // Contacts in the current frame
+        uint8_t bReceived; // Contacts of the current frame seen so far
+
+        static bool FindValue(HIDReportLayout *layout, uint8_t type, uint8_t rptId, uint16_t page, uint16_t usage, uint8_t n, MTValue *pv, const HID_REPORT_FIELD **pfield = NULL);
+        bool CompileTouchReport(uint8_t iface);
+        uint8_t SetInputModeFeature(HIDReportLayout *layout, uint8_t iface);
+
+        uint32_t GetValue(const MTValue *pv, const uint8_t *buf, uint8_t len) {
+                return HIDReportLayout::GetBits(buf, len, pv->offset, pv->size);
+        };
+
+        MT_CONTACT* FindContact(uint16_t id);
+        void UpdateContact(uint16_t id, bool tip, uint16_t x, uint16_t y);
+        void EndFrame();
+        void ResetContacts();
+
+protected:
+        uint8_t OnInitSuccessful();
+        void ParseHIDData(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+
+        virtual void OnTouchDown(const MT_CONTACT *contact __attribute__((unused))) {
+        };
+
+        virtual void OnTouchMove(const MT_CONTACT *contact __attribute__((unused))) {
+        };
+
+        // Called with the position of the last report of the contact
+        virtual void OnTouchUp(const MT_CONTACT *contact __attribute__((unused))) {
+        };
+
+        virtual void OnFrame(uint8_t contacts __attribute__((unused))) {
+        };
+
+public:
+        HIDMultiTouch(USB *p);
+
+        uint8_t Release();
+
+        // Input Mode set when the device is configured, MT_INPUT_MODE_MULTI_INPUT by default
+        void SetInputMode(uint8_t mode) {
+                bInputMode = mode;
+        };
+
+        bool isTouchDevice() {
+                return isReady() && bNumSlots;
+        };
+
+        uint8_t GetNumContacts();
+
+        // Contact i of the table, NULL if it is not down
+        const MT_CONTACT* GetContact(uint8_t i) {
+                return (i < MT_MAX_CONTACTS && contacts[i].state != MT_CONTACT_FREE) ? &contacts[i] : NULL;
+        };
+
+        uint16_t GetMaxX() {
+                return maxX;
+        };
+
+        uint16_t GetMaxY() {
+                return maxY;
+        };
+};
+
+#endif // __HIDMULTITOUCH_H__
@@ -0,0 +1,74 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "hidoutputqueue.h"
+
+/* Queues a report. A report with the same interface and report ID that was not sent yet is replaced and keeps its place.
+   Returns false if the report is too long or the queue is full */
+bool HIDOutputReportQueue::Put(uint8_t iface, uint8_t report_id, uint8_t nbytes, const uint8_t *data) {
+        if(nbytes > HID_OUTPUT_REPORT_SIZE)
+                return false;
+
+        OutputReport *pr = NULL;
+
+        for(uint8_t i = 0; i < numReports; i++)
+                if(reports[i].iface == iface && reports[i].rptId == report_id) {
+                        pr = reports + i;
+                        break;
+                }
+
+        if(!pr) {
+                if(numReports >= HID_OUTPUT_QUEUE_SIZE)
+                        return false;
+
+                pr = reports + numReports++;
+                pr->iface = iface;
+                pr->rptId = report_id;
+        }
+
+        pr->len = nbytes;
+        memcpy(pr->data, data, nbytes);
+        return true;
+}
+
+void HIDOutputReportQueue::Remove(uint8_t index) {
+        numReports--;
+
+        for(uint8_t i = index; i < numReports; i++)
+                reports[i] = reports[i + 1];
+}
+
+/* Sends up to max_reports reports, oldest first. A report the device NAKs stays in the queue and is sent again
+   next time, a report that fails otherwise is dropped. Returns the first error other than a NAK */
+uint8_t HIDOutputReportQueue::Send(USBHID *hid, uint8_t max_reports) {
+        uint8_t rcode = 0;
+
+        while(numReports && max_reports--) {
+                OutputReport *pr = reports;
+                uint8_t ret = hid->SendOutputReport(pr->iface, pr->rptId, pr->len, pr->data);
+
+                if(ret == hrNAK)
+                        break;
+
+                if(ret) {
+                        USBTRACE3("(hidoutputqueue.h) Send:", ret, 0x81);
+                        if(!rcode)
+                                rcode = ret;
+                }
+                Remove(0);
+        }
+        return rcode;
+}
@@ -0,0 +1,73 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__HIDOUTPUTQUEUE_H__)
+#define __HIDOUTPUTQUEUE_H__
+
+#include "usbhid.h"
+
+#ifndef HID_OUTPUT_QUEUE_SIZE
+#define HID_OUTPUT_QUEUE_SIZE           4       // Reports waiting to be sent
+#endif
+
+#ifndef HID_OUTPUT_REPORT_SIZE
+#define HID_OUTPUT_REPORT_SIZE          16      // Largest report that can be queued, including the report ID byte
+#endif
+
+#ifndef HID_OUTPUT_REPORTS_PER_POLL
+#define HID_OUTPUT_REPORTS_PER_POLL     1       // Reports sent by one Poll() of the driver
+#endif
+
+/*
+ * Output reports (LEDs, rumble, force feedback) waiting to be sent to one device.
+ * A report put in the queue replaces the one with the same interface and report ID that is still waiting,
+ * so an application that updates the LEDs faster than the device takes them only sends the latest state.
+ * The driver sends a few reports every Poll() with USBHID::SendOutputReport(), using the interrupt OUT
+ * endpoint when the interface has one. Attach the queue with USBHID::SetOutputQueue().
+ */
+class HIDOutputReportQueue {
+
+        struct OutputReport {
+                uint8_t iface;
+                uint8_t rptId;
+                uint8_t len;
+                uint8_t data[HID_OUTPUT_REPORT_SIZE];
+        };
+
+        OutputReport reports[HID_OUTPUT_QUEUE_SIZE]; // Oldest first
+        uint8_t numReports;
+
+        void Remove(uint8_t index);
+
+public:
+        HIDOutputReportQueue() : numReports(0) {
+        };
+
+        // data is the whole report, starting with the report ID if the device uses report IDs
+        bool Put(uint8_t iface, uint8_t report_id, uint8_t nbytes, const uint8_t *data);
+
+        uint8_t Send(USBHID *hid, uint8_t max_reports);
+
+        void Clear() {
+                numReports = 0;
+        };
+
+        uint8_t GetCount() {
+                return numReports;
+        };
+};
+
+#endif // __HIDOUTPUTQUEUE_H__
@@ -0,0 +1,259 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "hidpowerdevice.h"
+
+// Layout that keeps no fields at all: the watched usages are looked up while the descriptor is compiled, so
+// only the report lengths take room on the stack
+class HIDPowerDeviceLayout : public HIDReportLayoutT<1, PD_LAYOUT_MAX_REPORTS> {
+        HIDPowerDevice *pDev;
+
+protected:
+        bool IsFieldWanted(const HID_REPORT_FIELD *field) {
+                if(field->reportType == HID_REPORT_TYPE_OUTPUT || !(field->flags & HID_FIELD_VARIABLE))
+                        return false;
+
+                for(uint8_t i = 0; i < pDev->numWatches; i++) {
+                        HIDPowerDevice::PDWatch *pw = pDev->watches + i;
+
+                        if(pw->usagePage != field->usagePage || pw->usage < field->usageMin || pw->usage > field->usageMax)
+                                continue;
+
+                        // The first feature report with the usage, or else the first input report
+                        if(pw->reportType == HID_REPORT_TYPE_FEATURE || (pw->reportType && field->reportType == HID_REPORT_TYPE_INPUT))
+                                continue;
+
+                        uint16_t n = pw->usage - field->usageMin;
+
+                        // Elements past usageMax repeat the last usage
+                        if(n >= field->count)
+                                n = 0;
+
+                        pw->reportType = field->reportType;
+                        pw->reportId = field->reportId;
+                        pw->offset = field->offset + n * field->size + ((field->reportId) ? 8 : 0);
+                        pw->size = field->size;
+                        pw->flags = (field->logicalMin < 0) ? PD_WATCH_SIGNED : 0;
+                }
+                return false;
+        };
+
+public:
+        HIDPowerDeviceLayout(HIDPowerDevice *dev) : pDev(dev) {
+        };
+};
+
+HIDPowerDevice::HIDPowerDevice(USB *p) :
+HIDUniversal(p),
+numWatches(0),
+bIface(0xFF),
+bReportIds(false),
+bResolve(false),
+wPollPeriod(PD_POLL_PERIOD),
+qNextRound(0),
+qNextRequest(0) {
+}
+
+/* Adds a usage to the watch list, or sets new limits if it is already in it. Returns false if the list is full */
+bool HIDPowerDevice::Watch(uint16_t page, uint16_t usage, int32_t low, int32_t high) {
+        PDWatch *pw = NULL;
+
+        for(uint8_t i = 0; i < numWatches; i++)
+                if(watches[i].usagePage == page && watches[i].usage == usage)
+                        pw = watches + i;
+
+        if(!pw) {
+                if(numWatches >= PD_MAX_WATCHES)
+                        return false;
+
+                pw = watches + numWatches++;
+                pw->usagePage = page;
+                pw->usage = usage;
+                pw->reportType = 0;
+                pw->flags = 0;
+                pw->zone = PD_ZONE_NORMAL;
+                bResolve = true;
+        }
+        pw->low = low;
+        pw->high = high;
+        return true;
+}
+
+void HIDPowerDevice::Unwatch() {
+        numWatches = 0;
+        bIface = 0xFF;
+}
+
+bool HIDPowerDevice::GetValue(uint16_t page, uint16_t usage, int32_t *value) {
+        for(uint8_t i = 0; i < numWatches; i++) {
+                const PDWatch *pw = watches + i;
+
+                if(pw->usagePage == page && pw->usage == usage) {
+                        if(!(pw->flags & PD_WATCH_VALID))
+                                return false;
+
+                        *value = pw->value;
+                        return true;
+                }
+        }
+        return false;
+}
+
+/* Compiles the report descriptors until an interface has one of the watched usages and finds the report, the
+   bit offset and the size of each usage. A feature report is preferred to an input report */
+void HIDPowerDevice::Resolve() {
+        HIDPowerDeviceLayout layout(this);
+
+        bIface = 0xFF;
+
+        for(uint8_t n = 0; n < bNumIface && bIface == 0xFF; n++) {
+                for(uint8_t i = 0; i < numWatches; i++)
+                        watches[i].reportType = 0;
+
+                if(layout.Compile(this, hidInterfaces[n].bmInterface))
+                        continue;
+
+                for(uint8_t i = 0; i < numWatches; i++) {
+                        PDWatch *pw = watches + i;
+
+                        if(!pw->reportType)
+                                continue;
+
+                        uint16_t len = layout.GetReportLength(pw->reportId, pw->reportType);
+
+                        if(!len || len > PD_MAX_REPORT_SIZE) {
+                                pw->reportType = 0;
+                                continue;
+                        }
+
+                        pw->reportLen = (uint8_t)len;
+                        bIface = hidInterfaces[n].bmInterface;
+                }
+
+                bReportIds = layout.HasReportIds();
+        }
+
+        if(layout.IsTruncated())
+                USBTRACE("(hidpowerdevice.h) Report descriptor truncated\r\n");
+}
+
+uint8_t HIDPowerDevice::OnInitSuccessful() {
+        bIface = 0xFF;
+        bResolve = true; // On the first Poll()
+        qNextRound = qNextRequest = (uint32_t)millis();
+        return 0;
+}
+
+uint8_t HIDPowerDevice::Release() {
+        bIface = 0xFF;
+        bResolve = false;
+
+        // The readings are of the device that is gone, the next one starts from the normal zone
+        for(uint8_t i = 0; i < numWatches; i++) {
+                watches[i].flags = 0;
+                watches[i].reportType = 0;
+                watches[i].zone = PD_ZONE_NORMAL;
+        }
+        return HIDUniversal::Release();
+}
+
+void HIDPowerDevice::UpdateValue(PDWatch *pw, int32_t value) {
+        if((pw->flags & PD_WATCH_VALID) && value == pw->value)
+                return;
+
+        pw->flags |= PD_WATCH_VALID;
+        pw->value = value;
+        OnValueChanged(pw->usagePage, pw->usage, value);
+
+        uint8_t zone = (value < pw->low) ? PD_ZONE_LOW : (value > pw->high) ? PD_ZONE_HIGH : PD_ZONE_NORMAL;
+
+        if(zone != pw->zone) {
+                pw->zone = zone;
+                OnThreshold(pw->usagePage, pw->usage, value, zone);
+        }
+}
+
+/* Updates every watched usage in the report, buf is NULL if the report could not be read */
+void HIDPowerDevice::UpdateReport(uint8_t type, uint8_t id, const uint8_t *buf, uint8_t len) {
+        for(uint8_t i = 0; i < numWatches; i++) {
+                PDWatch *pw = watches + i;
+
+                if(pw->reportType != type || pw->reportId != id)
+                        continue;
+
+                pw->flags |= PD_WATCH_READ;
+
+                if(!buf || pw->offset + pw->size > (uint16_t)len * 8)
+                        continue;
+
+                uint32_t val = HIDReportLayout::GetBits(buf, len, pw->offset, pw->size);
+
+                if((pw->flags & PD_WATCH_SIGNED) && pw->size < 32 && (val & ((uint32_t)1 << (pw->size - 1))))
+                        val |= ~(uint32_t)0 << pw->size;
+
+                UpdateValue(pw, (int32_t)val);
+        }
+}
+
+void HIDPowerDevice::ParseHIDData(USBHID *hid __attribute__((unused)), bool is_rpt_id __attribute__((unused)), uint8_t len, uint8_t *buf) {
+        if(bIface != 0xFF && len)
+                UpdateReport(HID_REPORT_TYPE_INPUT, (bReportIds) ? *buf : 0, buf, len);
+}
+
+/* Polls the interrupt endpoints, then sends at most one GET_REPORT for a report not read in this round */
+uint8_t HIDPowerDevice::Poll() {
+        uint8_t rcode = HIDUniversal::Poll();
+
+        if(!isReady())
+                return rcode;
+
+        if(bResolve) {
+                bResolve = false;
+                Resolve();
+        }
+
+        if(bIface == 0xFF || (int32_t)((uint32_t)millis() - qNextRequest) < 0L)
+                return rcode;
+
+        if((int32_t)((uint32_t)millis() - qNextRound) >= 0L) {
+                qNextRound = (uint32_t)millis() + wPollPeriod;
+
+                for(uint8_t i = 0; i < numWatches; i++)
+                        watches[i].flags &= ~PD_WATCH_READ;
+        }
+
+        for(uint8_t i = 0; i < numWatches; i++) {
+                PDWatch *pw = watches + i;
+
+                if(!pw->reportType || (pw->flags & PD_WATCH_READ))
+                        continue;
+
+                uint8_t buf[PD_MAX_REPORT_SIZE];
+                uint8_t ret = GetReport(0, bIface, pw->reportType, pw->reportId, pw->reportLen, buf);
+
+                qNextRequest = (uint32_t)millis() + PD_REQUEST_INTERVAL;
+
+                if(ret) {
+                        USBTRACE3("(hidpowerdevice.h) GetReport:", ret, 0x81);
+                        if(!rcode)
+                                rcode = ret;
+                }
+
+                UpdateReport(pw->reportType, pw->reportId, (ret) ? NULL : buf, pw->reportLen);
+                break;
+        }
+        return rcode;
+}
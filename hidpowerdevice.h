@@ -0,0 +1,163 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__HIDPOWERDEVICE_H__)
+#define __HIDPOWERDEVICE_H__
+
+#include "hiduniversal.h"
+#include "hidreportlayout.h"
+
+#ifndef PD_MAX_WATCHES
+#define PD_MAX_WATCHES                  12      // Usages a HIDPowerDevice can watch, 24 bytes of RAM each
+#endif
+
+#ifndef PD_POLL_PERIOD
+#define PD_POLL_PERIOD                  5000    // Default time in ms from the start of one round of feature reads to the next
+#endif
+
+#ifndef PD_REQUEST_INTERVAL
+#define PD_REQUEST_INTERVAL             20      // Minimum time in ms between two GET_REPORT requests
+#endif
+
+#ifndef PD_LAYOUT_MAX_REPORTS
+#define PD_LAYOUT_MAX_REPORTS           32      // Report IDs of the report descriptor, 7 bytes each, only on the stack while the usages are looked up
+#endif
+
+#define PD_MAX_REPORT_SIZE              32      // Longest report that is read, report ID included
+
+#define PD_NO_LOW_LIMIT                 ((int32_t)0x80000000)
+#define PD_NO_HIGH_LIMIT                ((int32_t)0x7FFFFFFF)
+
+/* Power Device page usages */
+#define PD_USAGE_PRESENT_STATUS         0x02
+#define PD_USAGE_VOLTAGE                0x30
+#define PD_USAGE_CURRENT                0x31
+#define PD_USAGE_FREQUENCY              0x32
+#define PD_USAGE_PERCENT_LOAD           0x35
+#define PD_USAGE_TEMPERATURE            0x36
+#define PD_USAGE_OVERLOAD               0x65
+#define PD_USAGE_SHUTDOWN_IMMINENT      0x69
+
+/* Battery System page usages */
+#define PD_USAGE_CHARGING               0x44
+#define PD_USAGE_DISCHARGING            0x45
+#define PD_USAGE_NEED_REPLACEMENT       0x4B
+#define PD_USAGE_REMAINING_CAPACITY     0x66
+#define PD_USAGE_FULL_CHARGE_CAPACITY   0x67
+#define PD_USAGE_RUN_TIME_TO_EMPTY      0x68
+#define PD_USAGE_AC_PRESENT             0xD0
+#define PD_USAGE_BATTERY_PRESENT        0xD1
+
+/* Watch flags */
+#define PD_WATCH_SIGNED                 0x01
+#define PD_WATCH_VALID                  0x02    // The value was read
+#define PD_WATCH_READ                   0x04    // The report was read in this round
+
+/* Threshold zones */
+#define PD_ZONE_NORMAL                  0x00
+#define PD_ZONE_LOW                     0x01    // Value below the low limit
+#define PD_ZONE_HIGH                    0x02    // Value above the high limit
+
+/*
+ * Driver for UPS units and batteries that use the Power Device (0x84) and Battery System (0x85) pages.
+ * It replaces HIDUniversal:
+ *
+ *      HIDPowerDevice Ups(&Usb);
+ *
+ *      Ups.Watch(HID_USAGE_PAGE_BATTERY_SYSTEM, PD_USAGE_REMAINING_CAPACITY, 20, PD_NO_HIGH_LIMIT);
+ *      Ups.Watch(HID_USAGE_PAGE_BATTERY_SYSTEM, PD_USAGE_AC_PRESENT);
+ *
+ * The watched usages are looked up in the report descriptor when the device is configured, preferring feature
+ * reports. Only the fields of watched usages are kept, so large UPS descriptors do not need a large table.
+ *
+ * Power devices send most values only in feature reports, which are read with GET_REPORT on the control
+ * endpoint. Every PD_POLL_PERIOD ms a round reads each report that holds a watched usage once, so usages in the
+ * same report cost a single request. At most one request is sent per Poll() and requests are spaced by
+ * PD_REQUEST_INTERVAL ms, which bounds the load on EP0. Input reports sent on the interrupt endpoint update
+ * the watched usages as they arrive.
+ *
+ * Values are the logical values of the report, the unit exponent is not applied. OnValueChanged() is called
+ * when a value changes and OnThreshold() when it moves into another zone of its limits.
+ */
+class HIDPowerDevice : public HIDUniversal {
+        friend class HIDPowerDeviceLayout;
+
+        struct PDWatch {
+                uint16_t usagePage;
+                uint16_t usage;
+                int32_t low;
+                int32_t high;
+                int32_t value;
+                uint8_t reportType; // 0 if the device does not have the usage
+                uint8_t reportId;
+                uint8_t reportLen; // Report ID included
+                uint16_t offset; // Bit offset, report ID included
+                uint8_t size;
+                uint8_t flags; // PD_WATCH_*
+                uint8_t zone;
+        } __attribute__((packed));
+
+        PDWatch watches[PD_MAX_WATCHES];
+        uint8_t numWatches;
+        uint8_t bIface; // Interface with the watched usages, 0xFF if none
+        bool bReportIds; // The interface uses report IDs
+        bool bResolve; // Look the watched usages up again on the next Poll()
+        uint16_t wPollPeriod;
+        uint32_t qNextRound; // Start of the next round of reads
+        uint32_t qNextRequest;
+
+        void Resolve();
+        void UpdateReport(uint8_t type, uint8_t id, const uint8_t *buf, uint8_t len);
+        void UpdateValue(PDWatch *pw, int32_t value);
+
+protected:
+        uint8_t OnInitSuccessful();
+        void ParseHIDData(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+
+        virtual void OnValueChanged(uint16_t page __attribute__((unused)), uint16_t usage __attribute__((unused)), int32_t value __attribute__((unused))) {
+        };
+
+        virtual void OnThreshold(uint16_t page __attribute__((unused)), uint16_t usage __attribute__((unused)), int32_t value __attribute__((unused)), uint8_t zone __attribute__((unused))) {
+        };
+
+public:
+        HIDPowerDevice(USB *p);
+
+        uint8_t Release();
+        uint8_t Poll();
+
+        bool Watch(uint16_t page, uint16_t usage, int32_t low = PD_NO_LOW_LIMIT, int32_t high = PD_NO_HIGH_LIMIT);
+        void Unwatch();
+
+        // Returns false if the usage is not watched, the device does not have it or it was not read yet
+        bool GetValue(uint16_t page, uint16_t usage, int32_t *value);
+
+        // Time in ms between two rounds of feature reads
+        void SetPollPeriod(uint16_t period) {
+                wPollPeriod = period;
+        };
+
+        // Start a round of reads on the next Poll()
+        void RequestUpdate() {
+                qNextRound = (uint32_t)millis();
+        };
+
+        bool isPowerDevice() {
+                return isReady() && bIface != 0xFF;
+        };
+};
+
+#endif // __HIDPOWERDEVICE_H__
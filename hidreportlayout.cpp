@@ -0,0 +1,597 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "hidreportlayout.h"
+
+HIDReportLayout::HIDReportLayout(HID_REPORT_FIELD *pfields, uint8_t max_fields, HID_REPORT_INFO *preports, uint8_t max_reports) :
+fields(pfields),
+reports(preports),
+maxFields(max_fields),
+maxReports(max_reports) {
+        Reset();
+}
+
+void HIDReportLayout::Reset() {
+        numFields = 0;
+        numReports = 0;
+        bTruncated = false;
+}
+
+/* Reads the report descriptor of interface iface and compiles it */
+uint8_t HIDReportLayout::Compile(USBHID *hid, uint8_t iface) {
+        HIDReportDescCompiler compiler(this);
+
+        Reset();
+
+        uint8_t rcode = hid->GetReportDescr(iface, &compiler, HID_LAYOUT_DESCR_LENGTH);
+
+        if(rcode)
+                Reset();
+
+        return rcode;
+}
+
+HID_REPORT_INFO* HIDReportLayout::GetReportInfo(uint8_t id, bool add) {
+        for(uint8_t i = 0; i < numReports; i++)
+                if(reports[i].reportId == id)
+                        return &reports[i];
+
+        if(!add)
+                return NULL;
+
+        if(numReports >= maxReports) {
+                bTruncated = true;
+                return NULL;
+        }
+
+        HID_REPORT_INFO *pri = &reports[numReports++];
+
+        pri->reportId = id;
+        pri->bits[0] = pri->bits[1] = pri->bits[2] = 0;
+        return pri;
+}
+
+/* Returns the length in bytes of a report, including the report ID byte. Returns 0 if the report does not exist */
+uint16_t HIDReportLayout::GetReportLength(uint8_t id, uint8_t type) {
+        HID_REPORT_INFO *pri = GetReportInfo(id, false);
+
+        if(!pri || type < HID_REPORT_TYPE_INPUT || type > HID_REPORT_TYPE_FEATURE || !pri->bits[type - 1])
+                return 0;
+
+        return ((pri->bits[type - 1] + 7) >> 3) + (id ? 1 : 0);
+}
+
+/* Returns true if a field of the given type holds relative values, e.g. mouse motion */
+bool HIDReportLayout::HasRelativeFields(uint8_t type) {
+        for(uint8_t i = 0; i < numFields; i++)
+                if(fields[i].reportType == type && (fields[i].flags & HID_FIELD_RELATIVE))
+                        return true;
+
+        return false;
+}
+
+/* Returns the first field of the given type holding usage, index is set to the element */
+const HID_REPORT_FIELD* HIDReportLayout::FindField(uint8_t type, uint16_t page, uint16_t usage, uint8_t *index) {
+        for(uint8_t i = 0; i < numFields; i++) {
+                const HID_REPORT_FIELD *pf = &fields[i];
+
+                if(pf->reportType != type || pf->usagePage != page || usage < pf->usageMin || usage > pf->usageMax)
+                        continue;
+
+                if(index) {
+                        uint16_t n = usage - pf->usageMin;
+
+                        // Elements past usageMax repeat the last usage, so any index from here on is the same usage
+                        *index = ((pf->flags & HID_FIELD_VARIABLE) && n < pf->count) ? n : 0;
+                }
+                return pf;
+        }
+        return NULL;
+}
+
+/* Calls handler for every element of the report in buf. Returns the number of elements decoded */
+uint8_t HIDReportLayout::Decode(const uint8_t *buf, uint8_t len, HIDReportFieldHandler *handler, uint8_t type) {
+        uint8_t id = 0;
+        uint8_t n = 0;
+
+        if(HasReportIds()) {
+                if(!len)
+                        return 0;
+                id = *buf++;
+                len--;
+        }
+
+        for(uint8_t i = 0; i < numFields; i++) {
+                const HID_REPORT_FIELD *pf = &fields[i];
+
+                if(pf->reportId != id || pf->reportType != type)
+                        continue;
+
+                for(uint8_t j = 0; j < pf->count; j++, n++) {
+                        int32_t value = GetElement(pf, buf, len, j);
+                        uint16_t usage = (pf->flags & HID_FIELD_VARIABLE) ? GetElementUsage(pf, j) : GetArrayUsage(pf, value);
+
+                        handler->OnField(pf, j, usage, value);
+                }
+        }
+        return n;
+}
+
+/* Reads the value of one usage from an input report. For array fields the value is 1 if the usage is in the array, 0 if not.
+  Returns false if the report does not hold the usage */
+bool HIDReportLayout::GetValue(const uint8_t *buf, uint8_t len, uint16_t page, uint16_t usage, int32_t *value) {
+        uint8_t id = 0;
+
+        if(HasReportIds()) {
+                if(!len)
+                        return false;
+                id = *buf++;
+                len--;
+        }
+
+        for(uint8_t i = 0; i < numFields; i++) {
+                const HID_REPORT_FIELD *pf = &fields[i];
+
+                if(pf->reportId != id || pf->reportType != HID_REPORT_TYPE_INPUT || pf->usagePage != page || usage < pf->usageMin || usage > pf->usageMax)
+                        continue;
+
+                if(pf->flags & HID_FIELD_VARIABLE) {
+                        uint16_t n = usage - pf->usageMin;
+
+                        *value = GetElement(pf, buf, len, (n < pf->count) ? n : pf->count - 1);
+                        return true;
+                }
+
+                *value = 0;
+                for(uint8_t j = 0; j < pf->count; j++)
+                        if(GetArrayUsage(pf, GetElement(pf, buf, len, j)) == usage) {
+                                *value = 1;
+                                break;
+                        }
+                return true;
+        }
+        return false;
+}
+
+uint16_t HIDReportLayout::GetElementUsage(const HID_REPORT_FIELD *field, uint8_t index) {
+        uint16_t usage = field->usageMin + index;
+
+        return (usage > field->usageMax || usage < field->usageMin) ? field->usageMax : usage;
+}
+
+/* Value of element index, sign extended if the logical minimum is negative. data points to the report without the report ID byte */
+int32_t HIDReportLayout::GetElement(const HID_REPORT_FIELD *field, const uint8_t *data, uint8_t len, uint8_t index) {
+        uint32_t val = GetBits(data, len, field->offset + (uint16_t)index * field->size, field->size);
+
+        if(field->logicalMin < 0 && field->size < 32 && (val & ((uint32_t)1 << (field->size - 1))))
+                val |= ~(uint32_t)0 << field->size;
+
+        return (int32_t)val;
+}
+
+/* Usage selected by an array element, 0 if the value is out of the logical range */
+uint16_t HIDReportLayout::GetArrayUsage(const HID_REPORT_FIELD *field, int32_t value) {
+        if(value < field->logicalMin || value > field->logicalMax)
+                return 0;
+
+        uint32_t usage = field->usageMin + (uint32_t)(value - field->logicalMin);
+
+        return (usage > field->usageMax) ? 0 : usage;
+}
+
+/* Extracts size bits (1 to 32) starting at bit offset. Only the bytes holding the field are read, lowest byte first as
+  HID reports are little endian, and combined into one word which is shifted and masked once. Bytes past len read as 0 */
+uint32_t HIDReportLayout::GetBits(const uint8_t *buf, uint8_t len, uint16_t offset, uint8_t size) {
+        uint16_t i = offset >> 3;
+        uint8_t shift = offset & 7;
+        uint8_t nbytes = (shift + size + 7) >> 3;
+        uint32_t val = 0;
+
+        if(!size || size > 32 || i >= len)
+                return 0;
+
+        for(uint8_t b = (nbytes > 4) ? 4 : nbytes; b; b--) {
+                val <<= 8;
+                if(i + b - 1 < len)
+                        val |= buf[i + b - 1];
+        }
+        val >>= shift;
+
+        if(nbytes > 4 && i + 4 < len) // Field of more than 25 bits not starting at a byte boundary
+                val |= (uint32_t)buf[i + 4] << (32 - shift);
+
+        if(size < 32)
+                val &= ((uint32_t)1 << size) - 1;
+
+        return val;
+}
+
+/* Writes the low size bits (1 to 32) of value at bit offset, e.g. to build an output or feature report. Bits past len are dropped */
+void HIDReportLayout::SetBits(uint8_t *buf, uint8_t len, uint16_t offset, uint8_t size, uint32_t value) {
+        if(!size || size > 32)
+                return;
+
+        for(uint8_t n = 0; n < size; n++, offset++) {
+                uint16_t i = offset >> 3;
+
+                if(i >= len)
+                        return;
+
+                if(value & ((uint32_t)1 << n))
+                        buf[i] |= (1 << (offset & 7));
+                else
+                        buf[i] &= ~(1 << (offset & 7));
+        }
+}
+
+HIDReportDescCompiler::HIDReportDescCompiler(HIDReportLayout *layout) :
+pLayout(layout),
+itemState(0),
+itemPrefix(0),
+itemLeft(0),
+itemSize(0),
+itemData(0),
+stackDepth(0) {
+        memset(&global, 0, sizeof(global));
+        ClearLocals();
+}
+
+void HIDReportDescCompiler::ClearLocals() {
+        numUsages = 0;
+        usageExt = 0;
+        usageMin = 0;
+        usageMax = 0;
+        usageMinMax = 0;
+}
+
+void HIDReportDescCompiler::Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset __attribute__((unused))) {
+        for(uint16_t i = 0; i < len; i++) {
+                uint8_t b = pbuf[i];
+
+                switch(itemState) {
+                        case 0: // Item prefix
+                                itemPrefix = b;
+                                itemData = 0;
+                                if(b == HID_LONG_ITEM_PREFIX) {
+                                        itemState = 2;
+                                        break;
+                                }
+                                itemSize = itemLeft = ((b & DATA_SIZE_MASK) == DATA_SIZE_4) ? 4 : (b & DATA_SIZE_MASK);
+                                if(itemLeft)
+                                        itemState = 1;
+                                else
+                                        OnItem();
+                                break;
+                        case 1: // Item data, little endian
+                                itemData |= (uint32_t)b << ((itemSize - itemLeft) << 3);
+                                if(!--itemLeft) {
+                                        itemState = 0;
+                                        OnItem();
+                                }
+                                break;
+                        case 2: // Long items are not used by any defined usage, they are skipped
+                                itemLeft = b;
+                                itemState = 3;
+                                break;
+                        case 3: // Long item tag
+                                itemState = itemLeft ? 4 : 0;
+                                break;
+                        case 4:
+                                if(!--itemLeft)
+                                        itemState = 0;
+                                break;
+                }
+        }
+}
+
+void HIDReportDescCompiler::OnItem() {
+        int32_t sdata = itemData; // Signed value of the data
+
+        if(itemSize == 1)
+                sdata = (int8_t)itemData;
+        else if(itemSize == 2)
+                sdata = (int16_t)itemData;
+
+        switch(itemPrefix & TYPE_MASK) {
+                case TYPE_MAIN:
+                        switch(itemPrefix & TAG_MASK) {
+                                case TAG_MAIN_INPUT:
+                                        OnMainItem(HID_REPORT_TYPE_INPUT, itemData);
+                                        break;
+                                case TAG_MAIN_OUTPUT:
+                                        OnMainItem(HID_REPORT_TYPE_OUTPUT, itemData);
+                                        break;
+                                case TAG_MAIN_FEATURE:
+                                        OnMainItem(HID_REPORT_TYPE_FEATURE, itemData);
+                                        break;
+                        }
+                        ClearLocals(); // Every main item, collections included, ends the local items
+                        break;
+                case TYPE_GLOBAL:
+                        switch(itemPrefix & TAG_MASK) {
+                                case TAG_GLOBAL_USAGEPAGE:
+                                        global.usagePage = itemData;
+                                        break;
+                                case TAG_GLOBAL_LOGICALMIN:
+                                        global.logicalMin = sdata;
+                                        break;
+                                case TAG_GLOBAL_LOGICALMAX:
+                                        // A maximum of e.g. 0xFF in one byte with a minimum of 0 is common and meant unsigned
+                                        global.logicalMax = (sdata < 0 && global.logicalMin >= 0) ? (int32_t)itemData : sdata;
+                                        break;
+                                case TAG_GLOBAL_REPORTSIZE:
+                                        global.reportSize = (itemData > 0xFF) ? 0 : itemData;
+                                        break;
+                                case TAG_GLOBAL_REPORTID:
+                                        global.reportId = itemData;
+                                        break;
+                                case TAG_GLOBAL_REPORTCOUNT:
+                                        global.reportCount = itemData;
+                                        break;
+                                case TAG_GLOBAL_PUSH:
+                                        if(stackDepth < HID_LAYOUT_STACK_DEPTH)
+                                                globalStack[stackDepth++] = global;
+                                        break;
+                                case TAG_GLOBAL_POP:
+                                        if(stackDepth)
+                                                global = globalStack[--stackDepth];
+                                        break;
+                        }
+                        break;
+                case TYPE_LOCAL:
+                        switch(itemPrefix & TAG_MASK) {
+                                case TAG_LOCAL_USAGE:
+                                        if(numUsages < HID_LAYOUT_MAX_USAGES) {
+                                                if(itemSize == 4)
+                                                        usageExt |= (1 << numUsages);
+                                                usages[numUsages++] = itemData;
+                                        }
+                                        break;
+                                case TAG_LOCAL_USAGEMIN:
+                                        usageMin = itemData;
+                                        usageMinMax |= (itemSize == 4) ? 0x05 : 0x01;
+                                        break;
+                                case TAG_LOCAL_USAGEMAX:
+                                        usageMax = itemData;
+                                        usageMinMax |= (itemSize == 4) ? 0x0A : 0x02;
+                                        break;
+                        }
+                        break;
+        }
+}
+
+/* Usage of element index of the current main item with the usage page in the high word */
+uint32_t HIDReportDescCompiler::GetUsage(uint16_t index) {
+        uint32_t usage = 0;
+        bool ext = false;
+
+        if(usageMinMax & 0x01) {
+                uint32_t max = (usageMinMax & 0x02) ? usageMax : usageMin;
+
+                usage = usageMin + index;
+                if(usage > max)
+                        usage = max;
+                ext = (usageMinMax & 0x04);
+        } else if(numUsages) {
+                if(index >= numUsages)
+                        index = numUsages - 1;
+                usage = usages[index];
+                ext = (usageExt & (1 << index));
+        }
+
+        if(!ext)
+                usage = ((uint32_t)global.usagePage << 16) | (usage & 0xFFFF);
+
+        return usage;
+}
+
+void HIDReportDescCompiler::OnMainItem(uint8_t type, uint8_t flags) {
+        HID_REPORT_INFO *pri = pLayout->GetReportInfo(global.reportId, true);
+
+        if(!pri)
+                return;
+
+        uint16_t offset = pri->bits[type - 1];
+        uint16_t count = global.reportCount;
+
+        pri->bits[type - 1] += (uint16_t)global.reportSize * count;
+
+        // Padding and fields which do not fit in 32 bits only take up space
+        if((flags & HID_FIELD_CONSTANT) || !global.reportSize || global.reportSize > 32 || !count)
+                return;
+
+        if(!(flags & HID_FIELD_VARIABLE)) {
+                uint32_t last;
+
+                if(usageMinMax & 0x02)
+                        last = (usageMinMax & 0x08) ? usageMax : (((uint32_t)global.usagePage << 16) | (usageMax & 0xFFFF));
+                else
+                        last = GetUsage(numUsages ? numUsages - 1 : 0);
+
+                AddField(type, flags, offset, count, GetUsage(0), last);
+                return;
+        }
+
+        // Variable items get one field per run of consecutive usages, a repeated last usage is part of the run
+        for(uint16_t i = 0; i < count;) {
+                uint16_t start = i;
+                uint32_t first = GetUsage(i++);
+                uint32_t last = first;
+
+                while(i < count && GetUsage(i) == last + 1)
+                        last = GetUsage(i++);
+                while(i < count && GetUsage(i) == last)
+                        i++;
+
+                AddField(type, flags, offset + start * global.reportSize, i - start, first, last);
+        }
+}
+
+void HIDReportDescCompiler::AddField(uint8_t type, uint8_t flags, uint16_t offset, uint16_t count, uint32_t first, uint32_t last) {
+        while(count) {
+                HID_REPORT_FIELD field;
+                uint8_t n = (count > 0xFF) ? 0xFF : count;
+
+                field.reportId = global.reportId;
+                field.reportType = type;
+                field.flags = flags;
+                field.size = global.reportSize;
+                field.count = n;
+                field.offset = offset;
+                field.usagePage = first >> 16;
+                field.usageMin = first;
+                field.usageMax = ((last >> 16) == (first >> 16) && last >= first) ? (uint16_t)last : (uint16_t)first;
+                field.logicalMin = global.logicalMin;
+                field.logicalMax = global.logicalMax;
+
+                if(pLayout->IsFieldWanted(&field)) {
+                        if(pLayout->numFields >= pLayout->maxFields) {
+                                pLayout->bTruncated = true;
+                                return;
+                        }
+                        pLayout->fields[pLayout->numFields++] = field;
+                }
+
+                // Rest of a field with more than 255 elements
+                count -= n;
+                offset += (uint16_t)n * global.reportSize;
+                if(flags & HID_FIELD_VARIABLE)
+                        first = (first + n > last) ? last : first + n;
+        }
+}
+
+HIDUsageReportParser::HIDUsageReportParser() :
+numSubs(0),
+bIface(0),
+bAddress(0),
+bCompiled(false),
+bCompileTries(0),
+bRelative(false) {
+}
+
+void HIDUsageReportParser::Reset() {
+        bCompiled = false;
+        bCompileTries = 0;
+        bRelative = false;
+}
+
+/* Watches usageMin to usageMax on the given page. Returns false if the subscription table is too small */
+bool HIDUsageReportParser::Subscribe(uint16_t page, uint16_t usageMin, uint16_t usageMax) {
+        if(usageMax < usageMin || (uint32_t)usageMax - usageMin >= (uint32_t)(HID_MAX_SUBSCRIPTIONS - numSubs))
+                return false;
+
+        for(uint32_t usage = usageMin; usage <= usageMax; usage++) {
+                Subscription *ps = &subs[numSubs++];
+
+                ps->usagePage = page;
+                ps->usage = (uint16_t)usage;
+                ps->field = HID_NO_FIELD;
+                ps->index = 0;
+                ps->value = 0;
+
+                if(bCompiled)
+                        Resolve(ps);
+        }
+        return true;
+}
+
+void HIDUsageReportParser::Unsubscribe() {
+        numSubs = 0;
+}
+
+// Last value of a subscribed usage
+bool HIDUsageReportParser::GetValue(uint16_t page, uint16_t usage, int32_t *value) {
+        for(uint8_t i = 0; i < numSubs; i++)
+                if(subs[i].usagePage == page && subs[i].usage == usage) {
+                        *value = subs[i].value;
+                        return true;
+                }
+        return false;
+}
+
+void HIDUsageReportParser::Resolve(Subscription *ps) {
+        const HID_REPORT_FIELD *pf = layout.FindField(HID_REPORT_TYPE_INPUT, ps->usagePage, ps->usage, &ps->index);
+
+        ps->field = (pf) ? (uint8_t)(pf - layout.GetField(0)) : HID_NO_FIELD;
+        ps->value = 0;
+}
+
+int32_t HIDUsageReportParser::GetSubscribedValue(const Subscription *ps, const uint8_t *data, uint8_t len) {
+        const HID_REPORT_FIELD *pf = layout.GetField(ps->field);
+
+        if(pf->flags & HID_FIELD_VARIABLE)
+                return HIDReportLayout::GetElement(pf, data, len, ps->index);
+
+        for(uint8_t j = 0; j < pf->count; j++)
+                if(HIDReportLayout::GetArrayUsage(pf, HIDReportLayout::GetElement(pf, data, len, j)) == ps->usage)
+                        return 1;
+        return 0;
+}
+
+void HIDUsageReportParser::Parse(USBHID *hid, bool is_rpt_id __attribute__((unused)), uint8_t len, uint8_t *buf) {
+        uint8_t addr = hid->GetAddress();
+
+        if(addr != bAddress)
+                Reset();
+        // The layout is compiled once per device, the driver calls Reset() when the device goes away. If reading
+        // the descriptor fails it is tried again on the next reports, until then no usage is reported
+        if(!bCompiled && bCompileTries < HID_LAYOUT_COMPILE_TRIES) {
+                bAddress = addr;
+                if(layout.Compile(hid, bIface))
+                        bCompileTries++;
+                else
+                        bCompiled = true;
+
+                bRelative = layout.HasRelativeFields();
+
+                for(uint8_t i = 0; i < numSubs; i++)
+                        Resolve(&subs[i]);
+        }
+
+        uint8_t id = 0;
+
+        if(layout.HasReportIds()) {
+                if(!len)
+                        return;
+                id = *buf++;
+                len--;
+        }
+
+        for(uint8_t i = 0; i < numSubs; i++) {
+                Subscription *ps = &subs[i];
+
+                if(ps->field == HID_NO_FIELD)
+                        continue;
+
+                const HID_REPORT_FIELD *pf = layout.GetField(ps->field);
+
+                if(pf->reportId != id)
+                        continue;
+
+                int32_t value = GetSubscribedValue(ps, buf, len);
+                int32_t old = ps->value;
+
+                if(value == old && !((pf->flags & HID_FIELD_RELATIVE) && value))
+                        continue;
+
+                ps->value = value;
+
+                if(ps->usagePage == HID_USAGE_PAGE_BUTTON)
+                        OnButtonChanged(ps->usage, value != 0);
+                else
+                        OnValueChanged(ps->usagePage, ps->usage, old, value);
+        }
+}
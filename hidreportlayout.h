@@ -0,0 +1,275 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__HIDREPORTLAYOUT_H__)
+#define __HIDREPORTLAYOUT_H__
+
+#include "usbhid.h"
+
+#ifndef HID_LAYOUT_MAX_FIELDS
+#define HID_LAYOUT_MAX_FIELDS           16      // Fields in a compiled report descriptor, 21 bytes of RAM each. Default size of HIDReportLayoutT
+#endif
+
+#ifndef HID_LAYOUT_MAX_REPORTS
+#define HID_LAYOUT_MAX_REPORTS          8       // Report IDs in a compiled report descriptor, 7 bytes of RAM each. Default size of HIDReportLayoutT
+#endif
+
+#ifndef HID_MAX_SUBSCRIPTIONS
+#define HID_MAX_SUBSCRIPTIONS           24      // Usages a HIDUsageReportParser can watch, 10 bytes of RAM each
+#endif
+
+#define HID_LAYOUT_MAX_USAGES           8       // Usage items kept per main item while compiling
+#define HID_LAYOUT_STACK_DEPTH          2       // Push items kept while compiling
+#define HID_LAYOUT_DESCR_LENGTH         1024    // wLength used to read the report descriptor
+
+#define HID_NO_FIELD                    0xFF
+
+/* Usage pages */
+#define HID_USAGE_PAGE_GENERIC_DESKTOP  0x01
+#define HID_USAGE_PAGE_KEYBOARD         0x07
+#define HID_USAGE_PAGE_LED              0x08
+#define HID_USAGE_PAGE_BUTTON           0x09
+#define HID_USAGE_PAGE_CONSUMER         0x0C
+#define HID_USAGE_PAGE_DIGITIZER        0x0D
+#define HID_USAGE_PAGE_POWER_DEVICE     0x84
+#define HID_USAGE_PAGE_BATTERY_SYSTEM   0x85
+
+/* Field flags, the data bits of the Input, Output or Feature item */
+#define HID_FIELD_CONSTANT              0x01
+#define HID_FIELD_VARIABLE              0x02    // Otherwise the field is an array of usage indexes
+#define HID_FIELD_RELATIVE              0x04
+#define HID_FIELD_WRAP                  0x08
+#define HID_FIELD_NONLINEAR             0x10
+#define HID_FIELD_NO_PREFERRED          0x20
+#define HID_FIELD_NULL_STATE            0x40
+#define HID_FIELD_VOLATILE              0x80
+
+/* One Input, Output or Feature item, or a part of it with consecutive usages.
+   Element i of the field has usage usageMin + i, limited to usageMax. Elements of an array field hold
+   an index, usage = usageMin + value - logicalMin */
+typedef struct {
+        uint8_t reportId; // 0 if the device does not use report IDs
+        uint8_t reportType; // HID_REPORT_TYPE_INPUT, HID_REPORT_TYPE_OUTPUT or HID_REPORT_TYPE_FEATURE
+        uint8_t flags; // HID_FIELD_*
+        uint8_t size; // Size of one element in bits
+        uint8_t count; // Number of elements
+        uint16_t offset; // Bit offset of the first element, not counting the report ID byte
+        uint16_t usagePage;
+        uint16_t usageMin;
+        uint16_t usageMax;
+        int32_t logicalMin;
+        int32_t logicalMax;
+} __attribute__((packed)) HID_REPORT_FIELD;
+
+/* Length of the three report types of one report ID */
+typedef struct {
+        uint8_t reportId;
+        uint16_t bits[3]; // Input, Output and Feature report size in bits, not counting the report ID byte
+} __attribute__((packed)) HID_REPORT_INFO;
+
+// Called by HIDReportLayout::Decode for every element of the report
+class HIDReportFieldHandler {
+public:
+        virtual void OnField(const HID_REPORT_FIELD *field, uint8_t index, uint16_t usage, int32_t value) = 0;
+};
+
+/* Table of the fields of a report descriptor, built once by HIDReportDescCompiler and used to decode reports.
+   The tables are provided by HIDReportLayoutT, which sets their size */
+class HIDReportLayout {
+        friend class HIDReportDescCompiler;
+
+        HID_REPORT_FIELD *fields;
+        HID_REPORT_INFO *reports;
+        uint8_t maxFields;
+        uint8_t maxReports;
+        uint8_t numFields;
+        uint8_t numReports;
+        bool bTruncated; // Fields or report IDs were dropped, the tables are too small
+
+        HID_REPORT_INFO* GetReportInfo(uint8_t id, bool add);
+
+protected:
+        HIDReportLayout(HID_REPORT_FIELD *pfields, uint8_t max_fields, HID_REPORT_INFO *preports, uint8_t max_reports);
+
+        // Called while compiling, a derived layout can drop the fields it does not need to save RAM
+        virtual bool IsFieldWanted(const HID_REPORT_FIELD *field __attribute__((unused))) {
+                return true;
+        };
+
+public:
+
+        void Reset();
+        uint8_t Compile(USBHID *hid, uint8_t iface);
+
+        uint8_t GetNumFields() {
+                return numFields;
+        };
+
+        const HID_REPORT_FIELD* GetField(uint8_t index) {
+                return (index < numFields) ? &fields[index] : NULL;
+        };
+
+        bool HasReportIds() {
+                return numReports && reports[0].reportId;
+        };
+
+        bool IsTruncated() {
+                return bTruncated;
+        };
+
+        uint16_t GetReportLength(uint8_t id, uint8_t type);
+        bool HasRelativeFields(uint8_t type = HID_REPORT_TYPE_INPUT);
+        const HID_REPORT_FIELD* FindField(uint8_t type, uint16_t page, uint16_t usage, uint8_t *index);
+
+        uint8_t Decode(const uint8_t *buf, uint8_t len, HIDReportFieldHandler *handler, uint8_t type = HID_REPORT_TYPE_INPUT);
+        bool GetValue(const uint8_t *buf, uint8_t len, uint16_t page, uint16_t usage, int32_t *value);
+
+        static uint16_t GetElementUsage(const HID_REPORT_FIELD *field, uint8_t index);
+        static int32_t GetElement(const HID_REPORT_FIELD *field, const uint8_t *data, uint8_t len, uint8_t index);
+        static uint16_t GetArrayUsage(const HID_REPORT_FIELD *field, int32_t value);
+        static uint32_t GetBits(const uint8_t *buf, uint8_t len, uint16_t offset, uint8_t size);
+        static void SetBits(uint8_t *buf, uint8_t len, uint16_t offset, uint8_t size, uint32_t value);
+};
+
+// Layout with room for MAX_FIELDS fields and MAX_REPORTS report IDs
+template <const uint8_t MAX_FIELDS = HID_LAYOUT_MAX_FIELDS, const uint8_t MAX_REPORTS = HID_LAYOUT_MAX_REPORTS>
+class HIDReportLayoutT : public HIDReportLayout {
+        HID_REPORT_FIELD fieldTable[MAX_FIELDS];
+        HID_REPORT_INFO reportTable[MAX_REPORTS];
+
+public:
+        HIDReportLayoutT() : HIDReportLayout(fieldTable, MAX_FIELDS, reportTable, MAX_REPORTS) {
+        };
+};
+
+// Compiles a report descriptor read with USBHID::GetReportDescr into a HIDReportLayout
+class HIDReportDescCompiler : public USBReadParser {
+
+        struct GlobalItems {
+                uint16_t usagePage;
+                int32_t logicalMin;
+                int32_t logicalMax;
+                uint8_t reportSize;
+                uint8_t reportId;
+                uint16_t reportCount;
+        };
+
+        HIDReportLayout *pLayout;
+
+        uint8_t itemState; // Item parser state
+        uint8_t itemPrefix; // Item prefix (first byte)
+        uint8_t itemLeft; // Data bytes of the item still to read
+        uint8_t itemSize; // Data bytes of the item
+        uint32_t itemData;
+
+        GlobalItems global;
+        GlobalItems globalStack[HID_LAYOUT_STACK_DEPTH];
+        uint8_t stackDepth;
+
+        uint32_t usages[HID_LAYOUT_MAX_USAGES]; // Usages with the page in the high word, if given as extended usage
+        uint8_t usageExt; // Bit mask, usage i was an extended usage
+        uint8_t numUsages;
+        uint32_t usageMin;
+        uint32_t usageMax;
+        uint8_t usageMinMax; // Bit 0 usage minimum, bit 1 usage maximum seen, bit 2 and 3 they were extended usages
+
+        void OnItem();
+        void OnMainItem(uint8_t type, uint8_t flags);
+        uint32_t GetUsage(uint16_t index);
+        void AddField(uint8_t type, uint8_t flags, uint16_t offset, uint16_t count, uint32_t first, uint32_t last);
+        void ClearLocals();
+
+public:
+        HIDReportDescCompiler(HIDReportLayout *layout);
+
+        void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset);
+};
+
+/*
+ * Report parser that only decodes the usages the application subscribed to:
+ *
+ *      Parser.Subscribe(0x01, 0x30, 0x32); // Generic Desktop X, Y and Z
+ *      Parser.Subscribe(0x09, 1, 16);      // Buttons 1 to 16
+ *
+ * The report descriptor is compiled on the first report and every subscribed usage is resolved to its
+ * field and element once, so a report costs one extraction per subscribed usage no matter how large it is.
+ * Derived classes get a callback when a value changes. Relative values (e.g. mouse movement) are passed on
+ * whenever they are not zero, and the driver does not drop repeated reports of a device that has them. A usage that is sent in an array field (e.g. keyboard keys) has the value 1
+ * while it is in the report and 0 otherwise.
+ */
+class HIDUsageReportParser : public HIDReportParser {
+
+        struct Subscription {
+                uint16_t usagePage;
+                uint16_t usage;
+                uint8_t field; // Index in the layout, HID_NO_FIELD if the device does not send the usage
+                uint8_t index; // Element of a variable field
+                int32_t value;
+        } __attribute__((packed));
+
+        HIDReportLayoutT<> layout;
+        Subscription subs[HID_MAX_SUBSCRIPTIONS];
+        uint8_t numSubs;
+        uint8_t bIface; // Interface to read the report descriptor from
+        uint8_t bAddress; // Address of the device the layout was compiled for
+        bool bCompiled;
+        uint8_t bCompileTries; // Failed reads of the report descriptor
+        bool bRelative; // The layout has relative input fields
+
+        void Resolve(Subscription *ps);
+        int32_t GetSubscribedValue(const Subscription *ps, const uint8_t *data, uint8_t len);
+
+protected:
+        virtual void OnValueChanged(uint16_t page __attribute__((unused)), uint16_t usage __attribute__((unused)), int32_t oldValue __attribute__((unused)), int32_t newValue __attribute__((unused))) {
+        };
+
+        // Called instead of OnValueChanged for usages on the Button page, button is the usage (1 = primary button)
+        virtual void OnButtonChanged(uint16_t button __attribute__((unused)), bool pressed __attribute__((unused))) {
+        };
+
+public:
+        HIDUsageReportParser();
+
+        void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+
+        bool Subscribe(uint16_t page, uint16_t usageMin, uint16_t usageMax);
+
+        bool Subscribe(uint16_t page, uint16_t usage) {
+                return Subscribe(page, usage, usage);
+        };
+
+        void Unsubscribe();
+        bool GetValue(uint16_t page, uint16_t usage, int32_t *value);
+
+        // Interface the reports come from, needed for devices with more than one HID interface
+        void SetInterface(uint8_t iface) {
+                bIface = iface;
+                Reset();
+        };
+
+        // Compile the report descriptor again on the next report, called by the driver when the device is released
+        void Reset();
+
+        bool WantsRepeatedReports() {
+                return bRelative;
+        };
+
+        HIDReportLayout* GetLayout() {
+                return &layout;
+        };
+};
+
+#endif // __HIDREPORTLAYOUT_H__
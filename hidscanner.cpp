@@ -0,0 +1,131 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "hidscanner.h"
+
+HIDScannerParser::HIDScannerParser() :
+tail(0),
+head(0),
+cur(0),
+numLines(0),
+bOverflow(false),
+bTerminator(UHS_HID_BOOT_KEY_ENTER),
+timeout(HID_SCANNER_TIMEOUT),
+firstKeyTime(0),
+lastKeyTime(0) {
+        memset(&stats, 0, sizeof (stats));
+}
+
+void HIDScannerParser::Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf) {
+        CheckTimeout();
+        KeyboardReportParser::Parse(hid, is_rpt_id, len, buf);
+}
+
+void HIDScannerParser::OnKeyDown(uint8_t mod, uint8_t key) {
+        // Keypad Enter ends a line like Enter
+        if(bTerminator && (key == bTerminator || (bTerminator == UHS_HID_BOOT_KEY_ENTER && key == 0x58))) {
+                EndLine();
+                return;
+        }
+
+        char str[7];
+        uint8_t n = OemToUtf8(mod, key, str);
+
+        if(!n)
+                return;
+
+        lastKeyTime = (uint32_t)micros();
+
+        if(cur == head)
+                firstKeyTime = lastKeyTime;
+
+        for(uint8_t i = 0; i < n; i++)
+                Put(str[i]);
+}
+
+void HIDScannerParser::Put(char c) {
+        // Keep one byte free for the end of the line
+        if(Next(Next(cur)) == tail || Next(cur) == tail) {
+                bOverflow = true;
+                return;
+        }
+        ring[cur] = c;
+        cur = Next(cur);
+}
+
+void HIDScannerParser::EndLine() {
+        if(cur == head)
+                return;
+
+        if(bOverflow) {
+                // The whole line is dropped rather than returning a partial code
+                cur = head;
+                bOverflow = false;
+                stats.dropped++;
+                return;
+        }
+
+        uint32_t duration = lastKeyTime - firstKeyTime;
+
+        stats.lastLength = (cur >= head) ? cur - head : cur + HID_SCANNER_BUFFER_SIZE - head;
+        stats.lastDuration = duration;
+        if(duration > stats.maxDuration)
+                stats.maxDuration = duration;
+        stats.scans++;
+
+        ring[cur] = '\0';
+        cur = Next(cur);
+        head = cur;
+        numLines++;
+}
+
+void HIDScannerParser::CheckTimeout() {
+        if(cur != head && (uint32_t)micros() - lastKeyTime >= (uint32_t)timeout * 1000)
+                EndLine();
+}
+
+// Number of complete lines waiting to be read
+uint8_t HIDScannerParser::Available() {
+        CheckTimeout();
+        return numLines;
+}
+
+/* Copies the oldest line to str and removes it from the buffer. A line longer than size - 1 is cut.
+   Returns the length of the string, 0 if there is no line */
+uint8_t HIDScannerParser::ReadLine(char *str, uint8_t size) {
+        if(!Available() || !size)
+                return 0;
+
+        uint8_t n = 0;
+
+        while(ring[tail]) {
+                if(n < size - 1)
+                        str[n++] = ring[tail];
+                tail = Next(tail);
+        }
+        tail = Next(tail);
+        numLines--;
+
+        str[n] = '\0';
+        return n;
+}
+
+// Drops all lines, including the one being scanned
+void HIDScannerParser::Flush() {
+        tail = head = cur = 0;
+        numLines = 0;
+        bOverflow = false;
+}
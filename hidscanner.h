@@ -0,0 +1,100 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__HIDSCANNER_H__)
+#define __HIDSCANNER_H__
+
+#include "hidboot.h"
+
+#ifndef HID_SCANNER_BUFFER_SIZE
+#define HID_SCANNER_BUFFER_SIZE         128     // Bytes of scanned lines waiting to be read, at most 255
+#endif
+
+#define HID_SCANNER_TIMEOUT             50      // Default time in ms without a key that ends a scan
+
+typedef struct {
+        uint32_t scans; // Lines put in the buffer
+        uint32_t dropped; // Lines lost because the buffer was full
+        uint32_t lastDuration; // Time from the first to the last key of the last scan in us
+        uint32_t maxDuration;
+        uint8_t lastLength; // Bytes in the last line
+} HID_SCANNER_STATS;
+
+/*
+ * Parser for barcode scanners that emulate a keyboard. Keys are collected into lines in a ring buffer,
+ * a line ends with the terminator key (Enter by default) or when no key arrives for the timeout.
+ * The application reads complete lines with ReadLine() instead of handling every key:
+ *
+ *      HIDBoot<USB_HID_PROTOCOL_KEYBOARD> Scanner(&Usb);
+ *      HIDScannerParser Prs;
+ *      ...
+ *      Scanner.SetReportParser(0, &Prs);
+ *      ...
+ *      char code[32];
+ *      if(Prs.ReadLine(code, sizeof (code)))
+ *              Serial.println(code);
+ *
+ * Text is stored as UTF-8 using the keymap of KeyboardReportParser.
+ */
+class HIDScannerParser : public KeyboardReportParser {
+        char ring[HID_SCANNER_BUFFER_SIZE];
+        uint8_t tail; // First byte of the oldest line
+        uint8_t head; // End of the last complete line
+        uint8_t cur; // End of the line being scanned
+        uint8_t numLines;
+        bool bOverflow; // The line being scanned did not fit
+
+        uint8_t bTerminator; // Keyboard page usage that ends a line, 0 to use the timeout only
+        uint16_t timeout;
+        uint32_t firstKeyTime; // micros() of the first key of the line being scanned
+        uint32_t lastKeyTime; // micros() of the last key
+
+        HID_SCANNER_STATS stats;
+
+        static uint8_t Next(uint8_t i) {
+                return (i + 1 < HID_SCANNER_BUFFER_SIZE) ? i + 1 : 0;
+        };
+
+        void Put(char c);
+        void EndLine();
+        void CheckTimeout();
+
+protected:
+        void OnKeyDown(uint8_t mod, uint8_t key);
+
+public:
+        HIDScannerParser();
+
+        void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf);
+
+        uint8_t Available();
+        uint8_t ReadLine(char *str, uint8_t size);
+        void Flush();
+
+        void SetTerminator(uint8_t key) {
+                bTerminator = key;
+        };
+
+        void SetTimeout(uint16_t ms) {
+                timeout = ms;
+        };
+
+        const HID_SCANNER_STATS* GetStats() {
+                return &stats;
+        };
+};
+
+#endif // __HIDSCANNER_H__
@@ -19,9 +19,9 @@ e-mail   :  support@circuitsathome.com
 
 HIDUniversal::HIDUniversal(USB *p) :
 USBHID(p),
-qNextPollTime(0),
-pollInterval(0),
+bPollFirst(0),
 bPollEnable(false),
+bFilterReports(true),
 bHasReportId(false) {
         Initialize();
 
@@ -52,8 +52,10 @@ void HIDUniversal::Initialize() {
         for(uint8_t i = 0; i < maxHidInterfaces; i++) {
                 hidInterfaces[i].bmInterface = 0;
                 hidInterfaces[i].bmProtocol = 0;
+                hidInterfaces[i].pollInterval = 0;
+                hidInterfaces[i].qNextPollTime = 0;
 
-                for(uint8_t j = 0; j < maxEpPerInterface; j++)
+                for(uint8_t j = 0; j <= maxEpPerInterface; j++)
                         hidInterfaces[i].epIndex[j] = 0;
         }
         for(uint8_t i = 0; i < totalEndpoints; i++) {
@@ -66,9 +68,7 @@ void HIDUniversal::Initialize() {
         bNumEP = 1;
         bNumIface = 0;
         bConfNum = 0;
-        pollInterval = 0;
-
-        ZeroMemory(constBuffLen, prevBuf);
+        bNumRptStates = 0;
 }
 
 bool HIDUniversal::SetReportParser(uint8_t id, HIDReportParser *prs) {
@@ -308,10 +308,17 @@ void HIDUniversal::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
 
         // Fill in interface structure in case of new interface
         if(!piface) {
+                if(bNumIface >= maxHidInterfaces)
+                        return;
+
                 piface = hidInterfaces + bNumIface;
                 piface->bmInterface = iface;
                 piface->bmAltSet = alt;
                 piface->bmProtocol = proto;
+                piface->pollInterval = 0;
+                piface->qNextPollTime = 0;
+                piface->epIndex[epInterruptInIndex] = 0;
+                piface->epIndex[epInterruptOutIndex] = 0;
                 bNumIface++;
         }
 
@@ -329,8 +336,8 @@ void HIDUniversal::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
                 // Fill in the endpoint index list
                 piface->epIndex[index] = bNumEP; //(pep->bEndpointAddress & 0x0F);
 
-                if(pollInterval < pep->bInterval) // Set the polling interval as the largest polling interval obtained from endpoints
-                        pollInterval = pep->bInterval;
+                if(index == epInterruptInIndex) // Each IN endpoint is polled at its own interval
+                        piface->pollInterval = pep->bInterval;
 
                 bNumEP++;
         }
@@ -339,87 +346,136 @@ void HIDUniversal::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint
 
 uint8_t HIDUniversal::Release() {
         pUsb->GetAddressPool().FreeAddress(bAddress);
+        ClearOutputQueue();
+
+        for(uint8_t i = 0; i < MAX_REPORT_PARSERS; i++)
+                if(rptParsers[i].rptParser)
+                        rptParsers[i].rptParser->Reset();
 
         bNumEP = 1;
+        bNumIface = 0;
+        bNumRptStates = 0;
         bAddress = 0;
-        qNextPollTime = 0;
         bPollEnable = false;
         return 0;
 }
 
-bool HIDUniversal::BuffersIdentical(uint8_t len, uint8_t *buf1, uint8_t *buf2) {
-        for(uint8_t i = 0; i < len; i++)
-                if(buf1[i] != buf2[i])
-                        return false;
-        return true;
-}
-
 void HIDUniversal::ZeroMemory(uint8_t len, uint8_t *buf) {
         for(uint8_t i = 0; i < len; i++)
                 buf[i] = 0;
 }
 
-void HIDUniversal::SaveBuffer(uint8_t len, uint8_t *src, uint8_t *dest) {
-        for(uint8_t i = 0; i < len; i++)
-                dest[i] = src[i];
+/* Returns false if the report is the same as the last one with the same interface and report ID.
+   Reports are compared byte by byte with the copy kept of the last one */
+bool HIDUniversal::IsReportChanged(uint8_t iface, uint8_t rptId, uint8_t len, uint8_t *buf) {
+        ReportState *ps = NULL;
+
+        for(uint8_t i = 0; i < bNumRptStates; i++)
+                if(rptStates[i].iface == iface && rptStates[i].rptId == rptId) {
+                        ps = rptStates + i;
+                        break;
+                }
+
+        if(!ps) {
+                if(bNumRptStates >= maxReportStates)
+                        return true; // No room to remember this one, pass every report on
+                ps = rptStates + bNumRptStates++;
+                ps->iface = iface;
+                ps->rptId = rptId;
+        } else if(ps->len == len && !memcmp(ps->data, buf, len))
+                return false;
+
+        ps->len = len;
+        memcpy(ps->data, buf, len);
+        return true;
 }
 
 uint8_t HIDUniversal::Poll() {
         uint8_t rcode = 0;
 
-        if(!bPollEnable)
+        if(!bPollEnable || !bNumIface)
                 return 0;
 
-        if((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L) {
-                qNextPollTime = (uint32_t)millis() + pollInterval;
+        uint8_t buf[constBuffLen];
+
+        // Every interface has its own deadline from the bInterval of its IN endpoint. A NAK or an error on one
+        // interface does not hold back the others, and the interface polled first moves on every call
+        for(uint8_t n = 0, i = bPollFirst; n < bNumIface; n++, i = (i + 1 < bNumIface) ? i + 1 : 0) {
+                HIDInterface *piface = hidInterfaces + i;
+                uint8_t index = piface->epIndex[epInterruptInIndex];
+
+                if(!index || (int32_t)((uint32_t)millis() - piface->qNextPollTime) < 0L)
+                        continue;
 
-                uint8_t buf[constBuffLen];
+                piface->qNextPollTime = (uint32_t)millis() + GetPollInterval(piface->pollInterval);
 
-                for(uint8_t i = 0; i < bNumIface; i++) {
-                        uint8_t index = hidInterfaces[i].epIndex[epInterruptInIndex];
-                        uint16_t read = (uint16_t)epInfo[index].maxPktSize;
+                uint16_t read = (uint16_t)epInfo[index].maxPktSize;
 
-                        ZeroMemory(constBuffLen, buf);
+                ZeroMemory(constBuffLen, buf);
 
-                        uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[index].epAddr, &read, buf);
+                uint8_t ret = pUsb->inTransfer(bAddress, epInfo[index].epAddr, &read, buf);
 
-                        if(rcode) {
-                                if(rcode != hrNAK)
-                                        USBTRACE3("(hiduniversal.h) Poll:", rcode, 0x81);
-                                return rcode;
+                if(ret) {
+                        if(ret != hrNAK) {
+                                USBTRACE3("(hiduniversal.h) Poll:", ret, 0x81);
+                                if(!rcode)
+                                        rcode = ret;
                         }
+                        continue;
+                }
 
-                        if(read > constBuffLen)
-                                read = constBuffLen;
+                if(read > constBuffLen)
+                        read = constBuffLen;
 
-                        bool identical = BuffersIdentical(read, buf, prevBuf);
+                StampReport();
 
-                        SaveBuffer(read, buf, prevBuf);
+                HIDReportParser *prs = GetReportParser(((bHasReportId) ? *buf : 0));
 
-                        if(identical)
-                                return 0;
+                // Relative reports are passed on even if they repeat, two equal moves are still two moves
+                if(bFilterReports && !(prs && prs->WantsRepeatedReports()) && !IsReportChanged(i, (bHasReportId) ? *buf : 0, (uint8_t)read, buf))
+                        continue;
 #if 0
-                        Notify(PSTR("\r\nBuf: "), 0x80);
+                Notify(PSTR("\r\nBuf: "), 0x80);
 
-                        for(uint8_t i = 0; i < read; i++) {
-                                D_PrintHex<uint8_t > (buf[i], 0x80);
-                                Notify(PSTR(" "), 0x80);
-                        }
+                for(uint8_t i = 0; i < read; i++) {
+                        D_PrintHex<uint8_t > (buf[i], 0x80);
+                        Notify(PSTR(" "), 0x80);
+                }
 
-                        Notify(PSTR("\r\n"), 0x80);
+                Notify(PSTR("\r\n"), 0x80);
 #endif
-                        ParseHIDData(this, bHasReportId, (uint8_t)read, buf);
+                ParseHIDData(this, bHasReportId, (uint8_t)read, buf);
 
-                        HIDReportParser *prs = GetReportParser(((bHasReportId) ? *buf : 0));
-
-                        if(prs)
-                                prs->Parse(this, bHasReportId, (uint8_t)read, buf);
-                }
+                if(prs)
+                        prs->Parse(this, bHasReportId, (uint8_t)read, buf);
         }
+
+        if(++bPollFirst >= bNumIface)
+                bPollFirst = 0;
+
+        uint8_t ret = SendQueuedReports();
+
+        if(!rcode)
+                rcode = ret;
+
         return rcode;
 }
 
-// Send a report to interrupt out endpoint. This is NOT SetReport() request!
+// Send a report to the interrupt OUT endpoint of the first interface, or with SET_REPORT if it has none.
+// With report IDs the first byte of the report is the ID
 uint8_t HIDUniversal::SndRpt(uint16_t nbytes, uint8_t *dataptr) {
-        return pUsb->outTransfer(bAddress, epInfo[epInterruptOutIndex].epAddr, nbytes, dataptr);
+        if(!bNumIface)
+                return USB_ERROR_EP_NOT_FOUND_IN_TBL;
+        return SendOutputReport(hidInterfaces[0].bmInterface, (bHasReportId && nbytes) ? dataptr[0] : 0, nbytes, dataptr);
+}
+
+// Uses the interrupt OUT endpoint of the interface if it has one, SET_REPORT otherwise
+uint8_t HIDUniversal::SendOutputReport(uint8_t iface, uint8_t report_id, uint16_t nbytes, uint8_t *data) {
+        for(uint8_t i = 0; i < bNumIface; i++) {
+                uint8_t index = hidInterfaces[i].epIndex[epInterruptOutIndex];
+
+                if(hidInterfaces[i].bmInterface == iface && index)
+                        return pUsb->outTransfer(bAddress, epInfo[index].epAddr, nbytes, data);
+        }
+        return USBHID::SendOutputReport(iface, report_id, nbytes, data);
 }
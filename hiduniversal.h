@@ -40,29 +40,47 @@ class HIDUniversal : public USBHID {
                         uint8_t bmAltSet : 3;
                         uint8_t bmProtocol : 2;
                 };
-                uint8_t epIndex[maxEpPerInterface];
+                uint8_t epIndex[maxEpPerInterface + 1]; // Indexed by epInterruptInIndex and epInterruptOutIndex
+                uint8_t pollInterval; // bInterval of the interrupt IN endpoint
+                uint32_t qNextPollTime; // next poll time
         };
 
+        static const uint16_t constBuffLen = 64; // event buffer length
+
+        // Last report seen on an interface with a report ID, used to drop reports that did not change
+        struct ReportState {
+                uint8_t iface;
+                uint8_t rptId;
+                uint8_t len;
+                uint8_t data[constBuffLen];
+        };
+
+        // Each one keeps a copy of a report, reports of further IDs are always passed on
+#if defined(__AVR__)
+        static const uint8_t maxReportStates = 2;
+#else
+        static const uint8_t maxReportStates = 8;
+#endif
+
         uint8_t bConfNum; // configuration number
-        uint8_t bNumIface; // number of interfaces in the configuration
         uint8_t bNumEP; // total number of EP in the configuration
-        uint32_t qNextPollTime; // next poll time
-        uint8_t pollInterval;
+        uint8_t bPollFirst; // interface polled first in the next Poll()
         bool bPollEnable; // poll enable flag
+        bool bFilterReports; // Drop a report that is the same as the last one
 
-        static const uint16_t constBuffLen = 64; // event buffer length
-        uint8_t prevBuf[constBuffLen]; // previous event buffer
+        ReportState rptStates[maxReportStates];
+        uint8_t bNumRptStates;
 
         void Initialize();
         HIDInterface* FindInterface(uint8_t iface, uint8_t alt, uint8_t proto);
 
         void ZeroMemory(uint8_t len, uint8_t *buf);
-        bool BuffersIdentical(uint8_t len, uint8_t *buf1, uint8_t *buf2);
-        void SaveBuffer(uint8_t len, uint8_t *src, uint8_t *dest);
+        bool IsReportChanged(uint8_t iface, uint8_t rptId, uint8_t len, uint8_t *buf);
 
 protected:
         EpInfo epInfo[totalEndpoints];
         HIDInterface hidInterfaces[maxHidInterfaces];
+        uint8_t bNumIface; // number of interfaces in the configuration
 
         bool bHasReportId;
 
@@ -101,8 +119,17 @@ public:
         // UsbConfigXtracter implementation
         void EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
 
-        // Send report - do not mix with SetReport()!
+        // Send an output report on the first interface, over the interrupt OUT endpoint if it has one
         uint8_t SndRpt(uint16_t nbytes, uint8_t *dataptr);
+
+        uint8_t SendOutputReport(uint8_t iface, uint8_t report_id, uint16_t nbytes, uint8_t *data);
+
+        // Repeated reports are dropped unless the parser of the report asks for them, see
+        // HIDReportParser::WantsRepeatedReports(). A driver that sums relative values in ParseHIDData()
+        // turns the filter off
+        void SetReportFilter(bool enable) {
+                bFilterReports = enable;
+        };
 };
 
 #endif // __HIDUNIVERSAL_H__
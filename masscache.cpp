@@ -0,0 +1,463 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "masscache.h"
+
+BulkOnlyCache::BulkOnlyCache(USB *p, uint8_t *mem, MASS_CACHE_SLOT *slots, uint8_t nslots, uint16_t slot_size) :
+BulkOnly(p),
+pMem(mem),
+pSlots(slots),
+nSlots(nslots),
+wSlotSize(slot_size),
+bHand(0),
+bSeqLun(0xFF),
+qSeqNext(0),
+bWriteBack(false),
+nDirty(0),
+wFlushTime(MASS_CACHE_FLUSH_TIME),
+qDirtyTime(0) {
+        bMaxDirty = nSlots / 2;
+        SetReadAhead(MASS_CACHE_READ_AHEAD);
+        Invalidate();
+        ResetStats();
+}
+
+/**
+ * Read data from media through the cache
+ *
+ * @param lun Logical Unit Number
+ * @param addr LBA address on media to read
+ * @param bsize size of a block, blocks are only cached if this is the slot size
+ * @param blocks how many blocks to read
+ * @param buf memory that is able to hold the requested data
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::Read(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, uint8_t *buf) {
+        if(!LUNIsGood(lun)) {
+                DropLUN(lun);
+                return BulkOnly::Read(lun, addr, bsize, blocks, buf);
+        }
+
+        bool seq = (lun == bSeqLun && addr == qSeqNext);
+        bSeqLun = lun;
+        qSeqNext = addr + blocks;
+
+        if(bsize != wSlotSize || blocks > nSlots / 2) {
+                stats.misses += blocks;
+                uint8_t rcode = DeviceIO(lun, addr, bsize, blocks, buf, false);
+
+                // The device has older data for the dirty blocks
+                for(uint8_t i = 0; !rcode && nDirty && i < nSlots; i++) {
+                        MASS_CACHE_SLOT *ps = &pSlots[i];
+
+                        if((ps->flags & MASS_CACHE_DIRTY) && ps->lun == lun && ps->lba >= addr && ps->lba - addr < blocks && bsize == wSlotSize)
+                                memcpy(buf + (uint32_t)(ps->lba - addr) * bsize, SlotData(i), bsize);
+                }
+                return rcode;
+        }
+
+        while(blocks) {
+                uint8_t s = Find(lun, addr);
+
+                if(s != 0xFF) {
+                        memcpy(buf, SlotData(s), bsize);
+                        pSlots[s].flags |= MASS_CACHE_REF;
+                        stats.hits++;
+                        addr++;
+                        buf += bsize;
+                        blocks--;
+                        continue;
+                }
+
+                // The blocks that are not cached from here on, one command reads them all
+                uint8_t limit = (uint8_t)blocks;
+                if(seq && limit < bReadAhead)
+                        limit = bReadAhead;
+                uint64_t left = GetCapacity64(lun) - addr;
+                if(left < limit)
+                        limit = (uint8_t)left;
+
+                uint8_t n = 1;
+                while(n < limit && Find(lun, addr + n) == 0xFF)
+                        n++;
+
+                uint8_t rcode = Fill(lun, addr, n, &s);
+                if(rcode)
+                        return rcode;
+
+                uint8_t m = (n < blocks) ? n : (uint8_t)blocks;
+                memcpy(buf, SlotData(s), (uint32_t)m * bsize);
+                for(uint8_t i = 0; i < m; i++)
+                        pSlots[s + i].flags |= MASS_CACHE_REF;
+                stats.misses += m;
+                stats.readAheads += n - m;
+                addr += m;
+                buf += (uint32_t)m * bsize;
+                blocks -= m;
+        }
+        return MASS_ERR_SUCCESS;
+}
+
+/**
+ * Write data to media, the blocks in the cache are updated
+ *
+ * @param lun Logical Unit Number
+ * @param addr LBA address on media to write
+ * @param bsize size of a block
+ * @param blocks how many blocks to write
+ * @param buf memory that contains the data to write
+ * @param fua write to the media now, also in write-back mode
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::Write(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, const uint8_t *buf, bool fua) {
+        if(!LUNIsGood(lun))
+                DropLUN(lun);
+
+        if(bWriteBack && !fua && bsize == wSlotSize && blocks <= nSlots / 2 && LUNOk[lun] && WriteOk[lun]) {
+                for(; blocks; blocks--, addr++, buf += bsize) {
+                        uint8_t s = Find(lun, addr);
+
+                        if(s == 0xFF) {
+                                uint8_t rcode = Place(lun, addr, &s);
+                                if(rcode)
+                                        return rcode;
+                                pSlots[s].lba = addr;
+                                pSlots[s].lun = lun;
+                        }
+                        memcpy(SlotData(s), buf, bsize);
+                        if(!(pSlots[s].flags & MASS_CACHE_DIRTY)) {
+                                if(!nDirty)
+                                        qDirtyTime = (uint32_t)millis();
+                                nDirty++;
+                        }
+                        pSlots[s].flags = MASS_CACHE_VALID | MASS_CACHE_REF | MASS_CACHE_DIRTY;
+                }
+                return (nDirty >= bMaxDirty) ? WriteDirty(0xFF) : MASS_ERR_SUCCESS;
+        }
+
+        uint8_t rcode = DeviceIO(lun, addr, bsize, blocks, (uint8_t*)buf, true, fua);
+
+        for(uint8_t i = 0; i < nSlots; i++) {
+                MASS_CACHE_SLOT *ps = &pSlots[i];
+
+                if(!(ps->flags & MASS_CACHE_VALID) || ps->lun != lun || ps->lba < addr || ps->lba - addr >= blocks)
+                        continue;
+                // After an error some of the blocks may have been written, drop them all
+                if(rcode || bsize != wSlotSize) {
+                        Drop(i);
+                        continue;
+                }
+                memcpy(SlotData(i), buf + (uint32_t)(ps->lba - addr) * bsize, bsize);
+                if(ps->flags & MASS_CACHE_DIRTY) {
+                        ps->flags &= ~MASS_CACHE_DIRTY;
+                        nDirty--;
+                }
+        }
+        return rcode;
+}
+
+/**
+ * For driver use only.
+ *
+ * @return
+ */
+uint8_t BulkOnlyCache::Release() {
+        // On unplug the dirty blocks can not be written, they are counted and traced as lost
+        if(nDirty && Flush()) {
+                for(uint8_t lun = 0; nDirty && lun < MASS_MAX_SUPPORTED_LUN; lun++)
+                        DropLUN(lun);
+        }
+        Invalidate();
+        return BulkOnly::Release();
+}
+
+/**
+ * For driver use only.
+ *
+ * Writes back dirty blocks that are too old. Like the media check nothing is done during a transfer, e.g. when
+ * a parser of Read() calls Usb.Task().
+ *
+ * @return
+ */
+uint8_t BulkOnlyCache::Poll() {
+        if(!bPollEnable || bTransferBusy)
+                return 0;
+
+        if(nDirty && (uint32_t)millis() - qDirtyTime >= wFlushTime) {
+                qDirtyTime = (uint32_t)millis(); // Try again later if it fails
+                WriteDirty(0xFF);
+        }
+        return BulkOnly::Poll();
+}
+
+uint8_t BulkOnlyCache::SetWriteBack(bool enable, uint8_t max_dirty, uint16_t max_age) {
+        bMaxDirty = (max_dirty && max_dirty <= nSlots) ? max_dirty : nSlots / 2;
+        wFlushTime = max_age;
+        bWriteBack = enable;
+        return (!enable && nDirty) ? WriteDirty(0xFF) : MASS_ERR_SUCCESS;
+}
+
+uint8_t BulkOnlyCache::Flush(uint8_t lun) {
+        uint8_t rcode = WriteDirty(lun);
+
+        for(uint8_t i = 0; !rcode && i <= bMaxLUN && i < MASS_MAX_SUPPORTED_LUN; i++)
+                if((lun == 0xFF || lun == i) && LUNOk[i])
+                        rcode = SynchronizeCache(i);
+        return rcode;
+}
+
+/**
+ * Unmap blocks on the device and drop them from the cache
+ *
+ * @param lun Logical Unit Number
+ * @param ranges the blocks
+ * @param count number of ranges
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::UnmapRanges(uint8_t lun, const MASS_UNMAP_RANGE *ranges, uint8_t count) {
+        uint8_t rcode = BulkOnly::UnmapRanges(lun, ranges, count);
+
+        if(rcode)
+                return rcode;
+        for(uint8_t i = 0; i < nSlots; i++) {
+                MASS_CACHE_SLOT *ps = &pSlots[i];
+
+                if(!(ps->flags & MASS_CACHE_VALID) || ps->lun != lun)
+                        continue;
+                for(uint8_t r = 0; r < count; r++)
+                        if(ps->lba >= ranges[r].lba && ps->lba - ranges[r].lba < ranges[r].blocks)
+                                Drop(i);
+        }
+        return MASS_ERR_SUCCESS;
+}
+
+void BulkOnlyCache::Invalidate(uint8_t lun) {
+        if(lun == 0xFF) {
+                for(uint8_t i = 0; i < nSlots; i++)
+                        pSlots[i].flags = 0;
+                nDirty = 0;
+                bHand = 0; // An empty cache fills the same way every time
+        } else {
+                for(uint8_t i = 0; i < nSlots; i++)
+                        if(pSlots[i].lun == lun)
+                                Drop(i);
+        }
+        bSeqLun = 0xFF;
+}
+
+uint8_t BulkOnlyCache::GetHitRate() {
+        uint32_t total = stats.hits + stats.misses;
+
+        if(!total)
+                return 0;
+        if(total < 0x1000000LU)
+                return (uint8_t)(stats.hits * 100 / total);
+        return (uint8_t)(stats.hits / (total / 100));
+}
+
+uint32_t BulkOnlyCache::GetThroughput() {
+        uint32_t ms = stats.busyTime / 1000;
+
+        return ms ? stats.bytes / ms : 0;
+}
+
+/**
+ * For driver use only.
+ *
+ * @return slot that holds the block, 0xFF if it is not cached
+ */
+uint8_t BulkOnlyCache::Find(uint8_t lun, uint64_t lba) {
+        for(uint8_t i = 0; i < nSlots; i++)
+                if((pSlots[i].flags & MASS_CACHE_VALID) && pSlots[i].lba == lba && pSlots[i].lun == lun)
+                        return i;
+        return 0xFF;
+}
+
+/**
+ * For driver use only.
+ *
+ * Takes n consecutive slots, n is at most half the slots. The clock hand skips the slots that were used since
+ * it last passed and clears their reference, the run starts at the first one that was not. Dirty blocks in the
+ * run are written back.
+ *
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::AllocRun(uint8_t n, uint8_t *first) {
+        while(pSlots[bHand].flags & MASS_CACHE_REF) {
+                pSlots[bHand].flags &= ~MASS_CACHE_REF;
+                if(++bHand >= nSlots)
+                        bHand = 0;
+        }
+        if(bHand + n > nSlots)
+                bHand = 0;
+
+        uint8_t s = bHand;
+        for(uint8_t i = 0; i < n; i++) {
+                if(pSlots[s + i].flags & MASS_CACHE_DIRTY) {
+                        uint8_t rcode = WriteRun(s + i);
+                        if(rcode)
+                                return rcode;
+                }
+                pSlots[s + i].flags = 0;
+        }
+
+        bHand += n;
+        if(bHand >= nSlots)
+                bHand = 0;
+        *first = s;
+        return MASS_ERR_SUCCESS;
+}
+
+/**
+ * For driver use only.
+ *
+ * Find a slot for a block that is written in write-back mode. The slot after the block before it is preferred,
+ * so adjacent dirty blocks end up in adjacent slots.
+ *
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::Place(uint8_t lun, uint64_t lba, uint8_t *slot) {
+        uint8_t p = lba ? Find(lun, lba - 1) : 0xFF;
+
+        if(p != 0xFF && p + 1 < nSlots && !(pSlots[p + 1].flags & MASS_CACHE_DIRTY)) {
+                pSlots[p + 1].flags = 0;
+                *slot = p + 1;
+                return MASS_ERR_SUCCESS;
+        }
+        return AllocRun(1, slot);
+}
+
+/**
+ * For driver use only.
+ *
+ * Read n blocks into consecutive slots with one command.
+ *
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::Fill(uint8_t lun, uint64_t lba, uint8_t n, uint8_t *first) {
+        uint8_t s;
+        uint8_t rcode = AllocRun(n, &s);
+
+        if(!rcode)
+                rcode = DeviceIO(lun, lba, wSlotSize, n, SlotData(s), false);
+        if(rcode)
+                return rcode;
+
+        for(uint8_t i = 0; i < n; i++) {
+                pSlots[s + i].lba = lba + i;
+                pSlots[s + i].lun = lun;
+                pSlots[s + i].flags = MASS_CACHE_VALID;
+        }
+        *first = s;
+        return MASS_ERR_SUCCESS;
+}
+
+// b holds the dirty block after dirty block a
+static bool DirtyPair(const MASS_CACHE_SLOT *a, const MASS_CACHE_SLOT *b) {
+        return (a->flags & b->flags & MASS_CACHE_DIRTY) && a->lun == b->lun && b->lba == a->lba + 1;
+}
+
+/**
+ * For driver use only.
+ *
+ * Write back the dirty blocks in the slots around slot that follow each other, with one command.
+ *
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::WriteRun(uint8_t slot) {
+        uint8_t first = slot;
+        uint8_t last = slot;
+
+        while(first && DirtyPair(&pSlots[first - 1], &pSlots[first]))
+                first--;
+        while(last + 1 < nSlots && DirtyPair(&pSlots[last], &pSlots[last + 1]))
+                last++;
+
+        uint8_t n = last - first + 1;
+        uint8_t rcode = DeviceIO(pSlots[first].lun, pSlots[first].lba, wSlotSize, n, SlotData(first), true);
+
+        if(rcode)
+                return rcode;
+
+        for(uint8_t i = first; i <= last; i++)
+                pSlots[i].flags &= ~MASS_CACHE_DIRTY;
+        nDirty -= n;
+        stats.writeBacks += n;
+        return MASS_ERR_SUCCESS;
+}
+
+/**
+ * For driver use only.
+ *
+ * Write back the dirty blocks of a LUN, or of all LUNs with lun 0xFF. Stops at the first error.
+ *
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::WriteDirty(uint8_t lun) {
+        for(uint8_t i = 0; nDirty && i < nSlots; i++) {
+                if((pSlots[i].flags & MASS_CACHE_DIRTY) && (lun == 0xFF || pSlots[i].lun == lun)) {
+                        uint8_t rcode = WriteRun(i);
+                        if(rcode)
+                                return rcode;
+                }
+        }
+        return MASS_ERR_SUCCESS;
+}
+
+/**
+ * For driver use only.
+ *
+ * Drop the cached blocks of a LUN that is gone or not good. Its dirty blocks are written back if the device
+ * still takes them, the ones that can not be written are counted as lost.
+ */
+void BulkOnlyCache::DropLUN(uint8_t lun) {
+        uint8_t rcode = (nDirty) ? WriteDirty(lun) : MASS_ERR_SUCCESS;
+
+        if(rcode) {
+                uint8_t lost = 0;
+
+                for(uint8_t i = 0; i < nSlots; i++)
+                        if((pSlots[i].flags & MASS_CACHE_DIRTY) && pSlots[i].lun == lun)
+                                lost++;
+                stats.lost += lost;
+                MASS_TRACE_ERROR(MASS_TRACE_CACHE_LOST, lun, lost, rcode);
+        }
+        Invalidate(lun);
+}
+
+void BulkOnlyCache::Drop(uint8_t slot) {
+        if(pSlots[slot].flags & MASS_CACHE_DIRTY)
+                nDirty--;
+        pSlots[slot].flags = 0;
+}
+
+/**
+ * For driver use only.
+ *
+ * Read or write on the device and count the time it takes.
+ *
+ * @return 0 on success
+ */
+uint8_t BulkOnlyCache::DeviceIO(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, uint8_t *buf, bool write, bool fua) {
+        uint32_t start = (uint32_t)micros();
+        uint8_t rcode = write ? BulkOnly::Write(lun, addr, bsize, blocks, buf, fua) : BulkOnly::Read(lun, addr, bsize, blocks, buf);
+
+        stats.busyTime += (uint32_t)micros() - start;
+        stats.commands += (blocks + 0xFFFELU) / 0xFFFFLU; // Read() and Write() send 0xFFFF blocks per command
+        if(!rcode)
+                stats.bytes += (uint32_t)bsize * blocks;
+        return rcode;
+}
@@ -0,0 +1,173 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__MASSCACHE_H__)
+#define __MASSCACHE_H__
+
+#include "masstorage.h"
+
+#ifndef MASS_CACHE_READ_AHEAD
+#define MASS_CACHE_READ_AHEAD           8       // Blocks read in one command once a sequential read is detected
+#endif
+
+#ifndef MASS_CACHE_FLUSH_TIME
+#define MASS_CACHE_FLUSH_TIME           1000    // Default time in ms dirty blocks are kept in write-back mode
+#endif
+
+/* Slot flags */
+#define MASS_CACHE_VALID                0x01
+#define MASS_CACHE_REF                  0x02    // Used since the clock hand last passed, gets a second chance
+#define MASS_CACHE_DIRTY                0x04    // Written in write-back mode, not on the device yet
+
+struct MASS_CACHE_SLOT {
+        uint64_t lba;
+        uint8_t lun;
+        uint8_t flags; // MASS_CACHE_*
+} __attribute__((packed));
+
+struct MASS_CACHE_STATS {
+        uint32_t hits; // Blocks read from the cache
+        uint32_t misses; // Blocks read from the device
+        uint32_t readAheads; // Blocks read ahead of a sequential read
+        uint32_t writeBacks; // Blocks written from dirty slots
+        uint32_t commands; // READ and WRITE commands sent to the device
+        uint32_t bytes; // Bytes moved to and from the device
+        uint32_t busyTime; // Time in us spent in those commands
+        uint32_t lost; // Dirty blocks dropped because they could not be written back
+};
+
+/*
+ * BulkOnly with a block cache in front of Read() and Write():
+ *
+ *      BulkOnlyCacheT<8> Disk(&Usb); // 8 slots of 512 bytes
+ *
+ * Each slot holds one block of a LUN whose block size is the slot size, blocks of other sizes go straight to
+ * the device. Slots are replaced with the clock algorithm. A read that continues the previous one is taken as
+ * sequential and reads MASS_CACHE_READ_AHEAD blocks with one command, so streaming small reads does not cost a
+ * command per block. Reads of more blocks than half the slots bypass the cache.
+ *
+ * Writes go through to the device and update the blocks that are in the cache. In write-back mode
+ * (SetWriteBack()) written blocks stay in the cache as dirty blocks. A block is put in the slot after the block
+ * before it, so adjacent dirty blocks are written back with one WRITE command. They are written when there are
+ * too many of them, when the oldest is too old (from Poll()), when a slot is needed, on Release() and on Flush(),
+ * which also sends SYNCHRONIZE CACHE. Write() with fua set goes straight to the media, e.g. for metadata.
+ * When the media of a LUN is removed or changed its dirty blocks can not be written any more. They are dropped,
+ * counted in the lost field of GetStats() and traced as MASS_TRACE_CACHE_LOST, so call Flush() before the
+ * user may take the media out.
+ *
+ * The slot memory can be any RAM the CPU can address, e.g. external XMEM:
+ *
+ *      BulkOnlyCache Disk(&Usb, xmem_buffer, slots, 32, 512);
+ */
+class BulkOnlyCache : public BulkOnly {
+        uint8_t *pMem;
+        MASS_CACHE_SLOT *pSlots;
+        uint8_t nSlots;
+        uint16_t wSlotSize;
+        uint8_t bHand; // Clock hand
+        uint8_t bReadAhead;
+        uint8_t bSeqLun;
+        uint64_t qSeqNext; // Block after the last read, a read starting here is sequential
+        bool bWriteBack;
+        uint8_t nDirty;
+        uint8_t bMaxDirty; // Dirty blocks are written back when there are this many
+        uint16_t wFlushTime;
+        uint32_t qDirtyTime; // When the oldest dirty block was written
+        MASS_CACHE_STATS stats;
+
+        uint8_t Find(uint8_t lun, uint64_t lba);
+        uint8_t AllocRun(uint8_t n, uint8_t *first);
+        uint8_t Place(uint8_t lun, uint64_t lba, uint8_t *slot);
+        uint8_t Fill(uint8_t lun, uint64_t lba, uint8_t n, uint8_t *first);
+        uint8_t WriteRun(uint8_t slot);
+        uint8_t WriteDirty(uint8_t lun);
+        void DropLUN(uint8_t lun);
+        void Drop(uint8_t slot);
+        uint8_t DeviceIO(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, uint8_t *buf, bool write, bool fua = false);
+
+        uint8_t* SlotData(uint8_t slot) {
+                return pMem + (uint32_t)slot * wSlotSize;
+        };
+
+protected:
+        // The cached blocks of the LUN are dropped, a derived class has to call these when it overrides them
+        void OnMediaInserted(uint8_t lun) {
+                DropLUN(lun);
+        };
+
+        void OnMediaRemoved(uint8_t lun) {
+                DropLUN(lun);
+        };
+
+public:
+        BulkOnlyCache(USB *p, uint8_t *mem, MASS_CACHE_SLOT *slots, uint8_t nslots, uint16_t slot_size);
+
+        using BulkOnly::Read;
+        uint8_t Read(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, uint8_t *buf);
+        uint8_t Write(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, const uint8_t *buf, bool fua = false);
+
+        // The cached blocks of the ranges are dropped, dirty ones are not written back
+        uint8_t UnmapRanges(uint8_t lun, const MASS_UNMAP_RANGE *ranges, uint8_t count);
+
+        uint8_t Release();
+        uint8_t Poll();
+
+        /* Keep written blocks in the cache. They are written back when there are max_dirty of them (half the
+         * slots if 0) or after max_age ms. Turning it off writes them back */
+        uint8_t SetWriteBack(bool enable, uint8_t max_dirty = 0, uint16_t max_age = MASS_CACHE_FLUSH_TIME);
+
+        // Write back the dirty blocks of a LUN, or of all LUNs with lun 0xFF, and send SYNCHRONIZE CACHE
+        uint8_t Flush(uint8_t lun = 0xFF);
+
+        uint8_t GetDirtyCount() {
+                return nDirty;
+        };
+
+        // Drop the cached blocks of a LUN, or of all LUNs with lun 0xFF. Dirty blocks are lost
+        void Invalidate(uint8_t lun = 0xFF);
+
+        // Blocks read in one command on sequential reads, limited to half the slots
+        void SetReadAhead(uint8_t blocks) {
+                bReadAhead = (blocks > nSlots / 2) ? nSlots / 2 : blocks;
+        };
+
+        const MASS_CACHE_STATS* GetStats() {
+                return &stats;
+        };
+
+        void ResetStats() {
+                memset(&stats, 0, sizeof (stats));
+        };
+
+        // Percentage of blocks read from the cache
+        uint8_t GetHitRate();
+
+        // Bytes per ms (kB/s) while the device was busy with READ and WRITE commands
+        uint32_t GetThroughput();
+};
+
+// BulkOnlyCache with SLOTS slots of SLOT_SIZE bytes
+template <const uint8_t SLOTS, const uint16_t SLOT_SIZE = 512>
+class BulkOnlyCacheT : public BulkOnlyCache {
+        uint8_t memTable[(uint32_t)SLOTS * SLOT_SIZE];
+        MASS_CACHE_SLOT slotTable[SLOTS];
+
+public:
+        BulkOnlyCacheT(USB *p) : BulkOnlyCache(p, memTable, slotTable, SLOTS, SLOT_SIZE) {
+        };
+};
+
+#endif // __MASSCACHE_H__
@@ -0,0 +1,431 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "masspart.h"
+
+// Partition tables are little endian
+
+static uint32_t GetLE32(const uint8_t *p) {
+        return BMAKE32(p[3], p[2], p[1], p[0]);
+}
+
+static uint64_t GetLE64(const uint8_t *p) {
+        return BMAKE64(p[7], p[6], p[5], p[4], p[3], p[2], p[1], p[0]);
+}
+
+// CRC-32 of the GPT, the one of Ethernet and zip. Start with crc 0, pass the result to continue
+static uint32_t Crc32(uint32_t crc, const uint8_t *p, uint16_t len) {
+        crc = ~crc;
+        while(len--) {
+                crc ^= *p++;
+                for(uint8_t i = 0; i < 8; i++)
+                        crc = (crc >> 1) ^ (0xEDB88320LU & (0 - (crc & 1)));
+        }
+        return ~crc;
+}
+
+// A block with a FAT, exFAT or NTFS boot sector instead of an MBR, the LUN has no partition table
+static bool IsBootSector(const uint8_t *p) {
+        if(p[0] != 0xEB && p[0] != 0xE9)
+                return false;
+        return !memcmp(p + 54, "FAT", 3) || !memcmp(p + 82, "FAT32", 5) || !memcmp(p + 3, "EXFAT", 5) || !memcmp(p + 3, "NTFS", 4);
+}
+
+static bool IsExtended(uint8_t type) {
+        return type == 0x05 || type == 0x0F || type == 0x85;
+}
+
+/**
+ * Check a transfer against the size of the partition
+ *
+ * @param lba first block in the partition
+ * @param blocks how many blocks
+ * @return 0 if the blocks are in the partition
+ */
+uint8_t MassPartition::Check(uint64_t lba, uint32_t blocks) {
+        if(!pDev)
+                return MASS_ERR_NO_MEDIA;
+        if(lba >= qBlocks || blocks > qBlocks - lba)
+                return MASS_ERR_BAD_LBA;
+        return MASS_ERR_SUCCESS;
+}
+
+/**
+ * Read blocks of the partition
+ *
+ * @param lba first block, relative to the start of the partition
+ * @param blocks how many blocks to read
+ * @param buf memory that is able to hold the requested data
+ * @return 0 on success
+ */
+uint8_t MassPartition::Read(uint64_t lba, uint32_t blocks, uint8_t *buf) {
+        uint8_t rcode = Check(lba, blocks);
+
+        if(rcode)
+                return rcode;
+        return pDev->Read(bLUN, qStart + lba, wBlockSize, blocks, buf);
+}
+
+/**
+ * Read blocks of the partition into a parser, needs MS_WANT_PARSER
+ *
+ * @param lba first block, relative to the start of the partition
+ * @param blocks how many blocks to read
+ * @param prs gets the data
+ * @return 0 on success
+ */
+uint8_t MassPartition::Read(uint64_t lba, uint32_t blocks, USBReadParser *prs) {
+        uint8_t rcode = Check(lba, blocks);
+
+        if(rcode)
+                return rcode;
+        return pDev->Read(bLUN, qStart + lba, wBlockSize, blocks, prs);
+}
+
+/**
+ * Write blocks of the partition
+ *
+ * @param lba first block, relative to the start of the partition
+ * @param blocks how many blocks to write
+ * @param buf the data
+ * @param fua write through the cache of the device
+ * @return 0 on success
+ */
+uint8_t MassPartition::Write(uint64_t lba, uint32_t blocks, const uint8_t *buf, bool fua) {
+        uint8_t rcode = Check(lba, blocks);
+
+        if(rcode)
+                return rcode;
+        return pDev->Write(bLUN, qStart + lba, wBlockSize, blocks, buf, fua);
+}
+
+/**
+ * Tell the device that blocks of the partition no longer hold data, see BulkOnly::UnmapRanges()
+ *
+ * @param lba first block, relative to the start of the partition
+ * @param blocks how many blocks
+ * @return 0 on success
+ */
+uint8_t MassPartition::Unmap(uint64_t lba, uint32_t blocks) {
+        uint8_t rcode = Check(lba, blocks);
+
+        if(rcode)
+                return rcode;
+        return pDev->Unmap(bLUN, qStart + lba, blocks);
+}
+
+MassPartitionTable::MassPartitionTable(MassPartition *parts, uint8_t max_parts, uint8_t *buf, uint16_t buf_size) :
+pParts(parts),
+bMaxParts(max_parts),
+nParts(0),
+bTruncated(false),
+pBuf(buf),
+wBufSize(buf_size),
+pDev(NULL),
+bLUN(0),
+wBlockSize(0),
+qCapacity(0),
+qBufLBA(0),
+wBufOffset(0),
+wBufLen(0) {
+}
+
+void MassPartitionTable::WindowParser::Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset) {
+        uint16_t first = pTable->wBufOffset;
+        uint16_t end = first + pTable->wBufLen;
+
+        for(uint16_t i = 0; i < len; i++) {
+                uint16_t pos = offset + i;
+
+                if(pos >= first && pos < end)
+                        pTable->pBuf[pos - first] = pbuf[i];
+        }
+}
+
+/**
+ * Get bytes of a block of the LUN being scanned. The block is only read if the buffer does not have them.
+ *
+ * @param lba block
+ * @param offset of the first byte in the block
+ * @param len how many bytes, no more than the buffer holds
+ * @param data set to the bytes in the buffer
+ * @return 0 on success
+ */
+uint8_t MassPartitionTable::ReadBytes(uint64_t lba, uint16_t offset, uint16_t len, const uint8_t **data) {
+        if(len > wBufSize || offset + len > wBlockSize)
+                return MASS_ERR_BAD_PARTITION_TABLE;
+
+        if(!wBufLen || lba != qBufLBA || offset < wBufOffset || offset + len > wBufOffset + wBufLen) {
+                uint8_t rcode;
+
+                qBufLBA = lba;
+                if(wBlockSize <= wBufSize) {
+                        wBufOffset = 0;
+                        wBufLen = wBlockSize;
+                        rcode = pDev->Read(bLUN, lba, wBlockSize, 1, pBuf);
+                } else {
+                        // Keep as much of the block from offset on as fits
+                        WindowParser prs(this);
+
+                        wBufOffset = offset;
+                        wBufLen = (wBlockSize - offset > wBufSize) ? wBufSize : wBlockSize - offset;
+                        rcode = pDev->Read(bLUN, lba, wBlockSize, 1, &prs);
+                }
+                if(rcode) {
+                        wBufLen = 0;
+                        return rcode;
+                }
+        }
+        *data = pBuf + (offset - wBufOffset);
+        return MASS_ERR_SUCCESS;
+}
+
+void MassPartitionTable::Add(uint64_t start, uint64_t blocks, uint8_t type, uint8_t flags) {
+        if(!blocks || start >= qCapacity || blocks > qCapacity - start)
+                return;
+        if(nParts == bMaxParts) {
+                bTruncated = true;
+                return;
+        }
+
+        MassPartition *pp = &pParts[nParts++];
+        uint16_t mask = (1U << pDev->GetPhysicalBlockExp(bLUN)) - 1;
+
+        pp->pDev = pDev;
+        pp->bLUN = bLUN;
+        pp->qStart = start;
+        pp->qBlocks = blocks;
+        pp->wBlockSize = wBlockSize;
+        pp->bType = type;
+        pp->bPhysExp = pDev->GetPhysicalBlockExp(bLUN);
+        pp->bFlags = flags;
+        if(!((start - pDev->GetLowestAlignedLBA(bLUN)) & mask))
+                pp->bFlags |= MASS_PART_ALIGNED;
+}
+
+/**
+ * Find the partitions of a LUN
+ *
+ * @param dev the device
+ * @param lun Logical Unit Number
+ * @return 0 on success, also if the LUN has no partition table
+ */
+uint8_t MassPartitionTable::Scan(BulkOnly *dev, uint8_t lun) {
+        Remove(lun);
+        if(!dev->LUNIsGood(lun))
+                return MASS_ERR_NO_MEDIA;
+
+        pDev = dev;
+        bLUN = lun;
+        wBlockSize = dev->GetSectorSize(lun);
+        qCapacity = dev->GetCapacity64(lun);
+        wBufLen = 0;
+
+        uint8_t rcode = ParseMBR();
+
+        wBufLen = 0;
+        pDev = NULL;
+        return rcode;
+}
+
+uint8_t MassPartitionTable::ParseMBR() {
+        const uint8_t *p;
+        uint8_t rcode = ReadBytes(0, 0, 512, &p);
+
+        if(rcode)
+                return rcode;
+
+        bool mbr = (p[510] == 0x55 && p[511] == 0xAA && !IsBootSector(p));
+
+        for(uint8_t i = 0; mbr && i < 4; i++)
+                if(p[446 + i * 16] & 0x7F) // Status is 0x00 or 0x80
+                        mbr = false;
+        if(!mbr) {
+                Add(0, qCapacity, MASS_PART_TYPE_NONE, 0);
+                return MASS_ERR_SUCCESS;
+        }
+
+        // The buffer is reused for the extended partition
+        uint8_t entries[64];
+
+        memcpy(entries, p + 446, 64);
+        for(uint8_t i = 0; i < 4; i++) {
+                if(entries[i * 16 + 4] == MASS_PART_TYPE_GPT) {
+                        // Protective or hybrid MBR
+                        rcode = ParseGPT(1);
+                        if(rcode == MASS_ERR_BAD_PARTITION_TABLE)
+                                rcode = ParseGPT(qCapacity - 1);
+                        return rcode;
+                }
+        }
+
+        for(uint8_t i = 0; i < 4; i++) {
+                const uint8_t *e = entries + i * 16;
+
+                if(e[4] && !IsExtended(e[4]))
+                        Add(GetLE32(e + 8), GetLE32(e + 12), e[4], (e[0] & 0x80) ? MASS_PART_BOOT : 0);
+        }
+
+        // Logical partitions come after the primary ones
+        for(uint8_t i = 0; !rcode && i < 4; i++) {
+                const uint8_t *e = entries + i * 16;
+
+                if(IsExtended(e[4]))
+                        rcode = ParseLogical(GetLE32(e + 8), GetLE32(e + 12));
+        }
+        return rcode;
+}
+
+/**
+ * Walk the chain of extended boot records
+ *
+ * @param ext_start first block of the extended partition
+ * @param ext_blocks its size
+ * @return 0 on success
+ */
+uint8_t MassPartitionTable::ParseLogical(uint64_t ext_start, uint64_t ext_blocks) {
+        uint64_t ebr = ext_start;
+
+        for(uint8_t n = 0; n < MASS_PART_MAX_LOGICAL; n++) {
+                const uint8_t *p;
+                uint8_t rcode = ReadBytes(ebr, 0, 512, &p);
+
+                if(rcode)
+                        return rcode;
+                if(p[510] != 0x55 || p[511] != 0xAA)
+                        break;
+
+                // The first entry is relative to this EBR, the link to the next one to the extended partition
+                const uint8_t *e = p + 446;
+                uint32_t next = GetLE32(e + 24);
+
+                if(e[4] && !IsExtended(e[4]))
+                        Add(ebr + GetLE32(e + 8), GetLE32(e + 12), e[4], (e[0] & 0x80) ? MASS_PART_BOOT : 0);
+                if(!IsExtended(e[20]) || !next || next >= ext_blocks)
+                        break;
+                ebr = ext_start + next;
+        }
+        return MASS_ERR_SUCCESS;
+}
+
+/**
+ * Read a GPT, the partitions are only kept if the CRCs of the header and the entries are right
+ *
+ * @param hdr_lba block of the GPT header, 1 or the last block for the backup
+ * @return 0 on success
+ */
+uint8_t MassPartitionTable::ParseGPT(uint64_t hdr_lba) {
+        const uint8_t *p;
+        uint8_t rcode = ReadBytes(hdr_lba, 0, 92, &p);
+
+        if(rcode)
+                return rcode;
+
+        uint32_t hsize = GetLE32(p + 12);
+
+        if(memcmp(p, "EFI PART", 8) || hsize < 92 || hsize > 512)
+                return MASS_ERR_BAD_PARTITION_TABLE;
+        rcode = ReadBytes(hdr_lba, 0, hsize, &p);
+        if(rcode)
+                return rcode;
+
+        // The CRC is computed with its own field set to 0
+        static const uint8_t zero[4] = {0, 0, 0, 0};
+        uint32_t crc = Crc32(Crc32(Crc32(0, p, 16), zero, 4), p + 20, hsize - 20);
+
+        if(crc != GetLE32(p + 16))
+                return MASS_ERR_BAD_PARTITION_TABLE;
+
+        uint64_t entry_lba = GetLE64(p + 72);
+        uint32_t count = GetLE32(p + 80);
+        uint32_t esize = GetLE32(p + 84);
+        uint32_t ecrc = GetLE32(p + 88);
+
+        // Entries are 128 * 2^n bytes and do not cross blocks
+        if(esize < 128 || esize > 512 || (esize & (esize - 1)))
+                return MASS_ERR_BAD_PARTITION_TABLE;
+
+        uint16_t per_block = wBlockSize / esize;
+        uint8_t first = nParts;
+        bool truncated = bTruncated;
+
+        crc = 0;
+        for(uint32_t i = 0; i < count; i++) {
+                rcode = ReadBytes(entry_lba + i / per_block, (i % per_block) * esize, esize, &p);
+                if(rcode)
+                        break;
+                crc = Crc32(crc, p, esize);
+
+                uint8_t type;
+
+                switch(GetLE32(p)) { // First field of the type GUID
+                        case 0x00000000: // Unused
+                        case 0xE3C9E316: // Microsoft reserved, no file system
+                                continue;
+                        case 0xC12A7328:
+                                type = MASS_PART_TYPE_EFI;
+                                break;
+                        case 0xEBD0A0A2:
+                                type = MASS_PART_TYPE_NTFS;
+                                break;
+                        case 0x0FC63DAF:
+                                type = MASS_PART_TYPE_LINUX;
+                                break;
+                        default:
+                                type = MASS_PART_TYPE_GPT;
+                                break;
+                }
+
+                uint64_t start = GetLE64(p + 32);
+                uint64_t last = GetLE64(p + 40);
+
+                if(last >= start)
+                        Add(start, last - start + 1, type, MASS_PART_GPT | ((p[48] & 0x04) ? MASS_PART_BOOT : 0));
+        }
+        if(!rcode && crc != ecrc)
+                rcode = MASS_ERR_BAD_PARTITION_TABLE;
+        if(rcode) {
+                for(uint8_t i = first; i < nParts; i++)
+                        pParts[i].pDev = NULL;
+                nParts = first;
+                bTruncated = truncated;
+        }
+        return rcode;
+}
+
+void MassPartitionTable::Remove(uint8_t lun) {
+        uint8_t n = 0;
+
+        for(uint8_t i = 0; i < nParts; i++) {
+                if(lun == 0xFF || pParts[i].bLUN == lun)
+                        continue;
+                if(n != i)
+                        pParts[n] = pParts[i];
+                n++;
+        }
+        for(uint8_t i = n; i < nParts; i++)
+                pParts[i].pDev = NULL;
+        nParts = n;
+        if(lun == 0xFF)
+                bTruncated = false;
+}
+
+MassPartition* MassPartitionTable::Get(uint8_t lun, uint8_t index) {
+        for(uint8_t i = 0; i < nParts; i++)
+                if(pParts[i].bLUN == lun && !index--)
+                        return &pParts[i];
+        return NULL;
+}
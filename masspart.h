@@ -0,0 +1,232 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__MASSPART_H__)
+#define __MASSPART_H__
+
+#include "masstorage.h"
+
+#ifndef MASS_MAX_PARTITIONS
+#define MASS_MAX_PARTITIONS             4       // Partitions kept for all LUNs, 24 bytes of RAM each. Default size of MassPartitionTableT
+#endif
+
+#define MASS_PART_MAX_LOGICAL           32      // Logical partitions followed in an extended partition, stops EBR loops
+
+#define MASS_ERR_BAD_PARTITION_TABLE    (MASS_ERR_USER + 0x00) // GPT without a valid header or entries
+
+/* Partition types, the MBR system ID. GPT partitions get the MBR type of the same use */
+#define MASS_PART_TYPE_NONE             0x00    // No partition table, the partition is the whole LUN
+#define MASS_PART_TYPE_NTFS             0x07    // Also exFAT and the GPT Microsoft basic data type
+#define MASS_PART_TYPE_FAT32_LBA        0x0C
+#define MASS_PART_TYPE_LINUX            0x83
+#define MASS_PART_TYPE_GPT              0xEE    // A GPT partition of a type not listed here
+#define MASS_PART_TYPE_EFI              0xEF    // EFI system partition
+
+/* Partition flags */
+#define MASS_PART_BOOT                  0x01    // Active in the MBR, legacy BIOS bootable in the GPT
+#define MASS_PART_GPT                   0x02    // Found in a GPT
+#define MASS_PART_ALIGNED               0x04    // Starts on a physical block of the device
+
+/*
+ * A partition of a LUN, used as a block device of its own. Block addresses are relative to the start of the
+ * partition and are checked against its size, a transfer outside of it fails with MASS_ERR_BAD_LBA.
+ */
+class MassPartition {
+        friend class MassPartitionTable;
+
+        BulkOnly *pDev; // NULL if not in use
+        uint64_t qStart;
+        uint64_t qBlocks;
+        uint16_t wBlockSize;
+        uint8_t bLUN;
+        uint8_t bType; // MASS_PART_TYPE_*
+        uint8_t bFlags; // MASS_PART_*
+        uint8_t bPhysExp; // 2^n blocks in a physical block
+
+        uint8_t Check(uint64_t lba, uint32_t blocks);
+
+public:
+        MassPartition() : pDev(NULL), qStart(0), qBlocks(0), wBlockSize(0), bLUN(0), bType(0), bFlags(0), bPhysExp(0) {
+        };
+
+        uint8_t Read(uint64_t lba, uint32_t blocks, uint8_t *buf);
+        uint8_t Read(uint64_t lba, uint32_t blocks, USBReadParser *prs);
+        uint8_t Write(uint64_t lba, uint32_t blocks, const uint8_t *buf, bool fua = false);
+        uint8_t Unmap(uint64_t lba, uint32_t blocks);
+
+        BulkOnly* GetDevice() {
+                return pDev;
+        };
+
+        uint8_t GetLUN() {
+                return bLUN;
+        };
+
+        // First block on the LUN
+        uint64_t GetStart() {
+                return qStart;
+        };
+
+        uint64_t GetBlocks() {
+                return qBlocks;
+        };
+
+        uint16_t GetBlockSize() {
+                return wBlockSize;
+        };
+
+        uint8_t GetType() {
+                return bType;
+        };
+
+        bool IsBootable() {
+                return (bFlags & MASS_PART_BOOT) != 0;
+        };
+
+        bool IsGPT() {
+                return (bFlags & MASS_PART_GPT) != 0;
+        };
+
+        bool IsAligned() {
+                return (bFlags & MASS_PART_ALIGNED) != 0;
+        };
+
+        /* Blocks in a physical block of the device, e.g. 8 on a 512e drive and 1 on a 4Kn drive. On an aligned
+         * partition transfers of a multiple of this many blocks, starting at a multiple of it, do not make the
+         * drive read and write back a physical block */
+        uint16_t GetTransferBlocks() {
+                return 1U << bPhysExp;
+        };
+
+        // Bytes in a physical block
+        uint32_t GetTransferSize() {
+                return (uint32_t)wBlockSize << bPhysExp;
+        };
+};
+
+/*
+ * Partitions of the LUNs of a BulkOnly device. Scan() reads the MBR, with the logical partitions of
+ * an extended partition, or the GPT, checking the CRCs and falling back to the backup GPT. A LUN without a
+ * partition table (e.g. a "superfloppy" formatted as one FAT volume) is one partition of type
+ * MASS_PART_TYPE_NONE. Partitions that do not fit on the LUN are left out.
+ *
+ * The block buffer needs at least 512 bytes. Devices with larger blocks (4Kn drives) need a buffer of a whole
+ * block, or MS_WANT_PARSER, then the table is read in pieces the size of the buffer.
+ *
+ * The tables are provided by MassPartitionTableT, which sets their size.
+ */
+class MassPartitionTable {
+        // Keeps the part of a block that goes into the buffer, for blocks larger than the buffer
+        class WindowParser : public USBReadParser {
+                MassPartitionTable *pTable;
+
+        public:
+                WindowParser(MassPartitionTable *table) : pTable(table) {
+                };
+
+                void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset);
+        };
+
+        MassPartition *pParts;
+        uint8_t bMaxParts;
+        uint8_t nParts;
+        bool bTruncated; // Partitions were dropped, the table is too small
+        uint8_t *pBuf;
+        uint16_t wBufSize;
+
+        // LUN being scanned and the bytes of it in the buffer
+        BulkOnly *pDev;
+        uint8_t bLUN;
+        uint16_t wBlockSize;
+        uint64_t qCapacity;
+        uint64_t qBufLBA;
+        uint16_t wBufOffset;
+        uint16_t wBufLen; // 0 if the buffer holds nothing
+
+        uint8_t ReadBytes(uint64_t lba, uint16_t offset, uint16_t len, const uint8_t **data);
+        uint8_t ParseMBR();
+        uint8_t ParseLogical(uint64_t ext_start, uint64_t ext_blocks);
+        uint8_t ParseGPT(uint64_t hdr_lba);
+        void Add(uint64_t start, uint64_t blocks, uint8_t type, uint8_t flags);
+
+protected:
+        MassPartitionTable(MassPartition *parts, uint8_t max_parts, uint8_t *buf, uint16_t buf_size);
+
+public:
+        // Read the partition table of a LUN, replacing the partitions found on it before
+        uint8_t Scan(BulkOnly *dev, uint8_t lun);
+
+        /* Drop the partitions of a LUN, or of all LUNs with lun 0xFF. The partitions after them move down, so
+         * partitions have to be looked up again after a media change */
+        void Remove(uint8_t lun = 0xFF);
+
+        uint8_t GetCount() {
+                return nParts;
+        };
+
+        MassPartition* Get(uint8_t index) {
+                return (index < nParts) ? &pParts[index] : NULL;
+        };
+
+        // The index'th partition of a LUN, NULL if there are not that many
+        MassPartition* Get(uint8_t lun, uint8_t index);
+
+        bool IsTruncated() {
+                return bTruncated;
+        };
+};
+
+// Partition table with room for PARTS partitions and a block buffer of BUF bytes
+template <const uint8_t PARTS = MASS_MAX_PARTITIONS, const uint16_t BUF = 512>
+class MassPartitionTableT : public MassPartitionTable {
+        MassPartition partTable[PARTS];
+        uint8_t bufTable[BUF];
+
+public:
+        MassPartitionTableT() : MassPartitionTable(partTable, PARTS, bufTable, BUF) {
+        };
+};
+
+/*
+ * BulkOnly, or a class derived from it, that reads the partition table when media is inserted:
+ *
+ *      BulkOnlyPartitionedT<> Disk(&Usb);
+ *      BulkOnlyPartitionedT<BulkOnlyCacheT<8>, 8> CachedDisk(&Usb); // With a block cache, up to 8 partitions
+ *
+ *      MassPartition *part = Disk.Partitions.Get(0);
+ *      if(part) part->Read(0, 1, buf); // First block of the first partition
+ */
+template <class BOT = BulkOnly, const uint8_t PARTS = MASS_MAX_PARTITIONS, const uint16_t BUF = 512>
+class BulkOnlyPartitionedT : public BOT {
+protected:
+        void OnMediaInserted(uint8_t lun) {
+                BOT::OnMediaInserted(lun);
+                Partitions.Scan(this, lun);
+        };
+
+        void OnMediaRemoved(uint8_t lun) {
+                Partitions.Remove(lun);
+                BOT::OnMediaRemoved(lun);
+        };
+
+public:
+        MassPartitionTableT<PARTS, BUF> Partitions;
+
+        BulkOnlyPartitionedT(USB *p) : BOT(p) {
+        };
+};
+
+#endif // __MASSPART_H__
@@ -31,14 +31,26 @@ const uint8_t BulkOnly::epInterruptInIndex = 3;
  * Get the capacity of the media
  *
  * @param lun Logical Unit Number
- * @return media capacity
+ * @return media capacity, clipped to 32 bits. Use GetCapacity64 for media of 2^32 blocks or more
  */
 uint32_t BulkOnly::GetCapacity(uint8_t lun) {
         if(LUNOk[lun])
-                return CurrentCapacity[lun];
+                return (CurrentCapacity[lun] > 0xFFFFFFFFLLU) ? 0xFFFFFFFFLU : (uint32_t)CurrentCapacity[lun];
         return 0LU;
 }
 
+/**
+ * Get the capacity of the media
+ *
+ * @param lun Logical Unit Number
+ * @return media capacity
+ */
+uint64_t BulkOnly::GetCapacity64(uint8_t lun) {
+        if(LUNOk[lun])
+                return CurrentCapacity[lun];
+        return 0LLU;
+}
+
 /**
  * Get the sector (block) size used on the media
  *
@@ -51,6 +63,31 @@ uint16_t BulkOnly::GetSectorSize(uint8_t lun) {
         return 0U;
 }
 
+/**
+ * Get the physical block size, e.g. of a 512e drive with 4096 byte physical blocks.
+ * Only known if the device supports READ CAPACITY(16).
+ *
+ * @param lun Logical Unit Number
+ * @return n, a physical block is 2^n sectors
+ */
+uint8_t BulkOnly::GetPhysicalBlockExp(uint8_t lun) {
+        if(LUNOk[lun])
+                return PhysicalBlockExp[lun];
+        return 0U;
+}
+
+/**
+ * Get the alignment of the physical blocks
+ *
+ * @param lun Logical Unit Number
+ * @return first sector that starts a physical block
+ */
+uint16_t BulkOnly::GetLowestAlignedLBA(uint8_t lun) {
+        if(LUNOk[lun])
+                return LowestAlignedLBA[lun];
+        return 0U;
+}
+
 /**
  * Test if LUN is ready for use
  *
@@ -96,13 +133,152 @@ uint8_t BulkOnly::SCSITransaction6(CDB6_t *cdb, uint16_t buf_size, void *buf, ui
  * @param dir MASS_CMD_DIR_IN | MASS_CMD_DIR_OUT
  * @return
  */
-uint8_t BulkOnly::SCSITransaction10(CDB10_t *cdb, uint16_t buf_size, void *buf, uint8_t dir) {
-        // promote buf_size to 32bits.
-        CommandBlockWrapper cbw = CommandBlockWrapper(++dCBWTag, (uint32_t)buf_size, cdb, dir);
+uint8_t BulkOnly::SCSITransaction10(CDB10_t *cdb, uint32_t buf_size, void *buf, uint8_t dir) {
+        CommandBlockWrapper cbw = CommandBlockWrapper(++dCBWTag, buf_size, cdb, dir);
         //SetCurLUN(cdb->LUN);
         return (HandleSCSIError(Transaction(&cbw, buf_size, buf)));
 }
 
+/**
+ * Wrap and execute a SCSI CDB with length of 16
+ *
+ * @param cdb CDB to execute
+ * @param lun Logical Unit Number, a 16 byte CDB does not carry it
+ * @param buf_size Size of expected transaction
+ * @param buf Buffer
+ * @param dir MASS_CMD_DIR_IN | MASS_CMD_DIR_OUT
+ * @return
+ */
+uint8_t BulkOnly::SCSITransaction16(CDB16_t *cdb, uint8_t lun, uint32_t buf_size, void *buf, uint8_t dir) {
+        CommandBlockWrapper cbw = CommandBlockWrapper(++dCBWTag, buf_size, cdb, lun, dir);
+        return (HandleSCSIError(Transaction(&cbw, buf_size, buf)));
+}
+
+/**
+ * Make the device write the data in its write cache to the media.
+ * A device that has no write cache may reject the command, this is not an error.
+ *
+ * @param lun Logical Unit Number
+ * @return 0 on success
+ */
+uint8_t BulkOnly::SynchronizeCache(uint8_t lun) {
+        if(!LUNOk[lun]) return MASS_ERR_NO_MEDIA;
+        Notify(PSTR("\r\nSynchronizeCache\r\n"), 0x80);
+        Notify(PSTR("-----------------\r\n"), 0x80);
+
+        // LBA 0 and no blocks: the whole media
+        CDB10_t cdb = CDB10_t(SCSI_CMD_SYNCHRONIZE_CACHE, lun);
+        uint8_t rcode = SCSITransaction10(&cdb, (uint32_t)0, NULL, (uint8_t)MASS_CMD_DIR_OUT);
+        return (rcode == MASS_ERR_CMD_NOT_SUPPORTED) ? MASS_ERR_SUCCESS : rcode;
+}
+
+/**
+ * Tell the device that blocks no longer hold data, so a flash device can erase them ahead of time instead of
+ * copying them around. The ranges are sent with as few UNMAP commands as the limits of the device allow.
+ * Reading the blocks afterwards may return anything.
+ *
+ * @param lun Logical Unit Number
+ * @param ranges the blocks
+ * @param count number of ranges
+ * @return 0 on success, MASS_ERR_CMD_NOT_SUPPORTED if the device does not support UNMAP
+ */
+uint8_t BulkOnly::UnmapRanges(uint8_t lun, const MASS_UNMAP_RANGE *ranges, uint8_t count) {
+        if(!LUNOk[lun]) return MASS_ERR_NO_MEDIA;
+        if(!WriteOk[lun]) return MASS_ERR_WRITE_PROTECTED;
+        if(!UnmapMaxBlocks[lun]) return MASS_ERR_CMD_NOT_SUPPORTED;
+
+        for(uint8_t i = 0; i < count; i++)
+                if(ranges[i].lba >= CurrentCapacity[lun] || ranges[i].blocks > CurrentCapacity[lun] - ranges[i].lba)
+                        return MASS_ERR_BAD_LBA;
+
+        uint8_t list[8 + MASS_UNMAP_DESCRIPTORS * 16];
+        uint8_t max_desc = (UnmapMaxDescriptors[lun] < MASS_UNMAP_DESCRIPTORS) ? UnmapMaxDescriptors[lun] : MASS_UNMAP_DESCRIPTORS;
+        uint8_t i = 0;
+        uint64_t lba = count ? ranges[0].lba : 0;
+        uint32_t left = count ? ranges[0].blocks : 0; // Of range i
+
+        bTransferBusy = true;
+        while(i < count) {
+                // Fill one parameter list, splitting ranges at the block limit of a command
+                uint8_t n = 0;
+                uint32_t room = UnmapMaxBlocks[lun];
+
+                memset(list, 0, sizeof (list));
+                while(n < max_desc && room && i < count) {
+                        if(!left) {
+                                if(++i < count) {
+                                        lba = ranges[i].lba;
+                                        left = ranges[i].blocks;
+                                }
+                                continue;
+                        }
+
+                        uint32_t blocks = (left > room) ? room : left;
+                        uint8_t *d = list + 8 + n * 16;
+
+                        // Descriptor: LBA, number of blocks, 4 reserved bytes. All big endian
+                        for(uint8_t b = 0; b < 8; b++)
+                                d[b] = (uint8_t)(lba >> (56 - b * 8));
+                        d[8] = BGRAB3(blocks);
+                        d[9] = BGRAB2(blocks);
+                        d[10] = BGRAB1(blocks);
+                        d[11] = BGRAB0(blocks);
+                        MASS_TRACE_COMMAND(MASS_TRACE_UNMAP, lun, (blocks > 0xFFFFLU) ? 0xFFFF : (uint16_t)blocks, (uint32_t)lba);
+                        lba += blocks;
+                        left -= blocks;
+                        room -= blocks;
+                        n++;
+                }
+                if(!n)
+                        break;
+
+                uint16_t len = 8 + (uint16_t)n * 16;
+
+                list[0] = BGRAB1(len - 2); // Parameter list length
+                list[1] = BGRAB0(len - 2);
+                list[2] = BGRAB1(len - 8); // Block descriptor length
+                list[3] = BGRAB0(len - 8);
+
+                CDB10_t cdb = CDB10_t(SCSI_CMD_UNMAP, lun, len, 0LU);
+                uint8_t rcode = SCSITransaction10(&cdb, (uint32_t)len, list, (uint8_t)MASS_CMD_DIR_OUT);
+
+                if(rcode) {
+                        if(rcode == MASS_ERR_CMD_NOT_SUPPORTED)
+                                UnmapMaxBlocks[lun] = 0; // Do not ask again
+                        bTransferBusy = false;
+                        return rcode;
+                }
+        }
+        bTransferBusy = false;
+        return MASS_ERR_SUCCESS;
+}
+
+/**
+ * Unmap one range of blocks, see UnmapRanges()
+ *
+ * @param lun Logical Unit Number
+ * @param lba first block
+ * @param blocks number of blocks
+ * @return 0 on success
+ */
+uint8_t BulkOnly::Unmap(uint8_t lun, uint64_t lba, uint32_t blocks) {
+        MASS_UNMAP_RANGE range;
+
+        range.lba = lba;
+        range.blocks = blocks;
+        return UnmapRanges(lun, &range, 1);
+}
+
+/**
+ * Test if the media supports UNMAP
+ *
+ * @param lun Logical Unit Number
+ * @return true if Unmap() can be used
+ */
+bool BulkOnly::UnmapSupported(uint8_t lun) {
+        return LUNOk[lun] && UnmapMaxBlocks[lun];
+}
+
 /**
  * Lock or Unlock the tray or door on device.
  * Caution: Some devices with buggy firmware will lock up.
@@ -144,6 +320,9 @@ uint8_t BulkOnly::MediaCTL(uint8_t lun, uint8_t ctl) {
 /**
  * Read data from media
  *
+ * Reads of more than 0xFFFF blocks are split into several commands. READ(16) is used for blocks at or
+ * above 2^32, READ(10) otherwise.
+ *
  * @param lun Logical Unit Number
  * @param addr LBA address on media to read
  * @param bsize size of a block (we should probably use the cached size)
@@ -151,62 +330,69 @@ uint8_t BulkOnly::MediaCTL(uint8_t lun, uint8_t ctl) {
  * @param buf memory that is able to hold the requested data
  * @return 0 on success
  */
-uint8_t BulkOnly::Read(uint8_t lun, uint32_t addr, uint16_t bsize, uint8_t blocks, uint8_t *buf) {
+uint8_t BulkOnly::Read(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, uint8_t *buf) {
         if(!LUNOk[lun]) return MASS_ERR_NO_MEDIA;
-        Notify(PSTR("\r\nRead LUN:\t"), 0x80);
-        D_PrintHex<uint8_t > (lun, 0x90);
-        Notify(PSTR("\r\nLBA:\t\t"), 0x90);
-        D_PrintHex<uint32_t > (addr, 0x90);
-        Notify(PSTR("\r\nblocks:\t\t"), 0x90);
-        D_PrintHex<uint8_t > (blocks, 0x90);
-        Notify(PSTR("\r\nblock size:\t"), 0x90);
-        D_PrintHex<uint16_t > (bsize, 0x90);
-        Notify(PSTR("\r\n---------\r\n"), 0x80);
-        CDB10_t cdb = CDB10_t(SCSI_CMD_READ_10, lun, blocks, addr);
+        MASS_TRACE_COMMAND(MASS_TRACE_READ, lun, (blocks > 0xFFFFLU) ? 0xFFFF : (uint16_t)blocks, (uint32_t)addr);
 
+        uint8_t er = MASS_ERR_SUCCESS;
+        bTransferBusy = true;
+        while(blocks && !er) {
+                uint16_t n = (blocks > 0xFFFFLU) ? 0xFFFF : (uint16_t)blocks;
+                CommandBlockWrapper cbw;
 again:
-        uint8_t er = SCSITransaction10(&cdb, ((uint16_t)bsize * blocks), buf, (uint8_t)MASS_CMD_DIR_IN);
+                BlockCBW(&cbw, lun, MASS_CMD_DIR_IN, addr, bsize, n);
+                er = HandleSCSIError(Transaction(&cbw, cbw.dCBWDataTransferLength, buf));
 
-        if(er == MASS_ERR_STALL) {
-                MediaCTL(lun, 1);
-                delay(150);
-                if(!TestUnitReady(lun)) goto again;
+                if(er == MASS_ERR_STALL) {
+                        MediaCTL(lun, 1);
+                        delay(150);
+                        if(!TestUnitReady(lun)) goto again;
+                }
+                addr += n;
+                buf += (uint32_t)bsize * n;
+                blocks -= n;
         }
+        bTransferBusy = false;
         return er;
 }
 
 /**
  * Write data to media
  *
+ * Split into commands and CDB sizes like Read.
+ *
  * @param lun Logical Unit Number
  * @param addr LBA address on media to write
  * @param bsize size of a block (we should probably use the cached size)
  * @param blocks how many blocks to write
  * @param buf memory that contains the data to write
+ * @param fua force unit access, the device does not report success before the data is on the media
  * @return 0 on success
  */
-uint8_t BulkOnly::Write(uint8_t lun, uint32_t addr, uint16_t bsize, uint8_t blocks, const uint8_t * buf) {
+uint8_t BulkOnly::Write(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, const uint8_t * buf, bool fua) {
         if(!LUNOk[lun]) return MASS_ERR_NO_MEDIA;
         if(!WriteOk[lun]) return MASS_ERR_WRITE_PROTECTED;
-        Notify(PSTR("\r\nWrite LUN:\t"), 0x80);
-        D_PrintHex<uint8_t > (lun, 0x90);
-        Notify(PSTR("\r\nLBA:\t\t"), 0x90);
-        D_PrintHex<uint32_t > (addr, 0x90);
-        Notify(PSTR("\r\nblocks:\t\t"), 0x90);
-        D_PrintHex<uint8_t > (blocks, 0x90);
-        Notify(PSTR("\r\nblock size:\t"), 0x90);
-        D_PrintHex<uint16_t > (bsize, 0x90);
-        Notify(PSTR("\r\n---------\r\n"), 0x80);
-        CDB10_t cdb = CDB10_t(SCSI_CMD_WRITE_10, lun, blocks, addr);
+        MASS_TRACE_COMMAND(MASS_TRACE_WRITE, lun, (blocks > 0xFFFFLU) ? 0xFFFF : (uint16_t)blocks, (uint32_t)addr);
 
+        uint8_t er = MASS_ERR_SUCCESS;
+        bTransferBusy = true;
+        while(blocks && !er) {
+                uint16_t n = (blocks > 0xFFFFLU) ? 0xFFFF : (uint16_t)blocks;
+                CommandBlockWrapper cbw;
 again:
-        uint8_t er = SCSITransaction10(&cdb, ((uint16_t)bsize * blocks), (void*)buf, (uint8_t)MASS_CMD_DIR_OUT);
+                BlockCBW(&cbw, lun, MASS_CMD_DIR_OUT, addr, bsize, n, fua ? SCSI_CDB_FUA : 0);
+                er = HandleSCSIError(Transaction(&cbw, cbw.dCBWDataTransferLength, (void*)buf));
 
-        if(er == MASS_ERR_WRITE_STALL) {
-                MediaCTL(lun, 1);
-                delay(150);
-                if(!TestUnitReady(lun)) goto again;
+                if(er == MASS_ERR_WRITE_STALL) {
+                        MediaCTL(lun, 1);
+                        delay(150);
+                        if(!TestUnitReady(lun)) goto again;
+                }
+                addr += n;
+                buf += (uint32_t)bsize * n;
+                blocks -= n;
         }
+        bTransferBusy = false;
         return er;
 }
 
@@ -226,6 +412,7 @@ bIface(0),
 bNumEP(1),
 qNextPollTime(0),
 bPollEnable(false),
+bTransferBusy(false),
 //dCBWTag(0),
 bLastUsbError(0) {
         ClearAllEP();
@@ -332,8 +519,10 @@ uint8_t BulkOnly::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
         AddressPool &addrPool = pUsb->GetAddressPool();
         UsbDevice *p = addrPool.GetUsbDevicePtr(bAddress);
 
-        if(!p)
+        if(!p) {
+                Release();
                 return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
+        }
 
         // Assign new address to the device
         delay(2000);
@@ -353,8 +542,10 @@ uint8_t BulkOnly::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
 
         p = addrPool.GetUsbDevicePtr(bAddress);
 
-        if(!p)
+        if(!p) {
+                Release();
                 return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
+        }
 
         p->lowspeed = lowspeed;
 
@@ -376,6 +567,21 @@ uint8_t BulkOnly::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
 
                 rcode = pUsb->getConfDescr(bAddress, 0, i, &BulkOnlyParser);
 
+                if(rcode)
+                        goto FailGetConfDescr;
+
+                if(bNumEP > 1)
+                        break;
+
+                // No Bulk-Only interface, look for a UFI floppy on CBI. EndpointXtract() takes protocol 0 and 1
+                ConfigDescParser< USB_CLASS_MASS_STORAGE,
+                        MASS_SUBCLASS_UFI,
+                        MASS_PROTO_CBI,
+                        CP_MASK_COMPARE_CLASS |
+                        CP_MASK_COMPARE_SUBCLASS > CBIParser(this);
+
+                rcode = pUsb->getConfDescr(bAddress, 0, i, &CBIParser);
+
                 if(rcode)
                         goto FailGetConfDescr;
 
@@ -383,13 +589,19 @@ uint8_t BulkOnly::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
                         break;
         }
 
-        if(bNumEP < 3)
+        if(bNumEP < 3 || !epInfo[epDataInIndex].epAddr || !epInfo[epDataOutIndex].epAddr) {
+                // Do not keep the address, or the next driver can not have the device
+                Release();
                 return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+        }
+        if(bProtocol == MASS_PROTO_CBI && !epInfo[epInterruptInIndex].epAddr)
+                bProtocol = MASS_PROTO_CBI_NO_INT;
 
         // Assign epInfo to epinfo pointer
         pUsb->setEpInfoEntry(bAddress, bNumEP, epInfo);
 
         USBTRACE2("Conf:", bConfNum);
+        USBTRACE2("Proto:", bProtocol);
 
         // Set Configuration Value
         rcode = pUsb->setConf(bAddress, 0, bConfNum);
@@ -415,6 +627,7 @@ uint8_t BulkOnly::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
                 if(rcode) {
                         ErrorMessage<uint8_t > (PSTR("Inquiry"), rcode);
                 } else {
+                        RC16Ok[lun] = MS_WANT_RC16 && (response.Version >= 5);
 #if 0
                         printf("LUN %i `", lun);
                         uint8_t *buf = response.VendorID;
@@ -471,8 +684,10 @@ uint8_t BulkOnly::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
                 }
         }
 
-
-        CheckMedia();
+        bPollLUN = 0;
+        for(uint8_t lun = 0; lun < MASS_MAX_SUPPORTED_LUN; lun++)
+                bPollSkip[lun] = bPollBackoff[lun] = 0;
+        qNextPollTime = (uint32_t)millis() + MASS_POLL_INTERVAL / (bMaxLUN + 1);
 
         rcode = OnInit();
 
@@ -486,6 +701,9 @@ uint8_t BulkOnly::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
         bPollEnable = true;
 
         //USBTRACE("Poll enabled\r\n");
+        for(uint8_t lun = 0; lun <= bMaxLUN; lun++)
+                if(LUNOk[lun])
+                        OnMediaInserted(lun);
         return 0;
 
 FailSetConfDescr:
@@ -540,33 +758,26 @@ Fail:
  * @param proto
  * @param pep
  */
-void BulkOnly::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto __attribute__((unused)), const USB_ENDPOINT_DESCRIPTOR * pep) {
+void BulkOnly::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR * pep) {
         ErrorMessage<uint8_t > (PSTR("Conf.Val"), conf);
         ErrorMessage<uint8_t > (PSTR("Iface Num"), iface);
         ErrorMessage<uint8_t > (PSTR("Alt.Set"), alt);
 
+        if(proto != MASS_PROTO_BBB && proto != MASS_PROTO_CBI && proto != MASS_PROTO_CBI_NO_INT)
+                return;
+
         bConfNum = conf;
+        bIface = iface;
+        bProtocol = proto;
 
         uint8_t index;
 
-#if 1
-        if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_BULK) {
-                index = ((pep->bEndpointAddress & 0x80) == 0x80) ? epDataInIndex : epDataOutIndex;
-                // Fill in the endpoint info structure
-                epInfo[index].epAddr = (pep->bEndpointAddress & 0x0F);
-                epInfo[index].maxPktSize = (uint8_t)pep->wMaxPacketSize;
-                epInfo[index].bmSndToggle = 0;
-                epInfo[index].bmRcvToggle = 0;
-
-                bNumEP++;
-
-                PrintEndpointDescriptor(pep);
-
-        }
-#else
-        if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_INTERRUPT && (pep->bEndpointAddress & 0x80) == 0x80)
+        if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_INTERRUPT && (pep->bEndpointAddress & 0x80) == 0x80) {
+                // Command completion of CBI
+                if(proto != MASS_PROTO_CBI)
+                        return;
                 index = epInterruptInIndex;
-        else if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_BULK)
+        } else if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_BULK)
                 index = ((pep->bEndpointAddress & 0x80) == 0x80) ? epDataInIndex : epDataOutIndex;
         else
                 return;
@@ -580,7 +791,6 @@ void BulkOnly::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t
         bNumEP++;
 
         PrintEndpointDescriptor(pep);
-#endif
 }
 
 /**
@@ -589,6 +799,9 @@ void BulkOnly::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t
  * @return
  */
 uint8_t BulkOnly::Release() {
+        for(uint8_t lun = 0; lun < MASS_MAX_SUPPORTED_LUN; lun++)
+                if(LUNOk[lun])
+                        OnMediaRemoved(lun);
         ClearAllEP();
         pUsb->GetAddressPool().FreeAddress(bAddress);
         return 0;
@@ -614,19 +827,53 @@ bool BulkOnly::CheckLUN(uint8_t lun) {
         for(uint8_t i = 0; i < 8 /*sizeof (Capacity)*/; i++)
                 D_PrintHex<uint8_t > (capacity.data[i], 0x80);
         Notify(PSTR("\r\n\r\n"), 0x80);
-        // Only 512/1024/2048/4096 are valid values!
+        uint64_t last = BMAKE32(capacity.data[0], capacity.data[1], capacity.data[2], capacity.data[3]);
         uint32_t c = BMAKE32(capacity.data[4], capacity.data[5], capacity.data[6], capacity.data[7]);
+        PhysicalBlockExp[lun] = 0;
+        LowestAlignedLBA[lun] = 0;
+        UnmapMaxBlocks[lun] = 0;
+        if(last == 0xFFFFFFFFLLU || RC16Ok[lun]) {
+                // 2^32 blocks or more, the last LBA only fits in READ CAPACITY(16). Newer devices also report
+                // the physical block size there.
+                uint8_t cap16[32];
+                for(uint8_t i = 0; i < 32; i++) cap16[i] = 0;
+
+                if(ReadCapacity16(lun, cap16)) {
+                        if(last == 0xFFFFFFFFLLU) {
+                                // Buggy firmware will report 0xffffffff for no media
+                                ErrorMessage<uint8_t > (PSTR(">>>>>>>>>>>>>>>>BUGGY FIRMWARE. CAPACITY FAIL ON LUN"), lun);
+                                return false;
+                        }
+                        RC16Ok[lun] = false; // Not supported after all, do not ask again
+                } else {
+                        uint64_t last16 = BMAKE64(cap16[0], cap16[1], cap16[2], cap16[3], cap16[4], cap16[5], cap16[6], cap16[7]);
+                        uint32_t c16 = BMAKE32(cap16[8], cap16[9], cap16[10], cap16[11]);
+
+                        // Below 2^32 blocks it has to agree with READ CAPACITY(10), else the bridge got it wrong and
+                        // the LUN goes on with the values of READ CAPACITY(10)
+                        if(last != 0xFFFFFFFFLLU && (last16 != last || c16 != c)) {
+                                RC16Ok[lun] = false;
+                                goto Capacity10;
+                        }
+                        last = last16;
+                        c = c16;
+                        PhysicalBlockExp[lun] = cap16[13] & 0x0F;
+                        LowestAlignedLBA[lun] = BMAKE16(cap16[14] & 0x3F, cap16[15]);
+                        if(cap16[14] & 0x80) // LBPME, thin provisioned
+                                CheckProvisioning(lun);
+                }
+        }
+Capacity10:
+        // Only 512/1024/2048/4096 are valid values!
         if(c != 0x0200LU && c != 0x0400LU && c != 0x0800LU && c != 0x1000LU) {
                 return false;
         }
         // Store capacity information.
         CurrentSectorSize[lun] = (uint16_t)(c); // & 0xFFFF);
 
-        CurrentCapacity[lun] = BMAKE32(capacity.data[0], capacity.data[1], capacity.data[2], capacity.data[3]) + 1;
-        if(CurrentCapacity[lun] == /*0xffffffffLU */ 0x01LU || CurrentCapacity[lun] == 0x00LU) {
-                // Buggy firmware will report 0xffffffff or 0 for no media
-                if(CurrentCapacity[lun])
-                        ErrorMessage<uint8_t > (PSTR(">>>>>>>>>>>>>>>>BUGGY FIRMWARE. CAPACITY FAIL ON LUN"), lun);
+        CurrentCapacity[lun] = last + 1;
+        if(CurrentCapacity[lun] == 0x01LLU) {
+                // Buggy firmware will report 0 for no media
                 return false;
         }
         delay(20);
@@ -638,27 +885,85 @@ bool BulkOnly::CheckLUN(uint8_t lun) {
 /**
  * For driver use only.
  *
- * Scan for media change on all LUNs
+ * Read the logical block provisioning VPD page to see if UNMAP is supported, and the block limits page for
+ * how many blocks and ranges one UNMAP command can have.
+ *
+ * @param lun Logical Unit Number
  */
-void BulkOnly::CheckMedia() {
-        for(uint8_t lun = 0; lun <= bMaxLUN; lun++) {
-                if(TestUnitReady(lun)) {
-                        LUNOk[lun] = false;
-                        continue;
+void BulkOnly::CheckProvisioning(uint8_t lun) {
+        uint8_t vpd[64];
+        bool limits = false;
+        bool provisioning = false;
+
+        memset(vpd, 0, sizeof (vpd));
+        if(Inquiry(lun, sizeof (vpd), vpd, true, SCSI_VPD_SUPPORTED_PAGES))
+                return;
+        for(uint8_t i = 0; i < vpd[3] && i < sizeof (vpd) - 4; i++) {
+                if(vpd[4 + i] == SCSI_VPD_BLOCK_LIMITS)
+                        limits = true;
+                else if(vpd[4 + i] == SCSI_VPD_LB_PROVISIONING)
+                        provisioning = true;
+        }
+
+        memset(vpd, 0, sizeof (vpd));
+        if(!provisioning || Inquiry(lun, 8, vpd, true, SCSI_VPD_LB_PROVISIONING) || !(vpd[5] & 0x80)) // LBPU
+                return;
+
+        // Without block limits send one range of up to 65536 blocks per command
+        UnmapMaxBlocks[lun] = 0x10000LU;
+        UnmapMaxDescriptors[lun] = 1;
+        memset(vpd, 0, sizeof (vpd));
+        if(limits && !Inquiry(lun, sizeof (vpd), vpd, true, SCSI_VPD_BLOCK_LIMITS) && vpd[3] >= 0x3C) {
+                uint32_t blocks = BMAKE32(vpd[20], vpd[21], vpd[22], vpd[23]);
+                uint32_t desc = BMAKE32(vpd[24], vpd[25], vpd[26], vpd[27]);
+
+                if(blocks && desc) {
+                        UnmapMaxBlocks[lun] = blocks;
+                        UnmapMaxDescriptors[lun] = (desc > 0xFF) ? 0xFF : (uint8_t)desc;
                 }
-                if(!LUNOk[lun])
-                        LUNOk[lun] = CheckLUN(lun);
         }
-#if 0
-        printf("}}}}}}}}}}}}}}}}STATUS ");
-        for(uint8_t lun = 0; lun <= bMaxLUN; lun++) {
-                if(LUNOk[lun])
-                        printf("#");
-                else printf(".");
+}
+
+/**
+ * For driver use only.
+ *
+ * Check the next LUN for a media change. A LUN without media is checked less often each time, up to every
+ * MASS_POLL_MAX_BACKOFF rounds. Only a missing or changed medium ends a LUN, a busy device, a NAK or another
+ * unit attention is checked again on the next round.
+ */
+void BulkOnly::CheckMedia() {
+        uint8_t lun = bPollLUN;
+
+        if(++bPollLUN > bMaxLUN)
+                bPollLUN = 0;
+        qNextPollTime = (uint32_t)millis() + MASS_POLL_INTERVAL / (bMaxLUN + 1);
+
+        if(bPollSkip[lun]) {
+                bPollSkip[lun]--;
+                return;
         }
-        printf("\r\n");
-#endif
-        qNextPollTime = (uint32_t)millis() + 2000;
+
+        bool was = LUNOk[lun];
+        uint8_t rcode = TestUnitReady(lun);
+
+        if(rcode == MASS_ERR_NO_MEDIA || rcode == MASS_ERR_MEDIA_CHANGED)
+                LUNOk[lun] = false;
+        else if(!rcode && !was)
+                LUNOk[lun] = CheckLUN(lun);
+
+        if(rcode == MASS_ERR_NO_MEDIA) {
+                // Empty slot, e.g. of a card reader: skip 0, 1, 3, 7 rounds
+                bPollBackoff[lun] = bPollBackoff[lun] ? bPollBackoff[lun] << 1 : 1;
+                if(bPollBackoff[lun] > MASS_POLL_MAX_BACKOFF)
+                        bPollBackoff[lun] = MASS_POLL_MAX_BACKOFF;
+                bPollSkip[lun] = bPollBackoff[lun] - 1;
+        } else
+                bPollBackoff[lun] = 0;
+
+        if(was && !LUNOk[lun])
+                OnMediaRemoved(lun);
+        else if(!was && LUNOk[lun])
+                OnMediaInserted(lun);
 }
 
 /**
@@ -667,16 +972,12 @@ void BulkOnly::CheckMedia() {
  * @return
  */
 uint8_t BulkOnly::Poll() {
-        //uint8_t rcode = 0;
-
-        if(!bPollEnable)
+        if(!bPollEnable || bTransferBusy)
                 return 0;
 
         if((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L) {
                 CheckMedia();
         }
-        //rcode = 0;
-
         return 0;
 }
 
@@ -709,13 +1010,16 @@ uint8_t BulkOnly::GetMaxLUN(uint8_t *plun) {
  * @param lun Logical Unit Number
  * @param bsize
  * @param buf
+ * @param vpd read a vital product data page instead of the standard data
+ * @param page VPD page code
  * @return
  */
-uint8_t BulkOnly::Inquiry(uint8_t lun, uint16_t bsize, uint8_t *buf) {
+uint8_t BulkOnly::Inquiry(uint8_t lun, uint16_t bsize, uint8_t *buf, bool vpd, uint8_t page) {
         Notify(PSTR("\r\nInquiry\r\n"), 0x80);
         Notify(PSTR("---------\r\n"), 0x80);
 
-        CDB6_t cdb = CDB6_t(SCSI_CMD_INQUIRY, lun, 0LU, (uint8_t)bsize, 0);
+        // EVPD is bit 0 of byte 1, the page code is byte 2
+        CDB6_t cdb = CDB6_t(SCSI_CMD_INQUIRY, lun, vpd ? 0x10000LU | ((uint32_t)page << 8) : 0LU, (uint8_t)bsize, 0);
         uint8_t rc = SCSITransaction6(&cdb, bsize, buf, (uint8_t)MASS_CMD_DIR_IN);
 
         return rc;
@@ -775,6 +1079,49 @@ uint8_t BulkOnly::ReadCapacity10(uint8_t lun, uint8_t *buf) {
         return SCSITransaction10(&cdb, 8, buf, (uint8_t)MASS_CMD_DIR_IN);
 }
 
+/**
+ * For driver use only.
+ *
+ * @param lun Logical Unit Number
+ * @param buf 32 bytes
+ * @return
+ */
+uint8_t BulkOnly::ReadCapacity16(uint8_t lun, uint8_t *buf) {
+        Notify(PSTR("\r\nReadCapacity16\r\n"), 0x80);
+        Notify(PSTR("---------------\r\n"), 0x80);
+
+        CDB16_t cdb = CDB16_t(SCSI_CMD_SERVICE_ACTION_IN_16, SCSI_SA_READ_CAPACITY_16, 0LLU, 32);
+        return SCSITransaction16(&cdb, lun, 32, buf, (uint8_t)MASS_CMD_DIR_IN);
+}
+
+/**
+ * For driver use only.
+ *
+ * Wrap a READ or WRITE of blocks at addr. The 16 byte CDB is only used when a block is at or above 2^32,
+ * older devices may not support it.
+ *
+ * @param pcbw CBW to fill in
+ * @param lun Logical Unit Number
+ * @param dir MASS_CMD_DIR_IN to read, MASS_CMD_DIR_OUT to write
+ * @param addr LBA of the first block
+ * @param bsize size of a block
+ * @param blocks how many blocks
+ * @param flags bits of CDB byte 1, e.g. SCSI_CDB_FUA
+ */
+void BulkOnly::BlockCBW(CommandBlockWrapper *pcbw, uint8_t lun, uint8_t dir, uint64_t addr, uint16_t bsize, uint16_t blocks, uint8_t flags) {
+        uint32_t bytes = (uint32_t)bsize * blocks;
+        bool out = (dir == MASS_CMD_DIR_OUT);
+
+        if(addr + blocks > 0x100000000LLU) {
+                CDB16_t cdb = CDB16_t(out ? SCSI_CMD_WRITE_16 : SCSI_CMD_READ_16, flags, addr, blocks);
+                *pcbw = CommandBlockWrapper(++dCBWTag, bytes, &cdb, lun, dir);
+        } else {
+                CDB10_t cdb = CDB10_t(out ? SCSI_CMD_WRITE_10 : SCSI_CMD_READ_10, lun, blocks, (uint32_t)addr);
+                cdb.Service_Action = flags;
+                *pcbw = CommandBlockWrapper(++dCBWTag, bytes, &cdb, dir);
+        }
+}
+
 /**
  * For driver use only.
  *
@@ -789,9 +1136,19 @@ uint8_t BulkOnly::Page3F(uint8_t lun) {
                 buf[i] = 0x00;
         }
         WriteOk[lun] = true;
-        uint8_t rc = ModeSense6(lun, 0, 0x3f, 0, 192, buf);
+        uint8_t rc;
+        uint8_t wp; // Byte of the mode parameter header with the WP bit
+        if(bProtocol == MASS_PROTO_BBB) {
+                rc = ModeSense6(lun, 0, 0x3f, 0, 192, buf);
+                wp = 2;
+        } else {
+                // UFI only has MODE SENSE(10)
+                CDB10_t cdb = CDB10_t(SCSI_CMD_MODE_SENSE_10, lun, 192, 0x3F000000LU);
+                rc = SCSITransaction10(&cdb, 192, buf, (uint8_t)MASS_CMD_DIR_IN);
+                wp = 3;
+        }
         if(!rc) {
-                WriteOk[lun] = ((buf[2] & 0x80) == 0);
+                WriteOk[lun] = ((buf[wp] & 0x80) == 0);
                 Notify(PSTR("Mode Sense: "), 0x80);
                 for(int i = 0; i < 4; i++) {
                         D_PrintHex<uint8_t > (buf[i], 0x80);
@@ -841,12 +1198,12 @@ uint8_t BulkOnly::ClearEpHalt(uint8_t index) {
 
         uint8_t ret = 0;
 
-        while((ret = (pUsb->ctrlReq(bAddress, 0, USB_SETUP_HOST_TO_DEVICE | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_ENDPOINT, USB_REQUEST_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0, ((index == epDataInIndex) ? (0x80 | epInfo[index].epAddr) : epInfo[index].epAddr), 0, 0, NULL, NULL)) == 0x01))
+        while((ret = (pUsb->ctrlReq(bAddress, 0, USB_SETUP_HOST_TO_DEVICE | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_ENDPOINT, USB_REQUEST_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0, ((index == epDataOutIndex) ? epInfo[index].epAddr : (0x80 | epInfo[index].epAddr)), 0, 0, NULL, NULL)) == 0x01))
                 delay(6);
 
         if(ret) {
                 ErrorMessage<uint8_t > (PSTR("ClearEpHalt"), ret);
-                ErrorMessage<uint8_t > (PSTR("EP"), ((index == epDataInIndex) ? (0x80 | epInfo[index].epAddr) : epInfo[index].epAddr));
+                ErrorMessage<uint8_t > (PSTR("EP"), ((index == epDataOutIndex) ? epInfo[index].epAddr : (0x80 | epInfo[index].epAddr)));
                 return ret;
         }
         epInfo[index].bmSndToggle = 0;
@@ -859,6 +1216,16 @@ uint8_t BulkOnly::ClearEpHalt(uint8_t index) {
  *
  */
 void BulkOnly::Reset() {
+        if(bProtocol != MASS_PROTO_BBB) {
+                // CBI command block reset, a SEND DIAGNOSTIC with the rest of the block set to 0xFF
+                uint8_t cdb[MASS_CBI_CMD_LENGTH];
+
+                memset(cdb, 0xFF, sizeof (cdb));
+                cdb[0] = SCSI_CMD_SEND_DIAGNOSTIC;
+                cdb[1] = 0x04;
+                while(pUsb->ctrlReq(bAddress, 0, bmREQ_MASSOUT, MASS_REQ_ADSC, 0, 0, bIface, sizeof (cdb), sizeof (cdb), cdb, NULL) == 0x01) delay(6);
+                return;
+        }
         while(pUsb->ctrlReq(bAddress, 0, bmREQ_MASSOUT, MASS_REQ_BOMSR, 0, 0, bIface, 0, 0, NULL, NULL) == 0x01) delay(6);
 }
 
@@ -868,8 +1235,7 @@ void BulkOnly::Reset() {
  * @return 0 if successful
  */
 uint8_t BulkOnly::ResetRecovery() {
-        Notify(PSTR("\r\nResetRecovery\r\n"), 0x80);
-        Notify(PSTR("-----------------\r\n"), 0x80);
+        MASS_TRACE_ERROR(MASS_TRACE_RESET, bTheLUN, 0, 0);
 
         delay(6);
         Reset();
@@ -900,9 +1266,15 @@ void BulkOnly::ClearAllEP() {
                 WriteOk[i] = false;
                 CurrentCapacity[i] = 0lu;
                 CurrentSectorSize[i] = 0;
+                RC16Ok[i] = false;
+                PhysicalBlockExp[i] = 0;
+                LowestAlignedLBA[i] = 0;
+                UnmapMaxBlocks[i] = 0;
+                UnmapMaxDescriptors[i] = 0;
         }
 
         bIface = 0;
+        bProtocol = MASS_PROTO_BBB;
         bNumEP = 1;
         bAddress = 0;
         qNextPollTime = 0;
@@ -921,11 +1293,11 @@ void BulkOnly::ClearAllEP() {
  */
 bool BulkOnly::IsValidCSW(CommandStatusWrapper *pcsw, CommandBlockWrapperBase *pcbw) {
         if(pcsw->dCSWSignature != MASS_CSW_SIGNATURE) {
-                Notify(PSTR("CSW:Sig error\r\n"), 0x80);
+                MASS_TRACE_ERROR(MASS_TRACE_BAD_CSW, bTheLUN, 0, pcsw->dCSWTag);
                 return false;
         }
         if(pcsw->dCSWTag != pcbw->dCBWTag) {
-                Notify(PSTR("CSW:Wrong tag\r\n"), 0x80);
+                MASS_TRACE_ERROR(MASS_TRACE_BAD_CSW, bTheLUN, 1, pcsw->dCSWTag);
                 return false;
         }
         return true;
@@ -946,8 +1318,7 @@ uint8_t BulkOnly::HandleUsbError(uint8_t error, uint8_t index) {
         //ClearEpHalt(index);
         while(error && count) {
                 if(error != hrSUCCESS) {
-                        ErrorMessage<uint8_t > (PSTR("USB Error"), error);
-                        ErrorMessage<uint8_t > (PSTR("Index"), index);
+                        MASS_TRACE_ERROR(MASS_TRACE_USB_ERROR, bTheLUN, error, index);
                 }
                 switch(error) {
                                 // case hrWRONGPID:
@@ -962,7 +1333,7 @@ uint8_t BulkOnly::HandleUsbError(uint8_t error, uint8_t index) {
                                 if(index == 0)
                                         return MASS_ERR_STALL;
                                 ClearEpHalt(index);
-                                if(index != epDataInIndex)
+                                if(index == epDataOutIndex)
                                         return MASS_ERR_WRITE_STALL;
                                 return MASS_ERR_STALL;
 
@@ -984,7 +1355,6 @@ uint8_t BulkOnly::HandleUsbError(uint8_t error, uint8_t index) {
                                 }
                                 return MASS_ERR_SUCCESS;
                         default:
-                                ErrorMessage<uint8_t > (PSTR("\r\nUSB"), error);
                                 return MASS_ERR_GENERAL_USB_ERROR;
                 }
                 count--;
@@ -995,101 +1365,75 @@ uint8_t BulkOnly::HandleUsbError(uint8_t error, uint8_t index) {
 
 #if MS_WANT_PARSER
 
-uint8_t BulkOnly::Transaction(CommandBlockWrapper *pcbw, uint16_t buf_size, void *buf) {
-        return Transaction(CommandBlockWrapper *pcbw, uint16_t buf_size, void *buf, 0);
+uint8_t BulkOnly::Transaction(CommandBlockWrapper *pcbw, uint32_t buf_size, void *buf) {
+        return Transaction(pcbw, buf_size, buf, 0);
 }
 #endif
 
 /**
  * For driver use only.
  *
+ * The data stage is split into USB transfers of at most MASS_MAX_TRANSFER bytes. With a parser the data stage
+ * must fit in one transfer, its offsets are 16 bits.
+ *
  * @param pcbw
  * @param buf_size
  * @param buf
  * @param flags
  * @return
  */
-uint8_t BulkOnly::Transaction(CommandBlockWrapper *pcbw, uint16_t buf_size, void *buf
+uint8_t BulkOnly::Transaction(CommandBlockWrapper *pcbw, uint32_t buf_size, void *buf
 #if MS_WANT_PARSER
         , uint8_t flags
 #endif
         ) {
 
 #if MS_WANT_PARSER
-        uint16_t bytes = (pcbw->dCBWDataTransferLength > buf_size) ? buf_size : pcbw->dCBWDataTransferLength;
-        printf("Transfersize %i\r\n", bytes);
-        delay(1000);
-
+        uint32_t bytes = (pcbw->dCBWDataTransferLength > buf_size) ? buf_size : pcbw->dCBWDataTransferLength;
         bool callback = (flags & MASS_TRANS_FLG_CALLBACK) == MASS_TRANS_FLG_CALLBACK;
 #else
-        uint16_t bytes = buf_size;
+        uint32_t bytes = buf_size;
+        bool callback = false;
 #endif
-        bool write = (pcbw->bmCBWFlags & MASS_CMD_DIR_IN) != MASS_CMD_DIR_IN;
         uint8_t ret = 0;
         uint8_t usberr;
         CommandStatusWrapper csw; // up here, we allocate ahead to save cpu cycles.
         SetCurLUN(pcbw->bmCBWLUN);
-        ErrorMessage<uint32_t > (PSTR("CBW.dCBWTag"), pcbw->dCBWTag);
+        MASS_TRACE_COMMAND(MASS_TRACE_CBW, bTheLUN, pcbw->CBWCB[0], pcbw->dCBWTag);
+
+        if(bProtocol != MASS_PROTO_BBB)
+                return CBITransaction(pcbw, bytes, buf, callback);
 
         while((usberr = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, sizeof (CommandBlockWrapper), (uint8_t*)pcbw)) == hrBUSY) delay(1);
 
         ret = HandleUsbError(usberr, epDataOutIndex);
         //ret = HandleUsbError(pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, sizeof (CommandBlockWrapper), (uint8_t*)pcbw), epDataOutIndex);
         if(ret) {
-                ErrorMessage<uint8_t > (PSTR("============================ CBW"), ret);
-        } else {
-                if(bytes) {
-                        if(!write) {
-#if MS_WANT_PARSER
-                                if(callback) {
-                                        uint8_t rbuf[bytes];
-                                        while((usberr = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &bytes, rbuf)) == hrBUSY) delay(1);
-                                        if(usberr == hrSUCCESS) ((USBReadParser*)buf)->Parse(bytes, rbuf, 0);
-                                } else {
-#endif
-                                        while((usberr = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &bytes, (uint8_t*)buf)) == hrBUSY) delay(1);
-#if MS_WANT_PARSER
-
-                                }
-#endif
-                                ret = HandleUsbError(usberr, epDataInIndex);
-                        } else {
-                                while((usberr = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, bytes, (uint8_t*)buf)) == hrBUSY) delay(1);
-                                ret = HandleUsbError(usberr, epDataOutIndex);
-                        }
-                        if(ret) {
-                                ErrorMessage<uint8_t > (PSTR("============================ DAT"), ret);
-                        }
-                }
-        }
+                MASS_TRACE_ERROR(MASS_TRACE_STAGE_ERROR, bTheLUN, ret, 0);
+        } else
+                ret = DataStage(pcbw, bytes, buf, callback);
 
         {
-                bytes = sizeof (CommandStatusWrapper);
+                uint16_t cswbytes = sizeof (CommandStatusWrapper);
                 int tries = 2;
                 while(tries--) {
-                        while((usberr = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &bytes, (uint8_t*) & csw)) == hrBUSY) delay(1);
+                        while((usberr = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &cswbytes, (uint8_t*) & csw)) == hrBUSY) delay(1);
                         if(!usberr) break;
                         ClearEpHalt(epDataInIndex);
                         if(tries) ResetRecovery();
                 }
-                if(!ret) {
-                        Notify(PSTR("CBW:\t\tOK\r\n"), 0x80);
-                        Notify(PSTR("Data Stage:\tOK\r\n"), 0x80);
-                } else {
+                if(ret) {
                         // Throw away csw, IT IS NOT OF ANY USE.
                         ResetRecovery();
                         return ret;
                 }
                 ret = HandleUsbError(usberr, epDataInIndex);
                 if(ret) {
-                        ErrorMessage<uint8_t > (PSTR("============================ CSW"), ret);
+                        MASS_TRACE_ERROR(MASS_TRACE_STAGE_ERROR, bTheLUN, ret, 2);
                 }
                 if(usberr == hrSUCCESS) {
                         if(IsValidCSW(&csw, pcbw)) {
-                                //ErrorMessage<uint32_t > (PSTR("CSW.dCBWTag"), csw.dCSWTag);
-                                //ErrorMessage<uint8_t > (PSTR("bCSWStatus"), csw.bCSWStatus);
-                                //ErrorMessage<uint32_t > (PSTR("dCSWDataResidue"), csw.dCSWDataResidue);
-                                Notify(PSTR("CSW:\t\tOK\r\n\r\n"), 0x80);
+                                MASS_TRACE_COMMAND(MASS_TRACE_CSW, bTheLUN, csw.bCSWStatus, csw.dCSWDataResidue);
                                 return csw.bCSWStatus;
                         } else {
                                 // NOTE! Sometimes this is caused by the reported residue being wrong.
@@ -1097,7 +1441,6 @@ uint8_t BulkOnly::Transaction(CommandBlockWrapper *pcbw, uint16_t buf_size, void
                                 // I own one... 05e3:0701 Genesys Logic, Inc. USB 2.0 IDE Adapter.
                                 // Other devices that exhibit this behavior exist in the wild too.
                                 // Be sure to check quirks in the Linux source code before reporting a bug. --xxxajk
-                                Notify(PSTR("Invalid CSW\r\n"), 0x80);
                                 ResetRecovery();
                                 //return MASS_ERR_SUCCESS;
                                 return MASS_ERR_INVALID_CSW;
@@ -1107,6 +1450,118 @@ uint8_t BulkOnly::Transaction(CommandBlockWrapper *pcbw, uint16_t buf_size, void
         return ret;
 }
 
+/**
+ * For driver use only.
+ *
+ * Move the data of a command over the bulk endpoints, in USB transfers of at most MASS_MAX_TRANSFER bytes.
+ *
+ * @param pcbw the command, gives the direction
+ * @param bytes length of the data stage
+ * @param buf data, or a USBReadParser if callback is set
+ * @param callback buf is a parser
+ * @return 0 on success
+ */
+uint8_t BulkOnly::DataStage(CommandBlockWrapper *pcbw, uint32_t bytes, void *buf, bool callback __attribute__((unused))) {
+        bool write = (pcbw->bmCBWFlags & MASS_CMD_DIR_IN) != MASS_CMD_DIR_IN;
+        uint32_t done = 0;
+        uint8_t ret = 0;
+        uint8_t usberr;
+
+        while(done < bytes && !ret) {
+                uint16_t chunk = (bytes - done > MASS_MAX_TRANSFER) ? MASS_MAX_TRANSFER : (uint16_t)(bytes - done);
+                uint16_t got = chunk;
+
+                if(!write) {
+#if MS_WANT_PARSER
+                        if(callback) {
+                                // buf is a USBReadParser, it gets every packet as it is read from the FIFO
+                                while((usberr = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &got, (USBReadParser*)buf, (uint16_t)done)) == hrBUSY) delay(1);
+                        } else
+#endif
+                                while((usberr = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &got, (uint8_t*)buf + done)) == hrBUSY) delay(1);
+                        ret = HandleUsbError(usberr, epDataInIndex);
+                } else {
+                        while((usberr = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, chunk, (uint8_t*)buf + done)) == hrBUSY) delay(1);
+                        ret = HandleUsbError(usberr, epDataOutIndex);
+                }
+                if(ret) {
+                        MASS_TRACE_ERROR(MASS_TRACE_STAGE_ERROR, bTheLUN, ret, 1);
+                }
+                done += got;
+                if(got < chunk)
+                        break; // Short packet, the device has no more data
+        }
+        return ret;
+}
+
+/**
+ * For driver use only.
+ *
+ * A command on the Control/Bulk/Interrupt transport. The command block goes in an ADSC control request, the
+ * data over the bulk endpoints and the status comes from the interrupt endpoint. Without one (protocol
+ * MASS_PROTO_CBI_NO_INT) a STALL is the only sign of a failed command. The result is the status of a CSW, so
+ * HandleSCSIError() works on both transports.
+ *
+ * @param pcbw the command, as for Bulk-Only
+ * @param bytes length of the data stage
+ * @param buf data, or a USBReadParser if callback is set
+ * @param callback buf is a parser
+ * @return 0 passed, 1 failed, or a MASS_ERR_* code
+ */
+uint8_t BulkOnly::CBITransaction(CommandBlockWrapper *pcbw, uint32_t bytes, void *buf, bool callback) {
+        uint8_t cdb[16];
+        uint8_t len = (pcbw->bmCBWCBLength > MASS_CBI_CMD_LENGTH) ? pcbw->bmCBWCBLength : MASS_CBI_CMD_LENGTH;
+        uint8_t usberr;
+        uint8_t ret;
+        bool failed = false;
+
+        memset(cdb, 0, sizeof (cdb));
+        memcpy(cdb, pcbw->CBWCB, pcbw->bmCBWCBLength);
+
+        while((usberr = pUsb->ctrlReq(bAddress, 0, bmREQ_MASSOUT, MASS_REQ_ADSC, 0, 0, bIface, len, len, cdb, NULL)) == hrBUSY) delay(1);
+        if(usberr == hrSTALL) {
+                // The device rejected the command
+                MASS_TRACE_COMMAND(MASS_TRACE_CSW, bTheLUN, 1, 0);
+                return 1;
+        }
+        ret = HandleUsbError(usberr, 0);
+        if(ret) {
+                MASS_TRACE_ERROR(MASS_TRACE_STAGE_ERROR, bTheLUN, ret, 0);
+                return ret;
+        }
+
+        ret = DataStage(pcbw, bytes, buf, callback);
+        if(ret == MASS_ERR_STALL || ret == MASS_ERR_WRITE_STALL)
+                failed = true; // The halt is cleared, the status still follows
+        else if(ret) {
+                ResetRecovery();
+                return ret;
+        }
+
+        if(bProtocol == MASS_PROTO_CBI) {
+                uint8_t status[2];
+                uint16_t n = sizeof (status);
+                uint32_t timeout = (uint32_t)millis() + MASS_CBI_STATUS_TIMEOUT;
+
+                // The device NAKs until the command is done
+                while((usberr = pUsb->inTransfer(bAddress, epInfo[epInterruptInIndex].epAddr, &n, status)) == hrBUSY || (usberr == hrNAK && (int32_t)((uint32_t)millis() - timeout) < 0L)) {
+                        n = sizeof (status);
+                        delay(1);
+                }
+                ret = HandleUsbError(usberr, epInterruptInIndex);
+                if(ret || n < sizeof (status)) {
+                        MASS_TRACE_ERROR(MASS_TRACE_STAGE_ERROR, bTheLUN, ret, 2);
+                        ResetRecovery();
+                        return ret ? ret : MASS_ERR_INVALID_CSW;
+                }
+                // UFI reports the ASC and ASCQ, both 0 if the command passed
+                if(status[0] || status[1])
+                        failed = true;
+        }
+        MASS_TRACE_COMMAND(MASS_TRACE_CSW, bTheLUN, failed ? 1 : 0, 0);
+        return failed ? 1 : 0;
+}
+
 /**
  * For driver use only.
  *
@@ -1133,14 +1588,12 @@ uint8_t BulkOnly::HandleSCSIError(uint8_t status) {
                 case 0: return MASS_ERR_SUCCESS;
 
                 case 2:
-                        ErrorMessage<uint8_t > (PSTR("Phase Error"), status);
-                        ErrorMessage<uint8_t > (PSTR("LUN"), bTheLUN);
+                        MASS_TRACE_ERROR(MASS_TRACE_SCSI_ERROR, bTheLUN, status, 0);
                         ResetRecovery();
                         return MASS_ERR_GENERAL_SCSI_ERROR;
 
                 case 1:
-                        ErrorMessage<uint8_t > (PSTR("SCSI Error"), status);
-                        ErrorMessage<uint8_t > (PSTR("LUN"), bTheLUN);
+                        MASS_TRACE_ERROR(MASS_TRACE_SCSI_ERROR, bTheLUN, status, 0);
                         RequestSenseResponce rsp;
 
                         ret = RequestSense(bTheLUN, sizeof (RequestSenseResponce), (uint8_t*) & rsp);
@@ -1148,18 +1601,7 @@ uint8_t BulkOnly::HandleSCSIError(uint8_t status) {
                         if(ret) {
                                 return MASS_ERR_GENERAL_SCSI_ERROR;
                         }
-                        ErrorMessage<uint8_t > (PSTR("Response Code"), rsp.bResponseCode);
-                        if(rsp.bResponseCode & 0x80) {
-                                Notify(PSTR("Information field: "), 0x80);
-                                for(int i = 0; i < 4; i++) {
-                                        D_PrintHex<uint8_t > (rsp.CmdSpecificInformation[i], 0x80);
-                                        Notify(PSTR(" "), 0x80);
-                                }
-                                Notify(PSTR("\r\n"), 0x80);
-                        }
-                        ErrorMessage<uint8_t > (PSTR("Sense Key"), rsp.bmSenseKey);
-                        ErrorMessage<uint8_t > (PSTR("Add Sense Code"), rsp.bAdditionalSenseCode);
-                        ErrorMessage<uint8_t > (PSTR("Add Sense Qual"), rsp.bAdditionalSenseQualifier);
+                        MASS_TRACE_ERROR(MASS_TRACE_SENSE, bTheLUN, ((uint16_t)rsp.bmSenseKey << 8) | rsp.bAdditionalSenseCode, rsp.bAdditionalSenseQualifier);
                         // warning, this is not testing ASQ, only SK and ASC.
                         switch(rsp.bmSenseKey) {
                                 case SCSI_S_UNIT_ATTENTION:
@@ -1191,8 +1633,7 @@ uint8_t BulkOnly::HandleSCSIError(uint8_t status) {
                         //    case 0x05/0x14: we stalled out
                         //    case 0x15/0x16: we naked out.
                 default:
-                        ErrorMessage<uint8_t > (PSTR("Gen SCSI Err"), status);
-                        ErrorMessage<uint8_t > (PSTR("LUN"), bTheLUN);
+                        MASS_TRACE_ERROR(MASS_TRACE_SCSI_ERROR, bTheLUN, status, 0);
                         return status;
         } // switch
 }
@@ -1236,30 +1677,39 @@ void BulkOnly::PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR * ep_ptr) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-/* We won't be needing this... */
-uint8_t BulkOnly::Read(uint8_t lun __attribute__((unused)), uint32_t addr __attribute__((unused)), uint16_t bsize __attribute__((unused)), uint8_t blocks __attribute__((unused)), USBReadParser * prs __attribute__((unused))) {
+/**
+ * Read data from media and hand it to a parser, one USB packet at a time.
+ * Needs MS_WANT_PARSER. A command reads at most MASS_MAX_TRANSFER bytes, so the 16-bit offset the parser gets
+ * never wraps. It counts from 0 again at the start of every command.
+ *
+ * @param lun Logical Unit Number
+ * @param addr LBA address on media to read
+ * @param bsize size of a block (we should probably use the cached size)
+ * @param blocks how many blocks to read
+ * @param prs parser that receives the data
+ * @return 0 on success
+ */
+uint8_t BulkOnly::Read(uint8_t lun __attribute__((unused)), uint64_t addr __attribute__((unused)), uint16_t bsize __attribute__((unused)), uint32_t blocks __attribute__((unused)), USBReadParser * prs __attribute__((unused))) {
 #if MS_WANT_PARSER
         if(!LUNOk[lun]) return MASS_ERR_NO_MEDIA;
-        Notify(PSTR("\r\nRead (With parser)\r\n"), 0x80);
-        Notify(PSTR("---------\r\n"), 0x80);
+        MASS_TRACE_COMMAND(MASS_TRACE_READ, lun, (blocks > 0xFFFFLU) ? 0xFFFF : (uint16_t)blocks, (uint32_t)addr);
 
-        CommandBlockWrapper cbw = CommandBlockWrapper();
+        uint8_t er = MASS_ERR_SUCCESS;
+        bTransferBusy = true;
+        // One USB transfer per command, USBReadParser offsets are 16 bits
+        uint16_t per = (bsize && bsize <= MASS_MAX_TRANSFER) ? MASS_MAX_TRANSFER / bsize : 1;
 
-        cbw.dCBWSignature = MASS_CBW_SIGNATURE;
-        cbw.dCBWTag = ++dCBWTag;
-        cbw.dCBWDataTransferLength = ((uint32_t)bsize * blocks);
-        cbw.bmCBWFlags = MASS_CMD_DIR_IN,
-                cbw.bmCBWLUN = lun;
-        cbw.bmCBWCBLength = 10;
+        while(blocks && !er) {
+                uint16_t n = (blocks > per) ? per : (uint16_t)blocks;
+                CommandBlockWrapper cbw;
 
-        cbw.CBWCB[0] = SCSI_CMD_READ_10;
-        cbw.CBWCB[8] = blocks;
-        cbw.CBWCB[2] = ((addr >> 24) & 0xff);
-        cbw.CBWCB[3] = ((addr >> 16) & 0xff);
-        cbw.CBWCB[4] = ((addr >> 8) & 0xff);
-        cbw.CBWCB[5] = (addr & 0xff);
-
-        return HandleSCSIError(Transaction(&cbw, bsize, prs, 1));
+                BlockCBW(&cbw, lun, MASS_CMD_DIR_IN, addr, bsize, n);
+                er = HandleSCSIError(Transaction(&cbw, cbw.dCBWDataTransferLength, prs, MASS_TRANS_FLG_CALLBACK));
+                addr += n;
+                blocks -= n;
+        }
+        bTransferBusy = false;
+        return er;
 #else
         return MASS_ERR_NOT_IMPLEMENTED;
 #endif
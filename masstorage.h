@@ -23,7 +23,14 @@ e-mail   :  support@circuitsathome.com
 #define MS_WANT_PARSER 0
 #endif
 
+// Send READ CAPACITY(16) to every SPC-3 or later device, for the physical block size and UNMAP. Some bridges do
+// not handle it well, so by default it is only sent when the capacity does not fit in READ CAPACITY(10)
+#ifndef MS_WANT_RC16
+#define MS_WANT_RC16 0
+#endif
+
 #include "Usb.h"
+#include "masstrace.h"
 
 #define bmREQ_MASSOUT       USB_SETUP_HOST_TO_DEVICE|USB_SETUP_TYPE_CLASS|USB_SETUP_RECIPIENT_INTERFACE
 #define bmREQ_MASSIN        USB_SETUP_DEVICE_TO_HOST|USB_SETUP_TYPE_CLASS|USB_SETUP_RECIPIENT_INTERFACE
@@ -76,6 +83,7 @@ e-mail   :  support@circuitsathome.com
 #define SCSI_CMD_MODE_SELECT_6          0x15
 #define SCSI_CMD_MODE_SENSE_6           0x1A
 #define SCSI_CMD_START_STOP_UNIT        0x1B
+#define SCSI_CMD_SEND_DIAGNOSTIC        0x1D
 #define SCSI_CMD_PREVENT_REMOVAL        0x1E
 /* Group 2 Commands (CDB's here are 10-bytes) */
 #define SCSI_CMD_READ_FORMAT_CAPACITIES 0x23
@@ -90,6 +98,7 @@ e-mail   :  support@circuitsathome.com
 #define SCSI_CMD_WRITE_BUFFER           0x3B
 #define SCSI_CMD_READ_BUFFER            0x3C
 #define SCSI_CMD_READ_SUBCHANNEL        0x42
+#define SCSI_CMD_UNMAP                  0x42    // Same opcode as READ SUBCHANNEL, for block devices
 #define SCSI_CMD_READ_TOC               0x43
 #define SCSI_CMD_READ_HEADER            0x44
 #define SCSI_CMD_PLAY_AUDIO_10          0x45
@@ -109,6 +118,16 @@ e-mail   :  support@circuitsathome.com
 #define SCSI_CMD_CLOSE_TRACK_SESSION    0x5B
 #define SCSI_CMD_READ_BUFFER_CAPACITY   0x5C
 #define SCSI_CMD_SEND_CUE_SHEET         0x5D
+/* Group 4 Commands (CDB's here are 16-bytes) */
+#define SCSI_CMD_READ_16                0x88
+#define SCSI_CMD_WRITE_16               0x8A
+#define SCSI_CMD_SERVICE_ACTION_IN_16   0x9E
+#define SCSI_SA_READ_CAPACITY_16        0x10    // Service action of SCSI_CMD_SERVICE_ACTION_IN_16
+#define SCSI_CDB_FUA                    0x08    // Force Unit Access, byte 1 of READ/WRITE(10) and (16)
+/* Vital product data pages, read with INQUIRY */
+#define SCSI_VPD_SUPPORTED_PAGES        0x00
+#define SCSI_VPD_BLOCK_LIMITS           0xB0
+#define SCSI_VPD_LB_PROVISIONING        0xB2
 /* Group 5 Commands (CDB's here are 12-bytes) */
 #define SCSI_CMD_REPORT_LUNS            0xA0
 #define SCSI_CMD_BLANK                  0xA1
@@ -174,7 +193,27 @@ e-mail   :  support@circuitsathome.com
 #define MASS_TRANS_FLG_NO_STALL_CHECK   0x02    // STALL condition is not checked
 #define MASS_TRANS_FLG_NO_PHASE_CHECK   0x04    // PHASE_ERROR is not checked
 
-#define MASS_MAX_ENDPOINTS              3
+#define MASS_MAX_ENDPOINTS              4       // Control, bulk IN, bulk OUT and the interrupt IN of CBI
+
+// Control/Bulk/Interrupt transport, used by UFI floppy drives
+#define MASS_CBI_CMD_LENGTH             12      // Command blocks are padded to 12 bytes
+#define MASS_CBI_STATUS_TIMEOUT         5000    // ms to wait for the completion interrupt, a floppy may have to spin up
+
+// Largest USB transfer of a data stage, longer data stages are split. A multiple of every packet size
+#define MASS_MAX_TRANSFER               0xFFC0U
+
+// Media polling, one LUN is checked per poll so a card reader does not block the USB task for long
+#define MASS_POLL_INTERVAL              2000    // ms between two checks of the same LUN
+#define MASS_POLL_MAX_BACKOFF           8       // A LUN without media is checked at most every 8 intervals
+
+// Block descriptors sent in one UNMAP command, 16 bytes of stack each
+#define MASS_UNMAP_DESCRIPTORS          4
+
+// Blocks that no longer hold data, for Unmap()
+struct MASS_UNMAP_RANGE {
+        uint64_t lba;
+        uint32_t blocks;
+};
 
 struct Capacity {
         uint8_t data[8];
@@ -317,8 +356,19 @@ struct CDB_LBA64_16 {
 
         uint8_t Misc2;
         uint8_t Control;
+public:
+
+        CDB_LBA64_16(uint8_t _Opcode, uint8_t _Misc, uint64_t LBA, uint32_t xflen) :
+        Opcode(_Opcode), Misc(_Misc),
+        LBA_M_M_MB(BGRAB7(LBA)), LBA_M_M_LB(BGRAB6(LBA)), LBA_M_L_MB(BGRAB5(LBA)), LBA_M_L_LB(BGRAB4(LBA)),
+        LBA_L_M_MB(BGRAB3(LBA)), LBA_L_M_LB(BGRAB2(LBA)), LBA_L_L_MB(BGRAB1(LBA)), LBA_L_L_LB(BGRAB0(LBA)),
+        ALC_M_MB(BGRAB3(xflen)), ALC_M_LB(BGRAB2(xflen)), ALC_L_MB(BGRAB1(xflen)), ALC_L_LB(BGRAB0(xflen)),
+        Misc2(0), Control(0) {
+        }
 } __attribute__((packed));
 
+typedef CDB_LBA64_16 CDB16_t;
+
 struct InquiryResponse {
         uint8_t DeviceType : 5;
         uint8_t PeripheralQualifier : 3;
@@ -390,8 +440,8 @@ struct CommandBlockWrapper : public CommandBlockWrapperBase {
         };
 
         struct {
-                uint8_t bmCBWCBLength : 4;
-                uint8_t bmReserved2 : 4;
+                uint8_t bmCBWCBLength : 5;
+                uint8_t bmReserved2 : 3;
         };
 
         uint8_t CBWCB[16];
@@ -431,6 +481,13 @@ public:
         bmCBWLUN(cdb->LUN), bmReserved1(0), bmCBWCBLength(10), bmReserved2(0) {
                 memcpy(&CBWCB, cdb, 10);
         }
+        // Wrap for CDB of 16, which has no LUN field
+
+        CommandBlockWrapper(uint32_t tag, uint32_t xflen, CDB16_t *cdb, uint8_t lu, uint8_t dir) :
+        CommandBlockWrapperBase(tag, xflen, dir),
+        bmCBWLUN(lu), bmReserved1(0), bmCBWCBLength(16), bmReserved2(0) {
+                memcpy(&CBWCB, cdb, 16);
+        }
 } __attribute__((packed));
 
 struct CommandStatusWrapper {
@@ -469,9 +526,14 @@ protected:
         uint8_t bAddress;
         uint8_t bConfNum; // configuration number
         uint8_t bIface; // interface value
+        uint8_t bProtocol; // Transport, MASS_PROTO_BBB, MASS_PROTO_CBI or MASS_PROTO_CBI_NO_INT
         uint8_t bNumEP; // total number of EP in the configuration
         uint32_t qNextPollTime; // next poll time
         bool bPollEnable; // poll enable flag
+        bool bTransferBusy; // Read or Write in progress, media is not polled
+        uint8_t bPollLUN; // LUN checked on the next poll
+        uint8_t bPollSkip[MASS_MAX_SUPPORTED_LUN]; // Polls left before a LUN without media is checked again
+        uint8_t bPollBackoff[MASS_MAX_SUPPORTED_LUN];
 
         EpInfo epInfo[MASS_MAX_ENDPOINTS];
 
@@ -480,10 +542,15 @@ protected:
         uint8_t bLastUsbError; // Last USB error
         uint8_t bMaxLUN; // Max LUN
         uint8_t bTheLUN; // Active LUN
-        uint32_t CurrentCapacity[MASS_MAX_SUPPORTED_LUN]; // Total sectors
+        uint64_t CurrentCapacity[MASS_MAX_SUPPORTED_LUN]; // Total sectors
         uint16_t CurrentSectorSize[MASS_MAX_SUPPORTED_LUN]; // Sector size, clipped to 16 bits
         bool LUNOk[MASS_MAX_SUPPORTED_LUN]; // use this to check for media changes.
         bool WriteOk[MASS_MAX_SUPPORTED_LUN];
+        bool RC16Ok[MASS_MAX_SUPPORTED_LUN]; // SPC-3 or later and MS_WANT_RC16, READ CAPACITY(16) is tried
+        uint8_t PhysicalBlockExp[MASS_MAX_SUPPORTED_LUN]; // 2^n blocks in a physical block
+        uint16_t LowestAlignedLBA[MASS_MAX_SUPPORTED_LUN]; // First block that starts a physical block
+        uint32_t UnmapMaxBlocks[MASS_MAX_SUPPORTED_LUN]; // Blocks in one UNMAP command, 0 if UNMAP is not supported
+        uint8_t UnmapMaxDescriptors[MASS_MAX_SUPPORTED_LUN]; // Ranges in one UNMAP command
         void PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR* ep_ptr);
 
 
@@ -492,6 +559,14 @@ protected:
         virtual uint8_t OnInit() {
                 return 0;
         };
+
+        // Called when media is found on a LUN, also for media present when the device is configured
+        virtual void OnMediaInserted(uint8_t lun __attribute__((unused))) {
+        };
+
+        // Called when the media of a LUN is gone, also when the device is released
+        virtual void OnMediaRemoved(uint8_t lun __attribute__((unused))) {
+        };
 public:
         BulkOnly(USB *p);
 
@@ -509,14 +584,23 @@ public:
 
         bool WriteProtected(uint8_t lun);
         uint8_t MediaCTL(uint8_t lun, uint8_t ctl);
-        uint8_t Read(uint8_t lun, uint32_t addr, uint16_t bsize, uint8_t blocks, uint8_t *buf);
-        uint8_t Read(uint8_t lun, uint32_t addr, uint16_t bsize, uint8_t blocks, USBReadParser *prs);
-        uint8_t Write(uint8_t lun, uint32_t addr, uint16_t bsize, uint8_t blocks, const uint8_t *buf);
+        // Virtual so a cache (see masscache.h) can sit in front of the device
+        virtual uint8_t Read(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, uint8_t *buf);
+        uint8_t Read(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, USBReadParser *prs);
+        virtual uint8_t Write(uint8_t lun, uint64_t addr, uint16_t bsize, uint32_t blocks, const uint8_t *buf, bool fua = false);
+        uint8_t SynchronizeCache(uint8_t lun);
+        // Virtual so a cache can drop the blocks
+        virtual uint8_t UnmapRanges(uint8_t lun, const MASS_UNMAP_RANGE *ranges, uint8_t count);
+        uint8_t Unmap(uint8_t lun, uint64_t lba, uint32_t blocks);
+        bool UnmapSupported(uint8_t lun);
         uint8_t LockMedia(uint8_t lun, uint8_t lock);
 
         bool LUNIsGood(uint8_t lun);
         uint32_t GetCapacity(uint8_t lun);
+        uint64_t GetCapacity64(uint8_t lun);
         uint16_t GetSectorSize(uint8_t lun);
+        uint8_t GetPhysicalBlockExp(uint8_t lun);
+        uint16_t GetLowestAlignedLBA(uint8_t lun);
 
         // USBDeviceConfig implementation
         uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
@@ -532,15 +616,19 @@ public:
         // UsbConfigXtracter implementation
         void EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
 
+        // Mass storage devices have their class in the interface descriptor, Init() checks the subclass and
+        // protocol there: SCSI on Bulk-Only, or UFI on CBI
         virtual bool DEVCLASSOK(uint8_t klass) {
                 return (klass == USB_CLASS_MASS_STORAGE);
         }
 
         uint8_t SCSITransaction6(CDB6_t *cdb, uint16_t buf_size, void *buf, uint8_t dir);
-        uint8_t SCSITransaction10(CDB10_t *cdb, uint16_t buf_size, void *buf, uint8_t dir);
+        uint8_t SCSITransaction10(CDB10_t *cdb, uint32_t buf_size, void *buf, uint8_t dir);
+        uint8_t SCSITransaction16(CDB16_t *cdb, uint8_t lun, uint32_t buf_size, void *buf, uint8_t dir);
 
 private:
-        uint8_t Inquiry(uint8_t lun, uint16_t size, uint8_t *buf);
+        uint8_t Inquiry(uint8_t lun, uint16_t size, uint8_t *buf, bool vpd = false, uint8_t page = 0);
+        void CheckProvisioning(uint8_t lun);
         uint8_t TestUnitReady(uint8_t lun);
         uint8_t RequestSense(uint8_t lun, uint16_t size, uint8_t *buf);
         uint8_t ModeSense6(uint8_t lun, uint8_t pc, uint8_t page, uint8_t subpage, uint8_t len, uint8_t *buf);
@@ -549,6 +637,8 @@ private:
         void Reset();
         uint8_t ResetRecovery();
         uint8_t ReadCapacity10(uint8_t lun, uint8_t *buf);
+        uint8_t ReadCapacity16(uint8_t lun, uint8_t *buf);
+        void BlockCBW(CommandBlockWrapper *pcbw, uint8_t lun, uint8_t dir, uint64_t addr, uint16_t bsize, uint16_t blocks, uint8_t flags = 0);
         void ClearAllEP();
         void CheckMedia();
         bool CheckLUN(uint8_t lun);
@@ -560,9 +650,11 @@ private:
 
         uint8_t ClearEpHalt(uint8_t index);
 #if MS_WANT_PARSER
-        uint8_t Transaction(CommandBlockWrapper *cbw, uint16_t bsize, void *buf, uint8_t flags);
+        uint8_t Transaction(CommandBlockWrapper *cbw, uint32_t bsize, void *buf, uint8_t flags);
 #endif
-        uint8_t Transaction(CommandBlockWrapper *cbw, uint16_t bsize, void *buf);
+        uint8_t Transaction(CommandBlockWrapper *cbw, uint32_t bsize, void *buf);
+        uint8_t DataStage(CommandBlockWrapper *pcbw, uint32_t bytes, void *buf, bool callback);
+        uint8_t CBITransaction(CommandBlockWrapper *pcbw, uint32_t bytes, void *buf, bool callback);
         uint8_t HandleUsbError(uint8_t error, uint8_t index);
         uint8_t HandleSCSIError(uint8_t status);
 
@@ -0,0 +1,76 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "masstorage.h"
+
+#if MASS_TRACE_RING
+
+static MASS_TRACE_RECORD traceRing[MASS_TRACE_RING_SIZE];
+static uint16_t traceHead; // Next record to write
+static uint16_t traceTail; // Oldest record
+static uint16_t traceLost;
+
+void MassTrace(uint8_t event, uint8_t lun, uint16_t arg, uint32_t value) {
+        MASS_TRACE_RECORD *rec = &traceRing[traceHead & (MASS_TRACE_RING_SIZE - 1)];
+
+        rec->time = (uint32_t)micros();
+        rec->event = event;
+        rec->lun = lun;
+        rec->arg = arg;
+        rec->value = value;
+        traceHead++;
+        if((uint16_t)(traceHead - traceTail) > MASS_TRACE_RING_SIZE) {
+                traceTail++; // Full, the oldest record is gone
+                traceLost++;
+        }
+}
+
+bool MassTraceGet(MASS_TRACE_RECORD *rec) {
+        if(traceHead == traceTail)
+                return false;
+        *rec = traceRing[traceTail & (MASS_TRACE_RING_SIZE - 1)];
+        traceTail++;
+        return true;
+}
+
+uint16_t MassTraceLost() {
+        return traceLost;
+}
+
+void MassTraceClear() {
+        traceTail = traceHead;
+        traceLost = 0;
+}
+
+#elif defined(DEBUG_USB_HOST)
+
+void MassTrace(uint8_t event, uint8_t lun, uint16_t arg, uint32_t value) {
+        Notify(PSTR("\r\nMS "), 0x80);
+        D_PrintHex<uint8_t > (event, 0x80);
+        Notify(PSTR(" LUN "), 0x80);
+        D_PrintHex<uint8_t > (lun, 0x80);
+        Notify(PSTR(" "), 0x80);
+        D_PrintHex<uint16_t > (arg, 0x80);
+        Notify(PSTR(" "), 0x80);
+        D_PrintHex<uint32_t > (value, 0x80);
+}
+
+#else
+
+void MassTrace(uint8_t event __attribute__((unused)), uint8_t lun __attribute__((unused)), uint16_t arg __attribute__((unused)), uint32_t value __attribute__((unused))) {
+}
+
+#endif
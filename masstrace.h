@@ -0,0 +1,85 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__MASSTRACE_H__)
+#define __MASSTRACE_H__
+
+#include "Usb.h"
+
+/*
+ * Trace points of the mass storage data path.
+ *
+ * MASS_TRACE_LEVEL in settings.h selects them at compile time, the ones below the level cost nothing:
+ *      0 off
+ *      1 errors: USB errors, bad CSWs, SCSI errors with their sense data and reset recoveries
+ *      2 also every READ, WRITE, CBW and CSW
+ * A trace point is printed on USB_HOST_SERIAL when ENABLE_UHS_DEBUGGING is set. With MASS_TRACE_RING set it is
+ * stored in a RAM ring buffer instead and read back with MassTraceGet(), which does not change the timing much.
+ */
+#define MASS_TRACE_READ                 0x01    // arg: blocks (clipped to 16 bits), value: LBA (low 32 bits)
+#define MASS_TRACE_WRITE                0x02    // arg: blocks (clipped to 16 bits), value: LBA (low 32 bits)
+#define MASS_TRACE_CBW                  0x03    // arg: opcode, value: tag
+#define MASS_TRACE_CSW                  0x04    // arg: status, value: residue
+#define MASS_TRACE_UNMAP                0x05    // arg: blocks (clipped to 16 bits), value: LBA (low 32 bits)
+#define MASS_TRACE_USB_ERROR            0x10    // arg: hr* error, value: endpoint index
+#define MASS_TRACE_STAGE_ERROR          0x11    // arg: MASS_ERR_* code, value: 0 CBW, 1 data, 2 CSW
+#define MASS_TRACE_BAD_CSW              0x12    // arg: 0 wrong signature, 1 wrong tag, value: tag received
+#define MASS_TRACE_SCSI_ERROR           0x13    // arg: status of the command
+#define MASS_TRACE_SENSE                0x14    // arg: sense key << 8 | ASC, value: ASCQ
+#define MASS_TRACE_RESET                0x15    // Reset recovery
+#define MASS_TRACE_CACHE_LOST           0x16    // arg: dirty blocks of a BulkOnlyCache that could not be written back, value: MASS_ERR_* code
+
+#ifndef MASS_TRACE_RING_SIZE
+#define MASS_TRACE_RING_SIZE            32      // Records in the ring buffer, a power of 2. 12 bytes of RAM each
+#endif
+
+typedef struct {
+        uint32_t time; // micros()
+        uint8_t event; // MASS_TRACE_*
+        uint8_t lun;
+        uint16_t arg;
+        uint32_t value;
+} __attribute__((packed)) MASS_TRACE_RECORD;
+
+#if MASS_TRACE_RING || defined(DEBUG_USB_HOST)
+#define MASS_TRACE_ACTIVE_LEVEL MASS_TRACE_LEVEL
+#else
+#define MASS_TRACE_ACTIVE_LEVEL 0 // Nowhere to send them
+#endif
+
+void MassTrace(uint8_t event, uint8_t lun, uint16_t arg, uint32_t value);
+
+#if MASS_TRACE_ACTIVE_LEVEL >= 1
+#define MASS_TRACE_ERROR(event, lun, arg, value) MassTrace((event), (lun), (arg), (value))
+#else
+#define MASS_TRACE_ERROR(...) ((void)0)
+#endif
+
+#if MASS_TRACE_ACTIVE_LEVEL >= 2
+#define MASS_TRACE_COMMAND(event, lun, arg, value) MassTrace((event), (lun), (arg), (value))
+#else
+#define MASS_TRACE_COMMAND(...) ((void)0)
+#endif
+
+#if MASS_TRACE_RING
+// Oldest record of the ring buffer, false if it is empty
+bool MassTraceGet(MASS_TRACE_RECORD *rec);
+// Records that were overwritten before they were read
+uint16_t MassTraceLost();
+void MassTraceClear();
+#endif
+
+#endif // __MASSTRACE_H__
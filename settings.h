@@ -72,6 +72,17 @@ e-mail   :  support@circuitsathome.com
 #define MASS_MAX_SUPPORTED_LUN 8
 #endif
 
+// Trace level of the mass storage data path, selected at compile time: 0 off, 1 errors, 2 every command.
+// The traces are printed if ENABLE_UHS_DEBUGGING is set, see masstrace.h.
+#ifndef MASS_TRACE_LEVEL
+#define MASS_TRACE_LEVEL 1
+#endif
+
+// Set this to 1 to record the traces in a ring buffer in RAM instead of printing them.
+#ifndef MASS_TRACE_RING
+#define MASS_TRACE_RING 0
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Set to 1 to use the faster spi4teensy3 driver.
 ////////////////////////////////////////////////////////////////////////////////
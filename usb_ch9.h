@@ -69,6 +69,7 @@ e-mail   :  support@circuitsathome.com
 #define USB_DESCRIPTOR_OTHER_SPEED              0x07    // bDescriptorType for a Other Speed Configuration.
 #define USB_DESCRIPTOR_INTERFACE_POWER          0x08    // bDescriptorType for Interface Power.
 #define USB_DESCRIPTOR_OTG                      0x09    // bDescriptorType for an OTG Descriptor.
+#define USB_DESCRIPTOR_INTERFACE_ASSOCIATION    0x0B    // bDescriptorType for an Interface Association Descriptor.
 
 #define HID_DESCRIPTOR_HID                      0x21
 
@@ -137,6 +138,18 @@ typedef struct {
         uint8_t iInterface; // Index of String Descriptor describing the interface.
 } __attribute__((packed)) USB_INTERFACE_DESCRIPTOR;
 
+/* Interface association descriptor structure */
+typedef struct {
+        uint8_t bLength; // Length of this descriptor.
+        uint8_t bDescriptorType; // INTERFACE ASSOCIATION descriptor type (USB_DESCRIPTOR_INTERFACE_ASSOCIATION).
+        uint8_t bFirstInterface; // Number of the first interface of the function.
+        uint8_t bInterfaceCount; // Number of contiguous interfaces of the function.
+        uint8_t bFunctionClass; // Class code.
+        uint8_t bFunctionSubClass; // Subclass code.
+        uint8_t bFunctionProtocol; // Protocol code.
+        uint8_t iFunction; // Index of String Descriptor describing the function.
+} __attribute__((packed)) USB_INTERFACE_ASSOCIATION_DESCRIPTOR;
+
 /* Endpoint descriptor structure */
 typedef struct {
         uint8_t bLength; // Length of this descriptor.
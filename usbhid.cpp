@@ -16,6 +16,7 @@ e-mail   :  support@circuitsathome.com
  */
 
 #include "usbhid.h"
+#include "hidoutputqueue.h"
 
 //get HID report descriptor
 
@@ -31,12 +32,13 @@ uint8_t USBHID::GetReportDescr(uint8_t ep, USBReadParser *parser) {
         return rcode;
 }
  */
-uint8_t USBHID::GetReportDescr(uint16_t wIndex, USBReadParser *parser) {
+// wLength may be larger than the descriptor, the device then sends a short packet after the last byte
+uint8_t USBHID::GetReportDescr(uint16_t wIndex, USBReadParser *parser, uint16_t wLength) {
         const uint8_t constBufLen = 64;
         uint8_t buf[constBufLen];
 
         uint8_t rcode = pUsb->ctrlReq(bAddress, 0x00, bmREQ_HID_REPORT, USB_REQUEST_GET_DESCRIPTOR, 0x00,
-                HID_DESCRIPTOR_REPORT, wIndex, 128, constBufLen, buf, (USBReadParser*)parser);
+                HID_DESCRIPTOR_REPORT, wIndex, wLength, constBufLen, buf, (USBReadParser*)parser);
 
         //return ((rcode != hrSTALL) ? rcode : 0);
         return rcode;
@@ -51,6 +53,23 @@ uint8_t USBHID::SetReport(uint8_t ep, uint8_t iface, uint8_t report_type, uint8_
         return ( pUsb->ctrlReq(bAddress, ep, bmREQ_HID_OUT, HID_REQUEST_SET_REPORT, report_id, report_type, iface, nbytes, nbytes, dataptr, NULL));
 }
 
+/* Sends an output report. data is the whole report, starting with the report ID if the device uses report IDs.
+   Without an interrupt OUT endpoint this is a SET_REPORT request, drivers that know the endpoints override it */
+uint8_t USBHID::SendOutputReport(uint8_t iface, uint8_t report_id, uint16_t nbytes, uint8_t *data) {
+        return SetReport(0, iface, HID_REPORT_TYPE_OUTPUT, report_id, nbytes, data);
+}
+
+// Called from Poll() of the drivers
+uint8_t USBHID::SendQueuedReports() {
+        return (pOutputQueue) ? pOutputQueue->Send(this, HID_OUTPUT_REPORTS_PER_POLL) : 0;
+}
+
+// Called from Release() of the drivers, the reports were meant for the device that is gone
+void USBHID::ClearOutputQueue() {
+        if(pOutputQueue)
+                pOutputQueue->Clear();
+}
+
 uint8_t USBHID::GetReport(uint8_t ep, uint8_t iface, uint8_t report_type, uint8_t report_id, uint16_t nbytes, uint8_t* dataptr) {
         return ( pUsb->ctrlReq(bAddress, ep, bmREQ_HID_IN, HID_REQUEST_GET_REPORT, report_id, report_type, iface, nbytes, nbytes, dataptr, NULL));
 }
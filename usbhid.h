@@ -73,6 +73,11 @@ e-mail   :  support@circuitsathome.com
 #define HID_REQUEST_SET_IDLE                    0x0A
 #define HID_REQUEST_SET_PROTOCOL                0x0B
 
+/* Report Types, high byte of wValue in Get_Report and Set_Report */
+#define HID_REPORT_TYPE_INPUT                   0x01
+#define HID_REPORT_TYPE_OUTPUT                  0x02
+#define HID_REPORT_TYPE_FEATURE                 0x03
+
 /* Class Descriptor Types */
 #define HID_DESCRIPTOR_HID                      0x21
 #define HID_DESCRIPTOR_REPORT                   0x22
@@ -134,16 +139,34 @@ struct MainItemIOFeature {
 };
 
 class USBHID;
+class HIDOutputReportQueue;
+
+#define HID_LAYOUT_COMPILE_TRIES        3       // Reports a parser tries to read the report descriptor on before it gives up
 
 class HIDReportParser {
 public:
         virtual void Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf) = 0;
+
+        // Called by the driver when the device is released, a parser that keeps something it learned from the
+        // device (e.g. a compiled report descriptor) drops it, so the next device starts over
+        virtual void Reset() {
+        };
+
+        // A parser that sums relative values, e.g. mouse motion, returns true so the driver passes on every
+        // report, including one that is the same as the report before it
+        virtual bool WantsRepeatedReports() {
+                return false;
+        };
 };
 
 class USBHID : public USBDeviceConfig, public UsbConfigXtracter {
 protected:
         USB *pUsb; // USB class instance pointer
         uint8_t bAddress; // address
+        uint8_t bPollInterval; // Poll interval set by the application, 0 to use bInterval
+        HIDOutputReportQueue *pOutputQueue; // Output reports sent by Poll()
+        uint32_t qReportTime; // micros() when the input report being parsed was received
+        uint16_t wReportFrame; // Frame number of qReportTime
 
 protected:
         static const uint8_t epInterruptInIndex = 1; // InterruptIN  endpoint index
@@ -160,9 +183,23 @@ protected:
                 return NULL;
         };
 
+        // Poll interval of an interrupt IN endpoint, the application can only make it shorter
+        uint8_t GetPollInterval(uint8_t interval) {
+                return (bPollInterval && bPollInterval < interval) ? bPollInterval : interval;
+        };
+
+        uint8_t SendQueuedReports();
+        void ClearOutputQueue();
+
+        // Called by the drivers right after an input report was read, before it is parsed
+        void StampReport() {
+                qReportTime = pUsb->GetLastInTime();
+                wReportFrame = pUsb->GetFrameNumber(qReportTime);
+        };
+
 public:
 
-        USBHID(USB *pusb) : pUsb(pusb) {
+        USBHID(USB *pusb) : pUsb(pusb), bPollInterval(0), pOutputQueue(NULL), qReportTime(0), wReportFrame(0) {
         };
 
         const USB* GetUsb() {
@@ -173,12 +210,34 @@ public:
                 return false;
         };
 
+        // micros() when the input report passed to the parser was received, see USBLatencyProbe
+        uint32_t GetReportTime() {
+                return qReportTime;
+        };
+
+        // Frame number of GetReportTime()
+        uint16_t GetReportFrame() {
+                return wReportFrame;
+        };
+
+        // Poll the interrupt IN endpoints at least every interval ms, even if the device asks for a longer bInterval. 0 restores bInterval
+        void SetPollInterval(uint8_t interval) {
+                bPollInterval = interval;
+        };
+
+        // Queue the driver sends output reports from, NULL to stop using it
+        void SetOutputQueue(HIDOutputReportQueue *queue) {
+                pOutputQueue = queue;
+        };
+
+        virtual uint8_t SendOutputReport(uint8_t iface, uint8_t report_id, uint16_t nbytes, uint8_t *data);
+
         uint8_t SetProtocol(uint8_t iface, uint8_t protocol);
         uint8_t GetProtocol(uint8_t iface, uint8_t* dataptr);
         uint8_t GetIdle(uint8_t iface, uint8_t reportID, uint8_t* dataptr);
         uint8_t SetIdle(uint8_t iface, uint8_t reportID, uint8_t duration);
 
-        uint8_t GetReportDescr(uint16_t wIndex, USBReadParser *parser = NULL);
+        uint8_t GetReportDescr(uint16_t wIndex, USBReadParser *parser = NULL, uint16_t wLength = 128);
 
         uint8_t GetHidDescr(uint8_t ep, uint16_t nbytes, uint8_t* dataptr);
         uint8_t GetReport(uint8_t ep, uint8_t iface, uint8_t report_type, uint8_t report_id, uint16_t nbytes, uint8_t* dataptr);
@@ -0,0 +1,74 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#include "usblatency.h"
+
+void USBLatencyProbe::Reset() {
+        memset(counts, 0, sizeof (counts));
+        maxLatency = 0;
+        lastLatency = 0;
+}
+
+/* Adds the time from t, a micros() time stamp, to now. Returns the latency in us */
+uint32_t USBLatencyProbe::Record(uint32_t t) {
+        uint32_t latency = (uint32_t)micros() - t;
+        uint32_t v = latency >> 4;
+        uint8_t bucket = 0;
+
+        while(v && bucket < USB_LATENCY_BUCKETS - 1) {
+                v >>= 1;
+                bucket++;
+        }
+
+        counts[bucket]++;
+        lastLatency = latency;
+
+        if(latency > maxLatency)
+                maxLatency = latency;
+
+        return latency;
+}
+
+uint32_t USBLatencyProbe::GetSamples() {
+        uint32_t n = 0;
+
+        for(uint8_t i = 0; i < USB_LATENCY_BUCKETS; i++)
+                n += counts[i];
+        return n;
+}
+
+/* Upper limit of the bucket holding the given percentile, e.g. 99 for the latency 99 % of the samples stay below.
+   The maximum is returned if it is smaller. Returns 0 if there are no samples */
+uint32_t USBLatencyProbe::GetPercentile(uint8_t percent) {
+        uint32_t n = GetSamples();
+
+        if(!n)
+                return 0;
+
+        // Samples at or below the percentile, rounded up without 64-bit math
+        uint32_t target = n / 100 * percent + ((n % 100) * percent + 99) / 100;
+        uint32_t sum = 0;
+
+        for(uint8_t i = 0; i < USB_LATENCY_BUCKETS; i++) {
+                sum += counts[i];
+                if(sum >= target && sum) {
+                        uint32_t limit = GetBucketLimit(i);
+
+                        return (limit < maxLatency) ? limit : maxLatency;
+                }
+        }
+        return maxLatency;
+}
@@ -0,0 +1,69 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__USBLATENCY_H__)
+#define __USBLATENCY_H__
+
+#include "Usb.h"
+
+#define USB_LATENCY_BUCKETS             16      // Bucket i counts latencies below 16 << i us, the last one everything longer
+
+/*
+ * Histogram of the time from the completion of an IN transfer to the point where the application handles the data.
+ * Call Record() with the receive time from the driver at the point to measure, e.g. in a report parser:
+ *
+ *      void MyParser::Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8_t *buf) {
+ *              ...
+ *              Probe.Record(hid->GetReportTime());
+ *      }
+ *
+ * The buckets double in width, so their limits run from 16 us to 262 ms (16 << 14 us) and the last bucket holds
+ * everything longer, with 4 bytes per bucket.
+ */
+class USBLatencyProbe {
+        uint32_t counts[USB_LATENCY_BUCKETS];
+        uint32_t maxLatency;
+        uint32_t lastLatency;
+
+public:
+        USBLatencyProbe() {
+                Reset();
+        };
+
+        void Reset();
+        uint32_t Record(uint32_t t);
+        uint32_t GetPercentile(uint8_t percent);
+        uint32_t GetSamples();
+
+        uint32_t GetCount(uint8_t bucket) {
+                return (bucket < USB_LATENCY_BUCKETS) ? counts[bucket] : 0;
+        };
+
+        // Latencies in the bucket are below this limit in us
+        static uint32_t GetBucketLimit(uint8_t bucket) {
+                return (bucket < USB_LATENCY_BUCKETS - 1) ? (uint32_t)16 << bucket : 0xFFFFFFFF;
+        };
+
+        uint32_t GetMax() {
+                return maxLatency;
+        };
+
+        uint32_t GetLast() {
+                return lastLatency;
+        };
+};
+
+#endif // __USBLATENCY_H__